@@ -0,0 +1,744 @@
+/**
+* Micro-benchmarks of the kernels of the algorithms, on synthetic dictionaries and streams
+*
+* Unlike the measurement of "exe" (see "measure.c"), which runs whole algorithms on given dictionaries and streams,
+* this program generates the dictionaries and the streams itself (from a fixed seed, so every run benchmarks the same
+* inputs), and times the kernels one by one: read_block & read_char of every algorithm, kmp_read_char, calc_fp,
+* field_mul and building the patterns tree. The inputs are made by workloads:
+*
+*   random        Random patterns of BENCH_MIN_LEN..BENCH_MAX_LEN letters, and a stream of random letters in which
+*                 a pattern starts at every position with the probability of the match density (-m).
+*   failure       Patterns x^k t (a run of one letter and another letter at the end), and a stream of runs of
+*                 BENCH_MAX_LEN - 1 letters, each ending with a letter of no pattern. Every run ends in the deepest
+*                 state of its letter, and the character after it walks the whole failure-link chain to the root
+*                 (one state, usually one cache miss, per link), which is the worst case of the Aho-Corasick
+*                 algorithms, and especially of the Low-Memory one (its children are searched on every link).
+*   fingerprint   Patterns that are all prefixes of one random base string (of BENCH_FP_MAX_LEN letters) with another
+*                 letter at the end, and a stream of the base string again and again. At every copy the fingerprints of
+*                 all the power-of-two prefixes of all the patterns match, so every pattern gets viable occurrences
+*                 (VOs) at every stage, and they all fail only on the last character, which is the worst case of
+*                 the Breslauer-Galil algorithms. (A real collision of random fingerprints can't be forced without
+*                 the secret r, but a fingerprint match costs the same, and a small field, e.g.
+*                 "-DFIELD_BARRETT -DFIELD_P=65521", adds real collisions.)
+*
+* The streams are read in blocks of BENCH_BLOCK bytes, and the time per byte of every block is a sample, from which we
+* report the mean, the p50, the p99 and the maximum (the tail). Every kernel is run at least once, and again until it
+* took BENCH_MIN_NS (at most BENCH_MAX_ROUNDS times). The results are printed as csv.
+*
+* With "-w PREFIX", the dictionary and the stream of the first workload (and size & density) are written to
+* PREFIX.dict & PREFIX.stream instead, so "exe" can measure the algorithms on them.
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "conf.h"
+#include "mps.h"
+#include "util.h"
+#include "kmprt.h"
+#include "Fingerprint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+// The seed of the generators (every run benchmarks the same inputs)
+#define BENCH_SEED 0x9e3779b97f4a7c15ull
+
+// The lengths of the patterns of the random and the failure workloads
+#define BENCH_MIN_LEN 8
+#define BENCH_MAX_LEN 32
+
+// The lengths of the patterns of the fingerprint workload (the base string is BENCH_FP_MAX_LEN letters)
+#define BENCH_FP_MIN_LEN 32
+#define BENCH_FP_MAX_LEN 256
+
+// The default length of the streams
+#define BENCH_DEFAULT_STREAM_LEN (16 * 1024)
+
+// The length of a block of a stream (every block is a sample of the latency)
+#define BENCH_BLOCK 1024
+
+// A kernel is run again until it took BENCH_MIN_NS, at most BENCH_MAX_ROUNDS times
+#define BENCH_MIN_NS 100000000ull
+#define BENCH_MAX_ROUNDS 5
+
+// The number of multiplications of the field_mul kernel
+#define BENCH_FIELD_MULS (1024 * 1024)
+
+// The maximal number of values of an option that can be given many times
+#define BENCH_MAX_VALUES 16
+
+enum {
+	WORKLOAD_RANDOM = 0,
+	WORKLOAD_FAILURE,
+	WORKLOAD_FINGERPRINT,
+	N_WORKLOADS
+};
+
+static const char* workload_names[N_WORKLOADS] = {"random", "failure", "fingerprint"};
+
+/**
+* A generated dictionary and stream
+*/
+typedef struct {
+	int            workload;
+	size_t         n_patterns;
+	double         density;      // the match density of a random stream (0 for the other workloads)
+	PatternsList   patterns;
+	PatternsTree  *tree;
+	char          *stream;
+	size_t         len;
+} BenchInput;
+
+/**
+* The samples of a kernel (the time per unit, e.g. per byte, of every block or round)
+*/
+typedef struct {
+	double  *values;
+	size_t   n;
+	size_t   capacity;
+	uint64_t total_ns;
+	size_t   total_units;
+} BenchSamples;
+
+/**
+* The options of the benchmarks
+*/
+typedef struct {
+	MpsInstance  instances[BENCH_MAX_VALUES * 4];
+	size_t       n_instances;
+	size_t       sizes[BENCH_MAX_VALUES];
+	size_t       n_sizes;
+	double       densities[BENCH_MAX_VALUES];
+	size_t       n_densities;
+	int          workloads[N_WORKLOADS];
+	size_t       n_workloads;
+	size_t       stream_len;
+	const char  *write_prefix;
+} BenchOptions;
+
+static uint64_t rand_state = BENCH_SEED;
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Print the usage of the benchmarks and exit
+*/
+static void bench_usage_and_exit() {
+	int i;
+	fprintf(stderr, "Usage: %s [OPTION]...\n", program_name);
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -a NAME[:KEY=VAL,...] benchmark the algorithm NAME (can be used many times, default all).\n");
+	fprintf(stderr, "  -n N                  the number of patterns of the dictionaries (can be used many times,\n");
+	fprintf(stderr, "                        default 100, 1000 and 4000).\n");
+	fprintf(stderr, "  -m DENSITY            the matches per byte of the random streams (can be used many times,\n");
+	fprintf(stderr, "                        default 0, 0.01 and 0.1).\n");
+	fprintf(stderr, "  -g WORKLOAD           random, failure or fingerprint (can be used many times, default all).\n");
+	fprintf(stderr, "  -l LEN                the length of the streams (default %d).\n", BENCH_DEFAULT_STREAM_LEN);
+	fprintf(stderr, "  -w PREFIX             write the dictionary and the stream of the first workload, size and\n");
+	fprintf(stderr, "                        density to PREFIX.dict and PREFIX.stream (instead of benchmarking).\n");
+	fprintf(stderr, "algorithms:\n");
+	for (i = 0; i < MPS_SIZE; ++i) {
+		fprintf(stderr, "  %-22s%s\n", mps_table[i].short_name, mps_table[i].name);
+	}
+	exit(EXIT_FAILURE);
+}
+
+/**
+* The next pseudo-random number (xorshift64*)
+*/
+static uint64_t bench_rand() {
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return rand_state * 2685821657736338717ull;
+}
+
+/**
+* A pseudo-random number in [from, to]
+*/
+static size_t bench_rand_range(size_t from, size_t to) {
+	return from + bench_rand() % (to - from + 1);
+}
+
+/**
+* A pseudo-random letter (of the first n letters)
+*/
+static char bench_rand_letter(size_t n) {
+	return 'a' + bench_rand() % n;
+}
+
+/**
+* Parse a non-negative number option (exits with the usage if it isn't valid)
+*/
+static size_t parse_size_option(const char* val) {
+	size_t ret;
+	if (mps_parse_size(val, &ret) != 0) {
+		fprintf(stderr, "Error: invalid number %s\n\n", val);
+		bench_usage_and_exit();
+	}
+	return ret;
+}
+
+/**
+* Parse the arguments of the benchmarks
+*
+* @param argc     The number of arguments
+* @param argv     The arguments
+* @param opts     The options to fill
+*/
+static void parse_bench_arguments(int argc, char* argv[], BenchOptions* opts) {
+	char* end;
+	int opt, i;
+
+	memset(opts, 0, sizeof(BenchOptions));
+	opts->stream_len = BENCH_DEFAULT_STREAM_LEN;
+	opterr = 0;
+	while ((opt = getopt(argc, argv, "a:n:m:g:l:w:")) != -1) {
+		switch (opt) {
+		case 'a':
+			if (opts->n_instances == sizeof(opts->instances) / sizeof(opts->instances[0]) ||
+			    mps_parse_instance(optarg, &opts->instances[opts->n_instances]) != 0 ||
+			    opts->instances[opts->n_instances].algo == MPS_NONE) {
+				fprintf(stderr, "Error: unknown algorithm %s\n\n", optarg);
+				bench_usage_and_exit();
+			}
+			opts->n_instances++;
+			break;
+		case 'n':
+			if (opts->n_sizes == BENCH_MAX_VALUES) bench_usage_and_exit();
+			opts->sizes[opts->n_sizes] = parse_size_option(optarg);
+			if (opts->sizes[opts->n_sizes++] == 0) bench_usage_and_exit();
+			break;
+		case 'm':
+			if (opts->n_densities == BENCH_MAX_VALUES) bench_usage_and_exit();
+			errno = 0;
+			opts->densities[opts->n_densities] = strtod(optarg, &end);
+			if (errno || *optarg == '\0' || *end != '\0' || opts->densities[opts->n_densities] < 0 ||
+			    opts->densities[opts->n_densities] > 1) {
+				fprintf(stderr, "Error: invalid density %s (must be between 0 and 1)\n\n", optarg);
+				bench_usage_and_exit();
+			}
+			opts->n_densities++;
+			break;
+		case 'g':
+			for (i = 0; i < N_WORKLOADS && strcmp(optarg, workload_names[i]); ++i);
+			if (i == N_WORKLOADS || opts->n_workloads == N_WORKLOADS) {
+				fprintf(stderr, "Error: unknown workload %s\n\n", optarg);
+				bench_usage_and_exit();
+			}
+			opts->workloads[opts->n_workloads++] = i;
+			break;
+		case 'l':
+			opts->stream_len = parse_size_option(optarg);
+			if (opts->stream_len == 0) bench_usage_and_exit();
+			break;
+		case 'w':
+			opts->write_prefix = optarg;
+			break;
+		default:
+			fprintf(stderr, "Unknown option or missing argument %s.\n\n", argv[optind - 1]);
+			bench_usage_and_exit();
+		}
+	}
+	if (optind != argc) bench_usage_and_exit();
+
+	if (opts->n_instances == 0) {
+		for (i = 0; i < MPS_SIZE; ++i) {
+			mps_parse_instance(mps_table[i].short_name, &opts->instances[opts->n_instances++]);
+		}
+	}
+	if (opts->n_sizes == 0) {
+		opts->sizes[0] = 100;
+		opts->sizes[1] = 1000;
+		opts->sizes[2] = 4000;
+		opts->n_sizes = 3;
+	}
+	if (opts->n_densities == 0) {
+		opts->densities[0] = 0;
+		opts->densities[1] = 0.01;
+		opts->densities[2] = 0.1;
+		opts->n_densities = 3;
+	}
+	if (opts->n_workloads == 0) {
+		for (i = 0; i < N_WORKLOADS; ++i) {
+			opts->workloads[opts->n_workloads++] = i;
+		}
+	}
+}
+
+/**
+* Add a generated pattern to the dictionary of an input
+*/
+static void input_add_pattern(BenchInput* input, const char* pat, size_t len) {
+	PatternInternalID internal_id;
+	internal_id.file_number = 0;
+	internal_id.line_number = input->patterns.n + 1;
+	patterns_list_add(&input->patterns, pat, len, internal_id, null_pattern_id);
+}
+
+/**
+* Generate the dictionary of an input (by its workload and number of patterns)
+*
+* The patterns of a workload don't depend on the density, so the random streams of all the densities are matched
+* against the same dictionary.
+*
+* @param input    The input (with its workload and number of patterns)
+*/
+static void generate_dictionary(BenchInput* input) {
+	char pat[BENCH_FP_MAX_LEN + 1], base[BENCH_FP_MAX_LEN];
+	size_t i, j, len;
+
+	rand_state = BENCH_SEED ^ (input->workload * 0x100000001b3ull) ^ input->n_patterns;
+	memset(&input->patterns, 0, sizeof(PatternsList));
+	switch (input->workload) {
+	case WORKLOAD_RANDOM:
+		for (i = 0; i < input->n_patterns; ++i) {
+			len = bench_rand_range(BENCH_MIN_LEN, BENCH_MAX_LEN);
+			for (j = 0; j < len; ++j) {
+				pat[j] = bench_rand_letter(26);
+			}
+			input_add_pattern(input, pat, len);
+		}
+		break;
+	case WORKLOAD_FAILURE:
+		// x^(len-1) t, for every letter x (but 'z'), length (the longest first, so even a small dictionary has the
+		// longest chains) and another letter t (but 'z', which ends the runs)
+		for (i = 0; i < input->n_patterns; ++i) {
+			len = BENCH_MAX_LEN - (i / 25) % (BENCH_MAX_LEN - BENCH_MIN_LEN + 1);
+			memset(pat, 'a' + i % 25, len - 1);
+			pat[len - 1] = 'a' + (i % 25 + 1 + (i / (25 * (BENCH_MAX_LEN - BENCH_MIN_LEN + 1))) % 24) % 25;
+			input_add_pattern(input, pat, len);
+		}
+		break;
+	case WORKLOAD_FINGERPRINT:
+		// a prefix of the base string, and another letter than the base string at the end
+		for (j = 0; j < BENCH_FP_MAX_LEN; ++j) {
+			base[j] = bench_rand_letter(26);
+		}
+		for (i = 0; i < input->n_patterns; ++i) {
+			len = BENCH_FP_MIN_LEN + i % (BENCH_FP_MAX_LEN - BENCH_FP_MIN_LEN + 1);
+			memcpy(pat, base, len - 1);
+			pat[len - 1] = 'a' + (base[len - 1] - 'a' + 1 + (i / (BENCH_FP_MAX_LEN - BENCH_FP_MIN_LEN + 1)) % 25) % 26;
+			input_add_pattern(input, pat, len);
+		}
+		break;
+	}
+	input->tree = patterns_tree_build_from_list(&input->patterns);
+}
+
+/**
+* Generate the stream of an input (by its workload and density, for its dictionary)
+*
+* @param input    The input (with its dictionary)
+* @param len      The length of the stream
+*/
+static void generate_stream(BenchInput* input, size_t len) {
+	const char* pat;
+	size_t i, j, n, run;
+
+	rand_state = BENCH_SEED ^ (uint64_t)(input->density * 1e9) ^ len;
+	input->stream = (char*)malloc(len);
+	if (input->stream == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	input->len = len;
+	switch (input->workload) {
+	case WORKLOAD_RANDOM:
+		for (i = 0; i < len; i += n) {
+			n = 1;
+			if (input->density > 0 && bench_rand() % 1000000 < input->density * 1000000) {
+				j = bench_rand() % input->patterns.n;
+				n = input->patterns.lens[j] < len - i ? input->patterns.lens[j] : len - i;
+				memcpy(input->stream + i, patterns_list_get(&input->patterns, j), n);
+			} else {
+				input->stream[i] = bench_rand_letter(26);
+			}
+		}
+		break;
+	case WORKLOAD_FAILURE:
+		for (i = 0, run = 0; i < len; ++run) {
+			for (j = 0; j < BENCH_MAX_LEN - 1 && i < len; ++j) {
+				input->stream[i++] = 'a' + run % 25;
+			}
+			if (i < len) input->stream[i++] = 'z';
+		}
+		break;
+	case WORKLOAD_FINGERPRINT:
+		// the base string is the longest pattern without its last letter, and then the letter of the base string
+		pat = patterns_list_get(&input->patterns, 0);
+		for (j = 1; j < input->patterns.n; ++j) {
+			if (input->patterns.lens[j] > input->patterns.lens[0]) pat = patterns_list_get(&input->patterns, j);
+		}
+		for (i = 0; i < len; ++i) {
+			input->stream[i] = pat[i % (BENCH_FP_MAX_LEN - 1)];
+		}
+		break;
+	}
+}
+
+/**
+* Free the dictionary of an input
+*/
+static void free_dictionary(BenchInput* input) {
+	patterns_tree_free(input->tree);
+	patterns_list_free(&input->patterns);
+}
+
+/**
+* Write the dictionary and the stream of an input to PREFIX.dict and PREFIX.stream
+*
+* @param input    The input
+* @param prefix   The prefix of the file names
+*/
+static void write_input(BenchInput* input, const char* prefix) {
+	char* name = (char*)malloc(strlen(prefix) + 8);
+	FILE* f;
+	size_t i;
+
+	if (name == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	sprintf(name, "%s.dict", prefix);
+	f = fopen(name, "w");
+	if (f == NULL) {
+		fprintf(stderr, "can't create %s: %s\n", name, strerror(errno));
+		FatalExit();
+	}
+	// the patterns are letters only, so they are written as they are (see parse_pattern_from_line)
+	for (i = 0; i < input->patterns.n; ++i) {
+		fwrite(patterns_list_get(&input->patterns, i), 1, input->patterns.lens[i], f);
+		fputc('\n', f);
+	}
+	fclose(f);
+	sprintf(name, "%s.stream", prefix);
+	f = fopen(name, "w");
+	if (f == NULL || fwrite(input->stream, 1, input->len, f) != input->len) {
+		fprintf(stderr, "can't write %s: %s\n", name, strerror(errno));
+		FatalExit();
+	}
+	fclose(f);
+	printf("wrote %zu patterns and %zu bytes (%s) to %s.dict and %s.stream\n", input->patterns.n, input->len,
+	       workload_names[input->workload], prefix, prefix);
+	free(name);
+}
+
+/**
+* Add a sample (the time of units, e.g. of the bytes of a block)
+*/
+static void samples_add(BenchSamples* samples, uint64_t ns, size_t units) {
+	if (units == 0) return;
+	if (samples->n == samples->capacity) {
+		samples->capacity = samples->capacity ? 2 * samples->capacity : 256;
+		samples->values = (double*)realloc(samples->values, samples->capacity * sizeof(double));
+		if (samples->values == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+	}
+	samples->values[samples->n++] = (double)ns / units;
+	samples->total_ns += ns;
+	samples->total_units += units;
+}
+
+/**
+* Compare doubles (for sorting the samples)
+*/
+static int cmp_double(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+* Print the result of a kernel (a csv row), and clear its samples
+*
+* @param samples    The samples of the kernel
+* @param kernel     The name of the kernel
+* @param algo       The name of the algorithm (or "-")
+* @param input      The input the kernel ran on (NULL if it has none)
+*/
+static void samples_report(BenchSamples* samples, const char* kernel, const char* algo, const BenchInput* input) {
+	double* v = samples->values;
+	size_t n = samples->n;
+	if (n == 0) return;
+	qsort(v, n, sizeof(double), cmp_double);
+	printf("%s,\"%s\",%s,%zu,%g,%zu,%.3f,%.3f,%.3f,%.3f\n", kernel, algo,
+	       input ? workload_names[input->workload] : "-", input ? input->patterns.n : 0,
+	       input ? input->density : 0, samples->total_units, (double)samples->total_ns / samples->total_units,
+	       v[n / 2], v[n * 99 / 100], v[n - 1]);
+	fflush(stdout);
+	samples->n = 0;
+	samples->total_ns = 0;
+	samples->total_units = 0;
+}
+
+/**
+* Whether a kernel should run another round
+*
+* @param samples    The samples of the kernel so far
+* @param round      The number of rounds done
+*/
+static int another_round(const BenchSamples* samples, size_t round) {
+	return round == 0 || (round < BENCH_MAX_ROUNDS && samples->total_ns < BENCH_MIN_NS);
+}
+
+/**
+* Benchmark read_block and read_char of an instance (already compiled) on an input
+*
+* @param inst       The instance
+* @param input      The input
+* @param out        Buffer of BENCH_BLOCK results
+* @param samples    The samples to use
+*/
+static void bench_instance_reads(MpsInstance* inst, BenchInput* input, pattern_id_t* out, BenchSamples* samples) {
+	MpsElem* mps = &mps_table[inst->algo];
+	uint64_t begin;
+	size_t round, i, j, n;
+
+	for (round = 0; mps->read_block && another_round(samples, round); ++round) {
+		mps->reset(inst->obj);
+		for (i = 0; i < input->len; i += n) {
+			n = input->len - i < BENCH_BLOCK ? input->len - i : BENCH_BLOCK;
+			begin = monotonic_ns();
+			mps->read_block(inst->obj, input->stream + i, n, out);
+			samples_add(samples, monotonic_ns() - begin, n);
+		}
+	}
+	samples_report(samples, "read_block", inst->name, input);
+
+	for (round = 0; another_round(samples, round); ++round) {
+		mps->reset(inst->obj);
+		for (i = 0; i < input->len; i += n) {
+			n = input->len - i < BENCH_BLOCK ? input->len - i : BENCH_BLOCK;
+			begin = monotonic_ns();
+			for (j = 0; j < n; ++j) {
+				out[j] = mps->read_char(inst->obj, input->stream[i + j]);
+			}
+			samples_add(samples, monotonic_ns() - begin, n);
+		}
+	}
+	samples_report(samples, "read_char", inst->name, input);
+}
+
+/**
+* Benchmark kmp_read_char (of the longest pattern of the dictionary) and calc_fp on an input
+*
+* @param input      The input
+* @param samples    The samples to use
+*/
+static void bench_bg_kernels(BenchInput* input, BenchSamples* samples) {
+	KMPRealTime* kmp;
+	KMPState* state;
+	FieldVal r, rn;
+	volatile fingerprint_t fp;
+	volatile int matched;
+	size_t round, i, j, n, longest = 0;
+	uint64_t begin;
+
+	for (i = 1; i < input->patterns.n; ++i) {
+		if (input->patterns.lens[i] > input->patterns.lens[longest]) longest = i;
+	}
+	kmp = kmp_new(patterns_list_get(&input->patterns, longest), input->patterns.lens[longest]);
+	state = kmp_state_init(kmp, malloc(kmp_state_size(kmp)));
+	for (round = 0; another_round(samples, round); ++round) {
+		kmp_reset(kmp, state);
+		for (i = 0; i < input->len; i += n) {
+			n = input->len - i < BENCH_BLOCK ? input->len - i : BENCH_BLOCK;
+			begin = monotonic_ns();
+			for (j = 0; j < n; ++j) {
+				matched = kmp_read_char(kmp, state, input->stream[i + j]);
+			}
+			samples_add(samples, monotonic_ns() - begin, n);
+		}
+	}
+	(void)matched;
+	samples_report(samples, "kmp_read_char", "-", input);
+	free(state);
+	kmp_free(kmp);
+
+	r.val = field_random();
+	r.inv = calculate_inverse(r.val, FIELD_P);
+	for (round = 0; another_round(samples, round); ++round) {
+		for (i = 0; i < input->len; i += n) {
+			n = input->len - i < BENCH_BLOCK ? input->len - i : BENCH_BLOCK;
+			begin = monotonic_ns();
+			fp = calc_fp(input->stream + i, n, &rn, &r);
+			samples_add(samples, monotonic_ns() - begin, n);
+		}
+	}
+	(void)fp;
+	samples_report(samples, "calc_fp", "-", input);
+}
+
+/**
+* Benchmark building the patterns tree of the dictionary of an input (per pattern)
+*
+* @param input      The input
+* @param samples    The samples to use
+*/
+static void bench_tree_build(BenchInput* input, BenchSamples* samples) {
+	PatternsList copy;
+	PatternsTree* tree;
+	uint64_t begin;
+	size_t round, i;
+
+	for (round = 0; another_round(samples, round); ++round) {
+		memset(&copy, 0, sizeof(PatternsList));
+		for (i = 0; i < input->patterns.n; ++i) {
+			patterns_list_add(&copy, patterns_list_get(&input->patterns, i), input->patterns.lens[i],
+			                  input->patterns.internal_ids[i], null_pattern_id);
+		}
+		begin = monotonic_ns();
+		tree = patterns_tree_build_from_list(&copy);
+		samples_add(samples, monotonic_ns() - begin, input->patterns.n);
+		patterns_tree_free(tree);
+		patterns_list_free(&copy);
+	}
+	samples_report(samples, "patterns_tree_build", "-", input);
+}
+
+/**
+* Benchmark field_mul (a chain of dependent multiplications, so it is the latency of a multiplication)
+*
+* @param samples    The samples to use
+*/
+static void bench_field_mul(BenchSamples* samples) {
+	FieldVal x, r;
+	volatile field_t sink;
+	uint64_t begin;
+	size_t round, i, j;
+
+	r.val = field_random();
+	r.inv = calculate_inverse(r.val, FIELD_P);
+	x = r;
+	for (round = 0; another_round(samples, round); ++round) {
+		for (i = 0; i < BENCH_FIELD_MULS; i += BENCH_BLOCK) {
+			begin = monotonic_ns();
+			for (j = 0; j < BENCH_BLOCK; ++j) {
+				field_mul(&x, &x, &r);
+			}
+			samples_add(samples, monotonic_ns() - begin, BENCH_BLOCK);
+		}
+	}
+	sink = x.val;
+	(void)sink;
+	samples_report(samples, "field_mul", "-", NULL);
+}
+
+/**
+* Benchmark all the kernels on the inputs of a workload and a dictionary size (one input for every density of the
+* random workload, and one input for the others)
+*
+* @param opts       The options
+* @param workload   The workload
+* @param size       The number of patterns
+* @param samples    The samples to use
+*/
+static void bench_workload(BenchOptions* opts, int workload, size_t size, BenchSamples* samples) {
+	BenchInput inputs[BENCH_MAX_VALUES];
+	size_t i, j, n_inputs = workload == WORKLOAD_RANDOM ? opts->n_densities : 1;
+	pattern_id_t* out = (pattern_id_t*)malloc(BENCH_BLOCK * sizeof(pattern_id_t));
+	MpsInstance* inst;
+
+	if (out == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	inputs[0].workload = workload;
+	inputs[0].n_patterns = size;
+	generate_dictionary(&inputs[0]);
+	for (i = 0; i < n_inputs; ++i) {
+		if (i) inputs[i] = inputs[0];
+		inputs[i].density = workload == WORKLOAD_RANDOM ? opts->densities[i] : 0;
+		generate_stream(&inputs[i], opts->stream_len);
+	}
+
+	bench_tree_build(&inputs[0], samples);
+	for (i = 0; i < n_inputs; ++i) {
+		bench_bg_kernels(&inputs[i], samples);
+	}
+	for (j = 0; j < opts->n_instances; ++j) {
+		// build the instance once for all the streams of the dictionary
+		inst = &opts->instances[j];
+		inst->obj = mps_create_object(inst);
+		for (i = 0; i < inputs[0].patterns.n; ++i) {
+			if (inputs[0].patterns.ids[i] == null_pattern_id) continue;
+			mps_table[inst->algo].add_pattern(inst->obj, patterns_list_get(&inputs[0].patterns, i),
+			                                  inputs[0].patterns.lens[i], inputs[0].patterns.ids[i]);
+		}
+		mps_table[inst->algo].compile(inst->obj);
+		for (i = 0; i < n_inputs; ++i) {
+			bench_instance_reads(inst, &inputs[i], out, samples);
+		}
+		mps_table[inst->algo].free(inst->obj);
+		inst->obj = NULL;
+	}
+
+	for (i = 0; i < n_inputs; ++i) {
+		free(inputs[i].stream);
+	}
+	free_dictionary(&inputs[0]);
+	free(out);
+}
+
+
+/******************************************************************************
+*		MAIN
+******************************************************************************/
+
+
+int main(int argc, char* argv[]) {
+	BenchOptions opts;
+	BenchSamples samples;
+	BenchInput input;
+	size_t i, j;
+
+	program_name = argv[0];
+	mps_table_setup();
+	parse_bench_arguments(argc, argv, &opts);
+	srand((unsigned)BENCH_SEED);
+
+	if (opts.write_prefix) {
+		input.workload = opts.workloads[0];
+		input.n_patterns = opts.sizes[0];
+		input.density = input.workload == WORKLOAD_RANDOM ? opts.densities[0] : 0;
+		generate_dictionary(&input);
+		generate_stream(&input, opts.stream_len);
+		write_input(&input, opts.write_prefix);
+		free(input.stream);
+		free_dictionary(&input);
+		return 0;
+	}
+
+	memset(&samples, 0, sizeof(BenchSamples));
+	printf("kernel,algorithm,workload,patterns,density,units,mean_ns,p50_ns,p99_ns,max_ns\n");
+	bench_field_mul(&samples);
+	for (i = 0; i < opts.n_workloads; ++i) {
+		for (j = 0; j < opts.n_sizes; ++j) {
+			bench_workload(&opts, opts.workloads[i], opts.sizes[j], &samples);
+		}
+	}
+	free(samples.values);
+	for (i = 0; i < opts.n_instances; ++i) {
+		free(opts.instances[i].name);
+		free(opts.instances[i].params);
+	}
+	return 0;
+}
@@ -24,14 +24,13 @@ typedef field_t fingerprint_t;
 ******************************************************************************************************/
 
 /* functions to calculate fingerprints. also calculate r^len (when got previously r^prefix_len) */
-fingerprint_t calc_fp(char* seq, size_t len, FieldVal* rn, FieldVal* r, fingerprint_t p);
+fingerprint_t calc_fp(char* seq, size_t len, FieldVal* rn, FieldVal* r);
 fingerprint_t calc_fp_with_prefix(char           *seq,
                                   size_t          len,
                                   fingerprint_t   prefix_fp,
                                   size_t          prefix_len,
                                   FieldVal       *rn,
-                                  FieldVal       *r,
-                                  fingerprint_t   p);
+                                  FieldVal       *r);
 
 
 /******************************************************************************************************
@@ -49,7 +48,7 @@ fingerprint_t calc_fp_with_prefix(char           *seq,
 * 'prefix_fp' is the prefix fingerprint = fp(text[0..prefix-1])
 * 'suffix_fp' is the suffix fingerprint = fp(text[prefix..all-1])
 * 'r_prefix' is r ^ prefix
-* 'p' is the size of the field
+* (all in the field of size FIELD_P)
 *
 * _______________________________
 * |_____________|_________________|
@@ -65,27 +64,20 @@ fingerprint_t calc_fp_with_prefix(char           *seq,
 */
 static inline fingerprint_t calc_fp_suffix(fingerprint_t  all_fp,
                                            fingerprint_t  prefix_fp,
-                                           FieldVal      *r_prefix,
-                                           field_t        p) {
-	return ((all_fp > prefix_fp ? all_fp - prefix_fp : p - prefix_fp + all_fp) * r_prefix->inv) % p;
+                                           FieldVal      *r_prefix) {
+	return field_mod_mul(field_mod_sub(all_fp, prefix_fp), r_prefix->inv);
 }
 
 static inline fingerprint_t calc_fp_prefix(fingerprint_t  all_fp,
                                            fingerprint_t  suffix_fp,
-                                           FieldVal      *r_prefix,
-                                           field_t        p) {
-	fingerprint_t suffix_part = (suffix_fp * r_prefix->val) % p;
-	return (all_fp > suffix_part ? all_fp - suffix_part : p - suffix_part + all_fp) % p;
+                                           FieldVal      *r_prefix) {
+	return field_mod_sub(all_fp, field_mod_mul(suffix_fp, r_prefix->val));
 }
 
 static inline fingerprint_t calc_fp_from_prefix_suffix(fingerprint_t  prefix_fp,
                                                        fingerprint_t  suffix_fp,
-                                                       FieldVal      *r_prefix,
-                                                       field_t        p) {
-	// we do % p twice, to not get overflow:
-	// All we are promised, is that p < sqrt(sizeof(field_t)), so suffix * r_prefix is in the range
-	// But, suffix * r_prefix + prefix might give overflow
-	return (prefix_fp + ((suffix_fp * r_prefix->val) % p)) % p;
+                                                       FieldVal      *r_prefix) {
+	return field_mod_add(prefix_fp, field_mod_mul(suffix_fp, r_prefix->val));
 }
 
 
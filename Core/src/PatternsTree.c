@@ -18,6 +18,10 @@
 *
 *     Note that if we have the longest match, than all the other matches are exactly its suffixes.
 *
+*     The nodes are kept in one array in DFS order, and every node has the interval of its subtree
+*     in that array, so checking whether a pattern is a suffix of another is O(1), and going up the
+*     tree reads a few compact nodes from one array.
+*
 * We define a pointer to a patterns tree node as pattern_id_t, and that the id of the pattern that
 * the Multi-Pattern searching alogirithms get.
 *
@@ -40,6 +44,8 @@
 
 #include "PatternsTree.h"
 #include "conf.h"
+#include <pthread.h>
+#include <string.h>
 
 
 /******************************************************************************
@@ -48,14 +54,18 @@
 
 
 // ============ FOR TESTING ===================
-void print_fpt(FullPatternsTree* full_tree);
 void print_patterns_tree(PatternsTree* tree);
 // ============ FOR TESTING ===================
 
 /**
-* We build the patterns tree in two stages:
-* 1. Build a full pattern tree (where every node have a list of its childs, with the suitable prefix)
-* 2. Convert the full tree to regular tree (where every node have only his parent)
+* We build the patterns tree in three stages:
+* 1. Parse all the patterns from the dictionary files (every file is parsed in parallel chunks)
+* 2. Sort the patterns by their reversed strings, so every pattern comes right after all its suffixes
+*    (with other patterns having the same suffixes between them), and find the parent of every pattern
+*    (its longest pattern suffix) in one pass over the sorted patterns, with a stack of the suffixes
+*    of the current pattern.
+* 3. Lay out the nodes in one array, in DFS order (flatten_patterns_tree)
+* 4. Add the patterns to the object with the callback function (by their order in the dictionary files)
 */
 
 /**
@@ -68,6 +78,47 @@ static inline void copy_pattern_internal_id(PatternInternalID* dest, PatternInte
 
 PatternInternalID null_pattern_internal_id = {-1,-1};
 
+// The minimal size of a chunk of a dictionary file that is parsed on its own thread
+#define DICT_MIN_CHUNK_SIZE (64 * 1024)
+
+/**
+* A chunk of a dictionary file, parsed on its own thread (the chunk starts at the beginning of a line)
+*/
+typedef struct {
+	char      *start;
+	size_t     len;
+	char      *patterns;      // all the parsed patterns of the chunk, one after another
+	size_t    *lens;          // the length of every parsed pattern
+	size_t    *lines;         // the line number of every parsed pattern (in the chunk, starting from 1)
+	size_t     n_patterns;
+	size_t     n_lines;
+	size_t     patterns_size; // the size of all the parsed patterns
+	pthread_t  thread;
+} DictChunk;
+
+/**
+* A pattern parsed from the dictionary files
+*/
+typedef struct {
+	char              *pat;  // the pattern (in the patterns of its chunk)
+	size_t             len;
+	PatternInternalID  id;
+	PatternsTreeNode  *node; // the node of the pattern in the tree (NULL if it is the same as an earlier pattern)
+} ParsedPattern;
+
+/**
+* All the patterns parsed from the dictionary files (by their order in the files)
+*/
+typedef struct {
+	ParsedPattern  *patterns;
+	size_t          n_patterns;
+	size_t          capacity;
+	DictChunk     **chunks;      // the chunks of every file (holding the parsed patterns)
+	size_t         *n_chunks;    // the number of chunks of every file
+	size_t          n_files;
+	size_t          max_pat_len;
+} ParsedDictionaries;
+
 #define SET_NULL_PATTERN_INTERNAL_ID(id) copy_pattern_internal_id(&(id), &null_pattern_internal_id)
 #define IS_NULL_PATTERN_INTERNAL_ID(id) ((id).file_number == null_pattern_internal_id.file_number \
                                          && (id).line_number == null_pattern_internal_id.line_number)
@@ -96,401 +147,576 @@ static int _is_suffix_of(char* suf, size_t suf_len, char* str, size_t str_len) {
 }
 
 /**
-* Add child to the begining of the edge list
+* Read a whole dictionary file to a dynamically allocated buffer
 *
-* @param list   Pointer to the edge list
-* @param node   The node of the child
-* @param pat    The prefix of the child from the parent
-* @param n      The length of the pattern
+* The buffer is terminated by '\0' (as the lines read by getline), since parsing a line can look at the byte after it.
+*
+* @param filename     The name of the dictionary file
+* @param size         Set to the size of the file
+*
+* @return             The buffer with the content of the file
 */
-static void fpt_add_child_to_list(FptEdge** list, FptNode* node, char* pat, size_t n) {
-	if (!list) {
-		return;
-	}
-	FptEdge* first = (FptEdge*)malloc(sizeof(FptEdge));
-	if (first == NULL) {
-		perror("failed to allocate memory");
+static char* read_dict_file(char* filename, size_t* size) {
+	FILE* fp;
+	char* buf = NULL;
+	size_t len = 0, capacity = 0, read;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "failed to open dictionary file %s: %s", filename, strerror(errno));
 		FatalExit();
 	}
-	first->node = node;
-	first->len = n;
-	first->text = (char*)malloc(n);
-	if (first->text == NULL) {
-		perror("failed to allocate memory");
+	do {
+		if (capacity - len < DICT_MIN_CHUNK_SIZE) {
+			capacity = capacity ? 2 * capacity : 4 * DICT_MIN_CHUNK_SIZE;
+			buf = (char*)realloc(buf, capacity + 1);
+			if (buf == NULL) {
+				perror("failed to allocate memory");
+				FatalExit();
+			}
+		}
+		read = fread(buf + len, 1, capacity - len, fp);
+		len += read;
+	} while (read != 0);
+	if (ferror(fp)) {
+		fprintf(stderr, "failed to read dictionary file %s: %s", filename, strerror(errno));
 		FatalExit();
 	}
-	memcpy(first->text, pat, n);
-	first->prev = NULL;
-	first->next = *list;
-	if (*list) (*list)->prev = first;
-	*list = first;
+	fclose(fp);
+	buf[len] = '\0';
+	*size = len;
+	return buf;
 }
 
 /**
-* Remove edge from the edge list (including freeing the edge)
+* Parse all the lines in a chunk of a dictionary file (thread function)
 *
-* @param list     Pointer to the edge list
-* @param child    The edge to remove from the list
+* @param arg     The chunk (DictChunk*)
+*
+* @return        NULL
 */
-static void fpt_remove_child_from_list(FptEdge** list, FptEdge* child) {
-	if (child->next) {
-		child->next->prev = child->prev;
-	}
-	if (child->prev) {
-		child->prev->next = child->next;
-	} else {
-		*list = child->next;
+static void* parse_dict_chunk(void* arg) {
+	DictChunk* chunk = (DictChunk*)arg;
+	char *line = chunk->start, *end = chunk->start + chunk->len, *nl;
+	char* pat;
+	size_t read, pat_len, capacity = 0, patterns_capacity = 0;
+
+	while (line < end) {
+		nl = (char*)memchr(line, '\n', end - line);
+		read = nl ? (size_t)(nl - line + 1) : (size_t)(end - line);
+		++chunk->n_lines;
+		pat = NULL;
+		pat_len = parse_pattern_from_line(line, line[read - 1] == '\n' ? read - 1 : read, &pat);
+		if (pat_len != 0) {
+			if (chunk->n_patterns == capacity) {
+				capacity = capacity ? 2 * capacity : 1024;
+				chunk->lens = (size_t*)realloc(chunk->lens, capacity * sizeof(size_t));
+				chunk->lines = (size_t*)realloc(chunk->lines, capacity * sizeof(size_t));
+			}
+			while (chunk->patterns_size + pat_len > patterns_capacity) {
+				patterns_capacity = patterns_capacity ? 2 * patterns_capacity : DICT_MIN_CHUNK_SIZE;
+				chunk->patterns = (char*)realloc(chunk->patterns, patterns_capacity);
+			}
+			if (chunk->lens == NULL || chunk->lines == NULL || chunk->patterns == NULL) {
+				perror("failed to allocate memory");
+				FatalExit();
+			}
+			memcpy(chunk->patterns + chunk->patterns_size, pat, pat_len);
+			chunk->patterns_size += pat_len;
+			chunk->lens[chunk->n_patterns] = pat_len;
+			chunk->lines[chunk->n_patterns++] = chunk->n_lines;
+		}
+		if (pat) free(pat);
+		line += read;
 	}
-	if (child->text) free(child->text);
-	free(child);
+	return NULL;
 }
 
 /**
-* Create new child for a given node
+* Parse all the patterns in a dictionary file
 *
-* @param parent     The node for which we create child
-* @param pat        The pattern from the parent to the child
-* @param n          The length of the pattern
-* @param id         The pattern id of the child
+* The file is split to chunks of whole lines (one per cpu, but not smaller than DICT_MIN_CHUNK_SIZE),
+* which are parsed in parallel, and then the patterns are added to the parsed patterns by their order in the file.
+* (the chunks are kept in parsed, since the parsed patterns are in them)
 *
-* @return           Pointer to the new child node created
+* @param parsed         The parsed patterns (of the previous files)
+* @param file_index     The index of the dictionary file name in dictionary_files
+* @param filename       The name of the dictionary file
 */
-static FptNode* fpt_create_new_child(FptNode* parent, char* pat, size_t n, PatternInternalID id) {
-	FptNode* node = (FptNode*)malloc(sizeof(FptNode));
-	if (node == NULL) {
+static void parse_dict_file(ParsedDictionaries* parsed, size_t file_index, char* filename) {
+	char *buf, *pat, *nl;
+	size_t i, j, size, n_chunks, pos, next, line_base = 0;
+	DictChunk* chunks;
+	ParsedPattern* pp;
+	int err;
+
+	buf = read_dict_file(filename, &size);
+	n_chunks = get_n_cpus();
+	if (n_chunks > size / DICT_MIN_CHUNK_SIZE) n_chunks = size / DICT_MIN_CHUNK_SIZE;
+	if (n_chunks == 0) n_chunks = 1;
+	chunks = (DictChunk*)calloc(n_chunks, sizeof(DictChunk));
+	if (chunks == NULL) {
 		perror("failed to allocate memory");
 		FatalExit();
 	}
-	node->parent = parent;
-	copy_pattern_internal_id(&node->pattern_id, &id);
-	node->edge_list = NULL;
-	fpt_add_child_to_list(&parent->edge_list, node, pat, n);
-	return node;
-}
-
-/**
-* Add pattern to a node in the full patterns tree
-*
-* To add the pattern to the node, the next should be performed:
-* 1. check whether there is a child of the node who is a suffix of the current pattern,
-*    if there is such child, add the pattern except that suffix to him recursively.
-* 2. otherwise, if the pattern is suffix of some childs, then the pattern should seperate the edges
-*    between the node to those childs (add the pattern as a mid-node between the current node to the suitable  childs)
-* 3. otherwise, just make the pattern a new child
-*
-* @param node    The node to add the pattern to
-* @param pat     The pattern to add to this node
-* @param n       The length of the pattern
-* @param id      The pattern id of the pattern
-*/
-static void fpt_add_pattern_to_node(FptNode* node, char* pat, size_t n, PatternInternalID id) {
-	FptEdge *current_edge, *next_edge;
-	FptNode *new_node = NULL;
-
-	current_edge = node->edge_list;
-	while (current_edge) {
-		next_edge = current_edge->next;
-		if (current_edge->len == n && !memcmp(current_edge->text, pat, n)) {
-			// pattern is already in the tree
-			return;
-		}
-		if (_is_suffix_of(current_edge->text, current_edge->len, pat, n)) {
-			fpt_add_pattern_to_node(current_edge->node, pat, n - current_edge->len, id);
-			return;
+	for (i = 0, pos = 0; i < n_chunks; ++i) {
+		next = i + 1 == n_chunks ? size : size / n_chunks * (i + 1);
+		if (next < pos) next = pos;
+		if (next < size && next > 0 && buf[next - 1] != '\n') {
+			nl = (char*)memchr(buf + next, '\n', size - next);
+			next = nl ? (size_t)(nl - buf + 1) : size;
 		}
-		if (_is_suffix_of(pat, n, current_edge->text, current_edge->len)) {
-			if (!new_node) {
-				new_node = fpt_create_new_child(node, pat, n, id);
-			}
-			fpt_add_child_to_list(&new_node->edge_list, current_edge->node, current_edge->text, current_edge->len - n);
-			fpt_remove_child_from_list(&node->edge_list, current_edge);
+		chunks[i].start = buf + pos;
+		chunks[i].len = next - pos;
+		pos = next;
+	}
+
+	for (i = 1; i < n_chunks; ++i) {
+		err = pthread_create(&chunks[i].thread, NULL, parse_dict_chunk, &chunks[i]);
+		if (err) {
+			errno = err;
+			perror("failed to create thread");
+			FatalExit();
 		}
-		current_edge = next_edge;
 	}
-	if (!new_node) {
-		// the pattern is not a suffix of a child nor conatin a child as suffix, just create new node
-		fpt_create_new_child(node, pat, n, id);
+	parse_dict_chunk(&chunks[0]);
+	for (i = 1; i < n_chunks; ++i) {
+		pthread_join(chunks[i].thread, NULL);
 	}
-}
-
+	free(buf);
 
-/**
-* Add pattern to the full patterns tree
-* 
-* @param tree   The full patterns tree
-* @param pat    The pattern to add to the tree
-* @param n      The length of the pattern
-* @param id     The id of the pattern
-*/
-static void fpt_add_pattern(FullPatternsTree* tree, char* pat, size_t n, PatternInternalID id) {
-	fpt_add_pattern_to_node(tree->root, pat, n, id);
+	for (i = 0; i < n_chunks; ++i) {
+		if (parsed->capacity - parsed->n_patterns < chunks[i].n_patterns) {
+			while (parsed->capacity - parsed->n_patterns < chunks[i].n_patterns) {
+				parsed->capacity = parsed->capacity ? 2 * parsed->capacity : 1024;
+			}
+			parsed->patterns = (ParsedPattern*)realloc(parsed->patterns, parsed->capacity * sizeof(ParsedPattern));
+			if (parsed->patterns == NULL) {
+				perror("failed to allocate memory");
+				FatalExit();
+			}
+		}
+		for (j = 0, pat = chunks[i].patterns; j < chunks[i].n_patterns; pat += chunks[i].lens[j++]) {
+			pp = &parsed->patterns[parsed->n_patterns++];
+			pp->pat = pat;
+			pp->len = chunks[i].lens[j];
+			pp->id.file_number = file_index;
+			pp->id.line_number = line_base + chunks[i].lines[j];
+			pp->node = NULL;
+			if (pp->len > parsed->max_pat_len) parsed->max_pat_len = pp->len;
+		}
+		line_base += chunks[i].n_lines;
+		free(chunks[i].lens);
+		free(chunks[i].lines);
+	}
+	parsed->chunks[file_index] = chunks;
+	parsed->n_chunks[file_index] = n_chunks;
 }
 
-
 /**
-* Create a new empty Full Patterns Tree
+* Parse all the patterns from the dictionary files
 *
-* @return       A new dynamically allocated empty Full Patterns Tree
+* @param conf     The program configuration
+* @param parsed   Where to put the parsed patterns
 */
-static FullPatternsTree* fpt_new() {
-	FullPatternsTree* ret = (FullPatternsTree*) malloc(sizeof(FullPatternsTree));
-	if (ret == NULL) {
+static void parse_dictionaries(Conf* conf, ParsedDictionaries* parsed) {
+	size_t i;
+
+	memset(parsed, 0, sizeof(ParsedDictionaries));
+	parsed->n_files = conf->n_dictionary_files;
+	parsed->chunks = (DictChunk**)calloc(parsed->n_files + 1, sizeof(DictChunk*));
+	parsed->n_chunks = (size_t*)calloc(parsed->n_files + 1, sizeof(size_t));
+	if (parsed->chunks == NULL || parsed->n_chunks == NULL) {
 		perror("failed to allocate memory");
 		FatalExit();
 	}
-	ret->root = (FptNode*)malloc(sizeof(FptNode));
-	if (ret->root == NULL) {
-		perror("failed to allocate memory");
-		FatalExit();
+	for (i = 0; i < parsed->n_files; ++i) {
+		parse_dict_file(parsed, i, conf->dictionary_files[i]);
 	}
-	memset(ret->root, 0, sizeof(FptNode));
-	SET_NULL_PATTERN_INTERNAL_ID(ret->root->pattern_id);
-	return ret;
 }
 
 /**
-* Fill an existing Fpt with all the patterns in a dictionary file
-*
-* @param tree           The Full Patterns Tree
-* @param file_index     The index of the dictionary file name in dictionary_files
-* @param filename       The name of the dictionary file
+* Free the parsed patterns
 *
-* @return               The longest patterns found
+* @param parsed   The parsed patterns
 */
-static size_t fpt_fill_with_dict_file(FullPatternsTree* tree, size_t file_index, char* filename) {
-	FILE* fp;
-	char* line = NULL;
-	char* pat = NULL;
-	size_t len, pat_len, max_pat_len = 0;
-	size_t line_num = 0;
-	ssize_t read;
-	PatternInternalID id;
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "failed to open dictionary file %s: %s", filename, strerror(errno));
-		FatalExit();
-	}
-	while ((read = getline(&line, &len, fp)) != -1) {
-		++line_num;
-		pat = NULL;
-		if (line[read - 1] == '\n') --read;
-		pat_len = parse_pattern_from_line(line, read, &pat);
-		if (pat_len != 0) {
-			id.file_number = file_index;
-			id.line_number = line_num;
-			fpt_add_pattern(tree, pat, pat_len, id);
-			if (pat_len > max_pat_len) max_pat_len = pat_len;
+static void free_parsed_dictionaries(ParsedDictionaries* parsed) {
+	size_t i, j;
+	for (i = 0; i < parsed->n_files; ++i) {
+		for (j = 0; j < parsed->n_chunks[i]; ++j) {
+			free(parsed->chunks[i][j].patterns);
 		}
-		if (pat) free(pat);
-		
+		free(parsed->chunks[i]);
 	}
-	free(line);
-	fclose(fp);
-	return max_pat_len;
+	free(parsed->chunks);
+	free(parsed->n_chunks);
+	free(parsed->patterns);
 }
 
 /**
-* Build the full patterns tree from the dictionary files
+* Compare two parsed patterns by their reversed strings (for sorting pointers to parsed patterns)
 *
-* @param conf   The program configuration
-*
-* @return       A dynamically allocated Full-Patterns-Tree filled with the patterns from the dictionary files
+* A pattern comes right after its suffixes, and identical patterns are ordered by their order in the
+* dictionary files (pointers into the patterns array preserve that order).
 */
-static FullPatternsTree* fpt_build(Conf* conf) {
-	FullPatternsTree* ret = fpt_new();
-	size_t i, n_dictionary_files = conf->n_dictionary_files, max_pat_len = 0, total_max_pat_len = 0;
-	char** dictionary_files = conf->dictionary_files;
-
-	for (i = 0; i < n_dictionary_files; ++i) {
-		max_pat_len = fpt_fill_with_dict_file(ret, i, dictionary_files[i]);
-		if (max_pat_len > total_max_pat_len) total_max_pat_len = max_pat_len;
-	}
-	ret->longest_pat_len = total_max_pat_len;
-	conf->max_pat_len = total_max_pat_len;
-	return ret;
+static int cmp_reversed_patterns(const void* a, const void* b) {
+	const ParsedPattern *x = *(const ParsedPattern**)a, *y = *(const ParsedPattern**)b;
+	size_t i, n = x->len < y->len ? x->len : y->len;
+	unsigned char cx, cy;
+	for (i = 1; i <= n; ++i) {
+		cx = (unsigned char)x->pat[x->len - i];
+		cy = (unsigned char)y->pat[y->len - i];
+		if (cx != cy) return cx < cy ? -1 : 1;
+	}
+	if (x->len != y->len) return x->len < y->len ? -1 : 1;
+	return x < y ? -1 : (x > y);
 }
 
 /**
-* Free a Full Patterns Tree node recursively
+* Create a patterns tree from the parent of every pattern, with the nodes in DFS order
+*
+* We find the children of every node (in one array, counting sort by the parent), and then go over
+* the tree in DFS order with a stack, giving every node its index, parent index and depth (the parent
+* is always visited before its children). The end of the subtree of every node is found by going over the
+* nodes backwards, since the subtree of a node is right after it. It is all O(n).
+*
+* @param n              The number of patterns
+* @param parents        The index of the parent of every pattern (PATTERNS_TREE_ROOT_PARENT if it is the root)
+* @param internal_ids   The internal id of every pattern
+* @param lens           The length of every pattern
+* @param ids            Where to put the id of every pattern (its node in the tree)
+*
+* @return     A dynamically allocated patterns tree, or NULL if the parents are not a tree (there is a cycle)
 */
-static void fpt_free_node(FptNode* node) {
-	FptEdge *current_edge, *next_edge;
+static PatternsTree* flatten_patterns_tree(size_t n, const size_t* parents, const PatternInternalID* internal_ids,
+                                           const size_t* lens, pattern_id_t* ids) {
+	PatternsTree* tree;
+	PatternsTreeNode *nodes, *node;
+	size_t *first_child, *children, *stack, *index_of;
+	size_t i, v, p, top = 0, n_visited = 0;
+
+	if (n >= PATTERNS_TREE_NO_PARENT) {
+		fprintf(stderr, "too many patterns (%zu)\n", n);
+		FatalExit();
+	}
+	// v is the node of the pattern of index v - 1 (0 is the root)
+	first_child = (size_t*)calloc(n + 2, sizeof(size_t));
+	children = (size_t*)malloc((n + 1) * sizeof(size_t));
+	stack = (size_t*)malloc((n + 1) * sizeof(size_t));
+	index_of = (size_t*)malloc((n + 1) * sizeof(size_t));
+	tree = (PatternsTree*)malloc(sizeof(PatternsTree));
+	nodes = (PatternsTreeNode*)malloc((n + 1) * sizeof(PatternsTreeNode));
+	if (first_child == NULL || children == NULL || stack == NULL || index_of == NULL || tree == NULL || nodes == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	tree->root = nodes;
+	tree->n_nodes = n + 1;
 
-	if (!node) {
-		return;
+	// the children of v are children[first_child[v]] ... children[first_child[v + 1] - 1]
+	for (i = 0; i < n; ++i) {
+		++first_child[(parents[i] == PATTERNS_TREE_ROOT_PARENT ? 0 : parents[i] + 1) + 1];
 	}
-	current_edge = node->edge_list;
-	while (current_edge) {
-		next_edge = current_edge->next;
-		if (current_edge->text) free(current_edge->text);
-		if (current_edge->node) fpt_free_node(current_edge->node);
-		free(current_edge);
-		current_edge = next_edge;
+	for (v = 1; v <= n + 1; ++v) {
+		first_child[v] += first_child[v - 1];
+	}
+	for (i = 0; i < n; ++i) {
+		p = parents[i] == PATTERNS_TREE_ROOT_PARENT ? 0 : parents[i] + 1;
+		children[first_child[p]++] = i + 1;
+	}
+	for (v = n + 1; v > 0; --v) {
+		first_child[v] = first_child[v - 1];
+	}
+	first_child[0] = 0;
+
+	stack[top++] = 0;
+	while (top) {
+		v = stack[--top];
+		index_of[v] = n_visited;
+		node = &nodes[n_visited];
+		node->index = n_visited;
+		node->end = n_visited + 1;
+		if (v == 0) {
+			node->parent = PATTERNS_TREE_NO_PARENT;
+			node->depth = 0;
+			node->len = 0;
+			copy_pattern_internal_id(&node->pattern_id, &null_pattern_internal_id);
+		} else {
+			p = parents[v - 1] == PATTERNS_TREE_ROOT_PARENT ? 0 : parents[v - 1] + 1;
+			node->parent = index_of[p];
+			node->depth = nodes[index_of[p]].depth + 1;
+			node->len = lens[v - 1];
+			copy_pattern_internal_id(&node->pattern_id, (PatternInternalID*)&internal_ids[v - 1]);
+			ids[v - 1] = node;
+		}
+		++n_visited;
+		for (i = first_child[v + 1]; i > first_child[v]; --i) {
+			stack[top++] = children[i - 1];
+		}
+	}
+	for (i = n_visited; i-- > 1;) {
+		if (nodes[nodes[i].parent].end < nodes[i].end) nodes[nodes[i].parent].end = nodes[i].end;
 	}
-	free(node);
-}
 
-/**
-* Free memory of Full Pattern Tree
-*/
-static void fpt_free(FullPatternsTree* full_tree) {
-	fpt_free_node(full_tree->root);
-	free(full_tree);
+	free(first_child);
+	free(children);
+	free(stack);
+	free(index_of);
+	if (n_visited != n + 1) {
+		// some patterns are not reachable from the root
+		free(nodes);
+		free(tree);
+		return NULL;
+	}
+	return tree;
 }
 
 /**
-* Add a new child to a node
+* Create the patterns tree of the parsed patterns
+*
+* In the order of the reversed patterns, all the patterns that are suffixes of a pattern are before it,
+* and the patterns between a suffix and the pattern have the same suffix. So going over the patterns in that
+* order, while keeping a stack of the suffixes of the previous pattern (from the shortest to the longest),
+* the parent of the current pattern is what left on the top of the stack after removing the patterns that
+* are not its suffixes. Every pattern is pushed and popped at most once, so after sorting it is
+* O(total length of the patterns).
+*
+* @param parsed    The parsed patterns (the node of every pattern is set, NULL for repeated patterns)
 *
-* @param parent    The parent node
-* @param child     The node to add the parent as child
+* @return          A dynamically allocated patterns tree of the parsed patterns
 */
-static void add_child_to_node(PatternsTreeNode* parent, PatternsTreeNode* child) {
-	PatternsTreeEdge* edge = (PatternsTreeEdge*) malloc(sizeof(PatternsTreeEdge));
-	if (edge == NULL) {
+static PatternsTree* create_patterns_tree(ParsedDictionaries* parsed) {
+	size_t i, top = 0, n_unique = 0, n = parsed->n_patterns;
+	ParsedPattern **sorted, *cur;
+	size_t *stack, *parents, *lens;
+	PatternInternalID* internal_ids;
+	pattern_id_t* ids;
+	PatternsTree* tree;
+
+	sorted = (ParsedPattern**)malloc((n ? n : 1) * sizeof(ParsedPattern*));
+	stack = (size_t*)malloc((n ? n : 1) * sizeof(size_t));
+	// zeroed, since with no patterns they are passed to flatten_patterns_tree without being filled
+	parents = (size_t*)calloc(n ? n : 1, sizeof(size_t));
+	lens = (size_t*)calloc(n ? n : 1, sizeof(size_t));
+	internal_ids = (PatternInternalID*)calloc(n ? n : 1, sizeof(PatternInternalID));
+	ids = (pattern_id_t*)malloc((n ? n : 1) * sizeof(pattern_id_t));
+	if (sorted == NULL || stack == NULL || parents == NULL || lens == NULL || internal_ids == NULL || ids == NULL) {
 		perror("failed to allocate memory");
 		FatalExit();
 	}
-	edge->node = child;
-	edge->next = parent->edge_list;
-	parent->edge_list = edge;
+	for (i = 0; i < n; ++i) {
+		sorted[i] = &parsed->patterns[i];
+	}
+	qsort(sorted, n, sizeof(ParsedPattern*), cmp_reversed_patterns);
+
+	// the unique patterns are kept at the start of sorted (by their order there)
+	for (i = 0; i < n; ++i) {
+		cur = sorted[i];
+		if (top && sorted[stack[top - 1]]->len == cur->len && !memcmp(sorted[stack[top - 1]]->pat, cur->pat, cur->len)) {
+			// pattern is already in the tree
+			continue;
+		}
+		while (top && !_is_suffix_of(sorted[stack[top - 1]]->pat, sorted[stack[top - 1]]->len, cur->pat, cur->len)) {
+			--top;
+		}
+		parents[n_unique] = top ? stack[top - 1] : PATTERNS_TREE_ROOT_PARENT;
+		lens[n_unique] = cur->len;
+		copy_pattern_internal_id(&internal_ids[n_unique], &cur->id);
+		sorted[n_unique] = cur;
+		stack[top++] = n_unique++;
+	}
+	tree = flatten_patterns_tree(n_unique, parents, internal_ids, lens, ids);
+	for (i = 0; i < n_unique; ++i) {
+		sorted[i]->node = ids[i];
+	}
+	free(sorted);
+	free(stack);
+	free(parents);
+	free(lens);
+	free(internal_ids);
+	free(ids);
+	return tree;
 }
 
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
 /**
-* Convert an Fpt node to a (regular) Patterns Tree node recursively
-*
-* We go through the nodes in the full tree, while keeping the pattern for each node.
-* For the purpose of saving the pattern for each node, we work on a buffer (long enough for the longest pattern)
-* where we save the current pattern for a node in the end of the buffer, and save the position in the buffer
-* from which the pattern start (so we can easily add/remove another pattern in the start).
+* Build a patterns tree from the dictionary files (configured in conf)
 *
-* On every new pattern added, we call the callback function add_pattern_func on the given object obj
+* Also call a given function for each pattern (by the order of the patterns in the dictionary files),
+* to add the patterns to the given object, so we won't lose it (impossible to discover pattern from node
+* in the patterns tree)
 *
-* @param node               The node to convert
-* @param buffer             The buffer to work on
-* @param buffer_len         The length of the buffer
-* @param pat_pos            The position in the buffer where the pattern of the node starts
-* @param obj                The object to add the patterns to
-* @param add_pattern_func   The callback function to add pattern to given object
+* @param conf                 The program configuration
+* @param obj                  The object to add the patterns to
+* @param add_patterns_func    The function that adds a pattern to the object
 *
-* @return          A dynamically allocated patterns tree node constructed from the given node
+* @return     A dynamically allocated patterns tree generated from the patterns in the dictionary files
 */
-static PatternsTreeNode* convert_fpt_node_to_patterns_tree_node(FptNode* node, char* buffer, size_t buffer_len, size_t pat_pos,
-			void* obj, void (*add_pattern_func)(void*, char*, size_t, pattern_id_t)) {
-	PatternsTreeNode* ret = (PatternsTreeNode*) malloc(sizeof(PatternsTreeNode));
-	if (ret == NULL) {
-		perror("failed to allocate memory");
-		FatalExit();
+PatternsTree* patterns_tree_build(Conf* conf,
+                                  void* obj,
+                                  void (*add_pattern_func)(void*, char*, size_t, pattern_id_t)) {
+	ParsedDictionaries parsed;
+	PatternsTree* tree;
+	size_t i;
+
+	parse_dictionaries(conf, &parsed);
+	conf->max_pat_len = parsed.max_pat_len;
+	tree = create_patterns_tree(&parsed);
+	for (i = 0; i < parsed.n_patterns; ++i) {
+		if (parsed.patterns[i].node) {
+			add_pattern_func(obj, parsed.patterns[i].pat, parsed.patterns[i].len, parsed.patterns[i].node);
+		}
 	}
-	PatternsTreeNode* temp;
-	FptEdge* current_edge;
+	free_parsed_dictionaries(&parsed);
+	return tree;
+}
 
-	memset(ret, 0, sizeof(PatternsTreeNode));
-	copy_pattern_internal_id(&ret->pattern_id, &node->pattern_id);
-	for (current_edge = node->edge_list; current_edge; current_edge = current_edge->next) {
-		size_t len = current_edge->len;
-		char* text = current_edge->text;
-		memcpy(buffer + pat_pos - len, text, len);
-		temp = convert_fpt_node_to_patterns_tree_node(current_edge->node, buffer, buffer_len, pat_pos - len,
-				obj, add_pattern_func);
-		temp->parent = ret;
-		add_child_to_node(ret, temp);
-	}
-	if (pat_pos != buffer_len) { // if not empty pattern (root)
-		add_pattern_func(obj, buffer + pat_pos, buffer_len - pat_pos, ret);
-	}
-	return ret;
+/**
+* Build a patterns tree from the parent of every pattern (e.g. when loading the patterns from a cache file)
+*
+* @param n              The number of patterns
+* @param parents        The index of the parent of every pattern (PATTERNS_TREE_ROOT_PARENT if it is the root)
+* @param internal_ids   The internal id of every pattern
+* @param lens           The length of every pattern
+* @param ids            Where to put the id of every pattern (its node in the tree)
+*
+* @return     A dynamically allocated patterns tree with the given patterns, or NULL if the parents are not a tree
+*/
+PatternsTree* patterns_tree_build_from_parents(size_t n, const size_t* parents, const PatternInternalID* internal_ids,
+                                               const size_t* lens, pattern_id_t* ids) {
+	return flatten_patterns_tree(n, parents, internal_ids, lens, ids);
 }
 
 /**
-* Convert Full-Patterns-Tree to (regular) Patterns Tree
+* Build a patterns tree from a list of patterns (e.g. the patterns of the dictionaries after a reload)
 *
-* Call callback function for each finished converted pattern, to add it to the given object
+* The ids of the patterns in the list are set to their nodes in the new tree (null_pattern_id for a pattern
+* that is the same as an earlier pattern in the list).
 *
-* @param full_tree          The Full Patterns Tree
-* @param obj                The object to add the pattern to
-* @param add_pattern_func   The callback function to add pattern to given object
+* @param list     The patterns
 *
-* @return       A dynamically allocated Patterns Tree constructed by the given Full Patterns Tree
+* @return     A dynamically allocated patterns tree with the patterns of the list
 */
-static PatternsTree* convert_fpt_to_patterns_tree(FullPatternsTree* full_tree, void* obj,
-			void (*add_pattern_func)(void*, char*, size_t, pattern_id_t)) {
-	PatternsTree* tree = (PatternsTree*) malloc(sizeof(PatternsTree));
-	if (tree == NULL) {
+PatternsTree* patterns_tree_build_from_list(PatternsList* list) {
+	ParsedDictionaries parsed;
+	PatternsTree* tree;
+	size_t i;
+
+	memset(&parsed, 0, sizeof(ParsedDictionaries));
+	parsed.n_patterns = list->n;
+	parsed.patterns = (ParsedPattern*)malloc((list->n ? list->n : 1) * sizeof(ParsedPattern));
+	if (parsed.patterns == NULL) {
 		perror("failed to allocate memory");
 		FatalExit();
 	}
-	size_t llen = full_tree->longest_pat_len;
-	char* buffer = (char*)malloc(llen);
-	tree->root = convert_fpt_node_to_patterns_tree_node(full_tree->root, buffer, llen, llen, obj, add_pattern_func);
-	free(buffer);
+	for (i = 0; i < list->n; ++i) {
+		parsed.patterns[i].pat = patterns_list_get(list, i);
+		parsed.patterns[i].len = list->lens[i];
+		copy_pattern_internal_id(&parsed.patterns[i].id, &list->internal_ids[i]);
+		parsed.patterns[i].node = NULL;
+	}
+	tree = create_patterns_tree(&parsed);
+	for (i = 0; i < list->n; ++i) {
+		list->ids[i] = parsed.patterns[i].node;
+	}
+	free(parsed.patterns);
 	return tree;
 }
 
 /**
-* Free a node in a patterns tree recursilvely
+* Call a function for every pattern matching where the given pattern is the longest match
 *
-* @param node       The node to free
+* These are the pattern itself and all its ancestors in the tree (not including the root), from the longest
+* to the shortest.
+*
+* @param id       The longest pattern matching (null_pattern_id for no match)
+* @param cb       The function to call with every matching pattern, returns non-zero to stop the enumeration
+* @param arg      An argument passed to cb
 */
-static void patterns_tree_free_node(PatternsTreeNode* node) {
-	PatternsTreeEdge *current_edge, *next_edge;
-
-	if (!node) {
-		return;
-	}
-	current_edge = node->edge_list;
-	while (current_edge) {
-		next_edge = current_edge->next;
-		if (current_edge->node) patterns_tree_free_node(current_edge->node);
-		free(current_edge);
-		current_edge = next_edge;
+void patterns_tree_for_each_match(pattern_id_t id, int (*cb)(pattern_id_t, void*), void* arg) {
+	PatternsTreeNode* nodes;
+	if (id == null_pattern_id) return;
+	nodes = id - id->index;
+	while (id->parent != PATTERNS_TREE_NO_PARENT) {
+		if (cb(id, arg)) return;
+		id = &nodes[id->parent];
 	}
-	free(node);
 }
 
-
-/******************************************************************************
-*		API FUNCTIONS
-******************************************************************************/
-
-
 /**
-* Build a patterns tree from the dictionary files (configured in conf)
+* Collect the patterns matching where the given pattern is the longest match
 *
-* Also call a given function for each finished converted pattern, to add the patterns to the
-* given object, so we won't lose it (impossible to discover pattern from node in the patterns tree)
+* The patterns are put in the same order as patterns_tree_for_each_match. There are exactly id->depth
+* such patterns (0 for null_pattern_id), so out with that size is always enough.
 *
-* @param conf                 The program configuration
-* @param obj                  The object to add the patterns to
-* @param add_patterns_func    The function that adds a pattern to the object
+* @param id       The longest pattern matching (null_pattern_id for no match)
+* @param out      Where to put the matching patterns
+* @param max      The size of out
 *
-* @return     A dynamically allocated patterns tree generated from the patterns in the dictionary files
+* @return         The number of patterns put in out (at most max)
 */
-PatternsTree* patterns_tree_build(Conf* conf,
-                                  void* obj,
-                                  void (*add_pattern_func)(void*, char*, size_t, pattern_id_t)) {
-	FullPatternsTree* full_tree = fpt_build(conf);
-	PatternsTree* tree = convert_fpt_to_patterns_tree(full_tree, obj, add_pattern_func);
-	fpt_free(full_tree);
+size_t patterns_tree_collect(pattern_id_t id, pattern_id_t* out, size_t max) {
+	PatternsTreeNode* nodes;
+	size_t n = 0;
+	if (id == null_pattern_id) return 0;
+	nodes = id - id->index;
+	while (n < max && id->parent != PATTERNS_TREE_NO_PARENT) {
+		out[n++] = id;
+		id = &nodes[id->parent];
+	}
+	return n;
 }
 
 /**
-* Return whether the first pattern is suffix of the second one
+* Add a pattern to the end of a patterns list (the pattern is copied)
 *
-* @param first       The pattern to check if it is suffix of the ohter
-* @param second      The pattern to check if it contains the other as a suffix
+* @param list          The list
+* @param pat           The pattern
+* @param len           The length of the pattern
+* @param internal_id   The internal id of the pattern
+* @param id            The id of the pattern
+*/
+void patterns_list_add(PatternsList* list, const char* pat, size_t len, PatternInternalID internal_id, pattern_id_t id) {
+	if (list->n == list->capacity) {
+		list->capacity = list->capacity ? 2 * list->capacity : 1024;
+		list->offsets = (size_t*)realloc(list->offsets, list->capacity * sizeof(size_t));
+		list->lens = (size_t*)realloc(list->lens, list->capacity * sizeof(size_t));
+		list->internal_ids = (PatternInternalID*)realloc(list->internal_ids, list->capacity * sizeof(PatternInternalID));
+		list->ids = (pattern_id_t*)realloc(list->ids, list->capacity * sizeof(pattern_id_t));
+	}
+	while (list->data_size + len > list->data_capacity) {
+		list->data_capacity = list->data_capacity ? 2 * list->data_capacity : 64 * 1024;
+		list->data = (char*)realloc(list->data, list->data_capacity);
+	}
+	if (list->offsets == NULL || list->lens == NULL || list->internal_ids == NULL || list->ids == NULL ||
+	    list->data == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	list->offsets[list->n] = list->data_size;
+	list->lens[list->n] = len;
+	list->internal_ids[list->n] = internal_id;
+	list->ids[list->n++] = id;
+	memcpy(list->data + list->data_size, pat, len);
+	list->data_size += len;
+}
+
+/**
+* Free the memory of a patterns list (the list is empty after that)
 *
-* @return            1 if the first is suffix of the second, 0 otherwise
+* @param list     The list
 */
-int is_pattern_suffix(pattern_id_t first, pattern_id_t second) {
-	PatternsTreeNode* suf = first;
-	PatternsTreeNode* cur = second;
-	if (suf == NULL) return 0;
-	while (cur != NULL) {
-		if (cur == suf) return 1;
-		cur = cur->parent;
-	}
-	return 0;
+void patterns_list_free(PatternsList* list) {
+	free(list->data);
+	free(list->offsets);
+	free(list->lens);
+	free(list->internal_ids);
+	free(list->ids);
+	memset(list, 0, sizeof(PatternsList));
 }
 
 /**
@@ -499,37 +725,18 @@ int is_pattern_suffix(pattern_id_t first, pattern_id_t second) {
 * @param tree       The tree to free
 */
 void patterns_tree_free(PatternsTree* tree) {
-	patterns_tree_free_node(tree->root);
+	free(tree->root);
 	free(tree);
 }
 
 // ==============================================================
 // ==================== FOT TESTING =============================
 // ==============================================================
-void print_fpt_node(FptNode* node, int indent) {
-	FptEdge* cur;
-	int i;
-	for (cur = node->edge_list; cur; cur = cur->next) {
-		for (i = 0; i < indent; ++i) printf(" ");
-		printf(":"); print_binary_str(cur->text, cur->len); printf("\n");
-		print_fpt_node(cur->node, indent + 2);
-	}
-}
-
-void print_fpt(FullPatternsTree* full_tree) {
-	print_fpt_node(full_tree->root, 0);
-}
-
-void print_patterns_tree_node(PatternsTreeNode* node, int indent) {
-	PatternsTreeEdge* edge;
-	int i;
-	for (i = 0; i < indent; ++i) printf(" ");
-	printf(":file = %lu:line = %lu:\n", node->pattern_id.file_number, node->pattern_id.line_number);
-	for (edge = node->edge_list; edge; edge = edge->next) {
-		print_patterns_tree_node(edge->node, indent + 2);
+void print_patterns_tree(PatternsTree* tree) {
+	size_t i;
+	int j;
+	for (i = 0; i < tree->n_nodes; ++i) {
+		for (j = 0; j < 2 * (int)tree->root[i].depth; ++j) printf(" ");
+		printf(":file = %lu:line = %lu:\n", tree->root[i].pattern_id.file_number, tree->root[i].pattern_id.line_number);
 	}
 }
-
-void print_patterns_tree(PatternsTree* tree) {
-	print_patterns_tree_node(tree->root, 0);
-}
\ No newline at end of file
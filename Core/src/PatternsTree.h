@@ -10,6 +10,7 @@
 #define _GNU_SOURCE
 #include "parser.h"
 #include "util.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -27,76 +28,32 @@ typedef struct {
 	size_t line_number;
 } PatternInternalID;
 
-//====================== Fpt = Full Patterns Tree ======================
-struct fpt_node;
-
-/**
-* Struct for holding a list of childs of a node
-*/
-typedef struct fpt_edge {
-	struct fpt_node  *node;
-	struct fpt_edge  *next;
-	struct fpt_edge  *prev;
-	/**
-	* The "text" member is the prefix of the child pattern until the parent pattern
-	* e.g. if the parent pattern is "de", and the child pattern is "abcde",
-	* then the "text" member in the corresponding edge is "abc".
-	* 
-	* In that way, by moving from the root to some node through some edges,
-	* then by adding each "text" member in each edge, as a prefix of the total text,
-	* we get the pattern of the node.
-	* e.g. if the patterns are "abcdef", "cdef", "ef",
-	* then we have: root ---parent of---> "ef" ---parent of---> "cdef" ---parent of---> "abcdef",
-	* with edges:   root -----"ef"------> "ef" -----"cd"------> "cdef" -----"ab"------> "abcdef"
-	* so from the root to "abcdef" we have the edges "ef","cd","ab" (which construct "abcdef").
-	*/
-	char             *text;
-	size_t            len; // the length of text member
-} FptEdge;
-
-/**
-* Struct for a node in the full patterns tree
-*/
-typedef struct fpt_node {
-	struct fpt_node   *parent;
-	PatternInternalID  pattern_id;
-	FptEdge*           edge_list;
-} FptNode;
-
-/**
-* Struct for the full patterns tree
-*/
-typedef struct full_patterns_tree {
-	FptNode* root;
-	size_t longest_pat_len;
-} FullPatternsTree;
-
-
 //==========================  Patterns Tree =============================
 
-struct patterns_tree_node;
-
 /**
-* Struct for holding edge of a node in the Patterns Tree
-*/
-typedef struct patterns_tree_edge {
-	struct patterns_tree_edge* next;
-	struct patterns_tree_node* node;
-} PatternsTreeEdge;
-
-/**
-* Struct for partial patterns tree
+* A node of the patterns tree (a pattern, or the root)
+*
+* The nodes are kept in one array, in DFS order (the root is the first), so the subtree of a node
+* is the nodes from its index up to (not including) its end, and a pattern is a suffix of another
+* exactly when the other is in its subtree.
 */
 typedef struct patterns_tree_node {
-	struct patterns_tree_node  *parent;
-	PatternInternalID           pattern_id;
-	PatternsTreeEdge           *edge_list;
+	uint32_t           index;      // the index of the node in the nodes array (its DFS entry time)
+	uint32_t           end;        // the index after the last node in the subtree of the node (its DFS exit time)
+	uint32_t           parent;     // the index of the parent (PATTERNS_TREE_NO_PARENT for the root)
+	uint32_t           depth;      // the number of patterns from the node to the root (0 for the root)
+	size_t             len;        // the length of the pattern (0 for the root)
+	PatternInternalID  pattern_id;
 } PatternsTreeNode;
 
 typedef struct {
-	PatternsTreeNode* root;
+	PatternsTreeNode *root;    // the nodes array (the root is its first node)
+	size_t            n_nodes; // the number of nodes (including the root)
 } PatternsTree;
 
+// The parent index of the root
+#define PATTERNS_TREE_NO_PARENT ((uint32_t)-1)
+
 /**
 * pattern_id_t should be primitive type (eg. int or pointer)
 * so it can be copied by '=' and compared by '=='
@@ -105,6 +62,30 @@ typedef PatternsTreeNode* pattern_id_t;
 
 #define null_pattern_id NULL
 
+// The parent index of a pattern which is a child of the root (for patterns_tree_build_from_parents)
+#define PATTERNS_TREE_ROOT_PARENT ((size_t)-1)
+
+/**
+* A list of patterns (e.g. all the patterns of the dictionaries, by their order there)
+*
+* Every pattern has its internal id, and its id (its node in the patterns tree built from the list, see
+* patterns_tree_build_from_list). A list should be initialized to zeros before use.
+*/
+typedef struct {
+	char               *data;          // the patterns one after another
+	size_t              data_size;
+	size_t              data_capacity;
+	size_t             *offsets;       // the offset of every pattern in data
+	size_t             *lens;          // the length of every pattern
+	PatternInternalID  *internal_ids;  // the internal id of every pattern
+	pattern_id_t       *ids;           // the id of every pattern (null_pattern_id if it is the same as an earlier one)
+	size_t              n;
+	size_t              capacity;
+} PatternsList;
+
+// The i-th pattern of a patterns list
+#define patterns_list_get(list, i) ((list)->data + (list)->offsets[(i)])
+
 
 /******************************************************************************
 *		API FUNCTIONS
@@ -115,10 +96,19 @@ PatternsTree* patterns_tree_build(struct _Conf* conf,
                                   void* obj,
                                   void (*add_pattern_func)(void*, char*, size_t, pattern_id_t));
 
+PatternsTree* patterns_tree_build_from_parents(size_t n, const size_t* parents, const PatternInternalID* internal_ids,
+                                               const size_t* lens, pattern_id_t* ids);
+
+PatternsTree* patterns_tree_build_from_list(PatternsList* list);
+
 void patterns_tree_free(PatternsTree* tree);
 
-// return whether the first pattern is a suffix of the second
-int is_pattern_suffix(pattern_id_t first, pattern_id_t second);
+// enumerate all the patterns matching where the given pattern is the longest match (from the longest)
+void patterns_tree_for_each_match(pattern_id_t id, int (*cb)(pattern_id_t, void*), void* arg);
+size_t patterns_tree_collect(pattern_id_t id, pattern_id_t* out, size_t max);
+
+void patterns_list_add(PatternsList* list, const char* pat, size_t len, PatternInternalID internal_id, pattern_id_t id);
+void patterns_list_free(PatternsList* list);
 
 
 /******************************************************************************
@@ -126,6 +116,30 @@ int is_pattern_suffix(pattern_id_t first, pattern_id_t second);
 ******************************************************************************/
 
 
+/**
+* Get the parent of a pattern in the patterns tree (its longest suffix which is a pattern)
+*
+* @param id     The pattern
+*
+* @return       The parent of the pattern (the root if no pattern is its suffix), NULL for the root
+*/
+static inline pattern_id_t patterns_tree_parent(pattern_id_t id) {
+	if (id->parent == PATTERNS_TREE_NO_PARENT) return NULL;
+	return id - id->index + id->parent; // the root is at index 0 of the nodes array
+}
+
+/**
+* Return whether the first pattern is suffix of the second one (O(1), by the DFS intervals of the nodes)
+*
+* @param first       The pattern to check if it is suffix of the ohter
+* @param second      The pattern to check if it contains the other as a suffix
+*
+* @return            1 if the first is suffix of the second, 0 otherwise
+*/
+static inline int is_pattern_suffix(pattern_id_t first, pattern_id_t second) {
+	return first != NULL && second != NULL && first->index <= second->index && second->index < first->end;
+}
+
 static inline void print_pattern_id(pattern_id_t id) {
 	if (id == NULL) {
 		printf("<no pattern>");
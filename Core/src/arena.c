@@ -0,0 +1,182 @@
+/**
+* Arena (bump) allocator implementation
+*
+* Constructing the algorithms allocates a lot of small objects (tree nodes, queue nodes, list nodes...)
+* that are all freed together at the end of compilation, and the compiled tables are all freed together
+* with the object. Instead of calling malloc & free for every one of them, we allocate them one after
+* another from big blocks, and free only the blocks.
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "arena.h"
+#include "util.h"
+#include <stdint.h>
+#include <string.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+/**
+* A block of an arena (the data of the block is right after its header)
+*/
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t              size; // the size of the data of the block
+	size_t              used; // the number of bytes used from the data of the block
+} ArenaBlock;
+
+// The size of the block header (padded, so the data is aligned)
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)
+
+#define block_data(block) ((char*)(block) + ARENA_HEADER_SIZE)
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Allocate a new block for the arena
+*
+* @param arena    The arena
+* @param size     The size of the data of the block
+*
+* @return         The new block (not yet in the blocks list of the arena)
+*/
+static ArenaBlock* arena_new_block(Arena* arena, size_t size) {
+	ArenaBlock* block = (ArenaBlock*)malloc(ARENA_HEADER_SIZE + size);
+	if (block == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	block->size = size;
+	block->used = 0;
+	arena->total += ARENA_HEADER_SIZE + size;
+	return block;
+}
+
+/**
+* Try to allocate from a block
+*
+* @param block       The block
+* @param size        The size of the allocation
+* @param alignment   The alignment of the allocation
+*
+* @return            The allocated memory, or NULL if there is not enough place left in the block
+*/
+static void* arena_block_alloc(ArenaBlock* block, size_t size, size_t alignment) {
+	uintptr_t start = (uintptr_t)block_data(block) + block->used;
+	size_t pad = (alignment - start % alignment) % alignment;
+	if (pad + size > block->size - block->used) return NULL;
+	block->used += pad + size;
+	return (void*)(start + pad);
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Allocate memory from the arena, with given alignment
+*
+* @param arena       The arena
+* @param size        The size of the allocation
+* @param alignment   The alignment of the allocation (power of 2)
+*
+* @return            The allocated memory (exit on failure)
+*/
+void* arena_alloc_aligned(Arena* arena, size_t size, size_t alignment) {
+	ArenaBlock* block = arena->blocks;
+	size_t next_size;
+	void* ret;
+
+	if (alignment < ARENA_ALIGNMENT) alignment = ARENA_ALIGNMENT;
+	if (size == 0) size = 1;
+	if (block && (ret = arena_block_alloc(block, size, alignment))) {
+		return ret;
+	}
+	next_size = arena->block_size ? 2 * arena->block_size : ARENA_MIN_BLOCK_SIZE;
+	if (next_size > ARENA_MAX_BLOCK_SIZE) next_size = ARENA_MAX_BLOCK_SIZE;
+	if (size + alignment - ARENA_ALIGNMENT > next_size / 2) {
+		// big allocation gets its own block (after the current block, so we continue to allocate from that block)
+		block = arena_new_block(arena, size + alignment - ARENA_ALIGNMENT);
+		if (arena->blocks) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			block->next = NULL;
+			arena->blocks = block;
+		}
+	} else {
+		block = arena_new_block(arena, next_size);
+		arena->block_size = next_size;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+	return arena_block_alloc(block, size, alignment);
+}
+
+/**
+* Allocate memory from the arena
+*
+* @param arena       The arena
+* @param size        The size of the allocation
+*
+* @return            The allocated memory, aligned to ARENA_ALIGNMENT (exit on failure)
+*/
+void* arena_alloc(Arena* arena, size_t size) {
+	return arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+}
+
+/**
+* Allocate memory filled with zeros from the arena
+*
+* @param arena       The arena
+* @param size        The size of the allocation
+*
+* @return            The allocated memory, aligned to ARENA_ALIGNMENT (exit on failure)
+*/
+void* arena_calloc(Arena* arena, size_t size) {
+	void* ret = arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+	memset(ret, 0, size);
+	return ret;
+}
+
+/**
+* Get the total memory the arena took from the heap
+*
+* @param arena       The arena
+*
+* @return            The total size of the blocks of the arena (including their headers)
+*/
+size_t arena_total_mem(Arena* arena) {
+	return arena->total;
+}
+
+/**
+* Free all the memory allocated from the arena (the arena can be used again after that)
+*
+* @param arena       The arena
+*/
+void arena_free(Arena* arena) {
+	ArenaBlock *block = arena->blocks, *next;
+	while (block) {
+		next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+	arena->block_size = 0;
+	arena->total = 0;
+}
@@ -0,0 +1,63 @@
+/**
+* Arena (bump) allocator
+*/
+#ifndef ARENA_H
+#define ARENA_H
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include <stddef.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+// The alignment of every allocation from an arena
+#define ARENA_ALIGNMENT 16
+
+// The size of the first block of an arena (every new block is twice the size of the previous one, up to the max)
+#define ARENA_MIN_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (4 * 1024 * 1024)
+
+struct arena_block;
+
+/**
+* An arena, from which many objects are allocated and then freed together with arena_free
+*
+* The objects are allocated one after another in big blocks (so allocating is just moving a pointer forward),
+* and an allocation bigger than half a block gets a block of its own (of exactly its size).
+*
+* The algorithms use two arenas (with different lifetimes):
+*   - a build arena, for everything used only until compilation (freed at the end of compilation)
+*   - a persistent arena, for the compiled tables (freed with the object), so the memory of the tables
+*     is exactly arena_total_mem of that arena
+*
+* An arena should be initialized to zeros (e.g. by memset of its containing struct, or ARENA_INIT) before use.
+*/
+typedef struct {
+	struct arena_block *blocks;     // the blocks of the arena (the first is the one we allocate from)
+	size_t              block_size; // the size of the last regular block
+	size_t              total;      // the total memory taken from the heap for the arena
+} Arena;
+
+#define ARENA_INIT {NULL, 0, 0}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t size);
+void* arena_alloc_aligned(Arena* arena, size_t size, size_t alignment);
+size_t arena_total_mem(Arena* arena);
+void arena_free(Arena* arena);
+
+#endif /* ARENA_H */
@@ -170,8 +170,6 @@ static size_t _bgps_find_period_continue(char* pattern, size_t all, size_t n, si
 *   kmp_period
 *   kmp_remaining
 *   n_kmp_period
-*   current_n_kmp_period
-*   last_kmp_period_match_pos
 *
 * @param bg       The bg struct we work on
 * @param pattern  The pattern of the bg struct
@@ -190,8 +188,6 @@ static void _bgps_init_kmp(BGStruct* bg, char* pattern) {
 	} else {
 		bg->kmp_remaining = NULL;
 	}
-	bg->current_n_kmp_period = 0;
-	bg->last_kmp_period_match_pos = 0;
 }
 
 /**
@@ -201,7 +197,6 @@ static void _bgps_init_kmp(BGStruct* bg, char* pattern) {
 *   logn
 *   first_stage
 *   r
-*   p
 *   flags
 *
 * Initialize:
@@ -217,8 +212,8 @@ static void _bgps_init_fps(BGStruct* bg, char* pattern) {
 	bg->fps = (fingerprint_t*) malloc ((N_STAGES(bg) + 1) * sizeof(fingerprint_t));
 	FieldVal rn;
 	size_t first_stage = bg->first_stage, logn = bg->logn;
-	bg->fps[0] = calc_fp(pattern, stage_to_len(bg, 0), &rn, &bg->r, bg->p);
-	field_div(&bg->first_stage_r, &rn, &bg->r, bg->p); // now, first_stage_r == r^(2^first_stage - 1)
+	bg->fps[0] = calc_fp(pattern, stage_to_len(bg, 0), &rn, &bg->r);
+	field_div(&bg->first_stage_r, &rn, &bg->r); // now, first_stage_r == r^(2^first_stage - 1)
 	int i = first_stage + 1;
 	for (; i < logn; ++i) {
 		bg->fps[i - first_stage] = calc_fp_with_prefix(
@@ -227,8 +222,7 @@ static void _bgps_init_fps(BGStruct* bg, char* pattern) {
 			bg->fps[i - first_stage - 1],
 			1 << (i - 1),
 			&rn,
-			&bg->r,
-			bg->p
+			&bg->r
 			);
 	}
 	if (first_stage != logn) {
@@ -239,8 +233,7 @@ static void _bgps_init_fps(BGStruct* bg, char* pattern) {
 			bg->fps[i - first_stage - 1],
 			1 << (i - 1),
 			&rn,
-			&bg->r,
-			bg->p
+			&bg->r
 		);
 		if (bg->n - (1 << (i - 1)) < logn) {
 			bg->flags |= BG_NEED_BEFORE_LAST_STAGE_FLAG;
@@ -254,6 +247,7 @@ static void _bgps_init_fps(BGStruct* bg, char* pattern) {
 * Also update the flags for having last stage(s) if necessary
 *
 * @param bg       The bg struct
+* @param state    The state of the stream
 * @param stage    The stage number (index in vos)
 * @param pos      The position of the VO we want to add (first character of the VO)
 * @param fp       The fingerprint of the all stream until pos NOT INCLUDE pos (i.e. fp(stream[0..pos-1]) )
@@ -262,23 +256,22 @@ static void _bgps_init_fps(BGStruct* bg, char* pattern) {
 * @return       0 - failed
 *               1 - succeed
 */
-static int _bgps_add_vo(BGStruct* bg, size_t stage, pos_t pos, fingerprint_t fp, FieldVal* rn) {
-	VOLinearProgression* vos = &bg->vos[stage];
-	field_t p = bg->p;
+static int _bgps_add_vo(BGStruct* bg, BGState* state, size_t stage, pos_t pos, fingerprint_t fp, FieldVal* rn) {
+	VOLinearProgression* vos = &state->vos[stage];
 	if (vos->n == 0) {
 		vos->first.pos = pos;
 		vos->first.fp = fp;
 		field_copy(&vos->first.r, rn);
 		vos->n = 1;
 		if (stage == bg->logn) {
-			bg->flags |= BG_HAVE_LAST_STAGE_FLAG;
+			state->flags |= BG_HAVE_LAST_STAGE_FLAG;
 		} else if (bg->flags & BG_NEED_BEFORE_LAST_STAGE_FLAG && stage == bg->logn - 1) {
-			bg->flags |= BG_HAVE_BEFORE_LAST_STAGE_FLAG;
+			state->flags |= BG_HAVE_BEFORE_LAST_STAGE_FLAG;
 		}
 	} else if (vos->n == 1) {
 		vos->step.pos = pos - vos->first.pos;
-		vos->step.fp = calc_fp_suffix(fp, vos->first.fp, &vos->first.r, p);
-		field_div(&vos->step.r, rn, &vos->first.r, p);
+		vos->step.fp = calc_fp_suffix(fp, vos->first.fp, &vos->first.r);
+		field_div(&vos->step.r, rn, &vos->first.r);
 		vos->n = 2;
 	} else {
 		if (vos->first.pos + (vos->n + 1) * vos->step.pos != pos) {
@@ -296,24 +289,24 @@ static int _bgps_add_vo(BGStruct* bg, size_t stage, pos_t pos, fingerprint_t fp,
 * Also update the flags for having last stage(s) if necessary
 *
 * @param bg     The bg struct
+* @param state  The state of the stream
 * @param stage  The stage number (index in vos)
 */
-static void _bgps_remove_first_vo(BGStruct* bg, size_t stage) {
-	VOLinearProgression* vos = &bg->vos[stage];
-	field_t p = bg->p;
+static void _bgps_remove_first_vo(BGStruct* bg, BGState* state, size_t stage) {
+	VOLinearProgression* vos = &state->vos[stage];
 	if (vos->n == 0) {
 		return;
 	} else if (vos->n == 1) {
 		vos->n = 0;
 		if (stage == bg->logn) {
-			bg->flags &= ~BG_HAVE_LAST_STAGE_FLAG;
+			state->flags &= ~BG_HAVE_LAST_STAGE_FLAG;
 		} else if (stage == bg->logn - 1) {
-			bg->flags &= ~BG_HAVE_BEFORE_LAST_STAGE_FLAG;
+			state->flags &= ~BG_HAVE_BEFORE_LAST_STAGE_FLAG;
 		}
 	} else {
 		vos->first.pos += vos->step.pos;
-		vos->first.fp = calc_fp_from_prefix_suffix(vos->first.fp, vos->step.fp, &vos->step.r, p);
-		field_mul(&vos->first.r, &vos->first.r, &vos->step.r, p);
+		vos->first.fp = calc_fp_from_prefix_suffix(vos->first.fp, vos->step.fp, &vos->step.r);
+		field_mul(&vos->first.r, &vos->first.r, &vos->step.r);
 		vos->n--;
 	}
 }
@@ -329,37 +322,38 @@ static void _bgps_remove_first_vo(BGStruct* bg, size_t stage) {
 *   - The VO is linear progression with the other VOs in stage stage_num+1.
 *
 * @param bg          The bg struct
+* @param state       The state of the stream
 * @param stage_num   The stage number as indexed in vos & fps (real stage is first_stage + parameter)
 *
 * @return            1 if there was an upgrade, 0 otherwise
 */
-static int _bgps_vo_stage_upgrade(BGStruct* bg, size_t stage_num) {
+static int _bgps_vo_stage_upgrade(BGStruct* bg, BGState* state, size_t stage_num) {
 	int ret = 0;
-	VOLinearProgression* vos = &bg->vos[stage_num];
+	VOLinearProgression* vos = &state->vos[stage_num];
 	if (vos->n == 0) {
 		return 0;
 	}
 	// end_pos is the position of the last character of the pattern of next stage starting at the first VO.
 	pos_t end_pos = vos->first.pos + stage_to_len(bg, stage_num + 1);
-	if (bg->current_pos < end_pos || bg->current_pos >= end_pos + bg->logn) {
+	if (state->current_pos < end_pos || state->current_pos >= end_pos + bg->logn) {
 		return 0; // We not yet need to upgrade the first VO
 	}
 	// check if fingerprint match the pattern:
-	fingerprint_t check_fp = calc_fp_suffix(bg->last_fps[end_pos % bg->logn], vos->first.fp, &vos->first.r, bg->p);
+	fingerprint_t check_fp = calc_fp_suffix(state->last_fps[end_pos % bg->logn], vos->first.fp, &vos->first.r);
 	if (check_fp == bg->fps[stage_num + 1]) {
 		if (stage_num == N_STAGES(bg) - 1) {
 			// Last stage dont have next stage
 			ret = 1;
-		} else if (!_bgps_add_vo(bg, stage_num + 1, vos->first.pos, vos->first.fp, &vos->first.r)) {
+		} else if (!_bgps_add_vo(bg, state, stage_num + 1, vos->first.pos, vos->first.fp, &vos->first.r)) {
 			// There is a fingerprint collision, just wipe out the vos in that stage
-			bg->vos[stage_num + 1].n = 0;
+			state->vos[stage_num + 1].n = 0;
 			//fprintf(stderr, "fingerprint collision, at position %llu, wiping out the stage\n", vos->first.pos);
 		} else {
 			ret = 1;
 		}
 	}
 	// remove the first VO from VOs:
-	_bgps_remove_first_vo(bg, stage_num);
+	_bgps_remove_first_vo(bg, state, stage_num);
 	return ret;
 }
 
@@ -367,45 +361,45 @@ static int _bgps_vo_stage_upgrade(BGStruct* bg, size_t stage_num) {
 * Check the last (and maybe before last) stage(s), because they need to be checked every char.
 *
 * @param bg   The bg struct
+* @param stateThe state of the stream
 *
 * @return     Whether the last stage match.
 */
-static int _bgps_check_last_stages(BGStruct* bg) {
-	if (bg->flags & BG_HAVE_BEFORE_LAST_STAGE_FLAG) {
-		_bgps_vo_stage_upgrade(bg, N_STAGES(bg) - 2);
+static int _bgps_check_last_stages(BGStruct* bg, BGState* state) {
+	if (state->flags & BG_HAVE_BEFORE_LAST_STAGE_FLAG) {
+		_bgps_vo_stage_upgrade(bg, state, N_STAGES(bg) - 2);
 	}
-	if (bg->flags & BG_HAVE_LAST_STAGE_FLAG) {
-		return _bgps_vo_stage_upgrade(bg, N_STAGES(bg) - 1);
+	if (state->flags & BG_HAVE_LAST_STAGE_FLAG) {
+		return _bgps_vo_stage_upgrade(bg, state, N_STAGES(bg) - 1);
 	}
 	return 0;
 }
 
 /**
-* Check whether we have a match of the first stage.
+* Check whether we have a match of the first stage, after the kmp objects of the first stage read the char.
 *
-* @param bg       The bg struct
-* @param c        The char just read
+* @param bg                    The bg struct
+* @param state                 The state of the stream
+* @param kmp_period_match      Whether kmp_period matched on the char
+* @param kmp_remaining_match   Whether kmp_remaining matched on the char (1 if there is no kmp_remaining)
 *
 * @return         Whether the first stage has a match
 */
-static int _bgps_check_first_stage(BGStruct* bg, char c) {
-	// In any case, we need to give c to kmp_period (and kmp_remaining if exist)	
-	int kmp_period_match = kmp_read_char(bg->kmp_period, c);
+static inline int _bgps_first_stage_match(BGStruct* bg, BGState* state, int kmp_period_match, int kmp_remaining_match) {
 	size_t period_len = kmp_get_pattern_len(bg->kmp_period);
-	int kmp_remaining_match = bg->kmp_remaining ? kmp_read_char(bg->kmp_remaining, c) : 1;
 	size_t remaining_len = bg->kmp_remaining ? kmp_get_pattern_len(bg->kmp_remaining) : 0;
 
 	if (kmp_period_match) { // if there was a match in kmp_period
-		if (bg->last_kmp_period_match_pos + period_len == bg->current_pos) {
-			bg->current_n_kmp_period++;
+		if (state->last_kmp_period_match_pos + period_len == state->current_pos) {
+			state->current_n_kmp_period++;
 		} else {
-			bg->current_n_kmp_period = 1;
+			state->current_n_kmp_period = 1;
 		}
-		bg->last_kmp_period_match_pos = bg->current_pos;
+		state->last_kmp_period_match_pos = state->current_pos;
 	} else {
-		if (bg->last_kmp_period_match_pos + period_len <= bg->current_pos) {
+		if (state->last_kmp_period_match_pos + period_len <= state->current_pos) {
 			// We passed the position in which the next match should occur
-			bg->current_n_kmp_period = 0;
+			state->current_n_kmp_period = 0;
 		}
 	}	
 	/**
@@ -415,24 +409,66 @@ static int _bgps_check_first_stage(BGStruct* bg, char c) {
 	* 3. The position of the last period match + the remaining length is the current position
 	*/
 	if (kmp_remaining_match
-	    && bg->current_n_kmp_period >= bg->n_kmp_period
-	    && bg->last_kmp_period_match_pos + remaining_len == bg->current_pos) {
+	    && state->current_n_kmp_period >= bg->n_kmp_period
+	    && state->last_kmp_period_match_pos + remaining_len == state->current_pos) {
 		return 1;
 	}
 	return 0;
 }
 
+/**
+* Check whether we have a match of the first stage.
+*
+* @param bg       The bg struct
+* @param state    The state of the stream
+* @param c        The char just read
+*
+* @return         Whether the first stage has a match
+*/
+static inline int _bgps_check_first_stage(BGStruct* bg, BGState* state, char c) {
+	// In any case, we need to give c to kmp_period (and kmp_remaining if exist)
+	int kmp_period_match = kmp_read_char(bg->kmp_period, state->kmp_period, c);
+	int kmp_remaining_match = bg->kmp_remaining ? kmp_read_char(bg->kmp_remaining, state->kmp_remaining, c) : 1;
+	return _bgps_first_stage_match(bg, state, kmp_period_match, kmp_remaining_match);
+}
+
+#ifdef BG_LAZY_INVERSE
+/**
+* Compute current_r.inv (r^-current_pos) from r^-inv_pos, by multiplying it by r^-(current_pos - inv_pos)
+* (with square and multiply of r^-1, so it is O(log) multiplications of the distance since the last time)
+*
+* @param bg       The bg struct
+* @param state    The state of the stream
+*/
+static void _bgps_update_inverse(BGStruct* bg, BGState* state) {
+	pos_t distance = state->current_pos - state->inv_pos;
+	field_t power = bg->r.inv, inv = state->current_r.inv;
+	for (; distance; distance >>= 1) {
+		if (distance & 1) {
+			inv = field_mod_mul(inv, power);
+		}
+		power = field_mod_mul(power, power);
+	}
+	state->current_r.inv = inv;
+	state->inv_pos = state->current_pos;
+}
+#endif
+
 /**
 * Add the current position as the end of a new VO to the first stage
 *
 * @param bg       The bg struct
+* @param state    The state of the stream
 */
-static void _bg_add_to_first_stage(BGStruct* bg) {
+static void _bg_add_to_first_stage(BGStruct* bg, BGState* state) {
 	FieldVal vo_r;
-	pos_t vo_pos = bg->current_pos - stage_to_len(bg, 0) + 1;
-	field_div(&vo_r, &bg->current_r, &bg->first_stage_r, bg->p);
-	fingerprint_t vo_fp = calc_fp_prefix(bg->current_fp, bg->fps[0], &vo_r, bg->p);
-	if (!_bgps_add_vo(bg, 0, vo_pos, vo_fp, &vo_r)) {
+	pos_t vo_pos = state->current_pos - stage_to_len(bg, 0) + 1;
+#ifdef BG_LAZY_INVERSE
+	_bgps_update_inverse(bg, state);
+#endif
+	field_div(&vo_r, &state->current_r, &bg->first_stage_r);
+	fingerprint_t vo_fp = calc_fp_prefix(state->current_fp, bg->fps[0], &vo_r);
+	if (!_bgps_add_vo(bg, state, 0, vo_pos, vo_fp, &vo_r)) {
 		// fingerprint collision, just ignore the new vo (possible option is to wipe out first stage)
 		//fprintf(stderr, "fingerprint collision, at position %llu\n", vo_pos);
 	}
@@ -447,12 +483,14 @@ static void _bg_add_to_first_stage(BGStruct* bg) {
 /**
 * Create new BGStruct accoring to a specific pattern
 *
+* The BGStruct is never changed while reading, the state of every stream is in a BGState (see bg_state_init)
+*
 * @param pattern  The pattern to search
 * @param n        The pattern length
 *
 * @return         Dynamically allocated BGStruct to use on stream
 */
-BGStruct* bg_new(char* pattern, size_t n, field_t p) {
+BGStruct* bg_new(char* pattern, size_t n) {
 	BGStruct* bg = (BGStruct*) malloc (sizeof(BGStruct));
 	memset(bg, 0, sizeof(BGStruct));
 	bg->n = n;
@@ -465,29 +503,16 @@ BGStruct* bg_new(char* pattern, size_t n, field_t p) {
 	bg->logn = bg_log2(n, 1);
 	bg->loglogn = bg_log2(bg->logn, 1) + 1;
 	_bgps_init_kmp(bg, pattern);
-	bg->p = p;
 	srand(time(NULL));
-	field_t r;
-	do {
-		r = rand() % p;
-	} while (r <= 1);
-	bg->r.val = r;
-	bg->r.inv = calculate_inverse(r, p);
+	bg->r.val = field_random();
+	bg->r.inv = calculate_inverse(bg->r.val, FIELD_P);
 
 	_bgps_init_fps(bg, pattern);
-	bg->last_fps = (fingerprint_t*) malloc (bg->logn * sizeof(fingerprint_t));
-	bg->vos = (VOLinearProgression*) malloc (N_STAGES(bg) * sizeof(VOLinearProgression));	
-	memset(bg->vos, 0, N_STAGES(bg) * sizeof(VOLinearProgression));
-	bg->current_fp = 0;
-	bg->current_r.val = 1;
-	bg->current_r.inv = 1;
-	bg->current_pos = 0;
-	bg->current_stage = 0;
 	return bg;
 }
 
 /**
-* Return the total memory used for this struct
+* Return the total memory used for this struct (without the states of the streams)
 *
 * @param bg       The bg struct
 *
@@ -500,72 +525,193 @@ size_t bg_get_total_mem(BGStruct* bg) {
 	}
 	return sizeof(BGStruct) +                              // for the struct itself
 	       (N_STAGES(bg) + 1) * sizeof(fingerprint_t) +    // for fps member
-	       N_STAGES(bg) * sizeof(VOLinearProgression) +    // for vos member
-	       bg->logn * sizeof(fingerprint_t) +              // for last_fps member
 	       kmp_get_total_mem(bg->kmp_period) +             // for kmp_period member
 	       kmp_get_total_mem(bg->kmp_remaining);           // for kmp_remaining member
 }
 
 /**
-* Reset the bg to the initial state
+* Get the size of the memory needed for a state of a stream
+*
+* The state is laid out in one block: the BGState struct, the vos, the last fingerprints,
+* and the states of the kmp structs.
+*
+* @param bg       The bg struct
 *
-* @param bg    The bg struct to reset
+* @return         The size in bytes (a multiple of STATE_ALIGNMENT)
 */
-void bg_reset(BGStruct* bg) {
+size_t bg_state_size(BGStruct* bg) {
+	size_t size = STATE_ALIGN(sizeof(BGState)) + kmp_state_size(bg->kmp_period);
 	if (bg->flags & BG_SHORT_PATTERN_FLAG) {
-		kmp_reset(bg->kmp_period);
+		return size;
+	}
+	return size +
+	       STATE_ALIGN(N_STAGES(bg) * sizeof(VOLinearProgression)) +    // for vos member
+	       STATE_ALIGN(bg->logn * sizeof(fingerprint_t)) +              // for last_fps member
+	       kmp_state_size(bg->kmp_remaining);                           // for kmp_remaining member
+}
+
+/**
+* Initialize a state of a stream in the given memory, in the initial state
+*
+* @param bg       The bg struct
+* @param mem      Memory of bg_state_size(bg) bytes (aligned to STATE_ALIGNMENT)
+*
+* @return         The state (at the start of mem)
+*/
+BGState* bg_state_init(BGStruct* bg, void* mem) {
+	char* cur = (char*)mem;
+	BGState* state = (BGState*)cur;
+	cur += STATE_ALIGN(sizeof(BGState));
+	state->vos = NULL;
+	state->last_fps = NULL;
+	state->kmp_remaining = NULL;
+	state->kmp_period = kmp_state_init(bg->kmp_period, cur);
+	cur += kmp_state_size(bg->kmp_period);
+	if (!(bg->flags & BG_SHORT_PATTERN_FLAG)) {
+		state->vos = (VOLinearProgression*)cur;
+		cur += STATE_ALIGN(N_STAGES(bg) * sizeof(VOLinearProgression));
+		state->last_fps = (fingerprint_t*)cur;
+		cur += STATE_ALIGN(bg->logn * sizeof(fingerprint_t));
+		if (bg->kmp_remaining) {
+			state->kmp_remaining = kmp_state_init(bg->kmp_remaining, cur);
+		}
+	}
+	bg_reset(bg, state);
+	return state;
+}
+
+/**
+* Copy a state of a stream to the given memory (e.g. when the states of a context are moved)
+*
+* The state is one block, so the copy is the same block, with the pointers moved into the new memory.
+*
+* @param bg       The bg struct
+* @param mem      Memory of bg_state_size(bg) bytes (aligned to STATE_ALIGNMENT)
+* @param from     The state to copy
+*
+* @return         The copy (at the start of mem), in the same state as from
+*/
+BGState* bg_state_copy(BGStruct* bg, void* mem, BGState* from) {
+	char* cur = (char*)mem;
+	BGState* state = (BGState*)cur;
+	memcpy(mem, from, bg_state_size(bg));
+	cur += STATE_ALIGN(sizeof(BGState));
+	state->kmp_period = kmp_state_copy(bg->kmp_period, cur, from->kmp_period);
+	cur += kmp_state_size(bg->kmp_period);
+	if (!(bg->flags & BG_SHORT_PATTERN_FLAG)) {
+		state->vos = (VOLinearProgression*)cur;
+		cur += STATE_ALIGN(N_STAGES(bg) * sizeof(VOLinearProgression));
+		state->last_fps = (fingerprint_t*)cur;
+		cur += STATE_ALIGN(bg->logn * sizeof(fingerprint_t));
+		if (bg->kmp_remaining) {
+			state->kmp_remaining = kmp_state_copy(bg->kmp_remaining, cur, from->kmp_remaining);
+		}
+	}
+	return state;
+}
+
+/**
+* Reset a state of a stream to the initial state
+*
+* @param bg       The bg struct
+* @param state    The state to reset
+*/
+void bg_reset(BGStruct* bg, BGState* state) {
+	state->flags = 0;
+	if (bg->flags & BG_SHORT_PATTERN_FLAG) {
+		kmp_reset(bg->kmp_period, state->kmp_period);
 		return;
 	}
-	bg->current_r.val = 1;
-	bg->current_r.inv = 1;
-	bg->current_pos = 0;
-	bg->current_fp = 0;
-	bg->current_stage = 0;
-	bg->last_kmp_period_match_pos = 0;
-	bg->current_n_kmp_period = 0;
-	memset(bg->vos, 0, N_STAGES(bg) * sizeof(VOLinearProgression));
-	kmp_reset(bg->kmp_period);
-	kmp_reset(bg->kmp_remaining);
-	bg->flags &= ~BG_HAVE_LAST_STAGE_FLAG & ~BG_HAVE_BEFORE_LAST_STAGE_FLAG;
+	state->current_r.val = 1;
+	state->current_r.inv = 1;
+#ifdef BG_LAZY_INVERSE
+	state->inv_pos = 0;
+#endif
+	state->current_pos = 0;
+	state->current_fp = 0;
+	state->current_stage = 0;
+	state->last_kmp_period_match_pos = 0;
+	state->current_n_kmp_period = 0;
+	memset(state->vos, 0, N_STAGES(bg) * sizeof(VOLinearProgression));
+	kmp_reset(bg->kmp_period, state->kmp_period);
+	kmp_reset(bg->kmp_remaining, state->kmp_remaining);
 }
 
 /**
-* Read char and return whether we have a match.
+* Read char (after the first stage was checked on it) and return whether we have a match.
 *
-* @param bg     The BGStruct of the pattern we want to search
-* @param c      The new character from the stream
+* @param bg                  The BGStruct of the pattern we want to search (not a short pattern)
+* @param state               The state of the stream
+* @param c                   The new character from the stream
+* @param first_stage_match   Whether the first stage has a match on c
 *
 * @return       1 if found pattern, 0 if not
 */
-int bg_read_char(BGStruct* bg, char c) {
-	if (bg->flags & BG_SHORT_PATTERN_FLAG) {
-		return kmp_read_char(bg->kmp_period, c);
-	} else if (N_STAGES(bg) == 0) {
-		return _bgps_check_first_stage(bg, c);
+static inline int _bgps_read_char(BGStruct* bg, BGState* state, char c, int first_stage_match) {
+	if (N_STAGES(bg) == 0) {
+		return first_stage_match;
 	}
 	int ret = 0;
-	bg->current_fp = calc_fp_from_prefix_suffix(bg->current_fp,
-	                                            (fingerprint_t)c,
-	                                            &bg->current_r,
-	                                            bg->p);
-	bg->last_fps[bg->current_pos % bg->logn] = bg->current_fp;
-	if (_bgps_check_first_stage(bg, c)) {
-		_bg_add_to_first_stage(bg);
+	state->current_fp = calc_fp_from_prefix_suffix(state->current_fp,
+	                                               field_from_char(c),
+	                                               &state->current_r);
+	state->last_fps[state->current_pos % bg->logn] = state->current_fp;
+	if (first_stage_match) {
+		_bg_add_to_first_stage(bg, state);
 	}
-	if (_bgps_check_last_stages(bg)) {
+	if (_bgps_check_last_stages(bg, state)) {
 		ret = 1;
 	}
 	if (N_STAGES(bg) > 1) {
 		// If there is only one stage, then it is already handled by last stage checking
 		// Worst that can happen, the before last stage is checked twice (which is fine)
-		_bgps_vo_stage_upgrade(bg, bg->current_stage);
-		MOD_DEC(bg->current_stage, N_STAGES(bg) - 1);
+		_bgps_vo_stage_upgrade(bg, state, state->current_stage);
+		MOD_DEC(state->current_stage, N_STAGES(bg) - 1);
 	}
-	field_mul(&bg->current_r, &bg->current_r, &bg->r, bg->p);
-	bg->current_pos++;
+#ifdef BG_LAZY_INVERSE
+	state->current_r.val = field_mod_mul(state->current_r.val, bg->r.val);
+#else
+	field_mul(&state->current_r, &state->current_r, &bg->r);
+#endif
+	state->current_pos++;
 	return ret;
 }
 
+/**
+* Read char and return whether we have a match.
+*
+* @param bg     The BGStruct of the pattern we want to search
+* @param state  The state of the stream
+* @param c      The new character from the stream
+*
+* @return       1 if found pattern, 0 if not
+*/
+int bg_read_char(BGStruct* bg, BGState* state, char c) {
+	if (bg->flags & BG_SHORT_PATTERN_FLAG) {
+		return kmp_read_char(bg->kmp_period, state->kmp_period, c);
+	}
+	return _bgps_read_char(bg, state, c, _bgps_check_first_stage(bg, state, c));
+}
+
+/**
+* Read char, when the kmp objects of the first stage already read it (e.g. in a KMPBank with the kmp objects of many
+* patterns, see "kmpbank.h"), and return whether we have a match.
+*
+* @param bg                    The BGStruct of the pattern we want to search
+* @param state                 The state of the stream (its kmp states already read c)
+* @param c                     The new character from the stream
+* @param kmp_period_match      Whether kmp_period matched on c
+* @param kmp_remaining_match   Whether kmp_remaining matched on c (1 if there is no kmp_remaining)
+*
+* @return       1 if found pattern, 0 if not
+*/
+int bg_read_char_after_kmp(BGStruct* bg, BGState* state, char c, int kmp_period_match, int kmp_remaining_match) {
+	if (bg->flags & BG_SHORT_PATTERN_FLAG) {
+		return kmp_period_match;
+	}
+	return _bgps_read_char(bg, state, c, _bgps_first_stage_match(bg, state, kmp_period_match, kmp_remaining_match));
+}
+
 /**
 * Free memory of BGStruct
 *
@@ -574,13 +720,69 @@ int bg_read_char(BGStruct* bg, char c) {
 void bg_free(BGStruct* bg) {
 	if (!bg) return;
 	if (bg->fps) free(bg->fps);
-	if (bg->vos) free(bg->vos);
-	if (bg->kmp_period) free(bg->kmp_period);
-	if (bg->kmp_remaining) free(bg->kmp_remaining);
-	if (bg->last_fps) free(bg->last_fps);
+	if (bg->kmp_period) kmp_free(bg->kmp_period);
+	if (bg->kmp_remaining) kmp_free(bg->kmp_remaining);
 	free(bg);
 }
 
+/**
+* Save the BGStruct to the cache file (its sizes, r, the fingerprints of the stages and the kmp structs)
+*
+* @param bg     The BGStruct
+* @param w      The cache writer
+*/
+void bg_save(BGStruct* bg, CacheWriter* w) {
+	uint64_t sizes[7] = {bg->n, bg->logn, bg->loglogn, bg->first_stage, bg->n_kmp_period, bg->flags,
+	                     bg->kmp_remaining != NULL};
+	cache_write(w, sizes, sizeof(sizes));
+	cache_write(w, &bg->r, sizeof(FieldVal));
+	cache_write(w, &bg->first_stage_r, sizeof(FieldVal));
+	if (!(bg->flags & BG_SHORT_PATTERN_FLAG)) {
+		cache_write(w, bg->fps, (N_STAGES(bg) + 1) * sizeof(fingerprint_t));
+	}
+	kmp_save(bg->kmp_period, w);
+	if (bg->kmp_remaining) kmp_save(bg->kmp_remaining, w);
+}
+
+/**
+* Load a BGStruct (saved with bg_save) from the cache file
+*
+* @param r      The cache reader
+*
+* @return       Dynamically allocated BGStruct (as bg_new would create, with the same r)
+*/
+BGStruct* bg_load(CacheReader* r) {
+	BGStruct* bg = (BGStruct*) malloc (sizeof(BGStruct));
+	uint64_t sizes[7];
+	size_t fps_size;
+	if (bg == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memset(bg, 0, sizeof(BGStruct));
+	memcpy(sizes, cache_read(r, sizeof(sizes)), sizeof(sizes));
+	bg->n = sizes[0];
+	bg->logn = sizes[1];
+	bg->loglogn = sizes[2];
+	bg->first_stage = sizes[3];
+	bg->n_kmp_period = (int)sizes[4];
+	bg->flags = (int)sizes[5];
+	memcpy(&bg->r, cache_read(r, sizeof(FieldVal)), sizeof(FieldVal));
+	memcpy(&bg->first_stage_r, cache_read(r, sizeof(FieldVal)), sizeof(FieldVal));
+	if (!(bg->flags & BG_SHORT_PATTERN_FLAG)) {
+		fps_size = (N_STAGES(bg) + 1) * sizeof(fingerprint_t);
+		bg->fps = (fingerprint_t*) malloc (fps_size);
+		if (bg->fps == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		memcpy(bg->fps, cache_read(r, fps_size), fps_size);
+	}
+	bg->kmp_period = kmp_load(r);
+	if (sizes[6]) bg->kmp_remaining = kmp_load(r);
+	return bg;
+}
+
 /*
 ================================= F O R     T E S T I N G ================================
 */
@@ -598,24 +800,24 @@ void print_BG(BGStruct* bg) {
 	if (bg->flags & BG_SHORT_PATTERN_FLAG) {
 		printf("BG is in short pattern mode\n");
 	} else {
-		printf("p = %llu, r = %llu, n = %d, first stage = %d\n", bg->p, bg->r.val, bg->n, bg->first_stage);
+		printf("p = %llu, r = %llu, n = %d, first stage = %d\n", FIELD_P, bg->r.val, bg->n, bg->first_stage);
 		printf("logn = %d, loglogn = %d, number of VO-stages = %d\n", bg->logn, bg->loglogn, N_STAGES(bg));
 		printf("kmp period length = %d, kmp remaining length = %d, number of periods = %d\n",
 			kmp_get_pattern_len(bg->kmp_period), kmp_get_pattern_len(bg->kmp_remaining), bg->n_kmp_period);
 	}
 }
 
-void print_BG_after_char(BGStruct* bg) {
+void print_BG_after_char(BGStruct* bg, BGState* state) {
 	if (bg->flags & BG_SHORT_PATTERN_FLAG) {
 		printf("BG is in short pattern mode\n");
 	} else {
 		printf("current position = %llu, r ^ current position = %llu, current fingerprint = %llu\n",
-			bg->current_pos, bg->current_r.val, bg->current_fp);
-		printf("current stage = %d, current flag = %d\n", bg->current_stage, bg->flags);
+			state->current_pos, state->current_r.val, state->current_fp);
+		printf("current stage = %d, current flag = %d\n", state->current_stage, state->flags);
 		printf("VOS:\n");
 		int i;
 		for (i = 0; i < N_STAGES(bg); ++i) {
-			print_VOS(&bg->vos[i], i);
+			print_VOS(&state->vos[i], i);
 		}
 	}
 }
@@ -625,11 +827,11 @@ void print_BG_after_char(BGStruct* bg) {
 int main() {
 	int i;
 	printf("\n\n");
-    field_t p = 101ul;
     //               0         1   
     //               01234567890123
     char* pattern = "ABCDABDABC";
-    BGStruct* bg = bg_new(pattern, strlen(pattern), p);
+    BGStruct* bg = bg_new(pattern, strlen(pattern));
+    BGState* state = bg_state_init(bg, malloc(bg_state_size(bg)));
     //            0         1         2         3         4
     //            012345678901234567890123456789012345678901234
     char* text = "ABCDABCDABDABCDABDABCDABBABCDABDABCDABDBADFSG";
@@ -644,12 +846,12 @@ int main() {
     print_BG(bg);
     for (i = 0; i < strlen(text); ++i) {
     	//printf("\n\non character number %d, char = %c:\n\n\n", i, text[i]);
-    	if (bg_read_char(bg, text[i])) {
+    	if (bg_read_char(bg, state, text[i])) {
     		printf("=======================================================================\n");
     		printf("======================== found match on index %d ======================\n", i);
     		printf("=======================================================================\n");
     	}
-    	//print_BG_after_char(bg);
+    	//print_BG_after_char(bg, state);
     }
 }
 */
\ No newline at end of file
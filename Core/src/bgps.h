@@ -27,14 +27,22 @@ typedef unsigned long long pos_t;
 * In order to solve this, whenever we have a VO in the last stage (and in 1-before-last in case that the length
 * difference between the last and 1-before-last stages is smaller than log(n)), we need to check them every char.
 */
-#define BG_HAVE_LAST_STAGE_FLAG          0x1 // States that we have VO in last stage
-#define BG_HAVE_BEFORE_LAST_STAGE_FLAG   0x2 // States that we have VO in 1-before-last stage
+#define BG_HAVE_LAST_STAGE_FLAG          0x1 // States that we have VO in last stage (flag of BGState)
+#define BG_HAVE_BEFORE_LAST_STAGE_FLAG   0x2 // States that we have VO in 1-before-last stage (flag of BGState)
 #define BG_NEED_BEFORE_LAST_STAGE_FLAG   0x4 // States whether we need to check 1-before-last stage
                                              // (the langth difference between the last stages is smaller than log(n))
 #define BG_SHORT_PATTERN_FLAG            0x8 // when the pattern is too short, we just use kmp real-time version instead
 
 #define BG_SHORT_PATTERN_LENGTH 8
 
+/**
+* Define BG_LAZY_INVERSE (e.g. "make CFLAGS=-DBG_LAZY_INVERSE") to keep only r^pos on every character, without its
+* inverse. The inverse is only needed when a VO is added to the first stage, so it is computed then, from the inverse
+* at the last VO (multiplied by r^-distance, with O(log distance) multiplications).
+*
+* #define BG_LAZY_INVERSE
+*/
+
 
 /**
 * Struct for saving information about a position in the stream.
@@ -66,38 +74,52 @@ typedef struct {
 
 /**
 * Struct for holding all the information about the pattern that we need to know
+*
+* It is never changed while reading a stream (the state of every stream is in a BGState),
+* so it can be shared by many streams.
 */
 typedef struct {
-	
-
 	FieldVal r;
-	FieldVal current_r;
 	FieldVal first_stage_r; // r^(length(first_stage) - 1)  (= r^(2^first_stage - 1)) )
-		
-	pos_t current_pos;
-	pos_t last_kmp_period_match_pos; // The END position of the last match of kmp_period
-
-	fingerprint_t current_fp; // The current fingerprint of all the text until now
-
-	field_t p; // Size of field
 
 	fingerprint_t 		*fps; // The array of fingerprints of every stage (from first_stage to stage logn-1)
-	VOLinearProgression	*vos; // VOS array (last stage is all pattern)
 
 	KMPRealTime			*kmp_period; // kmp struct for the period of first stage (or for all pattern on case of short pattern)
 	KMPRealTime			*kmp_remaining; // kmp struct for the remaining of first stage (after the periods)
-	fingerprint_t		*last_fps; // Saves last logn figerprints
 
 	size_t n;
 	size_t logn;
 	size_t loglogn; // ceil(log(log(n))) + 1
 	size_t first_stage; // The first stage
-	size_t current_stage; // This is the index in vos, the real stage is current_stage + first_stage
 	int n_kmp_period; // The number of periods that there are in first stage
-	int current_n_kmp_period; // The number of periods currently matched
 	int flags;
 } BGStruct;
 
+/**
+* Struct for holding the state of a stream (bg_state_size bytes, the arrays are right after the struct)
+*/
+typedef struct {
+	FieldVal current_r; // r^current_pos (on BG_LAZY_INVERSE, current_r.inv is r^-inv_pos)
+#ifdef BG_LAZY_INVERSE
+	pos_t inv_pos; // the position current_r.inv was last computed for
+#endif
+
+	pos_t current_pos;
+	pos_t last_kmp_period_match_pos; // The END position of the last match of kmp_period
+
+	fingerprint_t current_fp; // The current fingerprint of all the text until now
+
+	VOLinearProgression	*vos; // VOS array (last stage is all pattern)
+	fingerprint_t		*last_fps; // Saves last logn figerprints
+
+	KMPState			*kmp_period; // The state of kmp_period
+	KMPState			*kmp_remaining; // The state of kmp_remaining (NULL if there is no kmp_remaining)
+
+	size_t current_stage; // This is the index in vos, the real stage is current_stage + first_stage
+	int current_n_kmp_period; // The number of periods currently matched
+	int flags;
+} BGState;
+
 // Calculate number of stage given BGStruct
 // N_STAGES is the number of VO-stages, the number of fps stored is N_STAGES+1, 
 // because we need to save the fingerprint of the all pattern
@@ -109,11 +131,17 @@ typedef struct {
 ******************************************************************************************************/
 
 
-BGStruct* bg_new(char* pattern, size_t n, field_t p);
-int bg_read_char(BGStruct* bg, char c);
+BGStruct* bg_new(char* pattern, size_t n);
+int bg_read_char(BGStruct* bg, BGState* state, char c);
+int bg_read_char_after_kmp(BGStruct* bg, BGState* state, char c, int kmp_period_match, int kmp_remaining_match);
 void bg_free(BGStruct* bg);
+void bg_save(BGStruct* bg, CacheWriter* w);
+BGStruct* bg_load(CacheReader* r);
 size_t bg_get_total_mem(BGStruct* bg);
-void bg_reset(BGStruct* bg);
+size_t bg_state_size(BGStruct* bg);
+BGState* bg_state_init(BGStruct* bg, void* mem);
+BGState* bg_state_copy(BGStruct* bg, void* mem, BGState* from);
+void bg_reset(BGStruct* bg, BGState* state);
 
 
 /******************************************************************************************************
@@ -0,0 +1,904 @@
+/**
+* Binary cache of the parsed patterns, the patterns tree and the compiled mps instances
+*
+* Loading the dictionaries (parsing them, building the patterns tree, and adding every pattern to every instance
+* and compiling it) takes much longer than measuring small streams, so with the "-c" option we save all of it to
+* a cache file after building, and on the next run with the same dictionaries we map the cache file instead.
+*
+* The cache file is made of a header and sections (every section starts on CACHE_ALIGNMENT):
+*   - Dictionaries section: the name, size and modification time of every dictionary file.
+*     If the dictionaries were changed (or the version or the build flags of the cache are different),
+*     the cache is ignored, and rebuilt after the dictionaries are loaded.
+*   - Patterns section: all the patterns (in the order they were added to the instances), with the index
+*     of the parent of every pattern in the patterns tree, and the pattern internal id.
+*   - Instance section for every mps instance (and the reliable instance at the end): the instance name,
+*     and the data saved by the "save" function of the algorithm (if it has one).
+*     When loading, an instance with data is loaded with the "load" function of its algorithm,
+*     and any other instance gets all the patterns from the patterns section and is compiled.
+*
+* Pattern ids are pointers, so they are saved as the index of the pattern in the patterns section
+* (see cache_write_ids and cache_read_ids).
+*
+* The result of the calibration (see "calibrate.c") is saved next to the cache file, in the cache file name with the
+* suffix ".calib", which has the same header (with the calibration magic) and two sections: the dictionaries section,
+* and a calibration section with the key the result was computed for, and the result. The cache file itself is written
+* only when it is rebuilt, so the calibration (which is computed after it is loaded) doesn't rewrite it.
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "cache.h"
+#include "conf.h"
+#include "mps.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+#define CACHE_MAGIC "MPSCACHE"
+#define CACHE_CALIBRATION_MAGIC "MPSCALIB"
+
+// The suffix of the calibration file name (after the cache file name)
+#define CACHE_CALIBRATION_SUFFIX ".calib"
+
+// Build flags that change the compiled tables of the algorithms
+#ifdef AC_DFA
+#define CACHE_FLAG_AC_DFA 1
+#else
+#define CACHE_FLAG_AC_DFA 0
+#endif
+#define CACHE_BUILD_FLAGS (CACHE_FLAG_AC_DFA)
+
+// The index of no pattern (for null_pattern_id, or for the parent of a pattern which is child of the root)
+#define CACHE_NO_INDEX UINT32_MAX
+
+enum {
+	CACHE_SECTION_DICTIONARIES = 1,
+	CACHE_SECTION_PATTERNS,
+	CACHE_SECTION_INSTANCE,
+	CACHE_SECTION_CALIBRATION
+};
+
+/**
+* The header of the cache file
+*/
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t flags;      // CACHE_BUILD_FLAGS
+	uint32_t id_size;    // sizeof(pattern_id_t)
+	uint32_t n_sections;
+} CacheHeader;
+
+/**
+* The header of a section (the size is the size of the section after the header)
+*/
+typedef struct {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t size;
+} CacheSectionHeader;
+
+/**
+* A pattern in the patterns section
+*/
+typedef struct {
+	uint64_t file_number;
+	uint64_t line_number;
+	uint64_t offset;      // the offset of the pattern in the patterns data
+	uint32_t len;
+	uint32_t parent;      // the index of the parent pattern (CACHE_NO_INDEX if the parent is the root)
+} CachePattern;
+
+/**
+* The cache state of the configuration (conf->cache)
+*/
+typedef struct {
+	// The patterns recorded while building the patterns tree (for saving)
+	char          *data;
+	size_t         data_size;
+	size_t         data_capacity;
+	CachePattern  *patterns;
+	pattern_id_t  *ids;         // the id of every pattern
+	size_t         n_patterns;
+	size_t         patterns_capacity;
+
+	// The mapping of the cache file (after loading)
+	void          *map;
+	size_t         map_size;
+} CacheState;
+
+/**
+* Pair of pattern id and its index (for finding the index of id when saving)
+*/
+typedef struct {
+	pattern_id_t id;
+	uint32_t     index;
+} CacheIdIndex;
+
+struct cache_writer {
+	FILE          *f;
+	uint64_t       offset;  // the current offset in the file
+	int            failed;
+	CacheIdIndex  *sorted;  // the ids of all the patterns, sorted
+	size_t         n_ids;
+};
+
+struct cache_reader {
+	const char    *map;
+	size_t         pos;     // the current position in the mapping
+	size_t         end;     // the end of the current section
+	pattern_id_t  *ids;     // the id of every pattern index
+	size_t         n_ids;
+};
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Get the cache state of the configuration (create it if not exist)
+*/
+static CacheState* get_cache_state(Conf* conf) {
+	if (conf->cache == NULL) {
+		conf->cache = calloc(1, sizeof(CacheState));
+		if (conf->cache == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+	}
+	return (CacheState*)conf->cache;
+}
+
+/**
+* Exit because of a corrupted cache file
+*/
+static void cache_corrupted(void) {
+	fprintf(stderr, "the cache file is corrupted (delete it to rebuild it)\n");
+	FatalExit();
+}
+
+/**
+* Build the signature of the dictionary files (their names, sizes and modification times)
+*
+* @param conf     The configuration
+* @param len      Set to the length of the signature
+*
+* @return         Dynamically allocated signature, or NULL if some dictionary file can't be accessed
+*/
+static char* dictionaries_signature(Conf* conf, size_t* len) {
+	size_t i, name_len, pos = 0, size = sizeof(uint64_t);
+	char* ret;
+	struct stat st;
+	uint64_t values[4];
+
+	for (i = 0; i < conf->n_dictionary_files; ++i) {
+		size += sizeof(values) + strlen(conf->dictionary_files[i]);
+	}
+	ret = (char*)malloc(size);
+	if (ret == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	values[0] = conf->n_dictionary_files;
+	memcpy(ret, values, sizeof(uint64_t));
+	pos += sizeof(uint64_t);
+	for (i = 0; i < conf->n_dictionary_files; ++i) {
+		if (stat(conf->dictionary_files[i], &st) == -1) {
+			free(ret);
+			return NULL;
+		}
+		name_len = strlen(conf->dictionary_files[i]);
+		values[0] = name_len;
+		values[1] = st.st_size;
+		values[2] = st.st_mtim.tv_sec;
+		values[3] = st.st_mtim.tv_nsec;
+		memcpy(ret + pos, values, sizeof(values));
+		pos += sizeof(values);
+		memcpy(ret + pos, conf->dictionary_files[i], name_len);
+		pos += name_len;
+	}
+	*len = size;
+	return ret;
+}
+
+/**
+* Compare pattern id indices (for sorting and searching by the id)
+*/
+static int cmp_id_index(const void* a, const void* b) {
+	const CacheIdIndex *x = (const CacheIdIndex*)a, *y = (const CacheIdIndex*)b;
+	if (x->id == y->id) return 0;
+	return (uintptr_t)x->id < (uintptr_t)y->id ? -1 : 1;
+}
+
+/**
+* Find the index of a pattern id (for saving)
+*
+* @param w     The cache writer
+* @param id    The pattern id
+*
+* @return      The index of the pattern, or CACHE_NO_INDEX for null_pattern_id (or unknown id)
+*/
+static uint32_t cache_id_to_index(CacheWriter* w, pattern_id_t id) {
+	CacheIdIndex key, *found;
+	if (id == null_pattern_id) return CACHE_NO_INDEX;
+	key.id = id;
+	found = (CacheIdIndex*)bsearch(&key, w->sorted, w->n_ids, sizeof(CacheIdIndex), cmp_id_index);
+	return found ? found->index : CACHE_NO_INDEX;
+}
+
+/**
+* Start a new section in the cache file
+*
+* @param w       The cache writer
+* @param type    The type of the section
+*
+* @return        The offset of the section header (for cache_end_section)
+*/
+static uint64_t cache_begin_section(CacheWriter* w, uint32_t type) {
+	CacheSectionHeader header;
+	uint64_t ret;
+	cache_write_align(w);
+	ret = w->offset;
+	memset(&header, 0, sizeof(header));
+	header.type = type;
+	cache_write(w, &header, sizeof(header));
+	return ret;
+}
+
+/**
+* End the section (write its size in the section header)
+*
+* @param w              The cache writer
+* @param header_offset  The offset of the section header (as returned from cache_begin_section)
+*/
+static void cache_end_section(CacheWriter* w, uint64_t header_offset) {
+	uint64_t size = w->offset - header_offset - sizeof(CacheSectionHeader);
+	if (w->failed) return;
+	if (fseek(w->f, header_offset + offsetof(CacheSectionHeader, size), SEEK_SET) == -1 ||
+	    fwrite(&size, sizeof(size), 1, w->f) != 1 ||
+	    fseek(w->f, w->offset, SEEK_SET) == -1) {
+		w->failed = 1;
+	}
+}
+
+/**
+* Read the next section header, and set the reader bounds to the section
+*
+* @param r        The cache reader (its end should be the end of the mapping)
+* @param type     The type the section should have
+* @param map_end  The end of the mapping
+*
+* @return         1 if the section is valid, 0 otherwise
+*/
+static int cache_next_section(CacheReader* r, uint32_t type, size_t map_end) {
+	const CacheSectionHeader* header;
+	r->end = map_end;
+	r->pos = (r->pos + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+	if (r->pos + sizeof(CacheSectionHeader) > map_end) return 0;
+	header = (const CacheSectionHeader*)(r->map + r->pos);
+	r->pos += sizeof(CacheSectionHeader);
+	if (header->type != type || header->size > map_end - r->pos) return 0;
+	r->end = r->pos + header->size;
+	return 1;
+}
+
+/**
+* Read the name of the instance from an instance section, and check that it is the name of the instance
+* (the name of the algorithm with its parameters, see MpsInstance)
+*
+* @param r        The cache reader
+* @param inst     The instance
+* @param has_data Set to whether the section has data saved by the algorithm
+*
+* @return         1 if the instance is the same, 0 otherwise
+*/
+static int cache_check_instance(CacheReader* r, MpsInstance* inst, uint32_t* has_data) {
+	const char* name = inst->name;
+	uint32_t len;
+	if (r->end - r->pos < 2 * sizeof(uint32_t)) return 0;
+	memcpy(&len, r->map + r->pos, sizeof(uint32_t));
+	r->pos += sizeof(uint32_t);
+	if (len != strlen(name) || r->end - r->pos < len + sizeof(uint32_t) ||
+	    memcmp(r->map + r->pos, name, len)) {
+		return 0;
+	}
+	r->pos += len;
+	memcpy(has_data, r->map + r->pos, sizeof(uint32_t));
+	r->pos += sizeof(uint32_t);
+	return 1;
+}
+
+/**
+* Load an mps instance from its section (or build it from the patterns, if the algorithm didn't save data)
+*
+* Loading is measured as the compile phase of building the instance (see measure_phase_start)
+*
+* @param conf     The configuration
+* @param r        The cache reader (at the start of the section)
+* @param inst     The instance
+* @param stats    The statistics of the instance (NULL if not measured)
+* @param cs       The cache state with the loaded patterns
+*/
+static void cache_load_instance(Conf* conf, CacheReader* r, MpsInstance* inst, InstanceStats* stats, CacheState* cs) {
+	MpsElem* mps;
+	uint32_t has_data;
+	size_t i;
+
+	cache_check_instance(r, inst, &has_data); // already checked
+	if (inst->algo == MPS_NONE) return;
+	mps = &mps_table[inst->algo];
+	if (has_data && mps->load) {
+		measure_phase_start(conf, stats ? &stats->build.compile : NULL);
+		mps->load(inst->obj, r);
+		measure_phase_stop(conf, stats ? &stats->build.compile : NULL);
+		return;
+	}
+	measure_phase_start(conf, stats ? &stats->build.add : NULL);
+	for (i = 0; i < cs->n_patterns; ++i) {
+		mps->add_pattern(inst->obj, (char*)cs->data + cs->patterns[i].offset, cs->patterns[i].len, cs->ids[i]);
+	}
+	measure_phase_stop(conf, stats ? &stats->build.add : NULL);
+	measure_phase_start(conf, stats ? &stats->build.compile : NULL);
+	mps->compile(inst->obj);
+	measure_phase_stop(conf, stats ? &stats->build.compile : NULL);
+}
+
+/**
+* Get the name of the calibration file of the cache file
+*
+* @param conf     The configuration (with the cache file name)
+*
+* @return         Dynamically allocated name
+*/
+static char* calibration_file_name(Conf* conf) {
+	char* name = (char*)malloc(strlen(conf->cache_file_name) + strlen(CACHE_CALIBRATION_SUFFIX) + 1);
+	if (name == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	sprintf(name, "%s%s", conf->cache_file_name, CACHE_CALIBRATION_SUFFIX);
+	return name;
+}
+
+/**
+* Save an mps instance to its section
+*
+* @param w        The cache writer
+* @param inst     The instance
+*/
+static void cache_save_instance(CacheWriter* w, MpsInstance* inst) {
+	MpsElem* mps = inst->algo == MPS_NONE ? NULL : &mps_table[inst->algo];
+	uint64_t section = cache_begin_section(w, CACHE_SECTION_INSTANCE);
+	uint32_t len = strlen(inst->name), has_data = mps && mps->save != NULL;
+	cache_write(w, &len, sizeof(len));
+	cache_write(w, inst->name, len);
+	cache_write(w, &has_data, sizeof(has_data));
+	if (has_data) {
+		mps->save(inst->obj, w);
+	}
+	cache_end_section(w, section);
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Write data to the cache file
+*
+* @param w       The cache writer
+* @param data    The data to write
+* @param len     The length of the data
+*/
+void cache_write(CacheWriter* w, const void* data, size_t len) {
+	if (w->failed || len == 0) return;
+	if (fwrite(data, 1, len, w->f) != len) {
+		w->failed = 1;
+		return;
+	}
+	w->offset += len;
+}
+
+/**
+* Pad the cache file to CACHE_ALIGNMENT (so the data written next can be used directly from the mapping
+* as aligned memory, after cache_read_align)
+*
+* @param w       The cache writer
+*/
+void cache_write_align(CacheWriter* w) {
+	static const char zeros[CACHE_ALIGNMENT];
+	size_t pad = (CACHE_ALIGNMENT - w->offset % CACHE_ALIGNMENT) % CACHE_ALIGNMENT;
+	cache_write(w, zeros, pad);
+}
+
+/**
+* Write pattern ids to the cache file (as pattern indices)
+*
+* @param w       The cache writer
+* @param ids     The ids to write
+* @param n       The number of ids
+*/
+void cache_write_ids(CacheWriter* w, const pattern_id_t* ids, size_t n) {
+	size_t i;
+	uint32_t index;
+	for (i = 0; i < n; ++i) {
+		index = cache_id_to_index(w, ids[i]);
+		cache_write(w, &index, sizeof(index));
+	}
+}
+
+/**
+* Read data from the cache file
+*
+* @param r       The cache reader
+* @param len     The length of the data
+*
+* @return        Pointer to the data in the mapping of the cache file (exit if the cache file is too short)
+*/
+const void* cache_read(CacheReader* r, size_t len) {
+	const void* ret = r->map + r->pos;
+	if (r->end - r->pos < len) cache_corrupted();
+	r->pos += len;
+	return ret;
+}
+
+/**
+* Skip the padding written with cache_write_align
+*
+* @param r       The cache reader
+*/
+void cache_read_align(CacheReader* r) {
+	size_t pos = (r->pos + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+	if (pos > r->end) cache_corrupted();
+	r->pos = pos;
+}
+
+/**
+* Read pattern ids (written with cache_write_ids) from the cache file
+*
+* @param r       The cache reader
+* @param ids     Where to put the ids
+* @param n       The number of ids
+*/
+void cache_read_ids(CacheReader* r, pattern_id_t* ids, size_t n) {
+	const uint32_t* indices = (const uint32_t*)cache_read(r, n * sizeof(uint32_t));
+	size_t i;
+	uint32_t index;
+	for (i = 0; i < n; ++i) {
+		memcpy(&index, indices + i, sizeof(index));
+		if (index == CACHE_NO_INDEX) {
+			ids[i] = null_pattern_id;
+		} else if (index < r->n_ids) {
+			ids[i] = r->ids[index];
+		} else {
+			cache_corrupted();
+		}
+	}
+}
+
+/**
+* Record a pattern that was added to all the instances (so it would be saved to the cache file)
+*
+* @param conf     The configuration
+* @param pat      The pattern
+* @param len      The length of the pattern
+* @param id       The id of the pattern
+*/
+void cache_record_pattern(Conf* conf, char* pat, size_t len, pattern_id_t id) {
+	CacheState* cs = get_cache_state(conf);
+	CachePattern* cp;
+	if (cs->n_patterns == cs->patterns_capacity) {
+		cs->patterns_capacity = cs->patterns_capacity ? 2 * cs->patterns_capacity : 1024;
+		cs->patterns = (CachePattern*)realloc(cs->patterns, cs->patterns_capacity * sizeof(CachePattern));
+		cs->ids = (pattern_id_t*)realloc(cs->ids, cs->patterns_capacity * sizeof(pattern_id_t));
+	}
+	while (cs->data_size + len > cs->data_capacity) {
+		cs->data_capacity = cs->data_capacity ? 2 * cs->data_capacity : 64 * 1024;
+		cs->data = (char*)realloc(cs->data, cs->data_capacity);
+	}
+	if (cs->patterns == NULL || cs->ids == NULL || cs->data == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	cp = &cs->patterns[cs->n_patterns];
+	cp->file_number = id->pattern_id.file_number;
+	cp->line_number = id->pattern_id.line_number;
+	cp->offset = cs->data_size;
+	cp->len = len;
+	cp->parent = CACHE_NO_INDEX; // found when saving
+	cs->ids[cs->n_patterns++] = id;
+	memcpy(cs->data + cs->data_size, pat, len);
+	cs->data_size += len;
+}
+
+/**
+* Load the patterns tree and the mps instances from the cache file
+*
+* The instances must be already created (but without any pattern).
+*
+* @param conf     The configuration (with the cache file name)
+*
+* @return         1 if loaded, 0 if the cache file doesn't exist or is invalid (then nothing was changed)
+*/
+int cache_load(Conf* conf) {
+	CacheState* cs;
+	CacheReader r;
+	CacheHeader header;
+	const CachePattern* patterns;
+	PatternInternalID* internal_ids;
+	size_t *parents, *lens;
+	pattern_id_t* ids;
+	PatternsTree* tree;
+	char* signature = NULL;
+	size_t i, n, max_pat_len, sig_len, map_size, data_pos, instances_pos;
+	uint64_t n_patterns;
+	uint32_t has_data;
+	struct stat st;
+	void* map;
+	int fd, ok = 0;
+
+	fd = open(conf->cache_file_name, O_RDONLY);
+	if (fd == -1) return 0;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(CacheHeader)) {
+		close(fd);
+		return 0;
+	}
+	map_size = st.st_size;
+	map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+
+	memset(&r, 0, sizeof(r));
+	r.map = (const char*)map;
+	r.end = map_size;
+
+	// check the header and the dictionaries
+	memcpy(&header, r.map, sizeof(header));
+	r.pos = sizeof(header);
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) || header.version != CACHE_VERSION ||
+	    header.flags != CACHE_BUILD_FLAGS || header.id_size != sizeof(pattern_id_t) ||
+	    header.n_sections != conf->n_mps_instances + 3) {
+		goto out;
+	}
+	signature = dictionaries_signature(conf, &sig_len);
+	if (signature == NULL || !cache_next_section(&r, CACHE_SECTION_DICTIONARIES, map_size) ||
+	    r.end - r.pos != sig_len || memcmp(r.map + r.pos, signature, sig_len)) {
+		goto out;
+	}
+	r.pos = r.end;
+
+	// check the patterns section
+	if (!cache_next_section(&r, CACHE_SECTION_PATTERNS, map_size) || r.end - r.pos < sizeof(uint64_t)) goto out;
+	memcpy(&n_patterns, r.map + r.pos, sizeof(uint64_t));
+	r.pos += sizeof(uint64_t);
+	if (n_patterns > (r.end - r.pos) / sizeof(CachePattern)) goto out;
+	n = n_patterns;
+	patterns = (const CachePattern*)(r.map + r.pos);
+	data_pos = r.pos + n * sizeof(CachePattern);
+	for (i = 0; i < n; ++i) {
+		if (patterns[i].offset + patterns[i].len > r.end - data_pos ||
+		    (patterns[i].parent != CACHE_NO_INDEX && patterns[i].parent >= n)) {
+			goto out;
+		}
+	}
+	r.pos = r.end;
+
+	// check the instances sections
+	instances_pos = r.pos;
+	for (i = 0; i <= conf->n_mps_instances; ++i) {
+		if (!cache_next_section(&r, CACHE_SECTION_INSTANCE, map_size) ||
+		    !cache_check_instance(&r, i < conf->n_mps_instances ? &conf->mps_instances[i]
+		                                                        : &conf->reliable_mps_instance, &has_data)) {
+			goto out;
+		}
+		r.pos = r.end;
+	}
+
+	// build the patterns tree (fails if the parents of the patterns have a cycle)
+	ids = (pattern_id_t*)malloc(n * sizeof(pattern_id_t));
+	parents = (size_t*)malloc(n * sizeof(size_t));
+	lens = (size_t*)malloc(n * sizeof(size_t));
+	internal_ids = (PatternInternalID*)malloc(n * sizeof(PatternInternalID));
+	if ((ids == NULL || parents == NULL || lens == NULL || internal_ids == NULL) && n) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	max_pat_len = 0;
+	for (i = 0; i < n; ++i) {
+		parents[i] = patterns[i].parent == CACHE_NO_INDEX ? PATTERNS_TREE_ROOT_PARENT : patterns[i].parent;
+		internal_ids[i].file_number = patterns[i].file_number;
+		internal_ids[i].line_number = patterns[i].line_number;
+		lens[i] = patterns[i].len;
+		if (patterns[i].len > max_pat_len) max_pat_len = patterns[i].len;
+	}
+	tree = patterns_tree_build_from_parents(n, parents, internal_ids, lens, ids);
+	free(parents);
+	free(lens);
+	free(internal_ids);
+	if (tree == NULL) {
+		free(ids);
+		goto out;
+	}
+
+	// the cache is valid
+	conf->patterns_tree = tree;
+	conf->max_pat_len = max_pat_len;
+	cs = get_cache_state(conf);
+	cs->map = map;
+	cs->map_size = map_size;
+	cs->data = (char*)r.map + data_pos;
+	cs->patterns = (CachePattern*)patterns;
+	cs->n_patterns = n;
+	cs->ids = ids;
+	for (i = 0; i < n; ++i) {
+		patterns_list_add(&conf->patterns, cs->data + patterns[i].offset, patterns[i].len, ids[i]->pattern_id, ids[i]);
+	}
+
+	// load the instances
+	r.ids = cs->ids;
+	r.n_ids = n;
+	r.pos = instances_pos;
+	for (i = 0; i <= conf->n_mps_instances; ++i) {
+		cache_next_section(&r, CACHE_SECTION_INSTANCE, map_size);
+		if (i < conf->n_mps_instances) {
+			cache_load_instance(conf, &r, &conf->mps_instances[i], &conf->mps_instances_stats[i], cs);
+		} else {
+			cache_load_instance(conf, &r, &conf->reliable_mps_instance, NULL, cs);
+		}
+		r.pos = r.end;
+	}
+	ok = 1;
+	if (verbose) printf("loaded %zu patterns from cache file %s\n", n, conf->cache_file_name);
+
+out:
+	free(signature);
+	if (!ok) {
+		if (verbose) printf("cache file %s is out of date, rebuilding it\n", conf->cache_file_name);
+		munmap(map, map_size);
+	}
+	return ok;
+}
+
+/**
+* Save the recorded patterns, the patterns tree and the mps instances to the cache file
+*
+* The cache is written to a temporary file, which is then renamed to the cache file name.
+* Failing to write the cache is not fatal (just print a warning).
+*
+* @param conf     The configuration (with the cache file name)
+*/
+void cache_save(Conf* conf) {
+	CacheState* cs = get_cache_state(conf);
+	CacheWriter w;
+	CacheHeader header;
+	PatternsTreeNode* parent;
+	char* signature;
+	char* tmp_name;
+	size_t i, sig_len;
+	uint64_t section, n_patterns = cs->n_patterns;
+
+	signature = dictionaries_signature(conf, &sig_len);
+	tmp_name = (char*)malloc(strlen(conf->cache_file_name) + 5);
+	memset(&w, 0, sizeof(w));
+	w.n_ids = cs->n_patterns;
+	w.sorted = (CacheIdIndex*)malloc(w.n_ids * sizeof(CacheIdIndex));
+	if (tmp_name == NULL || (w.sorted == NULL && w.n_ids)) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	if (signature == NULL) {
+		fprintf(stderr, "warning: can't access the dictionary files, not saving cache\n");
+		goto out;
+	}
+	for (i = 0; i < w.n_ids; ++i) {
+		w.sorted[i].id = cs->ids[i];
+		w.sorted[i].index = i;
+	}
+	qsort(w.sorted, w.n_ids, sizeof(CacheIdIndex), cmp_id_index);
+	for (i = 0; i < cs->n_patterns; ++i) {
+		parent = patterns_tree_parent(cs->ids[i]);
+		cs->patterns[i].parent = parent == conf->patterns_tree->root ? CACHE_NO_INDEX : cache_id_to_index(&w, parent);
+	}
+
+	sprintf(tmp_name, "%s.tmp", conf->cache_file_name);
+	w.f = fopen(tmp_name, "wb");
+	if (w.f == NULL) {
+		fprintf(stderr, "warning: failed to create cache file %s: %s\n", tmp_name, strerror(errno));
+		goto out;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.flags = CACHE_BUILD_FLAGS;
+	header.id_size = sizeof(pattern_id_t);
+	header.n_sections = conf->n_mps_instances + 3;
+	cache_write(&w, &header, sizeof(header));
+
+	section = cache_begin_section(&w, CACHE_SECTION_DICTIONARIES);
+	cache_write(&w, signature, sig_len);
+	cache_end_section(&w, section);
+
+	section = cache_begin_section(&w, CACHE_SECTION_PATTERNS);
+	cache_write(&w, &n_patterns, sizeof(n_patterns));
+	cache_write(&w, cs->patterns, cs->n_patterns * sizeof(CachePattern));
+	cache_write(&w, cs->data, cs->data_size);
+	cache_end_section(&w, section);
+
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		cache_save_instance(&w, &conf->mps_instances[i]);
+	}
+	cache_save_instance(&w, &conf->reliable_mps_instance);
+
+	if (fclose(w.f) != 0) w.failed = 1;
+	if (w.failed || rename(tmp_name, conf->cache_file_name) == -1) {
+		fprintf(stderr, "warning: failed to write cache file %s\n", conf->cache_file_name);
+		unlink(tmp_name);
+	} else if (verbose) {
+		printf("saved %zu patterns to cache file %s\n", cs->n_patterns, conf->cache_file_name);
+	}
+
+out:
+	// the recorded patterns are not needed anymore
+	free(cs->data);
+	free(cs->patterns);
+	free(cs->ids);
+	cs->data = NULL;
+	cs->patterns = NULL;
+	cs->ids = NULL;
+	cs->n_patterns = cs->data_size = cs->data_capacity = cs->patterns_capacity = 0;
+	free(w.sorted);
+	free(tmp_name);
+	free(signature);
+}
+
+/**
+* Load the result of the calibration from the calibration file of the cache file
+*
+* The result is loaded only if it was saved with the same key, and the dictionaries weren't changed since.
+*
+* @param conf        The configuration (with the cache file name)
+* @param key         The key of the calibration (what the result depends on, e.g. the cpu and the instances)
+* @param key_len     The length of the key
+* @param result      Where to put the result
+* @param result_len  The length of the result
+*
+* @return            1 if loaded, 0 if there is no calibration file, or it is of another key or out of date
+*/
+int cache_load_calibration(Conf* conf, const void* key, size_t key_len, void* result, size_t result_len) {
+	CacheReader r;
+	CacheHeader header;
+	char *name, *data = NULL, *signature = NULL;
+	size_t size, sig_len;
+	uint64_t saved_key_len;
+	struct stat st;
+	int fd, ok = 0;
+
+	name = calibration_file_name(conf);
+	fd = open(name, O_RDONLY);
+	free(name);
+	if (fd == -1) return 0;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(CacheHeader)) goto out;
+	size = st.st_size;
+	data = (char*)malloc(size);
+	if (data == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	if (read(fd, data, size) != (ssize_t)size) goto out;
+
+	memset(&r, 0, sizeof(r));
+	r.map = data;
+	memcpy(&header, data, sizeof(header));
+	r.pos = sizeof(header);
+	if (memcmp(header.magic, CACHE_CALIBRATION_MAGIC, sizeof(header.magic)) || header.version != CACHE_VERSION ||
+	    header.flags != CACHE_BUILD_FLAGS || header.n_sections != 2) {
+		goto out;
+	}
+	signature = dictionaries_signature(conf, &sig_len);
+	if (signature == NULL || !cache_next_section(&r, CACHE_SECTION_DICTIONARIES, size) ||
+	    r.end - r.pos != sig_len || memcmp(r.map + r.pos, signature, sig_len)) {
+		goto out;
+	}
+	r.pos = r.end;
+	if (!cache_next_section(&r, CACHE_SECTION_CALIBRATION, size) ||
+	    r.end - r.pos != sizeof(uint64_t) + key_len + result_len) {
+		goto out;
+	}
+	memcpy(&saved_key_len, r.map + r.pos, sizeof(uint64_t));
+	r.pos += sizeof(uint64_t);
+	if (saved_key_len != key_len || memcmp(r.map + r.pos, key, key_len)) goto out;
+	memcpy(result, r.map + r.pos + key_len, result_len);
+	ok = 1;
+
+out:
+	close(fd);
+	free(data);
+	free(signature);
+	return ok;
+}
+
+/**
+* Save the result of the calibration to the calibration file of the cache file (see cache_load_calibration)
+*
+* Failing to write the file is not fatal (just print a warning).
+*
+* @param conf        The configuration (with the cache file name)
+* @param key         The key of the calibration
+* @param key_len     The length of the key
+* @param result      The result
+* @param result_len  The length of the result
+*/
+void cache_save_calibration(Conf* conf, const void* key, size_t key_len, const void* result, size_t result_len) {
+	CacheWriter w;
+	CacheHeader header;
+	char *name, *tmp_name, *signature;
+	size_t sig_len;
+	uint64_t section, saved_key_len = key_len;
+
+	signature = dictionaries_signature(conf, &sig_len);
+	if (signature == NULL) {
+		fprintf(stderr, "warning: can't access the dictionary files, not saving calibration\n");
+		return;
+	}
+	name = calibration_file_name(conf);
+	tmp_name = (char*)malloc(strlen(name) + 5);
+	if (tmp_name == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	sprintf(tmp_name, "%s.tmp", name);
+	memset(&w, 0, sizeof(w));
+	w.f = fopen(tmp_name, "wb");
+	if (w.f == NULL) {
+		fprintf(stderr, "warning: failed to create calibration file %s: %s\n", tmp_name, strerror(errno));
+		goto out;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_CALIBRATION_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.flags = CACHE_BUILD_FLAGS;
+	header.id_size = sizeof(pattern_id_t);
+	header.n_sections = 2;
+	cache_write(&w, &header, sizeof(header));
+
+	section = cache_begin_section(&w, CACHE_SECTION_DICTIONARIES);
+	cache_write(&w, signature, sig_len);
+	cache_end_section(&w, section);
+
+	section = cache_begin_section(&w, CACHE_SECTION_CALIBRATION);
+	cache_write(&w, &saved_key_len, sizeof(saved_key_len));
+	cache_write(&w, key, key_len);
+	cache_write(&w, result, result_len);
+	cache_end_section(&w, section);
+
+	if (fclose(w.f) != 0) w.failed = 1;
+	if (w.failed || rename(tmp_name, name) == -1) {
+		fprintf(stderr, "warning: failed to write calibration file %s\n", name);
+		unlink(tmp_name);
+	} else if (verbose) {
+		printf("saved the calibration to %s\n", name);
+	}
+
+out:
+	free(name);
+	free(tmp_name);
+	free(signature);
+}
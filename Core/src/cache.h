@@ -0,0 +1,63 @@
+/**
+* Binary cache of the parsed patterns, the patterns tree and the compiled mps instances
+*/
+#ifndef CACHE_H
+#define CACHE_H
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "PatternsTree.h"
+#include <stdint.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+struct _Conf;
+
+// Version of the cache file format (a cache file with another version is rebuilt)
+#define CACHE_VERSION 3
+
+// The alignment of the sections in the cache file (and of data aligned with cache_write_align)
+#define CACHE_ALIGNMENT 64
+
+/**
+* Writer of the data of an mps instance to the cache file (used by the "save" function of the algorithm)
+*/
+typedef struct cache_writer CacheWriter;
+
+/**
+* Reader of the data of an mps instance from the cache file (used by the "load" function of the algorithm)
+*
+* The data read is a pointer into the mapping of the cache file, which stays mapped until the program ends
+* (so an algorithm can use its tables directly from the mapping, without copying them)
+*/
+typedef struct cache_reader CacheReader;
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+int cache_load(struct _Conf* conf);
+void cache_record_pattern(struct _Conf* conf, char* pat, size_t len, pattern_id_t id);
+void cache_save(struct _Conf* conf);
+int cache_load_calibration(struct _Conf* conf, const void* key, size_t key_len, void* result, size_t result_len);
+void cache_save_calibration(struct _Conf* conf, const void* key, size_t key_len, const void* result, size_t result_len);
+
+// for the save/load functions of the algorithms
+void cache_write(CacheWriter* w, const void* data, size_t len);
+void cache_write_align(CacheWriter* w);
+void cache_write_ids(CacheWriter* w, const pattern_id_t* ids, size_t n);
+const void* cache_read(CacheReader* r, size_t len);
+void cache_read_align(CacheReader* r);
+void cache_read_ids(CacheReader* r, pattern_id_t* ids, size_t n);
+
+#endif /* CACHE_H */
@@ -0,0 +1,283 @@
+/**
+* Calibration - choosing the fastest mps instance on the host, before measuring
+*
+* With the "--calibrate" option, after the instances are built, every instance reads a sample of the streams (the
+* first CALIBRATE_SAMPLE_SIZE bytes of the first stream file) CALIBRATE_ROUNDS times, and only the instance with the
+* fastest round (in ns per byte, by the monotonic clock) is measured on the streams. An instance whose first round is
+* slower than CALIBRATE_CUTOFF times the fastest round so far can't win, so it isn't read again.
+*
+* Which instance is the fastest depends on the host: the vectorized code of the algorithms is chosen by the cpu
+* features (see cpu_features), which are printed with the results. The "simd=LEVEL" parameter limits the instructions
+* of an instance, so e.g. "-a pcac -a pcac:simd=none --calibrate" chooses between the prefilters of pcac.
+*
+* With a cache file ("-c"), the result is saved next to it (see cache_save_calibration) with its key: the cpu features,
+* the sample (its length and hash) and the names of the instances. A later run with the same key (and the same
+* dictionaries) takes the result from there, without reading the sample.
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "calibrate.h"
+#include "conf.h"
+#include "cache.h"
+#include "util.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+/**
+* The result of the calibration (as saved next to the cache file)
+*/
+typedef struct {
+	uint64_t winner;        // the index of the fastest instance
+	double   ns_per_byte[]; // the time of the fastest round of every instance
+} CalibrationResult;
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Read the sample of the calibration, the start of the first stream file (which isn't a capture file)
+*
+* @param conf     The configuration
+* @param name     Set to the name of the stream file
+* @param len      Set to the length of the sample (at most CALIBRATE_SAMPLE_SIZE)
+*
+* @return         Dynamically allocated sample
+*/
+static char* read_sample(Conf* conf, const char** name, size_t* len) {
+	struct stat st;
+	ssize_t len_read;
+	size_t i;
+	char* sample;
+	int fd;
+
+	for (i = 0; i < conf->n_stream_files && conf->stream_is_capture[i]; ++i);
+	*name = conf->stream_files[i];
+	fd = open(*name, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "can't open stream file %s: %s\n", *name, strerror(errno));
+		FatalExit();
+	}
+	if (!S_ISREG(st.st_mode)) {
+		// reading the sample from a pipe would take it from the measured stream
+		fprintf(stderr, "Error: can't calibrate on the stream file %s, which isn't a regular file\n", *name);
+		FatalExit();
+	}
+	sample = (char*)malloc(CALIBRATE_SAMPLE_SIZE);
+	if (sample == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	*len = 0;
+	do {
+		len_read = read(fd, sample + *len, CALIBRATE_SAMPLE_SIZE - *len);
+		if (len_read == -1) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "can't read from stream file %s: %s\n", *name, strerror(errno));
+			FatalExit();
+		}
+		*len += len_read;
+	} while (len_read != 0 && *len < CALIBRATE_SAMPLE_SIZE);
+	close(fd);
+	return sample;
+}
+
+/**
+* Build the key of the calibration: the cpu features, the length and the hash (FNV-1a) of the sample, and the names
+* of the instances
+*
+* @param conf        The configuration
+* @param sample      The sample
+* @param len         The length of the sample
+* @param key_len     Set to the length of the key
+*
+* @return            Dynamically allocated key
+*/
+static char* calibration_key(Conf* conf, const char* sample, size_t len, size_t* key_len) {
+	uint64_t values[4];
+	size_t i, name_len, pos = sizeof(values);
+	char* key;
+
+	values[0] = cpu_features();
+	values[1] = len;
+	values[2] = 14695981039346656037ull;
+	for (i = 0; i < len; ++i) {
+		values[2] = (values[2] ^ (unsigned char)sample[i]) * 1099511628211ull;
+	}
+	values[3] = conf->n_mps_instances;
+	*key_len = sizeof(values);
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		*key_len += strlen(conf->mps_instances[i].name) + 1;
+	}
+	key = (char*)malloc(*key_len);
+	if (key == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memcpy(key, values, sizeof(values));
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		name_len = strlen(conf->mps_instances[i].name) + 1;
+		memcpy(key + pos, conf->mps_instances[i].name, name_len);
+		pos += name_len;
+	}
+	return key;
+}
+
+/**
+* Read the sample with an instance once (from the initial state)
+*
+* @param inst     The instance
+* @param sample   The sample
+* @param len      The length of the sample
+* @param out      Buffer of len results
+*
+* @return         The time it took, in ns
+*/
+static uint64_t read_sample_round(MpsInstance* inst, const char* sample, size_t len, pattern_id_t* out) {
+	MpsElem* mps = &mps_table[inst->algo];
+	uint64_t begin;
+	size_t i;
+
+	mps->reset(inst->obj);
+	begin = monotonic_ns();
+	if (mps->read_block) {
+		mps->read_block(inst->obj, sample, len, out);
+	} else {
+		for (i = 0; i < len; ++i) {
+			out[i] = mps->read_char(inst->obj, sample[i]);
+		}
+	}
+	return monotonic_ns() - begin;
+}
+
+/**
+* Read the sample with every instance, and find the fastest
+*
+* @param conf     The configuration
+* @param sample   The sample
+* @param len      The length of the sample
+* @param result   Where to put the result (with room for every instance)
+*/
+static void run_calibration(Conf* conf, const char* sample, size_t len, CalibrationResult* result) {
+	pattern_id_t* out = (pattern_id_t*)malloc(len * sizeof(pattern_id_t));
+	uint64_t ns, best, fastest = UINT64_MAX;
+	size_t i, round;
+
+	if (out == NULL && len) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	result->winner = 0;
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		best = UINT64_MAX;
+		for (round = 0; round < CALIBRATE_ROUNDS; ++round) {
+			ns = read_sample_round(&conf->mps_instances[i], sample, len, out);
+			if (ns < best) best = ns;
+			if (round == 0 && fastest != UINT64_MAX && ns > CALIBRATE_CUTOFF * fastest) break;
+		}
+		mps_table[conf->mps_instances[i].algo].reset(conf->mps_instances[i].obj);
+		result->ns_per_byte[i] = len ? (double)best / len : 0;
+		if (best < fastest) {
+			fastest = best;
+			result->winner = i;
+		}
+	}
+	free(out);
+}
+
+/**
+* Keep only one of the instances (free the objects of the others)
+*
+* The statistics of the kept instance are moved to the first place with it (the statistics of the others stay after
+* it, and aren't used).
+*
+* @param conf     The configuration
+* @param keep     The index of the instance to keep
+*/
+static void keep_instance(Conf* conf, size_t keep) {
+	MpsInstance* inst;
+	InstanceStats stats;
+	size_t i;
+
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		if (i == keep) continue;
+		inst = &conf->mps_instances[i];
+		mps_table[inst->algo].free(inst->obj);
+		free(inst->name);
+		free(inst->params);
+	}
+	conf->mps_instances[0] = conf->mps_instances[keep];
+	stats = conf->mps_instances_stats[0];
+	conf->mps_instances_stats[0] = conf->mps_instances_stats[keep];
+	conf->mps_instances_stats[keep] = stats;
+	conf->n_mps_instances = 1;
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Choose the fastest instance on a sample of the streams, and keep only it for the measuring
+*
+* The result is loaded from the calibration file of the cache file, if it has the same key (and saved there if not).
+*
+* @param conf     The configuration (with the built instances)
+*/
+void calibrate_instances(Conf* conf) {
+	CalibrationResult* result;
+	const char* stream_name;
+	char *sample, *key, features[64];
+	size_t i, len, key_len, result_len;
+	int loaded = 0;
+
+	if (conf->n_mps_instances == 0) return;
+	sample = read_sample(conf, &stream_name, &len);
+	key = calibration_key(conf, sample, len, &key_len);
+	result_len = sizeof(CalibrationResult) + conf->n_mps_instances * sizeof(double);
+	result = (CalibrationResult*)malloc(result_len);
+	if (result == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	if (conf->cache_file_name) {
+		loaded = cache_load_calibration(conf, key, key_len, result, result_len) &&
+		         result->winner < conf->n_mps_instances;
+	}
+	if (!loaded) {
+		run_calibration(conf, sample, len, result);
+		if (conf->cache_file_name) cache_save_calibration(conf, key, key_len, result, result_len);
+	}
+
+	cpu_features_string(cpu_features(), features, sizeof(features));
+	printf("\nCalibration on %zu bytes of %s (cpu features: %s)%s\n", len, stream_name, features,
+	       loaded ? ", from the cache file" : "");
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		printf("  %10.3f ns per byte  %s\n", result->ns_per_byte[i], conf->mps_instances[i].name);
+	}
+	printf("Chosen: %s\n", conf->mps_instances[result->winner].name);
+	keep_instance(conf, result->winner);
+
+	free(result);
+	free(key);
+	free(sample);
+}
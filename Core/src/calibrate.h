@@ -0,0 +1,45 @@
+/**
+* Calibration - choosing the fastest mps instance on the host, before measuring
+*/
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include <stddef.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+struct _Conf;
+
+// The number of bytes of the first stream file that the instances read
+#ifndef CALIBRATE_SAMPLE_SIZE
+#define CALIBRATE_SAMPLE_SIZE (256 * 1024)
+#endif
+
+// The number of times every instance reads the sample (its fastest time is taken)
+#ifndef CALIBRATE_ROUNDS
+#define CALIBRATE_ROUNDS 3
+#endif
+
+// An instance whose first round is slower than CALIBRATE_CUTOFF times the fastest instance so far isn't read again
+#define CALIBRATE_CUTOFF 2
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+void calibrate_instances(struct _Conf* conf);
+
+
+#endif /* CALIBRATE_H */
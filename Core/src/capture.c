@@ -0,0 +1,671 @@
+/**
+* Reading packet capture files (pcap & pcapng), and splitting their payloads to flows (the "-p" option)
+*
+* A capture file is mapped to memory, and read in batches of packets. Only the TCP and UDP packets over IPv4 or IPv6
+* are read (the link types are Ethernet with VLAN tags, raw IP, Linux cooked capture and BSD loopback), and the
+* payload of a packet is a pointer to the mapping (nothing is copied). IP fragments are skipped.
+*
+* The front end splits the payloads to flows by their 5-tuple (every direction of a connection is a flow of its own),
+* which is what the matching is done on: every flow is read with a context of its own, which is reset when the flow
+* starts. The TCP payloads are put in the flow by their sequence numbers: the bytes that were already in the flow
+* (retransmissions) are removed, and after a gap (a lost packet) the flow continues from the packet. A SYN with a new
+* sequence number starts a new flow on the same 5-tuple, and a FIN or a RST ends the flow. When a new flow arrives
+* and the table is full, the least recently used flow is evicted (and when it comes back, it starts again).
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "capture.h"
+#include "util.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+// The magic numbers of pcap files (with microseconds or nanoseconds), and of pcapng sections
+#define PCAP_MAGIC           0xa1b2c3d4
+#define PCAP_MAGIC_NSEC      0xa1b23c4d
+#define PCAPNG_SHB_TYPE      0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER    0x1a2b3c4d
+
+#define PCAP_HEADER_SIZE     24
+#define PCAP_RECORD_SIZE     16
+
+// The pcapng blocks we read
+#define PCAPNG_IDB_TYPE      1 // interface description
+#define PCAPNG_PB_TYPE       2 // packet (obsolete)
+#define PCAPNG_SPB_TYPE      3 // simple packet
+#define PCAPNG_EPB_TYPE      6 // enhanced packet
+
+// The link types we read
+#define LINKTYPE_NULL        0
+#define LINKTYPE_ETHERNET    1
+#define LINKTYPE_RAW         101
+#define LINKTYPE_LOOP        108
+#define LINKTYPE_LINUX_SLL   113
+#define LINKTYPE_IPV4        228
+#define LINKTYPE_IPV6        229
+#define LINKTYPE_LINUX_SLL2  276
+
+#define ETHERTYPE_IPV4       0x0800
+#define ETHERTYPE_IPV6       0x86dd
+#define ETHERTYPE_VLAN       0x8100
+#define ETHERTYPE_QINQ       0x88a8
+
+// The number of buckets in the hash table of the flows
+#define FLOW_TABLE_BUCKETS   (2 * CAPTURE_MAX_FLOWS)
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Read a 16 bits number in the byte order of the capture file
+*/
+static inline uint16_t read_u16(const unsigned char* p, int swapped) {
+	uint16_t x;
+	memcpy(&x, p, sizeof(x));
+	return swapped ? __builtin_bswap16(x) : x;
+}
+
+/**
+* Read a 32 bits number in the byte order of the capture file
+*/
+static inline uint32_t read_u32(const unsigned char* p, int swapped) {
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return swapped ? __builtin_bswap32(x) : x;
+}
+
+/**
+* Read a 16 bits number in network byte order
+*/
+static inline uint16_t read_be16(const unsigned char* p) {
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/**
+* Read a 32 bits number in network byte order
+*/
+static inline uint32_t read_be32(const unsigned char* p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+* Parse the TCP or UDP header of a packet
+*
+* @param pkt      The packet (with the ip version, protocol and addresses in its key)
+* @param p        The transport header
+* @param len      The length of the transport header and its payload
+*
+* @return         1 if the packet was filled, 0 if it isn't a valid TCP or UDP packet
+*/
+static int parse_transport(CapturePacket* pkt, const unsigned char* p, size_t len) {
+	size_t header_len, udp_len;
+
+	if (pkt->key.protocol == IPPROTO_TCP) {
+		if (len < 20) return 0;
+		header_len = (p[12] >> 4) * 4;
+		if (header_len < 20 || header_len > len) return 0;
+		pkt->seq = read_be32(p + 4);
+		pkt->tcp_flags = p[13] & (CAPTURE_TCP_FIN | CAPTURE_TCP_SYN | CAPTURE_TCP_RST);
+	} else if (pkt->key.protocol == IPPROTO_UDP) {
+		if (len < 8) return 0;
+		header_len = 8;
+		// the UDP length can be shorter than the IP payload (padding)
+		udp_len = read_be16(p + 4);
+		if (udp_len >= 8 && udp_len < len) len = udp_len;
+	} else {
+		return 0;
+	}
+	pkt->key.src_port = read_be16(p);
+	pkt->key.dst_port = read_be16(p + 2);
+	pkt->payload = (const char*)p + header_len;
+	pkt->len = len - header_len;
+	return 1;
+}
+
+/**
+* Parse the IPv4 or IPv6 header of a packet (and the headers after it)
+*
+* @param pkt      The packet to fill
+* @param p        The IP header
+* @param len      The captured length of the IP header and its payload
+*
+* @return         1 if the packet was filled, 0 if it isn't a TCP or UDP packet (or it is a fragment)
+*/
+static int parse_ip(CapturePacket* pkt, const unsigned char* p, size_t len) {
+	size_t header_len, total_len, n_ext;
+	uint8_t next;
+
+	memset(pkt, 0, sizeof(CapturePacket));
+	if (len < 1) return 0;
+	if ((p[0] >> 4) == 4) {
+		if (len < 20) return 0;
+		header_len = (p[0] & 0xf) * 4;
+		total_len = read_be16(p + 2);
+		if (header_len < 20 || total_len < header_len || len < header_len) return 0;
+		// more fragments, or an offset of a fragment
+		if (read_be16(p + 6) & 0x3fff) return 0;
+		if (total_len < len) len = total_len;
+		pkt->key.ip_version = 4;
+		pkt->key.protocol = p[9];
+		memcpy(pkt->key.src, p + 12, 4);
+		memcpy(pkt->key.dst, p + 16, 4);
+		return parse_transport(pkt, p + header_len, len - header_len);
+	}
+	if ((p[0] >> 4) == 6) {
+		if (len < 40) return 0;
+		total_len = 40 + read_be16(p + 4);
+		if (total_len < len) len = total_len;
+		pkt->key.ip_version = 6;
+		memcpy(pkt->key.src, p + 8, 16);
+		memcpy(pkt->key.dst, p + 24, 16);
+		next = p[6];
+		header_len = 40;
+		// skip the extension headers (hop-by-hop, routing, destination options, authentication)
+		for (n_ext = 0; n_ext < 8 && (next == 0 || next == 43 || next == 60 || next == 51); ++n_ext) {
+			if (header_len + 8 > len) return 0;
+			total_len = next == 51 ? (p[header_len + 1] + 2) * 4 : (p[header_len + 1] + 1) * 8;
+			next = p[header_len];
+			header_len += total_len;
+		}
+		if (header_len > len) return 0;
+		pkt->key.protocol = next;
+		return parse_transport(pkt, p + header_len, len - header_len);
+	}
+	return 0;
+}
+
+/**
+* Parse a captured frame, by its link type
+*
+* @param pkt        The packet to fill
+* @param link_type  The link type of the frame
+* @param p          The frame
+* @param len        The captured length of the frame
+*
+* @return           1 if the packet was filled, 0 if it isn't a TCP or UDP packet over IP
+*/
+static int parse_frame(CapturePacket* pkt, uint32_t link_type, const unsigned char* p, size_t len) {
+	size_t offset;
+	uint32_t family;
+	uint16_t ether_type;
+
+	switch (link_type) {
+	case LINKTYPE_ETHERNET:
+		if (len < 14) return 0;
+		ether_type = read_be16(p + 12);
+		offset = 14;
+		while (ether_type == ETHERTYPE_VLAN || ether_type == ETHERTYPE_QINQ) {
+			if (offset + 4 > len) return 0;
+			ether_type = read_be16(p + offset + 2);
+			offset += 4;
+		}
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16) return 0;
+		ether_type = read_be16(p + 14);
+		offset = 16;
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		if (len < 20) return 0;
+		ether_type = read_be16(p);
+		offset = 20;
+		break;
+	case LINKTYPE_NULL:
+	case LINKTYPE_LOOP:
+		// the address family, in the byte order of the machine that captured (or big endian for LOOP)
+		if (len < 4) return 0;
+		family = read_be32(p);
+		if (family > 0xffff) family = __builtin_bswap32(family);
+		if (family == 2) {
+			ether_type = ETHERTYPE_IPV4;
+		} else if (family == 24 || family == 28 || family == 30) {
+			ether_type = ETHERTYPE_IPV6;
+		} else {
+			return 0;
+		}
+		offset = 4;
+		break;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		return parse_ip(pkt, p, len);
+	default:
+		return 0;
+	}
+	if (ether_type != ETHERTYPE_IPV4 && ether_type != ETHERTYPE_IPV6) return 0;
+	return parse_ip(pkt, p + offset, len - offset);
+}
+
+/**
+* Add an interface to the current pcapng section
+*
+* @param cf         The capture file
+* @param link_type  The link type of the interface
+* @param snap_len   The snapshot length of the interface
+*/
+static void capture_file_add_interface(CaptureFile* cf, uint32_t link_type, uint32_t snap_len) {
+	if (cf->n_ifs == cf->ifs_capacity) {
+		cf->ifs_capacity = cf->ifs_capacity ? 2 * cf->ifs_capacity : 4;
+		cf->if_link_types = (uint32_t*)realloc(cf->if_link_types, cf->ifs_capacity * sizeof(uint32_t));
+		cf->if_snap_lens = (uint32_t*)realloc(cf->if_snap_lens, cf->ifs_capacity * sizeof(uint32_t));
+		if (cf->if_link_types == NULL || cf->if_snap_lens == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+	}
+	cf->if_link_types[cf->n_ifs] = link_type;
+	cf->if_snap_lens[cf->n_ifs] = snap_len;
+	++cf->n_ifs;
+}
+
+/**
+* Read the next record of a pcap file
+*
+* @param cf       The capture file
+* @param pkt      Where to put the packet
+*
+* @return         1 if pkt was filled, 0 if the record isn't a packet we read, or -1 in the end of the file
+*/
+static int pcap_next_record(CaptureFile* cf, CapturePacket* pkt) {
+	const unsigned char* record = (const unsigned char*)cf->data + cf->offset;
+	size_t captured;
+
+	if (cf->size - cf->offset < PCAP_RECORD_SIZE) return -1;
+	captured = read_u32(record + 8, cf->swapped);
+	if (cf->size - cf->offset - PCAP_RECORD_SIZE < captured) return -1;
+	cf->offset += PCAP_RECORD_SIZE + captured;
+	++cf->n_packets;
+	return parse_frame(pkt, cf->link_type, record + PCAP_RECORD_SIZE, captured);
+}
+
+/**
+* Read the next block of a pcapng file
+*
+* @param cf       The capture file
+* @param pkt      Where to put the packet
+*
+* @return         1 if pkt was filled, 0 if the block isn't a packet we read, or -1 in the end of the file
+*/
+static int pcapng_next_block(CaptureFile* cf, CapturePacket* pkt) {
+	const unsigned char* block = (const unsigned char*)cf->data + cf->offset;
+	const unsigned char* body;
+	uint32_t type, byte_order, interface, snap_len;
+	size_t len, body_len, captured;
+
+	if (cf->size - cf->offset < 12) return -1;
+	memcpy(&type, block, sizeof(type));
+	if (type == PCAPNG_SHB_TYPE) {
+		// a new section, with its own byte order and interfaces
+		memcpy(&byte_order, block + 8, sizeof(byte_order));
+		if (byte_order == PCAPNG_BYTE_ORDER) {
+			cf->swapped = 0;
+		} else if (byte_order == __builtin_bswap32(PCAPNG_BYTE_ORDER)) {
+			cf->swapped = 1;
+		} else {
+			return -1;
+		}
+		cf->n_ifs = 0;
+	}
+	type = read_u32(block, cf->swapped);
+	len = read_u32(block + 4, cf->swapped);
+	if (len < 12 || len % 4 != 0 || cf->size - cf->offset < len) return -1;
+	cf->offset += len;
+	body = block + 8;
+	body_len = len - 12;
+
+	switch (type) {
+	case PCAPNG_IDB_TYPE:
+		if (body_len >= 8) capture_file_add_interface(cf, read_u16(body, cf->swapped), read_u32(body + 4, cf->swapped));
+		return 0;
+	case PCAPNG_EPB_TYPE:
+	case PCAPNG_PB_TYPE:
+		if (body_len < 20) return 0;
+		interface = type == PCAPNG_EPB_TYPE ? read_u32(body, cf->swapped) : read_u16(body, cf->swapped);
+		captured = read_u32(body + 12, cf->swapped);
+		if (captured > body_len - 20 || interface >= cf->n_ifs) return 0;
+		++cf->n_packets;
+		return parse_frame(pkt, cf->if_link_types[interface], body + 20, captured);
+	case PCAPNG_SPB_TYPE:
+		if (body_len < 4 || cf->n_ifs == 0) return 0;
+		// the captured length is the original length, up to the snapshot length of the first interface
+		captured = read_u32(body, cf->swapped);
+		snap_len = cf->if_snap_lens[0];
+		if (snap_len != 0 && captured > snap_len) captured = snap_len;
+		if (captured > body_len - 4) captured = body_len - 4;
+		++cf->n_packets;
+		return parse_frame(pkt, cf->if_link_types[0], body + 4, captured);
+	default:
+		return 0;
+	}
+}
+
+/**
+* Hash the 5-tuple of a flow (FNV-1a)
+*/
+static inline uint32_t hash_flow_key(const FlowKey* key) {
+	const unsigned char* p = (const unsigned char*)key;
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < sizeof(FlowKey); ++i) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/**
+* Remove a flow from the list of the flows by their use
+*/
+static void flow_table_unlink(FlowTable* table, size_t i) {
+	Flow* flow = &table->flows[i];
+	if (flow->lru_prev != CAPTURE_NO_FLOW) {
+		table->flows[flow->lru_prev].lru_next = flow->lru_next;
+	} else {
+		table->lru_head = flow->lru_next;
+	}
+	if (flow->lru_next != CAPTURE_NO_FLOW) {
+		table->flows[flow->lru_next].lru_prev = flow->lru_prev;
+	} else {
+		table->lru_tail = flow->lru_prev;
+	}
+}
+
+/**
+* Put a flow at the start of the list of the flows by their use (as the most recently used)
+*/
+static void flow_table_push_front(FlowTable* table, size_t i) {
+	Flow* flow = &table->flows[i];
+	flow->lru_prev = CAPTURE_NO_FLOW;
+	flow->lru_next = table->lru_head;
+	if (table->lru_head != CAPTURE_NO_FLOW) {
+		table->flows[table->lru_head].lru_prev = i;
+	} else {
+		table->lru_tail = i;
+	}
+	table->lru_head = i;
+}
+
+/**
+* Remove a flow from the table (it becomes free)
+*/
+static void flow_table_release(FlowTable* table, size_t i) {
+	size_t* link = &table->buckets[table->flows[i].hash % FLOW_TABLE_BUCKETS];
+	while (*link != i) {
+		link = &table->flows[*link].bucket_next;
+	}
+	*link = table->flows[i].bucket_next;
+	flow_table_unlink(table, i);
+	table->flows[i].lru_prev = table->free_head;
+	table->free_head = i;
+}
+
+/**
+* Find the flow of a 5-tuple, or add it if it isn't in the table (evicting the least recently used flow if the
+* table is full), and make it the most recently used flow
+*
+* @param table    The flow table
+* @param key      The 5-tuple of the flow
+* @param hash     The hash of the key
+*
+* @return         The index of the flow
+*/
+static size_t flow_table_find_or_add(FlowTable* table, const FlowKey* key, uint32_t hash) {
+	size_t i, bucket = hash % FLOW_TABLE_BUCKETS;
+	Flow* flow;
+
+	for (i = table->buckets[bucket]; i != CAPTURE_NO_FLOW; i = table->flows[i].bucket_next) {
+		if (table->flows[i].hash == hash && memcmp(&table->flows[i].key, key, sizeof(FlowKey)) == 0) {
+			flow_table_unlink(table, i);
+			flow_table_push_front(table, i);
+			return i;
+		}
+	}
+	if (table->free_head == CAPTURE_NO_FLOW) {
+		flow_table_release(table, table->lru_tail);
+		++table->n_evicted;
+	}
+	i = table->free_head;
+	flow = &table->flows[i];
+	table->free_head = flow->lru_prev;
+	flow->key = *key;
+	flow->hash = hash;
+	flow->next_seq = 0;
+	flow->seq_valid = 0;
+	flow->is_new = 1;
+	flow->bucket_next = table->buckets[bucket];
+	table->buckets[bucket] = i;
+	flow_table_push_front(table, i);
+	++table->n_flows;
+	return i;
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Open a capture file (pcap or pcapng, by its magic number), and map it to memory
+*
+* @param cf       The capture file to open
+* @param name     The name of the file
+*/
+void capture_file_open(CaptureFile* cf, const char* name) {
+	const unsigned char* header;
+	struct stat st;
+	uint32_t magic;
+	void* data;
+
+	memset(cf, 0, sizeof(CaptureFile));
+	cf->name = name;
+	cf->fd = open(name, O_RDONLY);
+	if (cf->fd == -1) {
+		fprintf(stderr, "can't open capture file %s: %s\n", name, strerror(errno));
+		FatalExit();
+	}
+	if (fstat(cf->fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Error: capture file %s must be a regular file (it is mapped to memory)\n", name);
+		FatalExit();
+	}
+	if (st.st_size < PCAP_HEADER_SIZE) {
+		fprintf(stderr, "Error: %s isn't a pcap or pcapng file\n", name);
+		FatalExit();
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, cf->fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "can't map capture file %s: %s\n", name, strerror(errno));
+		FatalExit();
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	cf->data = (const char*)data;
+	cf->size = st.st_size;
+
+	header = (const unsigned char*)cf->data;
+	memcpy(&magic, header, sizeof(magic));
+	if (magic == PCAPNG_SHB_TYPE) {
+		cf->pcapng = 1;
+	} else if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC) {
+		cf->link_type = read_u32(header + 20, 0);
+		cf->offset = PCAP_HEADER_SIZE;
+	} else if (magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+		cf->swapped = 1;
+		cf->link_type = read_u32(header + 20, 1);
+		cf->offset = PCAP_HEADER_SIZE;
+	} else {
+		fprintf(stderr, "Error: %s isn't a pcap or pcapng file\n", name);
+		FatalExit();
+	}
+}
+
+/**
+* Read the next batch of TCP and UDP packets from a capture file
+*
+* The batch ends after max_packets packets, or before the packet that would make the total length of the payloads
+* more than max_bytes.
+*
+* @param cf           The capture file
+* @param packets      Where to put the packets
+* @param max_packets  The maximal number of packets in the batch
+* @param max_bytes    The maximal total length of the payloads in the batch (at least the length of an IP packet)
+*
+* @return             The number of packets put in packets, or 0 in the end of the file
+*/
+size_t capture_file_next_batch(CaptureFile* cf, CapturePacket* packets, size_t max_packets, size_t max_bytes) {
+	size_t n = 0, bytes = 0, offset, n_packets;
+	int res;
+
+	while (n < max_packets) {
+		offset = cf->offset;
+		n_packets = cf->n_packets;
+		res = cf->pcapng ? pcapng_next_block(cf, &packets[n]) : pcap_next_record(cf, &packets[n]);
+		if (res < 0) {
+			if (cf->offset != cf->size) {
+				fprintf(stderr, "Warning: capture file %s is truncated or corrupted, reading stopped at offset %zu\n",
+				        cf->name, cf->offset);
+				cf->offset = cf->size;
+			}
+			break;
+		}
+		if (res == 0) {
+			if (cf->n_packets != n_packets) ++cf->n_skipped;
+			continue;
+		}
+		if (bytes + packets[n].len > max_bytes) {
+			if (n != 0) {
+				// leave this packet for the next batch
+				cf->offset = offset;
+				--cf->n_packets;
+				break;
+			}
+			packets[n].len = max_bytes;
+		}
+		bytes += packets[n].len;
+		++n;
+	}
+	return n;
+}
+
+/**
+* Close a capture file (and unmap it)
+*
+* @param cf       The capture file
+*/
+void capture_file_close(CaptureFile* cf) {
+	munmap((void*)cf->data, cf->size);
+	close(cf->fd);
+	free(cf->if_link_types);
+	free(cf->if_snap_lens);
+}
+
+/**
+* Initialize an empty flow table (before reading a capture file)
+*
+* @param table    The flow table
+*/
+void flow_table_init(FlowTable* table) {
+	size_t i;
+	for (i = 0; i < FLOW_TABLE_BUCKETS; ++i) {
+		table->buckets[i] = CAPTURE_NO_FLOW;
+	}
+	for (i = 0; i < CAPTURE_MAX_FLOWS; ++i) {
+		table->flows[i].lru_prev = i + 1 < CAPTURE_MAX_FLOWS ? i + 1 : CAPTURE_NO_FLOW;
+	}
+	table->free_head = 0;
+	table->lru_head = CAPTURE_NO_FLOW;
+	table->lru_tail = CAPTURE_NO_FLOW;
+	table->n_flows = 0;
+	table->n_evicted = 0;
+	table->n_bytes = 0;
+}
+
+/**
+* Put a batch of packets in their flows, and get the segments of the flows from them
+*
+* The packets that add nothing to their flows (no payload, or only bytes that are already in the flow) have no
+* segment. The segments are put one after another from offset 0 (see CaptureSegment).
+*
+* @param table     The flow table
+* @param packets   The packets (by their order in the capture file)
+* @param n         The number of packets
+* @param segments  Where to put the segments (at most n)
+*
+* @return          The number of segments
+*/
+size_t flow_table_add_packets(FlowTable* table, const CapturePacket* packets, size_t n, CaptureSegment* segments) {
+	const CapturePacket* pkt;
+	CaptureSegment* segment;
+	const char* data;
+	size_t i, index, len, n_segments = 0, offset = 0;
+	uint32_t hash, seq, known;
+	Flow* flow;
+
+	for (i = 0; i < n; ++i) {
+		pkt = &packets[i];
+		hash = hash_flow_key(&pkt->key);
+		index = flow_table_find_or_add(table, &pkt->key, hash);
+		flow = &table->flows[index];
+		data = pkt->payload;
+		len = pkt->len;
+
+		if (pkt->key.protocol == IPPROTO_TCP) {
+			seq = pkt->seq;
+			if (pkt->tcp_flags & CAPTURE_TCP_SYN) {
+				// the SYN takes a sequence number, and a SYN of another connection starts a new flow
+				++seq;
+				if (flow->seq_valid && flow->next_seq != seq) flow->is_new = 1;
+				flow->next_seq = seq;
+				flow->seq_valid = 1;
+			} else if (!flow->seq_valid) {
+				flow->next_seq = seq;
+				flow->seq_valid = 1;
+			}
+			// remove the bytes that are already in the flow (after a gap, continue from the packet)
+			known = flow->next_seq - seq;
+			if ((int32_t)known > 0) {
+				if (known >= len) {
+					len = 0;
+				} else {
+					data += known;
+					len -= known;
+					seq += known;
+				}
+			}
+			if (len != 0) flow->next_seq = seq + (uint32_t)len;
+		}
+
+		if (len != 0) {
+			segment = &segments[n_segments++];
+			segment->data = data;
+			segment->len = len;
+			segment->offset = offset;
+			segment->flow = index;
+			segment->hash = hash;
+			segment->new_flow = flow->is_new;
+			flow->is_new = 0;
+			offset += len;
+		}
+		if (pkt->key.protocol == IPPROTO_TCP && (pkt->tcp_flags & (CAPTURE_TCP_FIN | CAPTURE_TCP_RST))) {
+			flow_table_release(table, index);
+		}
+	}
+	table->n_bytes += offset;
+	return n_segments;
+}
@@ -0,0 +1,142 @@
+/**
+* Reading packet capture files (pcap & pcapng), and splitting their payloads to flows (the "-p" option)
+*/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+// The maximal number of flows read at the same time (every flow has a context in every instance that reads it).
+// When a new flow arrives and there are already that many, the least recently used flow is evicted.
+#ifndef CAPTURE_MAX_FLOWS
+#define CAPTURE_MAX_FLOWS 256
+#endif
+
+// The maximal number of packets in a batch
+#define CAPTURE_BATCH_PACKETS 4096
+
+// Not a flow (an index of a flow in the flow table)
+#define CAPTURE_NO_FLOW ((size_t)-1)
+
+/**
+* The 5-tuple of a flow (one direction of a connection)
+*
+* A key should be zeroed before it is filled (it is hashed and compared as bytes).
+*/
+typedef struct {
+	uint8_t   src[16];     // the source address (IPv4 addresses are in the first 4 bytes)
+	uint8_t   dst[16];     // the destination address
+	uint16_t  src_port;
+	uint16_t  dst_port;
+	uint8_t   ip_version;  // 4 or 6
+	uint8_t   protocol;    // IPPROTO_TCP or IPPROTO_UDP
+} FlowKey;
+
+// The TCP flags the flows are tracked by
+#define CAPTURE_TCP_FIN 0x01
+#define CAPTURE_TCP_SYN 0x02
+#define CAPTURE_TCP_RST 0x04
+
+/**
+* A TCP or UDP packet of a capture file
+*/
+typedef struct {
+	FlowKey       key;
+	const char   *payload;   // the payload (in the mapping of the capture file)
+	size_t        len;       // the length of the payload (that was captured)
+	uint32_t      seq;       // the sequence number (TCP only)
+	uint8_t       tcp_flags; // the CAPTURE_TCP_* flags (TCP only)
+} CapturePacket;
+
+/**
+* A capture file, mapped to memory (the payloads of its packets are read from the mapping, without copying)
+*/
+typedef struct {
+	const char   *name;
+	int           fd;
+	const char   *data;        // the mapping of the file
+	size_t        size;
+	size_t        offset;      // the offset of the next record (packet or pcapng block)
+	int           pcapng;      // whether the file is pcapng (otherwise it is pcap)
+	int           swapped;     // whether the byte order of the file (or of the current pcapng section) isn't ours
+	uint32_t      link_type;   // the link type of the pcap file
+	uint32_t     *if_link_types; // the link type of every interface of the current pcapng section
+	uint32_t     *if_snap_lens;  // the snapshot length of every interface of the current pcapng section
+	size_t        n_ifs;
+	size_t        ifs_capacity;
+	size_t        n_packets;   // the number of records read so far
+	size_t        n_skipped;   // the number of packets that aren't TCP or UDP over IP (or are IP fragments)
+} CaptureFile;
+
+/**
+* A flow in the flow table
+*
+* The index of the flow in the table is the index of its context (in every instance that reads it).
+*/
+typedef struct {
+	FlowKey   key;
+	uint32_t  hash;        // the hash of the key (the flows are dispatched to the workers by it)
+	uint32_t  next_seq;    // the sequence number of the next byte of a TCP flow
+	int       seq_valid;   // whether next_seq was set
+	int       is_new;      // whether the next segment of the flow is its first one (its context should be reset)
+	size_t    bucket_next; // the next flow in the bucket of the hash table
+	size_t    lru_prev;    // the more recently used flow (or the next free flow, for a free flow)
+	size_t    lru_next;    // the less recently used flow
+} Flow;
+
+/**
+* The flows of a capture file: a hash table of the flows from their 5-tuple, with at most CAPTURE_MAX_FLOWS flows
+* (the flows are in a list by the time they were used, so the least recently used is evicted when needed)
+*/
+typedef struct {
+	Flow      flows[CAPTURE_MAX_FLOWS];
+	size_t    buckets[2 * CAPTURE_MAX_FLOWS];
+	size_t    free_head;   // the list of the free flows
+	size_t    lru_head;    // the most recently used flow
+	size_t    lru_tail;    // the least recently used flow
+	size_t    n_flows;     // the number of flows seen (with the evicted and the ended)
+	size_t    n_evicted;
+	size_t    n_bytes;     // the number of payload bytes put in segments
+} FlowTable;
+
+/**
+* A segment of a flow: the new payload of a packet, after removing the bytes that were already in the flow
+*
+* The segments of a batch are put one after another in the results buffer, from offset (the result on
+* data[i] is at offset + i).
+*/
+typedef struct {
+	const char   *data;
+	size_t        len;
+	size_t        offset;
+	size_t        flow;     // the index of the flow (and of its context)
+	uint32_t      hash;     // the hash of the flow
+	int           new_flow; // whether this is the first segment of the flow (so its context should be reset)
+} CaptureSegment;
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+void capture_file_open(CaptureFile* cf, const char* name);
+size_t capture_file_next_batch(CaptureFile* cf, CapturePacket* packets, size_t max_packets, size_t max_bytes);
+void capture_file_close(CaptureFile* cf);
+void flow_table_init(FlowTable* table);
+size_t flow_table_add_packets(FlowTable* table, const CapturePacket* packets, size_t n, CaptureSegment* segments);
+
+#endif /* CAPTURE_H */
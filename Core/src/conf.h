@@ -4,6 +4,7 @@
 #include "PatternsTree.h"
 #include "mps.h"
 #include "measure.h"
+#include "report.h"
 
 /* This configuration file should include other headers, while headers should not include that file
    (instead, use struct _Conf in other headers, and include this header in their source file) */
@@ -13,13 +14,28 @@ typedef struct _Conf {
 	size_t n_dictionary_files;
 	char** stream_files;
 	size_t n_stream_files;
+	int* stream_is_capture; // whether every stream file is a packet capture (given with -p)
+	size_t n_capture_files;
 	size_t max_pat_len;
 	MpsInstance* mps_instances;
 	InstanceStats* mps_instances_stats;
 	MpsInstance reliable_mps_instance;
 	size_t n_mps_instances;
 	PatternsTree* patterns_tree;
+	PatternsList patterns; // the patterns of the dictionaries (with their ids in patterns_tree)
 	char* output_file_name;
+	int output_format; // the format of the output file (REPORT_CSV or REPORT_JSON)
+	char* baseline_file_name; // the results of an earlier run to compare to (NULL if not comparing)
+	double regression_threshold; // the change from the baseline which is a regression (in percents)
+	size_t n_threads; // number of worker threads used to measure the mps instances
+	PerfEventTypeGroup* perf_groups; // the perf_event groups to measure (the unsupported events are removed)
+	size_t n_perf_groups;
+	size_t n_interleaved; // number of streams every chunk is split to, and read together (at most MPS_MAX_BATCH)
+	int calibrate; // whether to measure only the fastest instance on a sample of the streams (see "calibrate.c")
+	int scan_mode; // the mode the streams are scanned with (MPS_SCAN_*), or MPS_SCAN_NONE to read them with read_block
+	char* cache_file_name; // the cache file of the loaded dictionaries (NULL if not using cache)
+	void* cache; // the state of the cache (see cache.c)
+	char* reload_file_name; // the patterns diff to reload the dictionaries with while measuring (NULL if not reloading)
 } Conf;
 
 #endif
\ No newline at end of file
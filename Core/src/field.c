@@ -50,8 +50,13 @@ field_t calculate_inverse(field_t a, field_t p) {
 	* When rr becomes 0, it means that r is now gcd(a,p) (which should be 1, since p should be prime)
 	* So now, we get that for r = 1, t * a = 1 (mod p)
 	*/
-	field_t r = p, t = 0, rr = a, tt = 1;
+	field_t r = p, rr = a;
 	field_t temp, q;
+	/*
+	* t and tt are kept as signed values (and not modulo p), since their absolute value is never above p,
+	* and so q * tt never overflows (even when p is near 2^61, and a product modulo p would overflow).
+	*/
+	long long t = 0, tt = 1, stemp;
 	while (rr != 0) {
 		q = r / rr;
 		// (r, rr) = (rr, r - q * rr)
@@ -59,14 +64,33 @@ field_t calculate_inverse(field_t a, field_t p) {
 		rr = r - q * rr;
 		r = temp;
 		// (t, tt) = (tt, t - q * tt)
-		temp = tt;
-		/*
-		* Every tt here (with the same modulo p) should do the trick, but we want 0 < tt < p.
-		* Because we work with unsigned, we very careful not to go negative for a moment.
-		*/
-		tt = t > q * tt ? t - q * tt : t + p - (q * tt % p);
-		t = temp;
+		stemp = tt;
+		tt = t - (long long)q * tt;
+		t = stemp;
 	}
 	// ASSERT(r, 1) // r need to be 1 right now (if, indeed, gcd(a,p) == 1)
-	return t;
+	return t < 0 ? (field_t)(t + (long long)p) : (field_t)t;
+}
+
+/**
+* Choose a random value of the field, that isn't 0 or 1 (with rand(), so srand should be called before).
+*
+* @return      The random value
+*/
+field_t field_random() {
+	field_t r;
+	do {
+#if FIELD_P > RAND_MAX
+		// rand() might give only 15 bits, so the value is made of enough calls (the modulo is only done here)
+		int i;
+		r = 0;
+		for (i = 0; i < 5; ++i) {
+			r = (r << 15) ^ (field_t)rand();
+		}
+		r %= FIELD_P;
+#else
+		r = (field_t)rand() % FIELD_P;
+#endif
+	} while (r <= 1);
+	return r;
 }
@@ -19,9 +19,35 @@
 #define MOD_INC(x,p) ((x) = ((x) + 1) % (p))
 #define MOD_DEC(x,p) ((x) = ((x) ? (x) - 1 : (p) - 1))
 
-// note: field size must be up to sqrt(sizeof(field_t)) because we need to be able to multiply
 typedef unsigned long long field_t;
 
+/*
+* The field of the fingerprints is chosen at compile time (e.g. make CFLAGS=-DFIELD_MERSENNE61):
+*   FIELD_MERSENNE31 (default)  p = 2^31 - 1, reduced by shifts and adds
+*   FIELD_MERSENNE61            p = 2^61 - 1, reduced by shifts and adds of a 128 bits product
+*                               (a much larger field, so much less fingerprint collisions)
+*   FIELD_BARRETT               any prime p = FIELD_P < 2^32 (2^31 - 1 by default), Barrett reduction
+* None of them divides on the hot path.
+*/
+#if defined(FIELD_MERSENNE61)
+#define FIELD_BITS 61
+#define FIELD_P ((1ull << FIELD_BITS) - 1)
+#elif defined(FIELD_BARRETT)
+#ifndef FIELD_P
+#define FIELD_P 2147483647ull
+#endif
+#if FIELD_P >= (1ull << 32) || FIELD_P <= 256
+#error "FIELD_P must be a prime between 256 and 2^32 (so a product of two field values fits in field_t)"
+#endif
+#define FIELD_BARRETT_MU (~0ull / (FIELD_P)) // floor(2^64 / p) (p isn't a power of 2)
+#else
+#ifndef FIELD_MERSENNE31
+#define FIELD_MERSENNE31
+#endif
+#define FIELD_BITS 31
+#define FIELD_P ((1ull << FIELD_BITS) - 1)
+#endif
+
 /**
 * Struct for saving value in field and it's inverse
 */
@@ -39,12 +65,65 @@ typedef struct {
 /* Calculate the inverse of given field value and the field size */
 field_t calculate_inverse(field_t a, field_t p);
 
+/* Choose a random value of the field (that isn't 0 or 1) */
+field_t field_random();
+
 
 /******************************************************************************************************
 *		INLINE FUNCTIONS
 ******************************************************************************************************/
 
 
+/**
+* Multiply two values of the field (both must be smaller than FIELD_P).
+*
+* @param a     The first value
+* @param b     The second value
+*
+* @return      a * b mod FIELD_P
+*/
+static inline field_t field_mod_mul(field_t a, field_t b) {
+#if defined(FIELD_MERSENNE61)
+	// 2^61 == 1 (mod p), so the high bits are added to the low bits (twice, the first sum might be a bit above p)
+	unsigned __int128 x = (unsigned __int128)a * b;
+	field_t r = ((field_t)x & FIELD_P) + (field_t)(x >> FIELD_BITS);
+	r = (r & FIELD_P) + (r >> FIELD_BITS);
+#elif defined(FIELD_BARRETT)
+	// The estimated quotient is at most 1 less than the real one, so one subtraction is enough
+	field_t x = a * b;
+	field_t q = (field_t)(((unsigned __int128)x * FIELD_BARRETT_MU) >> 64);
+	field_t r = x - q * FIELD_P;
+#else
+	// 2^31 == 1 (mod p), so the high bits are added to the low bits (twice, the first sum might be a bit above p)
+	field_t x = a * b;
+	field_t r = (x & FIELD_P) + (x >> FIELD_BITS);
+	r = (r & FIELD_P) + (r >> FIELD_BITS);
+#endif
+	return r >= FIELD_P ? r - FIELD_P : r;
+}
+
+/**
+* Add two values of the field (both must be smaller than FIELD_P).
+*/
+static inline field_t field_mod_add(field_t a, field_t b) {
+	field_t r = a + b;
+	return r >= FIELD_P ? r - FIELD_P : r;
+}
+
+/**
+* Subtract a value of the field from another (both must be smaller than FIELD_P).
+*/
+static inline field_t field_mod_sub(field_t a, field_t b) {
+	return a >= b ? a - b : a + FIELD_P - b;
+}
+
+/**
+* The value of a char in the field (chars are taken as unsigned, so the value is always smaller than FIELD_P)
+*/
+static inline field_t field_from_char(char c) {
+	return (field_t)(unsigned char)c;
+}
+
 static inline void field_copy(FieldVal* dst, FieldVal* src) {
     dst->val = src->val;
     dst->inv = src->inv;
@@ -56,27 +135,25 @@ static inline void field_copy(FieldVal* dst, FieldVal* src) {
 * @param dst          The value to put the result numerator/denomerater in
 * @param numerator    The numerator of the division
 * @param denomerator  The denomerator of the division
-* @param p			The size of the field
 */
-static inline void field_div(FieldVal* dst, FieldVal* numerator, FieldVal* denomerator, field_t p) {
+static inline void field_div(FieldVal* dst, FieldVal* numerator, FieldVal* denomerator) {
     // since if dst == denomerator, when we change dst->val we also change denomerator->val
     // to solve this, we save den_val before changing dst->val
     field_t den_val = denomerator->val;
-    dst->val = (numerator->val * denomerator->inv) % p;
-    dst->inv = (den_val * numerator->inv) % p;
+    dst->val = field_mod_mul(numerator->val, denomerator->inv);
+    dst->inv = field_mod_mul(den_val, numerator->inv);
 }
 
 /**
 * Multiply in the field.
 *
-* @param dst          The value to put the result numerator/denomerater in
-* @param numerator    The numerator of the division
-* @param denomerator  The denomerator of the division
-* @param p			The size of the field
+* @param dst          The value to put the result in
+* @param val1         The first value
+* @param val2         The second value
 */
-static inline void field_mul(FieldVal* dst, FieldVal* val1, FieldVal* val2, field_t p) {
-    dst->val = (val1->val * val2->val) % p;
-    dst->inv = (val1->inv * val2->inv) % p;
+static inline void field_mul(FieldVal* dst, FieldVal* val1, FieldVal* val2) {
+    dst->val = field_mod_mul(val1->val, val2->val);
+    dst->inv = field_mod_mul(val1->inv, val2->inv);
 }
 
 #endif /* FIELD_H */
@@ -0,0 +1,324 @@
+/**
+* KMP bank - many real-time kmp objects that read the same characters
+*
+* Every kmp object is a lane of the bank. The offsets, the pattern bytes and the restart offsets of the lanes are kept
+* in parallel arrays, so the common step of a lane (it isn't in the middle of a failure function loop, and the next
+* character of its pattern match, or it is at the start of its pattern) is done for 8 lanes at once with AVX2
+* (or 16 with AVX-512): the next character of every lane is gathered from the patterns, compared with the character
+* from the stream, and the offsets of the lanes that match are advanced (or set to the restart offset on a match).
+* Only the lanes that need the failure function (a mismatch after a partial match, or the looping and buffering of the
+* real-time kmp) are read by kmp_read_char on their own state, so every state is always the same as if the lane was
+* read by kmp_read_char alone.
+*
+* The lanes are read one group at a time over the whole tile (so the offsets of the group stay in a register),
+* and their matches are returned as bitmaps.
+*
+* The vectorized read is chosen by the cpu features (cpu_features), of those that the owner of the bank allows.
+* The scalar read (for other cpus) is kmp_read_char on every lane.
+*/
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "kmpbank.h"
+#include "util.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KMP_BANK_X86
+#include <immintrin.h>
+#endif
+
+
+/******************************************************************************************************
+*		DEFINITIONS
+******************************************************************************************************/
+
+
+// The flags of a state of a lane that is read by kmp_read_char (the real-time looping of the failure function)
+#define KMP_BANK_SLOW_FLAGS (KMP_LOOP_FAIL_FLAG | KMP_HAVE_BUFFER_FLAG)
+
+// Padding after the patterns, so a 32 bits gather at the last character stays in the array
+#define KMP_BANK_PADDING 4
+
+
+/******************************************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************************************/
+
+
+/**
+* Set the bit of a match of a lane on the j-th character of the tile
+*/
+static inline void kmp_bank_set_match(uint64_t* matches, size_t lane, size_t j) {
+	matches[lane * KMP_BANK_WORDS + j / 64] |= (uint64_t)1 << (j % 64);
+}
+
+/**
+* Read the lanes [from, to) of the bank with kmp_read_char (see KMPBankReadFunc)
+*/
+static void kmp_bank_read_lanes(const KMPBank* bank, KMPState** states, const char* buf, size_t len,
+                                uint64_t* matches, size_t from, size_t to) {
+	size_t lane, j;
+	KMPRealTime* kmp;
+	KMPState* state;
+	for (lane = from; lane < to; ++lane) {
+		kmp = bank->kmps[lane];
+		state = states[lane];
+		for (j = 0; j < len; ++j) {
+			if (kmp_read_char(kmp, state, buf[j])) kmp_bank_set_match(matches, lane, j);
+		}
+	}
+}
+
+/**
+* Scalar read, kmp_read_char on every lane (see KMPBankReadFunc)
+*/
+static void kmp_bank_read_scalar(const KMPBank* bank, KMPState** states, const char* buf, size_t len,
+                                 uint64_t* matches) {
+	memset(matches, 0, bank->n_lanes * KMP_BANK_WORDS * sizeof(uint64_t));
+	kmp_bank_read_lanes(bank, states, buf, len, matches, 0, bank->n_lanes);
+}
+
+#ifdef KMP_BANK_X86
+
+/**
+* Read a character with a lane of a vectorized group by kmp_read_char
+*
+* @param bank      The bank
+* @param state     The state of the lane
+* @param lane      The lane
+* @param c         The character
+* @param j         The index of the character in the tile
+* @param matches   The matches of the tile
+* @param off       The offset of the lane in the group (updated)
+*
+* @return          Whether the lane should be read by kmp_read_char on the next character too
+*/
+static inline int kmp_bank_step_lane(const KMPBank* bank, KMPState* state, size_t lane, char c, size_t j,
+                                     uint64_t* matches, int32_t* off) {
+	state->offset = (size_t)*off;
+	if (kmp_read_char(bank->kmps[lane], state, c)) kmp_bank_set_match(matches, lane, j);
+	*off = (int32_t)state->offset;
+	return (state->flags & KMP_BANK_SLOW_FLAGS) != 0;
+}
+
+/**
+* AVX2 read, 8 lanes at once (see KMPBankReadFunc)
+*/
+__attribute__((target("avx2")))
+static void kmp_bank_read_avx2(const KMPBank* bank, KMPState** states, const char* buf, size_t len,
+                               uint64_t* matches) {
+	const __m256i low = _mm256_set1_epi32(0xff), zero = _mm256_setzero_si256(), ones = _mm256_set1_epi32(-1);
+	const int* chars = (const int*)bank->chars;
+	__m256i starts, lens, restarts, off, slow, c, eq, need, adv, full;
+	int32_t offs[8], slows[8];
+	size_t g, l, j, n_groups = bank->n_lanes / 8 * 8;
+	unsigned full_bits, need_bits;
+
+	memset(matches, 0, bank->n_lanes * KMP_BANK_WORDS * sizeof(uint64_t));
+	for (g = 0; g < n_groups; g += 8) {
+		for (l = 0; l < 8; ++l) {
+			offs[l] = (int32_t)states[g + l]->offset;
+			slows[l] = (states[g + l]->flags & KMP_BANK_SLOW_FLAGS) ? -1 : 0;
+		}
+		starts = _mm256_loadu_si256((const __m256i*)(bank->starts + g));
+		lens = _mm256_loadu_si256((const __m256i*)(bank->lens + g));
+		restarts = _mm256_loadu_si256((const __m256i*)(bank->restarts + g));
+		off = _mm256_loadu_si256((const __m256i*)offs);
+		slow = _mm256_loadu_si256((const __m256i*)slows);
+		for (j = 0; j < len; ++j) {
+			c = _mm256_set1_epi32((unsigned char)buf[j]);
+			eq = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_i32gather_epi32(chars, _mm256_add_epi32(starts, off), 1), low), c);
+			// the slow lanes, and the lanes with a mismatch after a partial match, are read by kmp_read_char
+			need = _mm256_or_si256(slow, _mm256_andnot_si256(_mm256_or_si256(eq, _mm256_cmpeq_epi32(off, zero)), ones));
+			adv = _mm256_andnot_si256(need, eq);
+			off = _mm256_sub_epi32(off, adv);
+			full = _mm256_and_si256(adv, _mm256_cmpeq_epi32(off, lens));
+			off = _mm256_blendv_epi8(off, restarts, full);
+			full_bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(full));
+			need_bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(need));
+			while (full_bits) {
+				kmp_bank_set_match(matches, g + __builtin_ctz(full_bits), j);
+				full_bits &= full_bits - 1;
+			}
+			if (need_bits) {
+				_mm256_storeu_si256((__m256i*)offs, off);
+				_mm256_storeu_si256((__m256i*)slows, slow);
+				while (need_bits) {
+					l = __builtin_ctz(need_bits);
+					slows[l] = kmp_bank_step_lane(bank, states[g + l], g + l, buf[j], j, matches, &offs[l]) ? -1 : 0;
+					need_bits &= need_bits - 1;
+				}
+				off = _mm256_loadu_si256((const __m256i*)offs);
+				slow = _mm256_loadu_si256((const __m256i*)slows);
+			}
+		}
+		_mm256_storeu_si256((__m256i*)offs, off);
+		for (l = 0; l < 8; ++l) {
+			states[g + l]->offset = (size_t)offs[l];
+		}
+	}
+	kmp_bank_read_lanes(bank, states, buf, len, matches, n_groups, bank->n_lanes);
+}
+
+/**
+* AVX-512 read, 16 lanes at once (see KMPBankReadFunc)
+*/
+__attribute__((target("avx512f")))
+static void kmp_bank_read_avx512(const KMPBank* bank, KMPState** states, const char* buf, size_t len,
+                                 uint64_t* matches) {
+	const __m512i low = _mm512_set1_epi32(0xff), zero = _mm512_setzero_si512(), one = _mm512_set1_epi32(1);
+	const int* chars = (const int*)bank->chars;
+	__m512i starts, lens, restarts, off, c;
+	__mmask16 slow, eq, need, adv, full;
+	int32_t offs[16];
+	size_t g, l, j, n_groups = bank->n_lanes / 16 * 16;
+	unsigned bits;
+
+	memset(matches, 0, bank->n_lanes * KMP_BANK_WORDS * sizeof(uint64_t));
+	for (g = 0; g < n_groups; g += 16) {
+		slow = 0;
+		for (l = 0; l < 16; ++l) {
+			offs[l] = (int32_t)states[g + l]->offset;
+			if (states[g + l]->flags & KMP_BANK_SLOW_FLAGS) slow |= (__mmask16)(1u << l);
+		}
+		starts = _mm512_loadu_si512((const void*)(bank->starts + g));
+		lens = _mm512_loadu_si512((const void*)(bank->lens + g));
+		restarts = _mm512_loadu_si512((const void*)(bank->restarts + g));
+		off = _mm512_loadu_si512((const void*)offs);
+		for (j = 0; j < len; ++j) {
+			c = _mm512_set1_epi32((unsigned char)buf[j]);
+			eq = _mm512_cmpeq_epi32_mask(_mm512_and_si512(_mm512_i32gather_epi32(_mm512_add_epi32(starts, off), chars, 1), low), c);
+			// the slow lanes, and the lanes with a mismatch after a partial match, are read by kmp_read_char
+			need = slow | (__mmask16)~(eq | _mm512_cmpeq_epi32_mask(off, zero));
+			adv = eq & (__mmask16)~need;
+			off = _mm512_mask_add_epi32(off, adv, off, one);
+			full = _mm512_mask_cmpeq_epi32_mask(adv, off, lens);
+			off = _mm512_mask_mov_epi32(off, full, restarts);
+			for (bits = full; bits; bits &= bits - 1) {
+				kmp_bank_set_match(matches, g + __builtin_ctz(bits), j);
+			}
+			if (need) {
+				_mm512_storeu_si512((void*)offs, off);
+				for (bits = need; bits; bits &= bits - 1) {
+					l = __builtin_ctz(bits);
+					if (kmp_bank_step_lane(bank, states[g + l], g + l, buf[j], j, matches, &offs[l])) {
+						slow |= (__mmask16)(1u << l);
+					} else {
+						slow &= (__mmask16)~(1u << l);
+					}
+				}
+				off = _mm512_loadu_si512((const void*)offs);
+			}
+		}
+		_mm512_storeu_si512((void*)offs, off);
+		for (l = 0; l < 16; ++l) {
+			states[g + l]->offset = (size_t)offs[l];
+		}
+	}
+	kmp_bank_read_lanes(bank, states, buf, len, matches, n_groups, bank->n_lanes);
+}
+
+#endif // KMP_BANK_X86
+
+/**
+* Choose the fastest read function that the cpu features support
+*
+* @param features  The CPU_FEATURE_* flags that can be used
+*
+* @return          The read function
+*/
+static KMPBankReadFunc kmp_bank_select_read(unsigned features) {
+#ifdef KMP_BANK_X86
+	if (features & CPU_FEATURE_AVX512F) return kmp_bank_read_avx512;
+	if (features & CPU_FEATURE_AVX2) return kmp_bank_read_avx2;
+#endif
+	return kmp_bank_read_scalar;
+}
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+/**
+* Initialize a bank of kmp objects (the bank doesn't own the kmp objects, they should stay until the bank is freed)
+*
+* @param bank      The bank to initialize
+* @param kmps      The kmp object of every lane
+* @param n_lanes   The number of lanes
+* @param features  The cpu features the bank can use (CPU_FEATURE_* flags, the host's features or less of them)
+*/
+void kmp_bank_init(KMPBank* bank, KMPRealTime** kmps, size_t n_lanes, unsigned features) {
+	size_t i, n_chars = 0;
+
+	memset(bank, 0, sizeof(KMPBank));
+	bank->n_lanes = n_lanes;
+	bank->read = kmp_bank_select_read(features);
+	for (i = 0; i < n_lanes; ++i) {
+		n_chars += kmps[i]->n;
+	}
+	if (n_chars > INT32_MAX - KMP_BANK_PADDING) {
+		fprintf(stderr, "the patterns of the kmp bank are too long\n");
+		FatalExit();
+	}
+	bank->kmps = (KMPRealTime**)arena_alloc(&bank->mem, n_lanes * sizeof(KMPRealTime*));
+	bank->starts = (int32_t*)arena_alloc(&bank->mem, n_lanes * sizeof(int32_t));
+	bank->lens = (int32_t*)arena_alloc(&bank->mem, n_lanes * sizeof(int32_t));
+	bank->restarts = (int32_t*)arena_alloc(&bank->mem, n_lanes * sizeof(int32_t));
+	bank->chars = (unsigned char*)arena_alloc(&bank->mem, n_chars + KMP_BANK_PADDING);
+	memset(bank->chars + n_chars, 0, KMP_BANK_PADDING);
+	for (i = 0, n_chars = 0; i < n_lanes; ++i) {
+		bank->kmps[i] = kmps[i];
+		bank->starts[i] = (int32_t)n_chars;
+		bank->lens[i] = (int32_t)kmps[i]->n;
+		bank->restarts[i] = (int32_t)kmps[i]->failure_table[kmps[i]->n];
+		memcpy(bank->chars + n_chars, kmps[i]->pattern, kmps[i]->n);
+		n_chars += kmps[i]->n;
+	}
+}
+
+/**
+* Make a view of consecutive lanes of a bank (the view uses the arrays of the bank, so it shouldn't be freed,
+* and the bank should stay until the view isn't used)
+*
+* @param view         The view to initialize (its lane i is lane first_lane + i of the bank)
+* @param bank         The bank
+* @param first_lane   The first lane of the view
+* @param n_lanes      The number of lanes of the view
+*/
+void kmp_bank_view(KMPBank* view, const KMPBank* bank, size_t first_lane, size_t n_lanes) {
+	memset(view, 0, sizeof(KMPBank));
+	view->n_lanes = n_lanes;
+	view->read = bank->read;
+	view->kmps = bank->kmps + first_lane;
+	view->starts = bank->starts + first_lane;
+	view->lens = bank->lens + first_lane;
+	view->restarts = bank->restarts + first_lane;
+	view->chars = bank->chars;
+}
+
+/**
+* Get the total memory used for the arrays of a bank (0 for a view)
+*
+* @param bank     The bank
+*
+* @return         The memory in bytes
+*/
+size_t kmp_bank_total_mem(KMPBank* bank) {
+	return arena_total_mem(&bank->mem);
+}
+
+/**
+* Free the arrays of a bank (not the bank struct itself, nor the kmp objects)
+*
+* @param bank     The bank
+*/
+void kmp_bank_free(KMPBank* bank) {
+	arena_free(&bank->mem);
+}
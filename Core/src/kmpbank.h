@@ -0,0 +1,88 @@
+/**
+* A bank of real-time kmp objects, read together (structure of arrays), with vectorized steps for many kmp at once
+*/
+#ifndef KMPBANK_H
+#define KMPBANK_H
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+#include "kmprt.h"
+#include "arena.h"
+#include <stdint.h>
+
+/******************************************************************************************************
+*		DEFINITIONS
+******************************************************************************************************/
+
+// The maximal number of characters read by the bank at once (the matches of every lane are KMP_BANK_WORDS words)
+#define KMP_BANK_TILE 256
+#define KMP_BANK_WORDS (KMP_BANK_TILE / 64)
+
+struct kmp_bank;
+
+/**
+* Read a tile of characters with all the lanes of a bank (see kmp_bank_read)
+*/
+typedef void (*KMPBankReadFunc)(const struct kmp_bank* bank, KMPState** states,
+                                const char* buf, size_t len, uint64_t* matches);
+
+/**
+* The compiled bank: the kmp objects of all the lanes (never changed while reading, so it can be shared by many streams)
+*
+* The patterns of all the lanes are one after another in chars, so the next character of every lane is
+* chars[starts[lane] + offset] (gathered for many lanes at once).
+*
+* A bank can also be a view of consecutive lanes of another bank (see kmp_bank_view), which doesn't own its arrays.
+*/
+typedef struct kmp_bank {
+	size_t           n_lanes;
+	KMPRealTime    **kmps;     // the kmp object of every lane
+	int32_t         *starts;   // the start of the pattern of every lane in chars
+	int32_t         *lens;     // the length of the pattern of every lane
+	int32_t         *restarts; // the offset after a match of every lane (failure_table[n])
+	unsigned char   *chars;    // the patterns of all the lanes (with padding, so a 32 bits gather never reads outside)
+	KMPBankReadFunc  read;     // the fastest read function that the allowed cpu features support
+	Arena            mem;
+} KMPBank;
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+void kmp_bank_init(KMPBank* bank, KMPRealTime** kmps, size_t n_lanes, unsigned features);
+void kmp_bank_view(KMPBank* view, const KMPBank* bank, size_t first_lane, size_t n_lanes);
+size_t kmp_bank_total_mem(KMPBank* bank);
+void kmp_bank_free(KMPBank* bank);
+
+
+/******************************************************************************************************
+*		INLINE FUNCTIONS
+******************************************************************************************************/
+
+/**
+* Read up to KMP_BANK_TILE characters with every lane of the bank
+*
+* Every lane reads all the characters with its own state (which stays exactly as kmp_read_char would leave it).
+* Bit j % 64 of matches[lane * KMP_BANK_WORDS + j / 64] is set iff the lane has a match on buf[j].
+*
+* @param bank      The bank
+* @param states    The state of the stream of every lane
+* @param buf       The characters
+* @param len       The number of characters (at most KMP_BANK_TILE)
+* @param matches   The matches of every lane (bank->n_lanes * KMP_BANK_WORDS words, set by the function)
+*/
+static inline void kmp_bank_read(const KMPBank* bank, KMPState** states, const char* buf, size_t len, uint64_t* matches) {
+	bank->read(bank, states, buf, len, matches);
+}
+
+/**
+* Whether a lane has a match on the j-th character of the last tile
+*/
+static inline int kmp_bank_match(const uint64_t* matches, size_t lane, size_t j) {
+	return (int)((matches[lane * KMP_BANK_WORDS + j / 64] >> (j % 64)) & 1);
+}
+
+#endif /* KMPBANK_H */
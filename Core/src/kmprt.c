@@ -37,17 +37,18 @@
 * (i.e. ready for the char that comes after {@param c})
 *
 * @param kmp    The kmp struct
+* @param state  The state of the stream
 * @param c      The char that was mismatched that started the failure function loop
 *
 * @return       True if the failure function finished (we got the first position at which this character matches)
 *               False if not
 */
-static int _kmp_move_failure_function(KMPRealTime* kmp, char c) {
-	kmp->offset = kmp->failure_table[kmp->offset];
-	if (kmp->pattern[kmp->offset] == c) {
-		kmp->offset++;
+static int _kmp_move_failure_function(KMPRealTime* kmp, KMPState* state, char c) {
+	state->offset = kmp->failure_table[state->offset];
+	if (kmp->pattern[state->offset] == c) {
+		state->offset++;
 		return 1;
-	} else if (kmp->offset == 0) {
+	} else if (state->offset == 0) {
 		return 1;
 	} else {
 		return 0;
@@ -58,16 +59,17 @@ static int _kmp_move_failure_function(KMPRealTime* kmp, char c) {
 * Add character to the buffer at the end.
 *
 * @param kmp    The kmp struct
+* @param state  The state of the stream
 * @param c      The character to add to the buffer
 */
-static void _kmp_add_char_to_buffer(KMPRealTime* kmp, char c) {
-	if (kmp->flags & KMP_HAVE_BUFFER_FLAG) {
-		MOD_INC(kmp->buf_end, kmp->n);
-		kmp->buffer[kmp->buf_end] = c;
+static void _kmp_add_char_to_buffer(KMPRealTime* kmp, KMPState* state, char c) {
+	if (state->flags & KMP_HAVE_BUFFER_FLAG) {
+		MOD_INC(state->buf_end, kmp->n);
+		state->buffer[state->buf_end] = c;
 	} else {
-		kmp->buf_start = kmp->buf_end = 0;
-		kmp->buffer[0] = c;
-		kmp->flags |= KMP_HAVE_BUFFER_FLAG;
+		state->buf_start = state->buf_end = 0;
+		state->buffer[0] = c;
+		state->flags |= KMP_HAVE_BUFFER_FLAG;
 	}
 }
 
@@ -75,17 +77,18 @@ static void _kmp_add_char_to_buffer(KMPRealTime* kmp, char c) {
 * Add character to the buffer at the start.
 *
 * @param kmp    The kmp struct
+* @param state  The state of the stream
 * @param c      The character to add tp the buffer
 */
-static void _kmp_push_char_to_buffer(KMPRealTime* kmp, char c) {
-	if (kmp->flags & KMP_HAVE_BUFFER_FLAG) {
-		MOD_DEC(kmp->buf_start, kmp->n);
-		kmp->buffer[kmp->buf_start] = c;
+static void _kmp_push_char_to_buffer(KMPRealTime* kmp, KMPState* state, char c) {
+	if (state->flags & KMP_HAVE_BUFFER_FLAG) {
+		MOD_DEC(state->buf_start, kmp->n);
+		state->buffer[state->buf_start] = c;
 	}
 	else {
-		kmp->buf_start = kmp->buf_end = 0;
-		kmp->buffer[0] = c;
-		kmp->flags |= KMP_HAVE_BUFFER_FLAG;
+		state->buf_start = state->buf_end = 0;
+		state->buffer[0] = c;
+		state->flags |= KMP_HAVE_BUFFER_FLAG;
 	}
 }
 
@@ -93,15 +96,16 @@ static void _kmp_push_char_to_buffer(KMPRealTime* kmp, char c) {
 * Pop char from buffer.
 *
 * @param kmp    The kmp struct
+* @param state  The state of the stream
 *
 * @return       The first char in the buffer
 */
-static char _kmp_pop_buffer(KMPRealTime* kmp) {
-	char c = kmp->buffer[kmp->buf_start];
-	if (kmp->buf_start == kmp->buf_end) {
-		kmp->flags &= ~KMP_HAVE_BUFFER_FLAG;
+static char _kmp_pop_buffer(KMPRealTime* kmp, KMPState* state) {
+	char c = state->buffer[state->buf_start];
+	if (state->buf_start == state->buf_end) {
+		state->flags &= ~KMP_HAVE_BUFFER_FLAG;
 	}
-	MOD_INC(kmp->buf_start, kmp->n);
+	MOD_INC(state->buf_start, kmp->n);
 	return c;
 }
 
@@ -113,30 +117,31 @@ static char _kmp_pop_buffer(KMPRealTime* kmp) {
 *  -And return 0.
 *
 * @param kmp    The kmp struct
+* @param state  The state of the stream
 * @param c      The char
 *
 * @return       Whether there is a match
 */
-static int _kmp_read_char(KMPRealTime* kmp, char c) {
-	if (kmp->pattern[kmp->offset] == c) {
-		kmp->offset++;
-		if (kmp->offset == kmp->n) {
+static int _kmp_read_char(KMPRealTime* kmp, KMPState* state, char c) {
+	if (kmp->pattern[state->offset] == c) {
+		state->offset++;
+		if (state->offset == kmp->n) {
 			// In the n-th place, there is the next offset after successful match
-			kmp->offset = kmp->failure_table[kmp->n];
+			state->offset = kmp->failure_table[kmp->n];
 			return 1;
 		}
-	} else if (kmp->offset == 0) {
+	} else if (state->offset == 0) {
 		return 0;
 	} else {
 		int i;
 		for (i = 0; i < 2; ++i) {
-			if (_kmp_move_failure_function(kmp, c)) {
+			if (_kmp_move_failure_function(kmp, state, c)) {
 				return 0;
 			}
 		}
-		//printf("keep looping, offset is %d, flags is %d\n", kmp->offset, kmp->flags);
+		//printf("keep looping, offset is %d, flags is %d\n", state->offset, state->flags);
 		// If got here, there is need in looping through the failure function
-		kmp->flags |= KMP_LOOP_FAIL_FLAG;
+		state->flags |= KMP_LOOP_FAIL_FLAG;
 		/*
 		* If the buffer is empty then 'c' is the stream current character, so we need to enter it
 		* to the buffer for later use.
@@ -144,7 +149,7 @@ static int _kmp_read_char(KMPRealTime* kmp, char c) {
 		* it back for the loop through the failure function.
 		* Either way, we need to enter the char back to the start of the buffer.
 		*/
-		_kmp_push_char_to_buffer(kmp, c);
+		_kmp_push_char_to_buffer(kmp, state, c);
 	}
 	return 0;
 }
@@ -198,35 +203,78 @@ KMPRealTime* kmp_new(char* pattern, size_t n) {
 		FatalExit();
 	}
 	memcpy(kmp->pattern, pattern, n);
-	kmp->buffer = (char*) malloc (n * sizeof(char));
 	kmp->failure_table = kmp_create_failure_table(pattern, n);
 	return kmp;
 }
 
 /**
-* Get the total memory used for a KMP struct.
+* Get the total memory used for a KMP struct (without the states of the streams).
 *
 * Return the size of the struct, plus all the allocated memory which is:
 *   n * sizeof(char) for the pattern
-*   n * sizeof(char) for the buffer
 *   (n + 1) * sizeof(size_t) for the failure table
 */
 size_t kmp_get_total_mem(KMPRealTime* kmp) {
 	if (kmp == NULL) return 0;
-	return sizeof(KMPRealTime) + kmp->n * (2 * sizeof(char) + sizeof(size_t)) + sizeof(size_t);
+	return sizeof(KMPRealTime) + kmp->n * (sizeof(char) + sizeof(size_t)) + sizeof(size_t);
+}
+
+/**
+* Get the size of the memory needed for a state of a stream (the state struct and its buffer)
+*
+* @param kmp     The kmp struct
+*
+* @return        The size in bytes (a multiple of STATE_ALIGNMENT)
+*/
+size_t kmp_state_size(KMPRealTime* kmp) {
+	if (kmp == NULL) return 0;
+	return STATE_ALIGN(sizeof(KMPState)) + STATE_ALIGN(kmp->n * sizeof(char));
+}
+
+/**
+* Initialize a state of a stream in the given memory, in the initial state
+*
+* @param kmp     The kmp struct
+* @param mem     Memory of kmp_state_size(kmp) bytes (aligned to STATE_ALIGNMENT)
+*
+* @return        The state (at the start of mem)
+*/
+KMPState* kmp_state_init(KMPRealTime* kmp, void* mem) {
+	KMPState* state = (KMPState*)mem;
+	state->buffer = (char*)mem + STATE_ALIGN(sizeof(KMPState));
+	state->flags = 0;
+	kmp_reset(kmp, state);
+	return state;
+}
+
+/**
+* Copy a state of a stream to the given memory (e.g. when the states of a context are moved)
+*
+* @param kmp     The kmp struct
+* @param mem     Memory of kmp_state_size(kmp) bytes (aligned to STATE_ALIGNMENT)
+* @param from    The state to copy
+*
+* @return        The copy (at the start of mem), in the same state as from
+*/
+KMPState* kmp_state_copy(KMPRealTime* kmp, void* mem, KMPState* from) {
+	KMPState* state = (KMPState*)mem;
+	memcpy(mem, from, kmp_state_size(kmp));
+	state->buffer = (char*)mem + STATE_ALIGN(sizeof(KMPState));
+	return state;
 }
 
 /**
 * Reset the kmp state to the initial state
 *
-* @param kmp     The kmp struct to reset
+* @param kmp     The kmp struct
+* @param state   The state to reset
 */
-void kmp_reset(KMPRealTime* kmp) {
+void kmp_reset(KMPRealTime* kmp, KMPState* state) {
 	if (!kmp) return;
-	kmp->offset = 0;
-	kmp->buf_start = kmp->buf_end = 0;
-	kmp->flags &= ~KMP_HAVE_BUFFER_FLAG;
-	kmp->flags &= ~KMP_LOOP_FAIL_FLAG;
+	state->offset = 0;
+	state->buf_start = state->buf_end = 0;
+	state->flags &= ~KMP_HAVE_BUFFER_FLAG;
+	state->flags &= ~KMP_LOOP_FAIL_FLAG;
 }
 
 /**
@@ -248,39 +296,40 @@ size_t kmp_get_period(char* pattern, size_t n) {
 * Read char from stream and return whether we have a match.
 *
 * @param kmp    The KMPRealTime that used for the pattern we search
+* @param state  The state of the stream
 * @param c      The new character from the stream
 *
 * @return       1 if there is match, 0 if not
 */
-int kmp_read_char(KMPRealTime* kmp, char c) {
+int kmp_read_char(KMPRealTime* kmp, KMPState* state, char c) {
 	int i;
-	if (kmp->flags & KMP_LOOP_FAIL_FLAG) { // Have failure function moves to do
-		//printf("backtracing - offset: %lu, flags: %d\n", kmp->offset, kmp->flags);
-		_kmp_add_char_to_buffer(kmp, c);
+	if (state->flags & KMP_LOOP_FAIL_FLAG) { // Have failure function moves to do
+		//printf("backtracing - offset: %lu, flags: %d\n", state->offset, state->flags);
+		_kmp_add_char_to_buffer(kmp, state, c);
 		for (i = 0; i < 2; ++i) {
-			if (_kmp_move_failure_function(kmp, kmp->buffer[kmp->buf_start])) {
-				_kmp_pop_buffer(kmp);
-				kmp->flags &= ~KMP_LOOP_FAIL_FLAG;
+			if (_kmp_move_failure_function(kmp, state, state->buffer[state->buf_start])) {
+				_kmp_pop_buffer(kmp, state);
+				state->flags &= ~KMP_LOOP_FAIL_FLAG;
 				break;
 			}
 		}
 		return 0;
-	} else if (kmp->flags & KMP_HAVE_BUFFER_FLAG) { // Have chars waiting in buffer
-		//printf("buffer length %lu - offset: %lu, flags: %d\n", kmp->buf_end-kmp->buf_start+1, kmp->offset, kmp->flags);
-		_kmp_add_char_to_buffer(kmp, c);
+	} else if (state->flags & KMP_HAVE_BUFFER_FLAG) { // Have chars waiting in buffer
+		//printf("buffer length %lu - offset: %lu, flags: %d\n", state->buf_end-state->buf_start+1, state->offset, state->flags);
+		_kmp_add_char_to_buffer(kmp, state, c);
 		for (i = 0; i < 2; ++i) {
-			c = _kmp_pop_buffer(kmp);
+			c = _kmp_pop_buffer(kmp, state);
 			//printf("poped from buffer: %c\n", c);
-			if (_kmp_read_char(kmp,c)) {
+			if (_kmp_read_char(kmp, state, c)) {
 				// If algorithm works fine, should happen only when we just finished the buffer (not before)
 				return 1;
 			}
 		}
-		//printf("after working on buffer, offset: %lu, flags: %d\n", kmp->offset, kmp->flags);
+		//printf("after working on buffer, offset: %lu, flags: %d\n", state->offset, state->flags);
 		return 0;
 	} else {
 		//printf("reading char regular\n");
-		return _kmp_read_char(kmp, c);
+		return _kmp_read_char(kmp, state, c);
 	}
 }
 
@@ -292,10 +341,49 @@ int kmp_read_char(KMPRealTime* kmp, char c) {
 void kmp_free(KMPRealTime* kmp) {
 	free(kmp->failure_table);
 	free(kmp->pattern);
-	free(kmp->buffer);
 	free(kmp);
 }
 
+/**
+* Save the KMPRealTime to the cache file (the pattern and its failure table)
+*
+* @param kmp     The kmp struct
+* @param w       The cache writer
+*/
+void kmp_save(KMPRealTime* kmp, CacheWriter* w) {
+	uint64_t n = kmp->n;
+	cache_write(w, &n, sizeof(n));
+	cache_write(w, kmp->pattern, kmp->n);
+	cache_write(w, kmp->failure_table, (kmp->n + 1) * sizeof(size_t));
+}
+
+/**
+* Load a KMPRealTime (saved with kmp_save) from the cache file
+*
+* @param r       The cache reader
+*
+* @return        Dynamicaly allocated KMPRealTime (as kmp_new would create)
+*/
+KMPRealTime* kmp_load(CacheReader* r) {
+	KMPRealTime* kmp = (KMPRealTime *) malloc (sizeof(KMPRealTime));
+	uint64_t n;
+	if (kmp == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memcpy(&n, cache_read(r, sizeof(n)), sizeof(n));
+	kmp->n = n;
+	kmp->pattern = (char*) malloc (n * sizeof(char));
+	kmp->failure_table = (size_t*) malloc ((n + 1) * sizeof(size_t));
+	if (kmp->pattern == NULL || kmp->failure_table == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memcpy(kmp->pattern, cache_read(r, n), n);
+	memcpy(kmp->failure_table, cache_read(r, (n + 1) * sizeof(size_t)), (n + 1) * sizeof(size_t));
+	return kmp;
+}
+
 // ========================================================================
 // ===================     FOR TESTING     ================================
 // ========================================================================
@@ -310,13 +398,14 @@ int main() {
 //             012345678901234567890123456789012345678901234567890
 	char *t = "AAAAAAAAAAAAAAAAABAAAAAABAAAAAAAAAAAAAAAAABAAAAAAA";
 	KMPRealTime* kmp = kmp_new(p, strlen(p));
+	KMPState* state = kmp_state_init(kmp, malloc(kmp_state_size(kmp)));
 	printf("failure table:\n");
 	for (i = 0; i < kmp->n+1; ++i) {
 		printf("    %d:%d\n",i,kmp->failure_table[i]);
 	}
 	for (i = 0; i < strlen(t); ++i) {
 		//printf("on pos %d on char %c\n", i,t[i]);
-		if (kmp_read_char(kmp, t[i])) {
+		if (kmp_read_char(kmp, state, t[i])) {
 			printf("found on char %d\n", i);
 		}
 	}
@@ -9,6 +9,7 @@ Real-Time version of the KMP algorithm (by Galil) that is also used to find peri
 ******************************************************************************************************/
 
 #include "Fingerprint.h"
+#include "cache.h"
 
 /******************************************************************************************************
 *		DEFINITIONS
@@ -17,16 +18,29 @@ Real-Time version of the KMP algorithm (by Galil) that is also used to find peri
 #define KMP_LOOP_FAIL_FLAG 1 // there is still need to loop through failure function
 #define KMP_HAVE_BUFFER_FLAG 2 // flag for having chars in buffer
 
+// The alignment of the parts of a state of a stream (the states are laid out in one block of memory)
+#define STATE_ALIGNMENT 16
+#define STATE_ALIGN(size) (((size) + STATE_ALIGNMENT - 1) & ~(size_t)(STATE_ALIGNMENT - 1))
+
+/**
+* The compiled pattern (never changed while reading, so it can be shared by many streams)
+*/
 typedef struct {
 	size_t   n; // the pattern's length
 	char    *pattern; // the pattern itself
 	size_t  *failure_table; // the failure function table (size n + 1)
+} KMPRealTime;
+
+/**
+* The state of a stream (kmp_state_size bytes, the buffer is right after the struct)
+*/
+typedef struct {
 	size_t   offset; // how much characters from start of pattern until know is matched (what char are we)
 	char    *buffer; // buffer for saving characters that were received during the failure-function looping
 	size_t   buf_start; // the start position of the buffer (the buffer is round robin)
 	size_t   buf_end; // the end position of the buffer (the buffer is round robin)
 	int      flags;
-} KMPRealTime;
+} KMPState;
 
 
 /******************************************************************************************************
@@ -35,10 +49,15 @@ typedef struct {
 
 /* functions for using the real-time kmp algorithm */
 KMPRealTime* kmp_new(char* pattern, size_t n);
-int kmp_read_char(KMPRealTime* kmp, char c);
+int kmp_read_char(KMPRealTime* kmp, KMPState* state, char c);
 void kmp_free(KMPRealTime* kmp);
+void kmp_save(KMPRealTime* kmp, CacheWriter* w);
+KMPRealTime* kmp_load(CacheReader* r);
 size_t kmp_get_total_mem(KMPRealTime* kmp);
-void kmp_reset(KMPRealTime* kmp);
+size_t kmp_state_size(KMPRealTime* kmp);
+KMPState* kmp_state_init(KMPRealTime* kmp, void* mem);
+KMPState* kmp_state_copy(KMPRealTime* kmp, void* mem, KMPState* from);
+void kmp_reset(KMPRealTime* kmp, KMPState* state);
 
 size_t kmp_get_period(char* pattern, size_t n);
 size_t* kmp_create_failure_table(char* pattern, size_t n);
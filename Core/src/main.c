@@ -3,6 +3,8 @@
 #include "conf.h"
 #include "mps.h"
 #include "measure.h"
+#include "report.h"
+#include "calibrate.h"
 
 int main(int argc, char **argv) {
 	program_name = argv[0];
@@ -17,8 +19,14 @@ int main(int argc, char **argv) {
 	printf("\n");
 	printf("Initializing Multi-Pattern Search engine\n");
 	init_mps(conf);
+	if (conf->calibrate) calibrate_instances(conf);
 	printf("\nStart the Algorithms measuring\n");
 	measure_instances_stats(conf);
 	write_stats_to_file(conf);
+	if (conf->baseline_file_name && compare_stats_to_baseline(conf)) {
+		printf("\nprogram done (with regressions)\n");
+		return REPORT_REGRESSION_EXIT_STATUS;
+	}
 	printf("\nprogram done\n");
+	return 0;
 }
\ No newline at end of file
@@ -1,11 +1,49 @@
 /**
 * Measuring Multi-Pattern Matching Algorithms performance, and success rate.
 *
-* The performance measurements are defined in the "perf_events" static variable which defined
-* in the header file of this file.
+* The performance measurements are the perf_event groups of the configuration (the "-e" option),
+* or the default groups defined below. When the measurement starts, every event is opened once to check that
+* the system supports it, and the unsupported events are skipped (with a warning).
 *
-* We read the stream files in blocks of size STREAM_BUFFER_SIZE, and using the algorithm on every block
-* (so the stream to read would be in memory and not in file, because reading from file change performance)
+* Besides the totals, the counters are read after every window, so we also report the maximal count of every
+* event in a single window, and the latency of every window (in ns per byte) is put in a histogram,
+* from which we report the p50, p99 and p99.9 latencies.
+*
+* We map the stream files to memory, and use the algorithm on every window of size STREAM_BUFFER_SIZE of the mapping
+* (the algorithms scan the file pages directly, without copying them and without a system call per block).
+* The window is first scanned by the reliable instance, so its pages are already in memory when the algorithms
+* are measured on it. Files that can't be mapped (e.g. pipes) are read in blocks of that size instead.
+*
+* The instances can be measured on several worker threads (the "-j" option). Every worker is pinned to its own cpu
+* and has its own perf_event groups, while the stream blocks and the real results (of the reliable instance)
+* are computed once by the main thread and shared read-only by all the workers. The time of an instance is the CPU
+* time of the worker, and of the threads the object reads with besides it (see "threads" in mps.h), whose perf_event
+* groups are also added to those of the worker.
+*
+* With the "-k K" option, every window is split to K equal parts, and part i of all the windows of a stream file is
+* the stream of the i-th context of every instance (e.g. K flows whose packets arrive together). The K parts are
+* read together with ctx_read_batch of the algorithm (or one after another with ctx_read_block, if the algorithm
+* doesn't implement it), and the real results are computed the same way, with K contexts of the reliable instance.
+*
+* With the "-u FILE" option, the dictionaries are reloaded with the patterns diff FILE while the streams are read
+* (see "reload.c"). Every instance switches to the new dictionaries at the start of some chunk, and is compared with
+* the real results of its dictionaries (of the reliable instance of each), except for the first max_pat_len
+* characters of every stream after the switch (a match that started before the switch can be found by the old or by
+* the new dictionaries).
+*
+* With the "-p FILE" option, FILE is a packet capture, which is split to flows by the front end in "capture.c".
+* Every flow is read with a context of its own (reset when the flow starts), and the flows are dispatched to the
+* workers by their hash, like the flows of a multi-threaded scanner: every worker reads all the instances on its
+* flows, and the statistics of an instance are the sum of all the workers (its time is the CPU time of all of them).
+* The chunks of a capture file are batches of packets, whose segments are put one after another in the results.
+*
+* With the "--scan MODE" option, the streams are read with contexts (like with "-k") and scanned with the mode (see
+* "ctx_scan" in mps.h) instead of reading the result of every byte. With list, the results of the bytes are filled
+* from the matches after the measuring, and compared as usual. With count, the number of matches of every stream of
+* the chunk is compared to the number of real matches (the difference are the false positives or negatives, and the
+* other bytes are a success), and the chunk an instance switched its dictionaries at isn't compared. With first, every
+* part of every chunk is a packet of its own (its contexts are reset at its start, also for the real results), and
+* its first match is compared to the first real match (so the success rates are of the packets, not of the bytes).
 */
 
 
@@ -16,6 +54,9 @@
 
 #include "measure.h"
 #include "conf.h"
+#include "memtrack.h"
+#include "reload.h"
+#include "capture.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -24,6 +65,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/perf_event.h>
 #include <asm/unistd.h>
 #include <asm/types.h>
@@ -33,7 +75,8 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <time.h>
-#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 
 
 /******************************************************************************
@@ -59,6 +102,7 @@ typedef struct {
 typedef struct {
 	uint64_t id; 
 	int      fd;
+	uint64_t last; // the count in the previous reading
 } PerfEventData;
 
 /**
@@ -70,12 +114,132 @@ typedef struct {
 	PerfEventData  *events;
 } PerfEventGroupData;
 
-// PERF_BUF_SIZE should be enough to contain ReadFormat
-#define PERF_BUF_SIZE (sizeof(uint64_t) + (sizeof(uint64_t) * 2) * sizeof(perf_events) + 1)
+/**
+* The other threads an mps object reads with (see "threads" in MpsElem), and the perf_event groups of every one
+*
+* They are taken from the object on its first chunk, and again when the object is replaced (by a reload).
+*/
+typedef struct {
+	void                *obj;     // the object the threads were taken from (NULL before the first chunk)
+	size_t               n;
+	MpsThread           *threads;
+	PerfEventGroupData **data;
+} InstanceThreads;
+
+// PERF_BUF_SIZE should be enough to contain ReadFormat of a group
+#define PERF_BUF_SIZE (sizeof(uint64_t) + (sizeof(uint64_t) * 2) * PERF_MAX_GROUP_EVENTS)
 
-// The size of the buffer for the stream files
+/**
+* A perf_event type that can be given by name in the "-e" option
+*/
+typedef struct {
+	const char  *name;
+	uint32_t     type;
+	uint64_t     config;
+	char        *desc;
+} PerfEventName;
+
+// The config of a hardware cache event
+#define HW_CACHE_EVENT(cache, op, result) \
+	((PERF_COUNT_HW_CACHE_ ## cache) | (PERF_COUNT_HW_CACHE_OP_ ## op << 8) | (PERF_COUNT_HW_CACHE_RESULT_ ## result << 16))
+
+// The events that can be given by name (besides raw events, "rNNNN" with the hex config)
+static PerfEventName perf_event_names[] = {
+	{"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page faults"},
+	{"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, "software cpu clock"},
+	{"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "software task clock"},
+	{"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context switches"},
+	{"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu migrations"},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "number of instructions"},
+	{"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, "number of branch instructions"},
+	{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch misses"},
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "number of cycles"},
+	{"bus-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES, "bus cycles"},
+	{"ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, "total cycles"},
+	{"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, "cache references"},
+	{"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache misses"},
+	{"L1-dcache-loads", PERF_TYPE_HW_CACHE, HW_CACHE_EVENT(L1D, READ, ACCESS), "L1 data cache loads"},
+	{"L1-dcache-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_EVENT(L1D, READ, MISS), "L1 data cache load misses"},
+	{"LLC-loads", PERF_TYPE_HW_CACHE, HW_CACHE_EVENT(LL, READ, ACCESS), "LLC loads"},
+	{"LLC-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_EVENT(LL, READ, MISS), "LLC load misses"},
+	{"dTLB-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_EVENT(DTLB, READ, MISS), "dTLB load misses"}
+};
+
+#define N_PERF_EVENT_NAMES (sizeof(perf_event_names) / sizeof(PerfEventName))
+
+// The groups measured when no group is given with "-e"
+static const char* default_perf_groups[] = {
+	"page-faults,cpu-clock,task-clock",
+	"instructions,branches,cycles,bus-cycles,ref-cycles",
+	"cache-references,cache-misses,LLC-loads,LLC-load-misses"
+};
+
+#define N_DEFAULT_PERF_GROUPS (sizeof(default_perf_groups) / sizeof(char*))
+
+// The perf events of the main thread, for measuring the phases of building the instances
+static PerfEventGroupData* build_perf_data = NULL;
+
+// The size of a window of the stream files (the algorithms are measured on one window at a time)
 #define STREAM_BUFFER_SIZE (100 * 1024)
 
+/**
+* The data shared between the main thread and the measuring workers
+*
+* The main thread reads every chunk of the streams into stream_buffer, and runs the reliable instance
+* on it once (putting its results in real_results). Then all the workers run their instances on that chunk,
+* while only reading the shared data. The barrier separates the two phases.
+*
+* When reloading the dictionaries, there are two generations of the dictionaries (see "reload.h"), and the real
+* results of every generation that is used in the chunk are computed with its reliable instance.
+*/
+typedef struct {
+	struct _Conf       *conf;
+	const char         *stream_buffer; // the current chunk
+	pattern_id_t       *real_results[2];  // the real results of every generation
+	MpsInstance        *reliable[2];      // the reliable instance of every generation (NULL if it isn't used)
+	void              **reliable_ctxs[2]; // the contexts of the reliable instances (when reading interleaved streams)
+	MpsReader          *readers;    // the state of every instance on its worker
+	MpsReload          *reload;     // the reload of the dictionaries (NULL if not reloading)
+	size_t              skip;       // the characters not compared after an instance switched its dictionaries
+	ssize_t             len;        // the length of the current chunk
+	int                 new_stream; // whether the current chunk is the start of a stream
+	size_t              stream_index; // the index of the stream file of the current chunk
+	int                 sync_only;  // whether the workers should only switch their instances (no chunk to read)
+	int                 done;       // whether there are no more chunks (so the workers should finish)
+	const CaptureSegment *segments; // the segments of the flows in the current chunk (NULL if not from a capture)
+	size_t              n_segments;
+	pthread_mutex_t    *stats_locks; // a lock of the statistics of every instance (taken when all the workers add to them)
+	pthread_barrier_t   barrier;
+} MeasureShared;
+
+/**
+* A stream file that is read window by window
+*
+* The file is mapped to memory and the windows are parts of the mapping, or if the file can't be mapped,
+* the windows are read into buffer.
+*/
+typedef struct {
+	const char  *name;
+	int          fd;
+	const char  *data;   // the mapping of the file (NULL if not mapped)
+	size_t       size;   // the size of the file (when mapped)
+	size_t       offset; // the offset of the next window in the mapping
+	char        *buffer; // buffer of size STREAM_BUFFER_SIZE (when not mapped)
+} StreamFile;
+
+/**
+* The data of a single measuring worker thread
+*
+* The worker with index i measures the mps instances i, i + n_workers, i + 2 * n_workers, ...
+* (and in the chunks of capture files, all the instances on the flows whose hash is i modulo n_workers)
+*/
+typedef struct {
+	MeasureShared  *shared;
+	size_t          index;
+	size_t          n_workers;
+	pthread_t       thread;
+} MeasureWorker;
+
 
 /******************************************************************************
 *		INNER FUNCTIONS
@@ -110,59 +274,161 @@ static void fill_perf_event_attr(struct perf_event_attr* pea, uint32_t type, uin
 }
 
 /**
-* Initialize the perf events measurements
+* Open a perf event of a thread
 *
-* @param data      The data for all the perf events (matches perf_events)
+* @param type      The perf_event type
+* @param tid       The thread to count the event of (0 for the calling thread)
+* @param cpu       The cpu to count the event on (or -1 to count on any cpu)
+* @param group_fd  The leader of the group of the event (or -1 for a new group)
+*
+* @return          The file descriptor of the event, or -1 if it couldn't be opened
 */
-static PerfEventGroupData* create_perf_events_data() {
-	PerfEventGroupData* data;
+static int open_perf_event(PerfEventType* type, pid_t tid, int cpu, int group_fd) {
 	struct perf_event_attr pea;
-	size_t i, j, n;
-	PerfEventType* current_type;
-	PerfEventData* current_data;
+	fill_perf_event_attr(&pea, type->type, type->config);
+	return perf_event_open(&pea, tid, cpu, group_fd, 0);
+}
 
-	// Allocate memory for the data
-	data = (PerfEventGroupData*)malloc(N_PERF_GROUPS * sizeof(PerfEventGroupData));
-	for (i = 0; i < N_PERF_GROUPS; ++i) {
-		data[i].events = (PerfEventData*)malloc(perf_events[i].n * sizeof(PerfEventData));
-	}
+/**
+* Remove the perf events that the system doesn't support from the groups of the configuration
+*
+* Every event is opened in its group (so events that can't be in the same group with the others are also removed),
+* and groups without any supported event are removed.
+*
+* @param conf      The configuration with the perf_event groups
+*/
+static void remove_unsupported_perf_events(Conf* conf) {
+	PerfEventTypeGroup* group;
+	int fds[PERF_MAX_GROUP_EVENTS];
+	size_t i, j, n, n_groups = 0;
 
-	// Fill the data, according to perf_events
-	for (i = 0; i < N_PERF_GROUPS; ++i) {
-		n = perf_events[i].n;
-		current_type = &perf_events[i].events[0];
-		current_data = &data[i].events[0];
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		group = &conf->perf_groups[i];
+		for (j = 0, n = 0; j < group->n; ++j) {
+			fds[n] = open_perf_event(&group->events[j], 0, -1, n == 0 ? -1 : fds[0]);
+			if (fds[n] == -1) {
+				fprintf(stderr, "Warning: perf event \"%s\" is not supported (%s), skipping it\n",
+				        group->events[j].desc, strerror(errno));
+				continue;
+			}
+			group->events[n++] = group->events[j];
+		}
+		for (j = 0; j < n; ++j) {
+			close(fds[j]);
+		}
+		group->n = n;
+		if (n != 0) {
+			conf->perf_groups[n_groups++] = *group;
+		} else {
+			free(group->events);
+		}
+	}
+	conf->n_perf_groups = n_groups;
+}
 
-		// Create the leader perf event of the i-th group
-		fill_perf_event_attr(&pea, current_type->type, current_type->config);
-		current_data->fd = perf_event_open(&pea, 0, -1, -1, 0);
-		ioctl(current_data->fd, PERF_EVENT_IOC_ID, &current_data->id);
+/**
+* Initialize the perf events measurements of a thread
+*
+* @param conf      The configuration with the perf_event groups
+* @param tid       The thread to measure (0 for the calling thread)
+* @param cpu       The cpu to count the events on (or -1 to count on any cpu)
+*
+* @return          The data for all the perf events (matches the groups of the configuration)
+*/
+static PerfEventGroupData* create_perf_events_data(Conf* conf, pid_t tid, int cpu) {
+	PerfEventGroupData* data;
+	PerfEventTypeGroup* group;
+	size_t i, j;
+	int leader;
 
-		// Create the rest of the i-th group
-		for (j = 1; j < n; ++j) {
-			current_type = &perf_events[i].events[j];
-			current_data = &data[i].events[j];
+	// Allocate memory for the data
+	data = (PerfEventGroupData*)malloc(conf->n_perf_groups * sizeof(PerfEventGroupData));
+	if (data == NULL && conf->n_perf_groups != 0) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		data[i].events = (PerfEventData*)malloc(conf->perf_groups[i].n * sizeof(PerfEventData));
+		if (data[i].events == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+	}
 
-			fill_perf_event_attr(&pea, current_type->type, current_type->config);
-			current_data->fd = perf_event_open(&pea, 0, -1, data[i].events[0].fd, 0);
-			ioctl(current_data->fd, PERF_EVENT_IOC_ID, &current_data->id);
+	// Fill the data, according to the groups (the first event of every group is its leader)
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		group = &conf->perf_groups[i];
+		leader = -1;
+		for (j = 0; j < group->n; ++j) {
+			data[i].events[j].fd = open_perf_event(&group->events[j], tid, cpu, leader);
+			data[i].events[j].id = 0;
+			data[i].events[j].last = 0;
+			if (data[i].events[j].fd != -1) {
+				ioctl(data[i].events[j].fd, PERF_EVENT_IOC_ID, &data[i].events[j].id);
+			}
+			if (j == 0) leader = data[i].events[0].fd;
 		}
 	}
 	return data;
 }
 
+/**
+* Close the perf events and free their data
+*
+* @param conf      The configuration with the perf_event groups
+* @param data      The data for all the perf events (as returned from create_perf_events_data)
+*/
+static void free_perf_events_data(Conf* conf, PerfEventGroupData* data) {
+	size_t i, j;
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			if (data[i].events[j].fd != -1) {
+				close(data[i].events[j].fd);
+			}
+		}
+		free(data[i].events);
+	}
+	free(data);
+}
+
 /**
 * Do the ioctl request on every perf_event group in teh data
 *
 * @param data        The perf_event groups data to work on
+* @param n_groups    The number of groups
 * @param request     The ioctl request (e.g. PERF_EVENT_IOC_ENABLE)
 */
-static inline void perf_event_data_ioctl(PerfEventGroupData data[N_PERF_GROUPS], unsigned long request) {
-	for (size_t i = 0; i < N_PERF_GROUPS; ++i) {
+static inline void perf_event_data_ioctl(PerfEventGroupData* data, size_t n_groups, unsigned long request) {
+	for (size_t i = 0; i < n_groups; ++i) {
 		ioctl(data[i].events[0].fd, request, PERF_IOC_FLAG_GROUP);
 	}
 }
 
+/**
+* Check whether the real results of a generation are computed (its reliable instance isn't skipped with "-r none")
+*
+* @param shared   The shared data
+* @param gen      The generation of the dictionaries
+*
+* @return         1 if the real results are computed, 0 otherwise
+*/
+static inline int has_real_results(const MeasureShared* shared, int gen) {
+	return shared->reliable[gen]->algo != MPS_NONE;
+}
+
+/**
+* Add a success rate to another
+*
+* @param to       The success rate to add to
+* @param from     The success rate to add
+*/
+static inline void add_success_rate(SuccessRate* to, SuccessRate* from) {
+	to->success += from->success;
+	to->false_pos += from->false_pos;
+	to->false_neg += from->false_neg;
+	to->partial_suc += from->partial_suc;
+}
+
 /**
 * Measure the success rate, and add it to the success rate given
 *
@@ -189,6 +455,67 @@ static void measure_success_rate(SuccessRate* suc_rate, pattern_id_t algo_result
 	}
 }
 
+/**
+* Measure the success rate of the number of matches of a stream (MPS_SCAN_COUNT), and add it to a SuccessRate
+*
+* The difference from the number of real matches is counted as false positives (or negatives), and the other
+* characters as a success.
+*
+* @param suc_rate       Where to add the success rate
+* @param n_found        The number of matches the algorithm found
+* @param real_results   The real results of the stream
+* @param n              The length of the stream
+*/
+static void measure_count_success_rate(SuccessRate* suc_rate, size_t n_found, pattern_id_t real_results[], size_t n) {
+	size_t i, n_real = 0;
+	for (i = 0; i < n; ++i) {
+		if (real_results[i] != null_pattern_id) n_real++;
+	}
+	if (n_found > n_real) {
+		suc_rate->false_pos += n_found - n_real;
+		suc_rate->success += n - (n_found - n_real);
+	} else {
+		suc_rate->false_neg += n_real - n_found;
+		suc_rate->success += n - (n_real - n_found);
+	}
+}
+
+/**
+* Measure the success rate of the first match of a packet (MPS_SCAN_FIRST), and add it to a SuccessRate
+*
+* The packet is counted once: a success if the first match is the first real match (or both have none), a partial
+* success if it is at the same position but not the longest pattern, a false negative if the first real match was
+* missed, and a false positive otherwise.
+*
+* @param suc_rate       Where to add the success rate
+* @param first          The first match the algorithm found
+* @param n_found        The number of matches the algorithm found (0 or 1)
+* @param real_results   The real results of the packet
+* @param n              The length of the packet
+*/
+static void measure_first_success_rate(SuccessRate* suc_rate, const MpsMatch* first, size_t n_found,
+                                       pattern_id_t real_results[], size_t n) {
+	size_t pos = 0;
+	while (pos < n && real_results[pos] == null_pattern_id) pos++;
+	if (n_found == 0) {
+		if (pos == n) {
+			suc_rate->success++;
+		} else {
+			suc_rate->false_neg++;
+		}
+	} else if (first->pos > pos && pos < n) {
+		suc_rate->false_neg++;
+	} else if (first->pos != pos || pos == n) {
+		suc_rate->false_pos++;
+	} else if (first->id == real_results[pos]) {
+		suc_rate->success++;
+	} else if (is_pattern_suffix(first->id, real_results[pos])) {
+		suc_rate->partial_suc++;
+	} else {
+		suc_rate->false_pos++;
+	}
+}
+
 /**
 * Find the index of an id in the values returned from perf event file reading
 *
@@ -208,106 +535,890 @@ static size_t find_index_of_id(ReadFormat* rf, uint64_t id) {
 	return nr;
 }
 
+/**
+* Read the counters of a perf_event group, and add the count since the previous reading of every event to windows
+*
+* @param group        The perf_event group data
+* @param n            The number of events in the group
+* @param windows      Where to add the count of every event
+*/
+static void read_perf_group_window(PerfEventGroupData* group, size_t n, uint64_t* windows) {
+	char perf_buf[PERF_BUF_SIZE];
+	ReadFormat *read_stats = (ReadFormat*)perf_buf;
+	size_t j, index;
+	if (read(group->events[0].fd, perf_buf, PERF_BUF_SIZE) <= 0) return;
+	for (j = 0; j < n; ++j) {
+		index = find_index_of_id(read_stats, group->events[j].id);
+		if (index != read_stats->nr) {
+			windows[j] += read_stats->values[index].value - group->events[j].last;
+			group->events[j].last = read_stats->values[index].value;
+		}
+	}
+}
+
 /**
 * Read the perf_event counters and update the statistics according to it
 *
+* The counters are read after every window, so the difference from the previous reading is the count of the window,
+* which is also added to the statistics of the current stream. The counts of the other threads of the instance are
+* added to those of the calling thread (so the maximal window is of all its threads).
+*
+* @param conf         The configuration with the perf_event groups
 * @param data         The perf_event groups data
+* @param threads      The other threads of the instance (NULL if it has none)
 * @param stats        The place to put the statistics in
+* @param stream_stats The statistics of the current stream
 */
-static void read_perf_events_results(PerfEventGroupData data[N_PERF_GROUPS], InstanceStats* stats) {
-	char perf_buf[PERF_BUF_SIZE];
-	ReadFormat *read_stats = (ReadFormat*)perf_buf;
-	size_t i, j, n, index;
-	for (i = 0; i < N_PERF_GROUPS; ++i) {
-		read(data[i].events[0].fd, perf_buf, PERF_BUF_SIZE);
-		n = perf_events[i].n;
+static void read_perf_events_results(Conf* conf, PerfEventGroupData* data, InstanceThreads* threads,
+                                     InstanceStats* stats, InstanceStats* stream_stats) {
+	uint64_t windows[PERF_MAX_GROUP_EVENTS];
+	PerfEventGroupStats *group_stats, *stream_group_stats;
+	size_t i, j, t, n;
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		n = conf->perf_groups[i].n;
+		memset(windows, 0, sizeof(windows));
+		read_perf_group_window(&data[i], n, windows);
+		for (t = 0; threads && t < threads->n; ++t) {
+			read_perf_group_window(&threads->data[t][i], n, windows);
+		}
+		group_stats = &stats->perf_groups_stats[i];
+		stream_group_stats = &stream_stats->perf_groups_stats[i];
 		for (j = 0; j < n; ++j) {
-			index = find_index_of_id(read_stats, data[i].events[j].id);
-			if (index != read_stats->nr) {
-				stats->perf_groups_stats[i].perf_stats[j] = read_stats->values[index].value;
-			}
+			group_stats->perf_stats[j] += windows[j];
+			stream_group_stats->perf_stats[j] += windows[j];
+			if (windows[j] > group_stats->max_window_stats[j]) group_stats->max_window_stats[j] = windows[j];
+			if (windows[j] > stream_group_stats->max_window_stats[j]) stream_group_stats->max_window_stats[j] = windows[j];
 		}
 	}
 }
 
 /**
-* Run the mps instance while measuring all aspects of the instance to be measured.
+* Add the latency of a window to the latency histogram
 *
-* Put the resulted measurements in given parameter
+* @param hist         The latency histogram
+* @param value        The latency of the window (in picoseconds per byte)
+*/
+static void latency_histogram_add(LatencyHistogram* hist, uint64_t value) {
+	size_t bucket;
+	int high;
+	if (value < LATENCY_SUB_BUCKETS) {
+		bucket = value;
+	} else {
+		high = 63 - __builtin_clzll(value);
+		bucket = (high - LATENCY_SUB_BUCKETS_BITS + 1) * LATENCY_SUB_BUCKETS +
+		         ((value >> (high - LATENCY_SUB_BUCKETS_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+	}
+	hist->buckets[bucket]++;
+	hist->n++;
+}
+
+/**
+* Get the CPU time consumed by the calling thread
+*
+* This is like clock(), but clock() counts the time of all the threads in the process
 *
-* @param inst      The mps instance to run
-* @param stats     Where to put the measurements that were measured
+* @return       The CPU time of the calling thread, in units of CLOCKS_PER_SEC
 */
-static void measure_single_instance_stats(MpsInstance* inst, InstanceStats* stats, Conf* conf) {
-	size_t i;
-	char stream_buffer[STREAM_BUFFER_SIZE];
-	pattern_id_t algo_results[STREAM_BUFFER_SIZE];
-	pattern_id_t real_results[STREAM_BUFFER_SIZE];
-	size_t n_stream_files = conf->n_stream_files;
-	char** stream_files = conf->stream_files;
+static clock_t thread_clock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (clock_t)ts.tv_sec * CLOCKS_PER_SEC + (clock_t)((uint64_t)ts.tv_nsec * CLOCKS_PER_SEC / 1000000000);
+}
 
+/**
+* Get the CPU time consumed by the calling thread and by the other threads of an instance
+*
+* @param threads   The other threads of the instance (NULL if it has none)
+*
+* @return          The CPU time of all the threads, in units of CLOCKS_PER_SEC
+*/
+static clock_t instance_clock(InstanceThreads* threads) {
+	struct timespec ts;
+	clock_t ret = thread_clock();
+	size_t t;
+	for (t = 0; threads && t < threads->n; ++t) {
+		clock_gettime(threads->threads[t].clock, &ts);
+		ret += (clock_t)ts.tv_sec * CLOCKS_PER_SEC + (clock_t)((uint64_t)ts.tv_nsec * CLOCKS_PER_SEC / 1000000000);
+	}
+	return ret;
+}
 
+/**
+* Do the ioctl request on the perf_event groups of an instance, and on those of its other threads
+*
+* @param data        The perf_event groups data of the calling thread
+* @param threads     The other threads of the instance (NULL if it has none)
+* @param n_groups    The number of groups
+* @param request     The ioctl request (e.g. PERF_EVENT_IOC_ENABLE)
+*/
+static inline void instance_perf_ioctl(PerfEventGroupData* data, InstanceThreads* threads, size_t n_groups,
+                                       unsigned long request) {
+	size_t t;
+	perf_event_data_ioctl(data, n_groups, request);
+	for (t = 0; threads && t < threads->n; ++t) {
+		perf_event_data_ioctl(threads->data[t], n_groups, request);
+	}
+}
+
+/**
+* Free the other threads of an instance (close their perf_event groups)
+*
+* @param conf      The configuration with the perf_event groups
+* @param threads   The threads
+*/
+static void free_instance_threads(Conf* conf, InstanceThreads* threads) {
+	size_t t;
+	for (t = 0; t < threads->n; ++t) {
+		free_perf_events_data(conf, threads->data[t]);
+	}
+	free(threads->threads);
+	free(threads->data);
+	memset(threads, 0, sizeof(InstanceThreads));
+}
+
+/**
+* Take the other threads of an mps object (unless they were already taken from it), and open their perf_event groups
+*
+* @param conf      The configuration with the perf_event groups
+* @param algo      The algorithm of the object
+* @param obj       The object
+* @param threads   The threads of the instance
+*/
+static void sync_instance_threads(Conf* conf, int algo, void* obj, InstanceThreads* threads) {
+	size_t t;
+	if (threads->obj == obj) return;
+	free_instance_threads(conf, threads);
+	threads->obj = obj;
+	if (mps_table[algo].threads == NULL) return;
+	threads->n = mps_table[algo].threads(obj, NULL, 0);
+	if (threads->n == 0) return;
+	threads->threads = (MpsThread*)malloc(threads->n * sizeof(MpsThread));
+	threads->data = (PerfEventGroupData**)malloc(threads->n * sizeof(PerfEventGroupData*));
+	if (threads->threads == NULL || threads->data == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	mps_table[algo].threads(obj, threads->threads, threads->n);
+	for (t = 0; t < threads->n; ++t) {
+		// the threads of the object aren't pinned, so their events are counted on any cpu
+		threads->data[t] = create_perf_events_data(conf, threads->threads[t].tid, -1);
+		perf_event_data_ioctl(threads->data[t], conf->n_perf_groups, PERF_EVENT_IOC_RESET);
+	}
+}
+
+/**
+* Pin the calling thread to a single cpu out of the cpus the process is allowed to run on
+*
+* @param index     The index of the worker (the cpus are chosen round-robin by this index)
+*
+* @return          The cpu the thread was pinned to, or -1 if it couldn't be pinned
+*/
+static int pin_thread_to_cpu(size_t index) {
+	cpu_set_t allowed, set;
+	int cpu, n_allowed;
+
+	if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) != 0) return -1;
+	n_allowed = CPU_COUNT(&allowed);
+	if (n_allowed == 0) return -1;
+	index %= n_allowed;
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &allowed) && index-- == 0) break;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return -1;
+	return cpu;
+}
+
+/**
+* Open a stream file, and map it to memory if possible
+*
+* @param sf        The stream file to open
+* @param name      The name of the file
+* @param buffer    Buffer of size STREAM_BUFFER_SIZE to read to if the file can't be mapped
+*/
+static void stream_file_open(StreamFile* sf, const char* name, char* buffer) {
+	struct stat st;
+	void* data;
+
+	memset(sf, 0, sizeof(StreamFile));
+	sf->name = name;
+	sf->buffer = buffer;
+	sf->fd = open(name, O_RDONLY);
+	if (sf->fd == -1) {
+		fprintf(stderr, "can't open stream file %s: %s\n", name, strerror(errno));
+		FatalExit();
+	}
+	if (fstat(sf->fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		return;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, sf->fd, 0);
+	if (data == MAP_FAILED) {
+		return;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	madvise(data, st.st_size, MADV_HUGEPAGE);
+#endif
+	sf->data = (const char*)data;
+	sf->size = st.st_size;
+}
+
+/**
+* Get the next window of a stream file
+*
+* @param sf        The stream file
+* @param window    Set to the start of the window
+*
+* @return          The length of the window (at most STREAM_BUFFER_SIZE), or 0 in the end of the file
+*/
+static size_t stream_file_next_window(StreamFile* sf, const char** window) {
+	size_t len;
+	ssize_t len_read;
+
+	if (sf->data) {
+		len = sf->size - sf->offset;
+		if (len > STREAM_BUFFER_SIZE) len = STREAM_BUFFER_SIZE;
+		*window = sf->data + sf->offset;
+		sf->offset += len;
+		return len;
+	}
+	len = 0;
+	do {
+		len_read = read(sf->fd, sf->buffer + len, STREAM_BUFFER_SIZE - len);
+		if (len_read == -1) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "can't read from stream file %s: %s\n", sf->name, strerror(errno));
+			FatalExit();
+		}
+		len += len_read;
+	} while (len_read != 0 && len < STREAM_BUFFER_SIZE);
+	*window = sf->buffer;
+	return len;
+}
+
+/**
+* Close a stream file (and unmap it)
+*
+* @param sf        The stream file
+*/
+static void stream_file_close(StreamFile* sf) {
+	if (sf->data) {
+		munmap((void*)sf->data, sf->size);
+	}
+	close(sf->fd);
+}
+
+/**
+* Create zeroed statistics for the perf_event groups of the configuration
+*
+* @param conf         The configuration with the perf_event groups
+* @param max_window   Whether to also have the maximal counts in a window
+*
+* @return             The statistics of every group
+*/
+static PerfEventGroupStats* create_perf_groups_stats(Conf* conf, int max_window) {
+	PerfEventGroupStats* stats;
+	size_t i;
+	stats = (PerfEventGroupStats*)malloc(conf->n_perf_groups * sizeof(PerfEventGroupStats));
+	if (stats == NULL && conf->n_perf_groups != 0) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		stats[i].perf_stats = (uint64_t*)calloc(conf->perf_groups[i].n, sizeof(uint64_t));
+		stats[i].max_window_stats = max_window ? (uint64_t*)calloc(conf->perf_groups[i].n, sizeof(uint64_t)) : NULL;
+		if (stats[i].perf_stats == NULL || (max_window && stats[i].max_window_stats == NULL)) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+	}
+	return stats;
+}
+
+/**
+* Initialize the statistics of an mps instance before measuring it
+*
+* @param conf      The configuration with the perf_event groups
+* @param stats     The statistics to initialize
+* @param streams   Whether to also initialize statistics for every stream file (in stats->stream_stats)
+*/
+static void init_instance_stats(Conf* conf, InstanceStats* stats, int streams) {
+	size_t i;
 	memset(stats, 0, sizeof(InstanceStats));
-	for (i = 0; i < N_PERF_GROUPS; ++i) {
-		stats->perf_groups_stats[i].perf_stats = (uint64_t*)malloc(perf_events[i].n * sizeof(uint64_t));
+	if (streams) {
+		stats->build.add.perf_groups_stats = create_perf_groups_stats(conf, 0);
+		stats->build.compile.perf_groups_stats = create_perf_groups_stats(conf, 0);
+		stats->stream_stats = (InstanceStats*)malloc(conf->n_stream_files * sizeof(InstanceStats));
+		if (stats->stream_stats == NULL && conf->n_stream_files != 0) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		for (i = 0; i < conf->n_stream_files; ++i) {
+			init_instance_stats(conf, &stats->stream_stats[i], 0);
+		}
 	}
-	PerfEventGroupData* data = create_perf_events_data();
+	stats->perf_groups_stats = create_perf_groups_stats(conf, 1);
+}
 
-	// start the measuring
-	if (verbose) {
-		printf("Measuring algorithm %s...", mps_table[inst->algo].name);
-		fflush(stdout);
+/**
+* Check whether the streams are read with contexts (interleaved streams, or scanning them)
+*
+* @param conf     The configuration
+*
+* @return         1 if the streams are read with contexts, 0 otherwise
+*/
+static inline int reads_with_contexts(const Conf* conf) {
+	return conf->n_interleaved > 1 || conf->scan_mode != MPS_SCAN_NONE;
+}
+
+/**
+* Create the contexts of an mps object for reading interleaved streams
+*
+* @param algo      The algorithm of the object
+* @param obj       The mps object
+* @param k         The number of contexts
+*
+* @return          Array of k new contexts of the object
+*/
+static void** create_instance_contexts(int algo, void* obj, size_t k) {
+	size_t i;
+	void** ctxs = (void**)malloc(k * sizeof(void*));
+	if (ctxs == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
 	}
-	perf_event_data_ioctl(data, PERF_EVENT_IOC_RESET);
-	for (i = 0; i < n_stream_files; ++i) {
-		size_t j;
-		ssize_t len_read;
-		// hold the mps functions and object in variables,
-		// so we won't need to access extra memory during measurement
-		pattern_id_t (*read_char_func)(void*, char) = mps_table[inst->algo].read_char;
-		void* obj = inst->obj;
-		pattern_id_t (*reliable_read_char)(void*, char) = mps_table[conf->reliable_mps_instance.algo].read_char;
-		void* reliable_obj = conf->reliable_mps_instance.obj;
-		int fd;
-
-		// Reset the algorithms before start of stream
-		mps_table[conf->reliable_mps_instance.algo].reset(reliable_obj);
+	for (i = 0; i < k; ++i) {
+		ctxs[i] = mps_table[algo].new_context(obj);
+	}
+	return ctxs;
+}
+
+/**
+* Free the contexts of an mps object created by create_instance_contexts
+*
+* @param algo      The algorithm of the object
+* @param obj       The mps object
+* @param ctxs      The contexts to free
+* @param k         The number of contexts
+*/
+static void free_instance_contexts(int algo, void* obj, void** ctxs, size_t k) {
+	size_t i;
+	for (i = 0; i < k; ++i) {
+		mps_table[algo].free_context(obj, ctxs[i]);
+	}
+	free(ctxs);
+}
+
+/**
+* Read a chunk as k interleaved streams (the i-th part of the chunk is read with ctxs[i])
+*
+* @param mps       The functions of the algorithm
+* @param obj       The mps object
+* @param ctxs      The contexts of the streams
+* @param k         The number of streams
+* @param buf       The chunk
+* @param len       The length of the chunk
+* @param out       Where to put the results on every character of the chunk
+*/
+static inline void read_interleaved(MpsElem* mps, void* obj, void** ctxs, size_t k,
+                                    const char* buf, size_t len, pattern_id_t* out) {
+	const char* bufs[MPS_MAX_BATCH];
+	size_t lens[MPS_MAX_BATCH];
+	pattern_id_t* outs[MPS_MAX_BATCH];
+	size_t i, from, to;
+	for (i = 0; i < k; ++i) {
+		from = len * i / k;
+		to = len * (i + 1) / k;
+		bufs[i] = buf + from;
+		lens[i] = to - from;
+		outs[i] = out + from;
+	}
+	if (mps->ctx_read_batch) {
+		mps->ctx_read_batch(obj, ctxs, bufs, lens, outs, k);
+	} else {
+		for (i = 0; i < k; ++i) {
+			mps->ctx_read_block(obj, ctxs[i], bufs[i], lens[i], outs[i]);
+		}
+	}
+}
+
+/**
+* Scan a chunk as k interleaved streams (the i-th part of the chunk is scanned with ctxs[i])
+*
+* The matches of the i-th part are put in the matches of its characters (from the start of the part), and on
+* MPS_SCAN_FIRST every part is a packet, so its context is reset before scanning it.
+*
+* @param mps       The functions of the algorithm
+* @param obj       The mps object
+* @param ctxs      The contexts of the streams
+* @param k         The number of streams
+* @param buf       The chunk
+* @param len       The length of the chunk
+* @param mode      The scan mode
+* @param matches   Where to put the matches (of size len)
+* @param n_found   Where to put the number of matches of every stream
+*/
+static inline void scan_interleaved(MpsElem* mps, void* obj, void** ctxs, size_t k, const char* buf, size_t len,
+                                    int mode, MpsMatch* matches, size_t* n_found) {
+	size_t i, from, to;
+	for (i = 0; i < k; ++i) {
+		from = len * i / k;
+		to = len * (i + 1) / k;
+		if (mode == MPS_SCAN_FIRST) mps->reset_context(obj, ctxs[i]);
+		n_found[i] = mps_ctx_scan(mps, obj, ctxs[i], buf + from, to - from, mode, matches + from, to - from);
+	}
+}
+
+/**
+* Put the results of every character of a stream from its matches
+*
+* @param matches   The matches of the stream (their positions are from the start of the stream)
+* @param n_found   The number of matches
+* @param results   Where to put the results
+* @param n         The length of the stream
+*/
+static void matches_to_results(const MpsMatch* matches, size_t n_found, pattern_id_t* results, size_t n) {
+	size_t i;
+	for (i = 0; i < n; ++i) {
+		results[i] = null_pattern_id;
+	}
+	for (i = 0; i < n_found; ++i) {
+		results[matches[i].pos] = matches[i].id;
+	}
+}
+
+/**
+* Run the mps instance on the current chunk of the stream while measuring it,
+* and add the resulted measurements to its statistics
+*
+* @param inst          The mps instance to run
+* @param stats         The statistics of the instance
+* @param data          The perf_event groups data of the instance
+* @param shared        The shared data with the current chunk and its real results
+* @param algo_results  Buffer of size STREAM_BUFFER_SIZE to put the instance results in
+* @param matches       Buffer of size STREAM_BUFFER_SIZE to put the instance matches in (NULL if not scanning)
+* @param reader        The object of the instance, and its contexts of the interleaved streams
+* @param threads       The other threads of the object of the instance (their time and events are added)
+* @param switched      Whether the instance switched its dictionaries at the start of the chunk
+*/
+static void measure_chunk(MpsInstance* inst, InstanceStats* stats, PerfEventGroupData* data,
+                          MeasureShared* shared, pattern_id_t* algo_results, MpsMatch* matches, MpsReader* reader,
+                          InstanceThreads* threads, int switched) {
+	// hold the mps functions and object in variables,
+	// so we won't need to access extra memory during measurement
+	pattern_id_t (*read_char_func)(void*, char) = mps_table[inst->algo].read_char;
+	void (*read_block_func)(void*, const char*, size_t, pattern_id_t*) = mps_table[inst->algo].read_block;
+	void* obj = reader->obj;
+	void** ctxs = reader->ctxs;
+	pattern_id_t* real_results = shared->real_results[reader->generation];
+	const char* stream_buffer = shared->stream_buffer;
+	ssize_t j, len = shared->len;
+	size_t i, from, to, skip, k = shared->conf->n_interleaved, n_groups = shared->conf->n_perf_groups;
+	size_t n_found[MPS_MAX_BATCH];
+	int scan_mode = shared->conf->scan_mode;
+	InstanceStats* stream_stats = &stats->stream_stats[shared->stream_index];
+	SuccessRate suc_rate;
+	clock_t begin, end;
+	uint64_t begin_ns, end_ns, latency;
+
+	// Reset the algorithm before start of stream
+	if (shared->new_stream) {
 		mps_table[inst->algo].reset(obj);
-		fd = open(stream_files[i], O_RDONLY);
-		if (fd == -1) {
-			fprintf(stderr, "can't open stream file %s: %s\n", stream_files[i], strerror(errno));
-			FatalExit();
+		for (i = 0; ctxs && i < k; ++i) {
+			mps_table[inst->algo].reset_context(obj, ctxs[i]);
+		}
+	}
+
+	begin = instance_clock(threads);
+	instance_perf_ioctl(data, threads, n_groups, PERF_EVENT_IOC_ENABLE);
+	begin_ns = monotonic_ns();
+	if (scan_mode != MPS_SCAN_NONE) {
+		scan_interleaved(&mps_table[inst->algo], obj, ctxs, k, stream_buffer, len, scan_mode, matches, n_found);
+	} else if (ctxs) {
+		read_interleaved(&mps_table[inst->algo], obj, ctxs, k, stream_buffer, len, algo_results);
+	} else if (read_block_func) {
+		read_block_func(obj, stream_buffer, len, algo_results);
+	} else {
+		for (j = 0; j < len; ++j) {
+			algo_results[j] = read_char_func(obj, stream_buffer[j]);
+		}
+	}
+	end_ns = monotonic_ns();
+	instance_perf_ioctl(data, threads, n_groups, PERF_EVENT_IOC_DISABLE);
+	end = instance_clock(threads);
+	stats->total_cycles += end - begin;
+	stream_stats->total_cycles += end - begin;
+	stats->n_bytes += len;
+	stream_stats->n_bytes += len;
+	if (len > 0) {
+		latency = (end_ns - begin_ns) * 1000 / len;
+		latency_histogram_add(&stats->latency, latency);
+		latency_histogram_add(&stream_stats->latency, latency);
+	}
+	read_perf_events_results(shared->conf, data, threads, stats, stream_stats);
+
+	if (shared->reload && reader->generation == 0) stats->reload.old_bytes += len;
+
+	// compare every stream of the chunk (without its start, if the instance just switched its dictionaries)
+	memset(&suc_rate, 0, sizeof(SuccessRate));
+	skip = switched && !shared->new_stream ? shared->skip : 0;
+	for (i = 0; i < k && has_real_results(shared, reader->generation); ++i) {
+		from = len * i / k;
+		to = len * (i + 1) / k;
+		if (scan_mode == MPS_SCAN_COUNT) {
+			if (skip == 0) measure_count_success_rate(&suc_rate, n_found[i], real_results + from, to - from);
+			continue;
+		} else if (scan_mode == MPS_SCAN_FIRST) {
+			// the packet is read from its start, so nothing is skipped
+			measure_first_success_rate(&suc_rate, matches + from, n_found[i], real_results + from, to - from);
+			continue;
+		} else if (scan_mode == MPS_SCAN_LIST) {
+			matches_to_results(matches + from, n_found[i], algo_results + from, to - from);
+		}
+		from += skip;
+		if (from < to) measure_success_rate(&suc_rate, algo_results + from, real_results + from, to - from);
+	}
+	add_success_rate(&stats->suc_rate, &suc_rate);
+	add_success_rate(&stream_stats->suc_rate, &suc_rate);
+}
+
+/**
+* Run the mps instance on the flows of the worker in the current chunk (of a capture file) while measuring it,
+* and add the resulted measurements to its statistics
+*
+* The contexts of the new flows are created before measuring (but resetting them at the start of a flow, and
+* switching between the contexts of the flows, is measured).
+*
+* @param inst          The mps instance to run
+* @param stats         The statistics of the instance (shared by all the workers)
+* @param lock          The lock of the statistics
+* @param data          The perf_event groups data of the instance in this worker
+* @param shared        The shared data with the segments of the current chunk and their real results
+* @param algo_results  Buffer of size STREAM_BUFFER_SIZE to put the instance results in
+* @param flow_ctxs     The contexts of the flows of the instance (CAPTURE_MAX_FLOWS, NULL for a flow not read yet)
+* @param worker        The index of the worker (the worker reads the segments with this hash modulo n_workers)
+* @param n_workers     The number of workers
+*/
+static void measure_flows_chunk(MpsInstance* inst, InstanceStats* stats, pthread_mutex_t* lock,
+                                PerfEventGroupData* data, MeasureShared* shared, pattern_id_t* algo_results,
+                                void** flow_ctxs, size_t worker, size_t n_workers) {
+	void (*ctx_read_block_func)(void*, void*, const char*, size_t, pattern_id_t*) = mps_table[inst->algo].ctx_read_block;
+	void (*reset_context_func)(void*, void*) = mps_table[inst->algo].reset_context;
+	void* obj = inst->obj;
+	const CaptureSegment *segments = shared->segments, *segment;
+	size_t i, len = 0, n_segments = shared->n_segments;
+	InstanceStats* stream_stats = &stats->stream_stats[shared->stream_index];
+	SuccessRate suc_rate;
+	clock_t begin, end;
+	uint64_t begin_ns, end_ns, latency;
+
+	for (i = 0; i < n_segments; ++i) {
+		segment = &segments[i];
+		if (segment->hash % n_workers != worker) continue;
+		if (flow_ctxs[segment->flow] == NULL) flow_ctxs[segment->flow] = mps_table[inst->algo].new_context(obj);
+		len += segment->len;
+	}
+	if (len == 0) return;
+
+	begin = thread_clock();
+	perf_event_data_ioctl(data, shared->conf->n_perf_groups, PERF_EVENT_IOC_ENABLE);
+	begin_ns = monotonic_ns();
+	for (i = 0; i < n_segments; ++i) {
+		segment = &segments[i];
+		if (segment->hash % n_workers != worker) continue;
+		if (segment->new_flow) reset_context_func(obj, flow_ctxs[segment->flow]);
+		ctx_read_block_func(obj, flow_ctxs[segment->flow], segment->data, segment->len, algo_results + segment->offset);
+	}
+	end_ns = monotonic_ns();
+	perf_event_data_ioctl(data, shared->conf->n_perf_groups, PERF_EVENT_IOC_DISABLE);
+	end = thread_clock();
+
+	memset(&suc_rate, 0, sizeof(SuccessRate));
+	for (i = 0; i < n_segments && has_real_results(shared, 0); ++i) {
+		segment = &segments[i];
+		if (segment->hash % n_workers != worker) continue;
+		measure_success_rate(&suc_rate, algo_results + segment->offset, shared->real_results[0] + segment->offset,
+		                     segment->len);
+	}
+
+	pthread_mutex_lock(lock);
+	stats->total_cycles += end - begin;
+	stream_stats->total_cycles += end - begin;
+	stats->n_bytes += len;
+	stream_stats->n_bytes += len;
+	latency = (end_ns - begin_ns) * 1000 / len;
+	latency_histogram_add(&stats->latency, latency);
+	latency_histogram_add(&stream_stats->latency, latency);
+	read_perf_events_results(shared->conf, data, NULL, stats, stream_stats);
+	add_success_rate(&stats->suc_rate, &suc_rate);
+	add_success_rate(&stream_stats->suc_rate, &suc_rate);
+	pthread_mutex_unlock(lock);
+}
+
+/**
+* The main function of a measuring worker thread
+*
+* The worker opens its own perf_event groups (so they count only this thread, on the cpu it is pinned to),
+* and then measures its mps instances on every chunk the main thread publish, until there are no more chunks.
+*
+* @param arg       The MeasureWorker of this thread
+*
+* @return          NULL
+*/
+static void* measure_worker(void* arg) {
+	MeasureWorker* worker = (MeasureWorker*)arg;
+	MeasureShared* shared = worker->shared;
+	Conf* conf = shared->conf;
+	size_t i, j, k, n_workers = worker->n_workers, n_mps_instances = conf->n_mps_instances;
+	size_t n_interleaved = conf->n_interleaved;
+	PerfEventGroupData** data; // the perf_event groups data of every instance (NULL for an instance we don't read)
+	InstanceThreads* threads;  // the other threads of the object of every instance (when reading without contexts)
+	void*** flow_ctxs = NULL;  // the contexts of the flows of every instance (when reading capture files)
+	pattern_id_t* algo_results;
+	MpsMatch* matches = NULL;
+	MpsInstance* inst;
+	MpsReader* reader;
+	size_t mem;
+	int cpu, switched;
+
+	cpu = pin_thread_to_cpu(worker->index);
+	data = (PerfEventGroupData**)calloc(n_mps_instances, sizeof(PerfEventGroupData*));
+	threads = (InstanceThreads*)calloc(n_mps_instances, sizeof(InstanceThreads));
+	algo_results = (pattern_id_t*)malloc(STREAM_BUFFER_SIZE * sizeof(pattern_id_t));
+	if (conf->scan_mode != MPS_SCAN_NONE) matches = (MpsMatch*)malloc(STREAM_BUFFER_SIZE * sizeof(MpsMatch));
+	if (conf->n_capture_files) flow_ctxs = (void***)calloc(n_mps_instances, sizeof(void**));
+	if (((data == NULL || threads == NULL) && n_mps_instances != 0) || algo_results == NULL ||
+	    (conf->scan_mode != MPS_SCAN_NONE && matches == NULL) ||
+	    (conf->n_capture_files && flow_ctxs == NULL && n_mps_instances != 0)) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = worker->index; i < n_mps_instances; i += n_workers) {
+		// the contexts are created on the worker, so their memory is local to its cpu
+		reader = &shared->readers[i];
+		if (reads_with_contexts(conf)) {
+			reader->ctxs = create_instance_contexts(conf->mps_instances[i].algo, reader->obj, n_interleaved);
+			reader->n_ctxs = n_interleaved;
 		}
-		do {
-			// Read chunk of size STREAM_BUFFER_SIZE from the stream and measure performance on it
-			clock_t begin, end;
-			len_read = read(fd, stream_buffer, STREAM_BUFFER_SIZE);
-			if (len_read == -1) {
-				fprintf(stderr, "can't read from stream file %s: %s\n", stream_files[i], strerror(errno));
+	}
+	for (i = 0; i < n_mps_instances; ++i) {
+		// we read the flows of capture files on all the instances, and the stream files only on ours
+		if (!conf->n_capture_files && i % n_workers != worker->index) continue;
+		data[i] = create_perf_events_data(conf, 0, cpu);
+		perf_event_data_ioctl(data[i], conf->n_perf_groups, PERF_EVENT_IOC_RESET);
+		if (flow_ctxs) {
+			flow_ctxs[i] = (void**)calloc(CAPTURE_MAX_FLOWS, sizeof(void*));
+			if (flow_ctxs[i] == NULL) {
+				perror("failed to allocate memory");
 				FatalExit();
 			}
-			
-			begin = clock();
-			perf_event_data_ioctl(data, PERF_EVENT_IOC_ENABLE);
-			for (j = 0; j < len_read; ++j) {
-				algo_results[j] = read_char_func(obj, stream_buffer[j]);
+		}
+	}
+
+	while (1) {
+		// wait for the main thread to publish the next chunk
+		pthread_barrier_wait(&shared->barrier);
+		if (shared->done) break;
+		if (shared->segments) {
+			for (i = 0; i < n_mps_instances; ++i) {
+				measure_flows_chunk(&conf->mps_instances[i], &conf->mps_instances_stats[i], &shared->stats_locks[i],
+				                    data[i], shared, algo_results, flow_ctxs[i], worker->index, n_workers);
 			}
-			perf_event_data_ioctl(data, PERF_EVENT_IOC_DISABLE);
-			end = clock();
-			stats->total_cycles += end - begin;
+		} else {
+			for (i = worker->index; i < n_mps_instances; i += n_workers) {
+				reader = &shared->readers[i];
+				switched = shared->reload ? reload_sync_reader(shared->reload, i, reader, &conf->mps_instances_stats[i]) : 0;
+				if (shared->sync_only) continue;
+				// the contexts are read on the calling thread, so only the object itself may read on other threads
+				if (!reader->ctxs) sync_instance_threads(conf, conf->mps_instances[i].algo, reader->obj, &threads[i]);
+				measure_chunk(&conf->mps_instances[i], &conf->mps_instances_stats[i], data[i], shared, algo_results,
+				              matches, reader, &threads[i], switched);
+			}
+		}
+		// let the main thread know we are done with the chunk
+		pthread_barrier_wait(&shared->barrier);
+	}
 
-			// perform the raliable alogirthm to discover real results, and measure success rate
-			for (j = 0; j < len_read; ++j) {
-				real_results[j] = reliable_read_char(reliable_obj, stream_buffer[j]);
+	for (i = 0; i < n_mps_instances; ++i) {
+		inst = &conf->mps_instances[i];
+		reader = &shared->readers[i];
+		mem = 0;
+		if (i % n_workers == worker->index) {
+			mem += mps_table[inst->algo].total_mem(reader->obj);
+			for (j = 0; reader->ctxs && j < n_interleaved; ++j) {
+				mem += mps_table[inst->algo].context_mem(reader->obj, reader->ctxs[j]);
 			}
-			measure_success_rate(&stats->suc_rate, algo_results, real_results, len_read);
-		} while (len_read == STREAM_BUFFER_SIZE);
-		close(fd);
+			if (reader->ctxs) free_instance_contexts(inst->algo, reader->obj, reader->ctxs, n_interleaved);
+		}
+		for (k = 0; flow_ctxs && k < CAPTURE_MAX_FLOWS; ++k) {
+			if (flow_ctxs[i][k] == NULL) continue;
+			mem += mps_table[inst->algo].context_mem(inst->obj, flow_ctxs[i][k]);
+			mps_table[inst->algo].free_context(inst->obj, flow_ctxs[i][k]);
+		}
+		pthread_mutex_lock(&shared->stats_locks[i]);
+		conf->mps_instances_stats[i].total_mem += mem;
+		pthread_mutex_unlock(&shared->stats_locks[i]);
+		if (flow_ctxs) free(flow_ctxs[i]);
+		if (data[i]) free_perf_events_data(conf, data[i]);
+		free_instance_threads(conf, &threads[i]);
 	}
-	if (verbose) printf("Done\n");
-	
-	read_perf_events_results(data, stats);
-	stats->total_mem = mps_table[inst->algo].total_mem(inst->obj);
+	free(data);
+	free(threads);
+	free(flow_ctxs);
+	free(algo_results);
+	free(matches);
+	return NULL;
+}
+
+/**
+* Run the reliable mps instance of a generation on the current chunk, and put its results as the real results
+* of the chunk in that generation
+*
+* @param conf      The configuration
+* @param shared    The shared data with the current chunk
+* @param gen       The generation of the dictionaries (0 when not reloading)
+*/
+static void compute_real_results(Conf* conf, MeasureShared* shared, int gen) {
+	MpsInstance* reliable = shared->reliable[gen];
+	pattern_id_t (*reliable_read_char)(void*, char);
+	void (*reliable_read_block)(void*, const char*, size_t, pattern_id_t*);
+	void* reliable_obj = reliable->obj;
+	pattern_id_t* real_results = shared->real_results[gen];
+	ssize_t j, len = shared->len;
+	size_t i;
+
+	if (!has_real_results(shared, gen)) return;
+	reliable_read_char = mps_table[reliable->algo].read_char;
+	reliable_read_block = mps_table[reliable->algo].read_block;
+	if (conf->scan_mode == MPS_SCAN_FIRST) {
+		// every stream of the chunk is a packet of its own
+		for (i = 0; i < conf->n_interleaved; ++i) {
+			mps_table[reliable->algo].reset_context(reliable_obj, shared->reliable_ctxs[gen][i]);
+		}
+	}
+	if (shared->reliable_ctxs[gen]) {
+		read_interleaved(&mps_table[reliable->algo], reliable_obj, shared->reliable_ctxs[gen],
+		                 conf->n_interleaved, shared->stream_buffer, len, real_results);
+	} else if (reliable_read_block) {
+		reliable_read_block(reliable_obj, shared->stream_buffer, len, real_results);
+	} else {
+		for (j = 0; j < len; ++j) {
+			real_results[j] = reliable_read_char(reliable_obj, shared->stream_buffer[j]);
+		}
+	}
+}
+
+/**
+* Start using a generation of the dictionaries in the real results (create the contexts of its reliable instance,
+* in the initial state)
+*
+* @param conf      The configuration
+* @param shared    The shared data
+* @param reliable  The reliable instance of the generation
+* @param gen       The generation
+*/
+static void use_generation(Conf* conf, MeasureShared* shared, MpsInstance* reliable, int gen) {
+	shared->reliable[gen] = reliable;
+	if (reads_with_contexts(conf) && has_real_results(shared, gen)) {
+		shared->reliable_ctxs[gen] = create_instance_contexts(reliable->algo, reliable->obj, conf->n_interleaved);
+	}
+	shared->real_results[gen] = (pattern_id_t*)malloc(STREAM_BUFFER_SIZE * sizeof(pattern_id_t));
+	if (shared->real_results[gen] == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+}
+
+/**
+* Stop using a generation of the dictionaries in the real results (free the contexts of its reliable instance)
+*
+* @param conf      The configuration
+* @param shared    The shared data
+* @param gen       The generation
+*/
+static void unuse_generation(Conf* conf, MeasureShared* shared, int gen) {
+	if (shared->reliable_ctxs[gen]) {
+		free_instance_contexts(shared->reliable[gen]->algo, shared->reliable[gen]->obj, shared->reliable_ctxs[gen],
+		                       conf->n_interleaved);
+	}
+	free(shared->real_results[gen]);
+	shared->reliable[gen] = NULL;
+	shared->reliable_ctxs[gen] = NULL;
+	shared->real_results[gen] = NULL;
+}
+
+/**
+* Reset the reliable instances of the generations in use before the start of a stream
+*
+* @param conf      The configuration
+* @param shared    The shared data
+*/
+static void reset_reliable(Conf* conf, MeasureShared* shared) {
+	MpsInstance* reliable;
+	size_t j;
+	int gen;
+	for (gen = 0; gen < 2; ++gen) {
+		reliable = shared->reliable[gen];
+		if (reliable == NULL || !has_real_results(shared, gen)) continue;
+		mps_table[reliable->algo].reset(reliable->obj);
+		for (j = 0; shared->reliable_ctxs[gen] && j < conf->n_interleaved; ++j) {
+			mps_table[reliable->algo].reset_context(reliable->obj, shared->reliable_ctxs[gen][j]);
+		}
+	}
+}
+
+/**
+* Measure the instances on a capture file: read it batch by batch, put every batch in the flows, compute the real
+* results of the segments (with a context of the reliable instance for every flow), and let the workers measure
+* their flows on it
+*
+* @param shared        The shared data
+* @param name          The name of the capture file
+* @param flows         The flow table to use
+* @param packets       Buffer of CAPTURE_BATCH_PACKETS packets
+* @param segments      Buffer of CAPTURE_BATCH_PACKETS segments
+* @param flow_ctxs     The contexts of the flows of the reliable instance (CAPTURE_MAX_FLOWS, NULL if not created)
+*/
+static void measure_capture_file(MeasureShared* shared, const char* name, FlowTable* flows, CapturePacket* packets,
+                                 CaptureSegment* segments, void** flow_ctxs) {
+	MpsInstance* reliable = shared->reliable[0];
+	MpsElem* mps = has_real_results(shared, 0) ? &mps_table[reliable->algo] : NULL;
+	CaptureSegment* segment;
+	CaptureFile cf;
+	size_t i, n_packets;
+
+	capture_file_open(&cf, name);
+	flow_table_init(flows);
+	shared->new_stream = 1;
+	while ((n_packets = capture_file_next_batch(&cf, packets, CAPTURE_BATCH_PACKETS, STREAM_BUFFER_SIZE)) != 0) {
+		shared->n_segments = flow_table_add_packets(flows, packets, n_packets, segments);
+		if (shared->n_segments == 0) continue;
+		shared->len = 0;
+		for (i = 0; i < shared->n_segments; ++i) {
+			segment = &segments[i];
+			shared->len += segment->len;
+			if (mps == NULL) continue;
+			if (flow_ctxs[segment->flow] == NULL) {
+				flow_ctxs[segment->flow] = mps->new_context(reliable->obj);
+			} else if (segment->new_flow) {
+				mps->reset_context(reliable->obj, flow_ctxs[segment->flow]);
+			}
+			mps->ctx_read_block(reliable->obj, flow_ctxs[segment->flow], segment->data, segment->len,
+			                    shared->real_results[0] + segment->offset);
+		}
+		shared->segments = segments;
+
+		pthread_barrier_wait(&shared->barrier); // publish the chunk
+		pthread_barrier_wait(&shared->barrier); // wait for all the workers to finish it
+		shared->new_stream = 0;
+	}
+	shared->segments = NULL;
+	if (verbose) {
+		printf("\n%s: %zu packets (%zu not TCP or UDP), %zu flows (%zu evicted), %zu bytes of payload\n",
+		       name, cf.n_packets, cf.n_skipped, flows->n_flows, flows->n_evicted, flows->n_bytes);
+	}
+	capture_file_close(&cf);
 }
 
 /******************************************************************************
@@ -315,95 +1426,348 @@ static void measure_single_instance_stats(MpsInstance* inst, InstanceStats* stat
 ******************************************************************************/
 
 /**
-* Run all the mps instances on the streams and measure their statistics
-* 
-* Put the statistic in the mps_instances_stats member of the configuration struct
+* Get a percentile of the latency histogram
 *
-* @param conf    The configuration with the mps instances (and where to put the statistics)
+* @param hist         The latency histogram
+* @param q            The percentile (between 0 and 1, e.g. 0.99 for p99)
+*
+* @return             The latency of the percentile (in nanoseconds per byte), the middle of its bucket
 */
-void measure_instances_stats(Conf* conf) {
+double latency_histogram_percentile(LatencyHistogram* hist, double q) {
+	uint64_t rank, count = 0;
+	size_t bucket, high;
+	double low, width;
+	if (hist->n == 0) return 0;
+	rank = (uint64_t)(q * hist->n);
+	if (rank < q * hist->n) ++rank; // ceil
+	if (rank == 0) rank = 1;
+	for (bucket = 0; bucket < LATENCY_N_BUCKETS; ++bucket) {
+		count += hist->buckets[bucket];
+		if (count >= rank) break;
+	}
+	if (bucket < LATENCY_SUB_BUCKETS) {
+		low = bucket;
+		width = 1;
+	} else {
+		high = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS_BITS - 1;
+		width = (double)(1ULL << (high - LATENCY_SUB_BUCKETS_BITS));
+		low = (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) * width;
+	}
+	return (low + width / 2) / 1000;
+}
+
+/**
+* Add a perf_event group to the configuration (the "-e" option)
+*
+* The group is a comma separated list of events, where every event is one of the names in perf_event_names
+* (e.g. "cycles" or "LLC-load-misses"), or a raw event "rNNNN" (NNNN is the hex config of the event).
+* The first event is the leader of the group.
+*
+* @param conf    The configuration to add the group to
+* @param list    The events of the group
+*
+* @return        0 on success, or -1 if the list is invalid (after printing the error)
+*/
+int add_perf_events_group(Conf* conf, const char* list) {
+	PerfEventType events[PERF_MAX_GROUP_EVENTS];
+	PerfEventTypeGroup* groups;
+	const char *name = list, *name_end;
+	char* end;
+	size_t i, n = 0, len;
+
+	while (1) {
+		name_end = strchr(name, ',');
+		if (name_end == NULL) name_end = name + strlen(name);
+		len = name_end - name;
+		if (n == PERF_MAX_GROUP_EVENTS) {
+			fprintf(stderr, "Error: more than %d perf events in group %s\n\n", PERF_MAX_GROUP_EVENTS, list);
+			return -1;
+		}
+		for (i = 0; i < N_PERF_EVENT_NAMES; ++i) {
+			if (strlen(perf_event_names[i].name) == len && strncmp(perf_event_names[i].name, name, len) == 0) {
+				events[n].type = perf_event_names[i].type;
+				events[n].config = perf_event_names[i].config;
+				events[n].desc = perf_event_names[i].desc;
+				break;
+			}
+		}
+		if (i == N_PERF_EVENT_NAMES) {
+			if (len < 2 || name[0] != 'r') goto unknown;
+			errno = 0;
+			events[n].type = PERF_TYPE_RAW;
+			events[n].config = strtoull(name + 1, &end, 16);
+			if (errno || end != name_end) goto unknown;
+			events[n].desc = (char*)malloc(len + 1);
+			if (events[n].desc == NULL) {
+				perror("failed to allocate memory");
+				FatalExit();
+			}
+			memcpy(events[n].desc, name, len);
+			events[n].desc[len] = '\0';
+		}
+		++n;
+		if (*name_end == '\0') break;
+		name = name_end + 1;
+	}
+
+	groups = (PerfEventTypeGroup*)realloc(conf->perf_groups, (conf->n_perf_groups + 1) * sizeof(PerfEventTypeGroup));
+	if (groups == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	conf->perf_groups = groups;
+	groups[conf->n_perf_groups].events = (PerfEventType*)malloc(n * sizeof(PerfEventType));
+	if (groups[conf->n_perf_groups].events == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memcpy(groups[conf->n_perf_groups].events, events, n * sizeof(PerfEventType));
+	groups[conf->n_perf_groups].n = n;
+	conf->n_perf_groups++;
+	return 0;
+
+unknown:
+	fprintf(stderr, "Error: unknown perf event \"%.*s\" in group %s\nThe known events are:", (int)len, name, list);
+	for (i = 0; i < N_PERF_EVENT_NAMES; ++i) {
+		fprintf(stderr, " %s", perf_event_names[i].name);
+	}
+	fprintf(stderr, " (and raw events rNNNN)\n\n");
+	return -1;
+}
+
+/**
+* Initialize the measurement, after the mps instances were created (and before they are built)
+*
+* Set the perf_event groups (the default groups if none were given) without the unsupported events,
+* and initialize the statistics of the instances.
+*
+* @param conf    The configuration with the mps instances
+*/
+void init_measure(Conf* conf) {
+	size_t i;
+
+	if (conf->n_perf_groups == 0) {
+		for (i = 0; i < N_DEFAULT_PERF_GROUPS; ++i) {
+			add_perf_events_group(conf, default_perf_groups[i]);
+		}
+	}
+	remove_unsupported_perf_events(conf);
+	build_perf_data = create_perf_events_data(conf, 0, -1);
+
 	conf->mps_instances_stats = (InstanceStats*)malloc(conf->n_mps_instances * sizeof(InstanceStats));
-	size_t i , n_mps_instances = conf->n_mps_instances;
-	for (i = 0; i < n_mps_instances; ++i) {
-		measure_single_instance_stats(&conf->mps_instances[i],
-		                              &conf->mps_instances_stats[i],
-		                              conf);
+	if (conf->mps_instances_stats == NULL && conf->n_mps_instances != 0) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		init_instance_stats(conf, &conf->mps_instances_stats[i], 1);
 	}
 }
 
 /**
-* Write the statistics to the output file specified in the configuration struct
+* Start measuring a phase of building an instance (on the calling thread, which should be the main thread)
+*
+* Phases can't be nested, and a phase can be measured many times (the statistics are added).
+*
+* @param conf    The configuration with the perf_event groups
+* @param phase   The statistics of the phase (if NULL, nothing is measured)
+*/
+void measure_phase_start(Conf* conf, PhaseStats* phase) {
+	if (phase == NULL) return;
+	phase->start_mem = memtrack_current();
+	memtrack_reset_peak();
+	perf_event_data_ioctl(build_perf_data, conf->n_perf_groups, PERF_EVENT_IOC_RESET);
+	perf_event_data_ioctl(build_perf_data, conf->n_perf_groups, PERF_EVENT_IOC_ENABLE);
+	phase->start_ns = monotonic_ns();
+}
+
+/**
+* Stop measuring a phase of building an instance, and add the measurements to its statistics
 *
-* @param conf    The configuration struct with the statistic and the output file name
+* @param conf    The configuration with the perf_event groups
+* @param phase   The statistics of the phase (as given to measure_phase_start)
 */
-void write_stats_to_file(Conf* conf) {
-	int output_fd;
-	size_t i,j,k,n, algo, total_mem, len, sum;
-	InstanceStats* is;
-	MpsInstance* mi;
-	SuccessRate* sr;
-	char buf[256];
+void measure_phase_stop(Conf* conf, PhaseStats* phase) {
+	char perf_buf[PERF_BUF_SIZE];
+	ReadFormat *read_stats = (ReadFormat*)perf_buf;
+	size_t i, j, index, peak;
+	uint64_t end_ns;
 
-	if (verbose) printf("opening file %s to write results\n", conf->output_file_name);
-	output_fd = open(conf->output_file_name, O_WRONLY | O_CREAT);
-	if (output_fd == -1) {
-		fprintf(stderr, "failed to open results file %s: %s\n", conf->output_file_name, strerror(errno));
+	if (phase == NULL) return;
+	end_ns = monotonic_ns();
+	perf_event_data_ioctl(build_perf_data, conf->n_perf_groups, PERF_EVENT_IOC_DISABLE);
+	phase->ns += end_ns - phase->start_ns;
+	peak = memtrack_peak() - phase->start_mem;
+	if (peak > phase->peak_mem) phase->peak_mem = peak;
+	phase->mem += (int64_t)memtrack_current() - (int64_t)phase->start_mem;
+
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		if (read(build_perf_data[i].events[0].fd, perf_buf, PERF_BUF_SIZE) <= 0) continue;
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			index = find_index_of_id(read_stats, build_perf_data[i].events[j].id);
+			if (index != read_stats->nr) {
+				phase->perf_groups_stats[i].perf_stats[j] += read_stats->values[index].value;
+			}
+		}
 	}
-	write(output_fd, "Algorithm", 9);
-	write(output_fd, ",Time (in secs)", 15);
-	write(output_fd, ",Total Memory Used", 18);
-	write(output_fd, ",False Positive Rate", 20);
-	write(output_fd, ",False Negative Rate", 20);
-	write(output_fd, ",Partial Success Rate", 21);
-	for (i = 0; i < N_PERF_GROUPS; ++i) {
-		n = perf_events[i].n;
-		for (j = 0; j < n; ++j) {
-			write(output_fd, ",", 1);
-			write(output_fd, perf_events[i].events[j].desc, strlen(perf_events[i].events[j].desc));
-		}
-	}
-	for (k = 0; k < conf->n_mps_instances; ++k) {
-		write(output_fd, "\n", 1);
-		is = &conf->mps_instances_stats[k];
-		mi = &conf->mps_instances[k];
-		algo = mi->algo;
-		sr = &is->suc_rate;
-
-		// write name
-		write(output_fd, mps_table[algo].name, strlen(mps_table[algo].name));
-
-		// write the total time
-		len = snprintf(buf, sizeof(buf), "%.6Lf", (long double)(is->total_cycles) / CLOCKS_PER_SEC);
-		write(output_fd, ",", 1);
-		write(output_fd, buf, len);
-
-		// write the total memory
-		total_mem = mps_table[algo].total_mem(mi->obj);
-		len = snprintf(buf, sizeof(buf), "%zu", total_mem);
-		write(output_fd, ",", 1);
-		write(output_fd, buf, len);
-
-		// write the accuracy statistics
-		sum = sr->success + sr->false_pos + sr->false_neg + sr->partial_suc;
-		len = snprintf(buf, sizeof(buf), "%.6Lf", (long double)sr->false_pos / sum);
-		write(output_fd, ",", 1);
-		write(output_fd, buf, len);
-		len = snprintf(buf, sizeof(buf), "%.6Lf", (long double)sr->false_neg / sum);
-		write(output_fd, ",", 1);
-		write(output_fd, buf, len);
-		len = snprintf(buf, sizeof(buf), "%.6Lf", (long double)sr->partial_suc / sum);
-		write(output_fd, ",", 1);
-		write(output_fd, buf, len);
-
-		// write the perf_event counters
-		for (i = 0; i < N_PERF_GROUPS; ++i) {
-			n = perf_events[i].n;
-			for (j = 0; j < n; ++j) {
-				len = snprintf(buf, sizeof(buf), "%" PRIu64, is->perf_groups_stats[i].perf_stats[j]);
-				write(output_fd, ",", 1);
-				write(output_fd, buf, len);
+}
+
+/**
+* Run all the mps instances on the streams and measure their statistics
+*
+* The instances are divided between conf->n_threads worker threads. The main thread reads the streams
+* chunk by chunk, computes the real results of every chunk once (using the reliable instance),
+* and then all the workers measure their instances on that chunk.
+*
+* Put the statistic in the mps_instances_stats member of the configuration struct
+*
+* @param conf    The configuration with the mps instances (and where to put the statistics)
+*/
+void measure_instances_stats(Conf* conf) {
+	MeasureShared shared;
+	MeasureWorker* workers;
+	StreamFile sf;
+	FlowTable* flows = NULL;
+	CapturePacket* packets = NULL;
+	CaptureSegment* segments = NULL;
+	void** flow_ctxs = NULL;
+	size_t i, j, n_workers, n_mps_instances = conf->n_mps_instances;
+	size_t n_stream_files = conf->n_stream_files;
+	char** stream_files = conf->stream_files;
+	char* read_buffer;
+	int err, algo, gen, used;
+
+	// interleaved streams, scanned streams and flows are read with contexts, so all the algorithms must implement them
+	if (reads_with_contexts(conf) || conf->n_capture_files) {
+		for (i = 0; i <= n_mps_instances; ++i) {
+			algo = i < n_mps_instances ? conf->mps_instances[i].algo : conf->reliable_mps_instance.algo;
+			if (algo != MPS_NONE && mps_table[algo].new_context == NULL) {
+				fprintf(stderr, "Error: %s doesn't implement contexts, so it can't read interleaved streams, "
+				        "scan streams or read flows\n", mps_table[algo].name);
+				FatalExit();
+			}
+		}
+	}
+
+	// there is no use in workers without any instance to measure
+	n_workers = conf->n_threads < n_mps_instances ? conf->n_threads : n_mps_instances;
+	// (but the flows of capture files are dispatched to all the workers)
+	if (conf->n_capture_files) n_workers = conf->n_threads;
+	if (n_workers == 0) n_workers = 1;
+
+	memset(&shared, 0, sizeof(MeasureShared));
+	shared.conf = conf;
+	use_generation(conf, &shared, &conf->reliable_mps_instance, 0);
+	read_buffer = (char*)malloc(STREAM_BUFFER_SIZE);
+	workers = (MeasureWorker*)malloc(n_workers * sizeof(MeasureWorker));
+	shared.readers = (MpsReader*)calloc(n_mps_instances + 1, sizeof(MpsReader));
+	shared.stats_locks = (pthread_mutex_t*)malloc((n_mps_instances + 1) * sizeof(pthread_mutex_t));
+	if (read_buffer == NULL || workers == NULL || shared.readers == NULL || shared.stats_locks == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < n_mps_instances; ++i) {
+		shared.readers[i].obj = conf->mps_instances[i].obj;
+		pthread_mutex_init(&shared.stats_locks[i], NULL);
+	}
+	if (conf->n_capture_files) {
+		flows = (FlowTable*)malloc(sizeof(FlowTable));
+		packets = (CapturePacket*)malloc(CAPTURE_BATCH_PACKETS * sizeof(CapturePacket));
+		segments = (CaptureSegment*)malloc(CAPTURE_BATCH_PACKETS * sizeof(CaptureSegment));
+		flow_ctxs = (void**)calloc(CAPTURE_MAX_FLOWS, sizeof(void*));
+		if (flows == NULL || packets == NULL || segments == NULL || flow_ctxs == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+	}
+	pthread_barrier_init(&shared.barrier, NULL, n_workers + 1);
+	if (conf->reload_file_name) shared.reload = reload_start(conf);
+
+	if (verbose) {
+		printf("Measuring %zu algorithms on %zu threads...", n_mps_instances, n_workers);
+		fflush(stdout);
+	}
+	for (i = 0; i < n_workers; ++i) {
+		workers[i].shared = &shared;
+		workers[i].index = i;
+		workers[i].n_workers = n_workers;
+		err = pthread_create(&workers[i].thread, NULL, measure_worker, &workers[i]);
+		if (err) {
+			fprintf(stderr, "failed to create measuring thread: %s\n", strerror(err));
+			FatalExit();
+		}
+	}
+
+	for (i = 0; i < n_stream_files; ++i) {
+		// Reset the reliable algorithm before start of stream
+		reset_reliable(conf, &shared);
+		shared.stream_index = i;
+		if (conf->stream_is_capture[i]) {
+			measure_capture_file(&shared, stream_files[i], flows, packets, segments, flow_ctxs);
+			continue;
+		}
+		stream_file_open(&sf, stream_files[i], read_buffer);
+		shared.new_stream = 1;
+		// Take every window of the stream and let the workers measure performance on it
+		while ((shared.len = stream_file_next_window(&sf, &shared.stream_buffer)) != 0) {
+			used = shared.reload ? reload_begin_chunk(shared.reload) : 1;
+			if ((used & 2) && shared.reliable[1] == NULL) {
+				// the new generation was published (its reliable instance starts reading from this chunk)
+				use_generation(conf, &shared, &shared.reload->gens[1].reliable, 1);
+				shared.skip = shared.reload->gens[0].max_pat_len > shared.reload->gens[1].max_pat_len ?
+				              shared.reload->gens[0].max_pat_len : shared.reload->gens[1].max_pat_len;
+			}
+			if (!(used & 1) && shared.reliable[0]) {
+				unuse_generation(conf, &shared, 0);
+				reload_free_old(shared.reload);
 			}
+			for (gen = 0; gen < 2; ++gen) {
+				if (used & (1 << gen)) compute_real_results(conf, &shared, gen);
+			}
+
+			pthread_barrier_wait(&shared.barrier); // publish the chunk
+			pthread_barrier_wait(&shared.barrier); // wait for all the workers to finish it
+			shared.new_stream = 0;
+		}
+		stream_file_close(&sf);
+	}
+
+	if (shared.reload) {
+		// let the readers switch to the final objects of the reload
+		reload_finish(shared.reload);
+		shared.sync_only = 1;
+		pthread_barrier_wait(&shared.barrier);
+		pthread_barrier_wait(&shared.barrier);
+	}
+
+	// tell the workers there are no more chunks
+	shared.done = 1;
+	pthread_barrier_wait(&shared.barrier);
+	for (i = 0; i < n_workers; ++i) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	if (verbose) printf("Done\n");
+	for (i = 0; i < n_mps_instances; ++i) {
+		for (j = 0; j < n_stream_files; ++j) {
+			conf->mps_instances_stats[i].stream_stats[j].total_mem = conf->mps_instances_stats[i].total_mem;
 		}
+		pthread_mutex_destroy(&shared.stats_locks[i]);
 	}
-	close(output_fd);
-}
\ No newline at end of file
+
+	pthread_barrier_destroy(&shared.barrier);
+	free(workers);
+	free(read_buffer);
+	free(shared.readers);
+	free(shared.stats_locks);
+	for (i = 0; flow_ctxs && i < CAPTURE_MAX_FLOWS; ++i) {
+		if (flow_ctxs[i]) mps_table[shared.reliable[0]->algo].free_context(shared.reliable[0]->obj, flow_ctxs[i]);
+	}
+	free(flow_ctxs);
+	free(flows);
+	free(packets);
+	free(segments);
+	for (gen = 0; gen < 2; ++gen) {
+		if (shared.reliable[gen]) unuse_generation(conf, &shared, gen);
+	}
+	if (shared.reload) reload_end(shared.reload);
+}
@@ -39,35 +39,17 @@ typedef struct {
 * unreliable (from my tries, putting software cycles counters with hardware counters, made the software cycles
 * counters to return always 0)
 *
-* For that reason, we divide the perf_event types into seperate groups to measure them simultaneously
-* This groups are saved in the static variable perf_events
+* For that reason, we divide the perf_event types into seperate groups to measure them simultaneously.
+* The groups are given at runtime with the "-e" option (see add_perf_events_group), or the default groups
+* in "measure.c" are used. Events that the system doesn't support are skipped when the measurement starts.
 */
 typedef struct {
 	PerfEventType  *events;
 	size_t          n;
 } PerfEventTypeGroup;
 
-// The events to meaure and their short description
-static PerfEventType perf_group_1[] = {
-	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page faults"},
-	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, "software cpu clock"},
-	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "software task clock"}
-};
-
-static PerfEventType perf_group_2[] = {
-	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "number of instructions"},
-	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, "number of branch instructions"},
-	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "number of cycles"},
-	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES, "bus cycles"},
-	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, "total cycles"}
-};
-
-static PerfEventTypeGroup perf_events[] = {
-	{perf_group_1, 3},
-	{perf_group_2, 5}
-};
-
-#define N_PERF_GROUPS (sizeof(perf_events) / sizeof(PerfEventTypeGroup))
+// The maximal number of events in a perf_event group
+#define PERF_MAX_GROUP_EVENTS 16
 
 /**
 * Struct for saving the success rete of the algorithm
@@ -90,17 +72,73 @@ typedef struct {
 */
 typedef struct {
 	uint64_t  *perf_stats;
+	uint64_t  *max_window_stats; // the maximal count of every event in a single window of the stream
 } PerfEventGroupStats;
 
+/**
+* Histogram of the latency of the windows of the stream (in picoseconds per byte)
+*
+* The values are divided to buckets by their highest bit, and every such range is divided
+* to LATENCY_SUB_BUCKETS equal buckets, so the error of a percentile is at most 1/LATENCY_SUB_BUCKETS
+* (values smaller than LATENCY_SUB_BUCKETS have a bucket of their own).
+*/
+#define LATENCY_SUB_BUCKETS_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKETS_BITS)
+#define LATENCY_N_BUCKETS ((64 - LATENCY_SUB_BUCKETS_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+	uint64_t buckets[LATENCY_N_BUCKETS];
+	uint64_t n; // the number of windows
+} LatencyHistogram;
+
+/**
+* Statistics of a phase of building an mps instance (adding the patterns, or compiling)
+*
+* The heap memory is tracked by memtrack (see "memtrack.h"), and the instances are built one after another,
+* so the memory allocated during the phase is the memory of the instance.
+*/
+typedef struct {
+	uint64_t             ns;        // the time of the phase (in nanoseconds)
+	int64_t              mem;       // the change of the heap memory in the phase (negative if more was freed)
+	size_t               peak_mem;  // the peak of the heap memory during the phase, above the memory at its start
+	PerfEventGroupStats *perf_groups_stats; // the perf_event counters of the phase (without max_window_stats)
+	uint64_t             start_ns;  // when the phase started
+	size_t               start_mem; // the heap memory when the phase started
+} PhaseStats;
+
+/**
+* Statistics of building an mps instance
+*
+* When the instance is loaded from the cache file, loading is the compile phase (and nothing is added)
+*/
+typedef struct {
+	PhaseStats add;
+	PhaseStats compile;
+} BuildStats;
+
+/**
+* Statistics of reloading the dictionaries of an mps instance while it is measured (see "reload.h")
+*/
+typedef struct {
+	uint64_t  ns;        // the time of updating the instance in place, or of building it again (on the reloading thread)
+	int       in_place;  // whether the instance was updated in place (otherwise it was built again)
+	size_t    old_bytes; // the bytes read with the old dictionaries since the reload started
+} ReloadStats;
+
 /**
 * Statistics for an mps (multi-pattern search) instance
 */
 typedef struct instance_stats {
-	// perf_groups_stats should match perf_events static variable
-	PerfEventGroupStats perf_groups_stats[N_PERF_GROUPS];
+	// perf_groups_stats should match the perf_event groups of the configuration
+	PerfEventGroupStats *perf_groups_stats;
 	SuccessRate suc_rate;
 	size_t total_mem;
 	clock_t total_cycles;
+	size_t n_bytes; // the number of bytes read
+	LatencyHistogram latency;
+	struct instance_stats *stream_stats; // the statistics on every stream file (NULL in the statistics of a stream)
+	BuildStats build; // the statistics of building the instance (only in the statistics of all the streams)
+	ReloadStats reload; // the statistics of reloading the dictionaries (only in the statistics of all the streams)
 } InstanceStats;
 
 
@@ -109,7 +147,31 @@ typedef struct instance_stats {
 ******************************************************************************/
 
 
+int add_perf_events_group(struct _Conf* conf, const char* list);
+void init_measure(struct _Conf* conf);
+void measure_phase_start(struct _Conf* conf, PhaseStats* phase);
+void measure_phase_stop(struct _Conf* conf, PhaseStats* phase);
 void measure_instances_stats(struct _Conf* conf);
-void write_stats_to_file(struct _Conf* conf);
+double latency_histogram_percentile(LatencyHistogram* hist, double q);
+
+
+/******************************************************************************
+*		INLINE FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Get the peak heap memory of building an instance
+*
+* The memory added before compile is still used during compile, so the peak of compile is above it
+*
+* @param build    The statistics of building the instance
+*
+* @return         The peak heap memory of the instance during build (in bytes)
+*/
+static inline size_t build_peak_mem(BuildStats* build) {
+	int64_t compile_peak = (build->add.mem > 0 ? build->add.mem : 0) + (int64_t)build->compile.peak_mem;
+	return (int64_t)build->add.peak_mem > compile_peak ? build->add.peak_mem : (size_t)compile_peak;
+}
 
 #endif // MEASURE_H
\ No newline at end of file
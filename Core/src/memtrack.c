@@ -0,0 +1,131 @@
+/**
+* Tracking of the heap memory of the program
+*
+* The linker redirects the calls of our code to malloc, calloc, realloc, free & getline to the __wrap_ functions
+* here, which call the real functions (__real_) and update the counters. The counters are updated atomically,
+* since the algorithms can allocate on several threads.
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "memtrack.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <malloc.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+ssize_t __real_getline(char** lineptr, size_t* n, FILE* stream);
+
+static size_t current_mem = 0; // the bytes currently allocated
+static size_t peak_mem = 0;    // the maximum of current_mem (since the last memtrack_reset_peak)
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Count an allocated block
+*
+* @param ptr      The block (can be NULL, if the allocation failed)
+*/
+static inline void memtrack_add(void* ptr) {
+	size_t current, peak;
+	if (ptr == NULL) return;
+	current = __atomic_add_fetch(&current_mem, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&peak_mem, __ATOMIC_RELAXED);
+	while (current > peak &&
+	       !__atomic_compare_exchange_n(&peak_mem, &peak, current, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+/**
+* Uncount a block that is about to be freed
+*
+* @param ptr      The block (can be NULL)
+*/
+static inline void memtrack_sub(void* ptr) {
+	if (ptr == NULL) return;
+	__atomic_sub_fetch(&current_mem, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+void* __wrap_malloc(size_t size) {
+	void* ptr = __real_malloc(size);
+	memtrack_add(ptr);
+	return ptr;
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+	void* ptr = __real_calloc(n, size);
+	memtrack_add(ptr);
+	return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+	size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+	void* new_ptr = __real_realloc(ptr, size);
+	if (new_ptr == NULL && size != 0) return NULL; // failed, the old block is not changed
+	__atomic_sub_fetch(&current_mem, old_size, __ATOMIC_RELAXED);
+	memtrack_add(new_ptr);
+	return new_ptr;
+}
+
+void __wrap_free(void* ptr) {
+	memtrack_sub(ptr);
+	__real_free(ptr);
+}
+
+ssize_t __wrap_getline(char** lineptr, size_t* n, FILE* stream) {
+	// the C library allocates (or grows) the buffer without the wrappers, but our code frees it
+	size_t old_size = *lineptr ? malloc_usable_size(*lineptr) : 0;
+	ssize_t read = __real_getline(lineptr, n, stream);
+	__atomic_sub_fetch(&current_mem, old_size, __ATOMIC_RELAXED);
+	memtrack_add(*lineptr);
+	return read;
+}
+
+/**
+* Get the heap memory currently allocated by the program
+*
+* @return         The number of bytes
+*/
+size_t memtrack_current() {
+	return __atomic_load_n(&current_mem, __ATOMIC_RELAXED);
+}
+
+/**
+* Get the peak of the heap memory allocated by the program since the last memtrack_reset_peak
+*
+* @return         The number of bytes
+*/
+size_t memtrack_peak() {
+	return __atomic_load_n(&peak_mem, __ATOMIC_RELAXED);
+}
+
+/**
+* Start measuring the peak from now (set the peak to the memory currently allocated)
+*/
+void memtrack_reset_peak() {
+	__atomic_store_n(&peak_mem, memtrack_current(), __ATOMIC_RELAXED);
+}
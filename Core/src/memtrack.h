@@ -0,0 +1,46 @@
+/**
+* Tracking of the heap memory of the program (for measuring the peak memory of building the algorithms)
+*/
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include <stddef.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+/**
+* The allocation functions (malloc, calloc, realloc & free) of the program are wrapped by the linker
+* (with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free, see the Makefile), so every allocation and free
+* of our code updates the number of bytes currently allocated and their peak.
+*
+* The sizes are the usable sizes of the blocks (malloc_usable_size), so they include the rounding of malloc,
+* but not its headers. Memory that the C library allocates by itself (e.g. the buffers of FILE) is not tracked.
+*
+* A block that the C library allocates but our code frees would be subtracted without being added, so the functions
+* that return such blocks are wrapped too: getline (-Wl,--wrap=getline) counts the buffer it allocates or grows.
+* Other such functions (e.g. strdup, getdelim, realpath or posix_memalign) are not wrapped, so they must not be used
+* without adding a wrapper for them.
+*/
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+size_t memtrack_current();
+size_t memtrack_peak();
+void memtrack_reset_peak();
+
+
+#endif /* MEMTRACK_H */
@@ -15,8 +15,30 @@
 * We also generate suffix links, where suffix link of a node x is the longest proper suffix of the pattern
 * in x that is a pattern by itself, i.e. we get the suffix links by traveling on the failure links until
 * we see a node that is a pattern (have non-null id).
+* We save in every state the id of its suffix link (and not its position), so we don't need to access another state.
 *
 * After we read a character, and get to the current node, we return the id of its suffix link.
+*
+* When compiled with AC_DFA defined (see "mpac.h"), we also fill all the missing children during the BFS
+* of the failure links (the missing child of x with character c, is the child of the failure state of x with c),
+* so reading a character is exactly one lookup in the table, without traveling on the failure links.
+*
+* The patterns of a compiled object can be changed in place with ac_update (not on AC_DFA): the new states are added
+* at the end of the states array (so the states of the contexts stay valid), and only the failure links that end
+* on a new state are repaired, see repair_failure_links. The states of the removed patterns are kept (without an id).
+*
+* Many streams (contexts) can also be read together with ac_ctx_read_batch: on a big states array every transition
+* is a cache miss that depends on the previous one, so a single stream leaves the memory system idle most of the time.
+* Reading the streams in lockstep (one character of every stream at a time) while prefetching the next entry of every
+* stream overlaps the misses of the different streams.
+*
+* The tree and the queue of the BFS are allocated from a build arena (freed at the end of compilation),
+* and the states array from the persistent arena of the object (see "arena.h").
+*
+* The states array is saved to the cache file (see ac_save): on AC_DFA all the children of every state are saved,
+* and otherwise only the existing children, since most of them are missing (a state has 256 children entries, so
+* saving all of them would make the cache file as big as the states array). The states are copied from the cache
+* file (and not used from its mapping), since their ids must be set and ac_update changes them.
 */
 
 
@@ -26,6 +48,7 @@
 
 
 #include "mpac.h"
+#include "arena.h"
 
 
 /******************************************************************************
@@ -43,17 +66,24 @@ typedef struct tree_node {
 typedef struct {
 	size_t children[256];
 	size_t failure_state;
-	size_t suffix_link;
+	pattern_id_t suffix_id; // the id of the suffix link
 	pattern_id_t id;
 } State;
 
+// The stream state of the ac object (a context of a single stream)
+typedef struct {
+	size_t current_state;
+} ACContext;
+
 typedef struct {
 	union {
 		TreeNode *root;   // Aho-Corasick tree for before compilation
 		State    *states; // states array for after compilation
 	};
 	size_t n_states;
-	size_t current_state;
+	ACContext ctx;  // the context used by ac_read_char & ac_read_block
+	Arena  build; // arena for the tree (freed at the end of compilation)
+	Arena  mem;   // arena for the states array
 } AC;
 
 typedef struct qnode {
@@ -63,8 +93,24 @@ typedef struct qnode {
 
 typedef struct queue {
 	QNode *head, *tail;
+	QNode *free_nodes; // the nodes that were popped (reused by queue_add)
+	Arena *arena;      // the arena to allocate the nodes from
 } Queue;
 
+// A pattern added by ac_update
+typedef struct {
+	const char   *pat;
+	size_t        len;
+	pattern_id_t  id;
+} AddedPattern;
+
+// A list of states (used by repair_failure_links)
+typedef struct {
+	size_t *states;
+	size_t  n;
+	size_t  capacity;
+} StatesList;
+
 
 /******************************************************************************
 *		INNER FUNCTIONS
@@ -78,11 +124,13 @@ static void _print_states(AC* ac);
 /**
 * Create new queue
 *
-* @return    A new dynamically allocated queue
+* @param arena  The arena to allocate the queue and its nodes from
+*
+* @return    A new queue (allocated from the arena)
 */
-static Queue* queue_create() {
-	Queue *q = (Queue*)malloc(sizeof(Queue));
-	memset(q, 0, sizeof(Queue));
+static Queue* queue_create(Arena* arena) {
+	Queue *q = (Queue*)arena_calloc(arena, sizeof(Queue));
+	q->arena = arena;
 	return q;
 }
 
@@ -93,7 +141,12 @@ static Queue* queue_create() {
 * @param state  The state to add
 */
 static void queue_add(Queue* q, size_t state) {
-	QNode *node = (QNode*)malloc(sizeof(QNode));
+	QNode *node = q->free_nodes;
+	if (node) {
+		q->free_nodes = node->next;
+	} else {
+		node = (QNode*)arena_alloc(q->arena, sizeof(QNode));
+	}
 	node->next = NULL;
 	node->state = state;
 	if (q->tail) {
@@ -117,7 +170,8 @@ static size_t queue_pop(Queue* q) {
 	size_t state = temp->state;
 	q->head = temp->next;
 	if (!q->head) q->tail = NULL;
-	free(temp);
+	temp->next = q->free_nodes;
+	q->free_nodes = temp;
 	return state;
 }
 
@@ -172,30 +226,35 @@ static size_t convert_tree_to_states(TreeNode* node, State* states, size_t from)
 static void add_failure_to_state(State* states, size_t parent, size_t c) {
 	size_t fs = states[parent].failure_state;
 	size_t state = states[parent].children[c];
+#ifndef AC_DFA
 	while (!states[fs].children[c] && fs) {
 		fs = states[fs].failure_state;
 	}
+#endif
+	// on AC_DFA, the children of the failure state are already filled (it was before the parent in the BFS)
 	states[state].failure_state = states[fs].children[c];
-	states[state].suffix_link = states[state].id == null_pattern_id ? states[states[state].failure_state].suffix_link : state;
+	states[state].suffix_id = states[state].id == null_pattern_id ? states[states[state].failure_state].suffix_id
+	                                                               : states[state].id;
 }
 
 /**
 * Add failure links to the array of states (also add suffix links)
 *
 * @param states    The array of states
+* @param arena     The arena for the queue
 */
-static void add_failure_links(State* states) {
-	Queue* q = queue_create();
+static void add_failure_links(State* states, Arena* arena) {
+	Queue* q = queue_create(arena);
 	size_t i, curState;
 	// add the first level to the queue, and put their failure link to 0
 	states[0].failure_state = 0;
-	states[0].suffix_link = 0;
+	states[0].suffix_id = null_pattern_id;
 	for(i = 0; i < 256; ++i) {
 		curState = states[0].children[i];
 		if (curState) {
 			queue_add(q, curState);
 			states[curState].failure_state = 0;
-			states[curState].suffix_link = states[curState].id == null_pattern_id ? 0 : curState;
+			states[curState].suffix_id = states[curState].id;
 		}
 	}
 	while (queue_not_empty(q)) {
@@ -204,24 +263,199 @@ static void add_failure_links(State* states) {
 			if (states[curState].children[i]) {
 				add_failure_to_state(states, curState, i);
 				queue_add(q, states[curState].children[i]);
+			} else {
+#ifdef AC_DFA
+				// the failure state is before the current state in the BFS, so its children are already filled
+				states[curState].children[i] = states[states[curState].failure_state].children[i];
+#endif
 			}
 		}
 	}
 }
 
+
+#ifndef AC_DFA
+
 /**
-* Free the memory of the aho-corasick tree
+* Compare two added patterns lexicographically (for qsort)
+*/
+static int cmp_added_patterns(const void* a, const void* b) {
+	const AddedPattern *x = (const AddedPattern*)a, *y = (const AddedPattern*)b;
+	int res = memcmp(x->pat, y->pat, x->len < y->len ? x->len : y->len);
+	if (res) return res;
+	return x->len < y->len ? -1 : x->len > y->len;
+}
+
+/**
+* Count the states that adding the patterns to the states array creates
+*
+* In lexicographic order, the new prefixes of a pattern are those that are longer than its common prefix with the
+* previous pattern (the shorter were counted already), and longer than its longest prefix that is already a state.
+*
+* @param states     The states array
+* @param added      The added patterns (sorted lexicographically)
+* @param n          The number of added patterns
 *
-* @param root    The root of the tree
+* @return           The number of new states
 */
-static void free_tree(TreeNode *root) {
-	size_t i;
-	for (i = 0; i < 256; ++i) {
-		if (root->children[i]) free_tree(root->children[i]);
+static size_t count_new_states(State* states, AddedPattern* added, size_t n) {
+	size_t i, depth, lcp, state, count = 0;
+	for (i = 0; i < n; ++i) {
+		for (depth = 0, state = 0; depth < added[i].len; ++depth) {
+			state = states[state].children[(unsigned char)added[i].pat[depth]];
+			if (!state) break;
+		}
+		lcp = 0;
+		while (i && lcp < added[i].len && lcp < added[i - 1].len && added[i].pat[lcp] == added[i - 1].pat[lcp]) {
+			++lcp;
+		}
+		count += added[i].len - (depth > lcp ? depth : lcp);
+	}
+	return count;
+}
+
+/**
+* Add a pattern to the states array (the new states are put at the end, without failure links)
+*
+* @param ac         The ac object (with the states array, big enough for the new states)
+* @param pat        The added pattern
+* @param n_old      The number of states before the update
+* @param parents    Where to put the parent of every new state (indexed from n_old)
+* @param chars      Where to put the character from the parent of every new state (indexed from n_old)
+*/
+static void insert_pattern(AC* ac, AddedPattern* pat, size_t n_old, size_t* parents, unsigned char* chars) {
+	State* states = ac->states;
+	size_t i, state = 0, next;
+	unsigned char c;
+	for (i = 0; i < pat->len; ++i) {
+		c = (unsigned char)pat->pat[i];
+		next = states[state].children[c];
+		if (!next) {
+			next = ac->n_states++;
+			memset(&states[next], 0, sizeof(State));
+			states[next].id = null_pattern_id;
+			states[state].children[c] = next;
+			parents[next - n_old] = state;
+			chars[next - n_old] = c;
+		}
+		state = next;
+	}
+	states[state].id = pat->id;
+}
+
+/**
+* Add a state to a states list
+*
+* @param list     The list
+* @param state    The state
+*/
+static void states_list_add(StatesList* list, size_t state) {
+	if (list->n == list->capacity) {
+		list->capacity = list->capacity ? 2 * list->capacity : 1024;
+		list->states = (size_t*)realloc(list->states, list->capacity * sizeof(size_t));
+		if (list->states == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
 	}
-	free(root);
+	list->states[list->n++] = state;
 }
 
+/**
+* Repair the failure links after new states were added at the end of the states array
+*
+* The failure link of an old state w changes only to a new state v, which is a suffix of w that is longer than
+* its failure state. The old states that end with str(v) are the old children (by the last character c of v) of the
+* old states that end with str(u), where u is the parent of v, and these are:
+*   - if u is old, the old states whose failure links lead to u, i.e. the subtree of u in the old failure tree
+*   - if u is new, the same list that we found for u
+* So going over the new states by their depth, every new state gets its failure link from its parent (as in
+* compile, the failure links of the shallower states are already final), and it takes the old states that end
+* with it, from the ones whose failure state is shorter. This only goes over the old states that end with a new
+* state (and the subtrees of the parents of the new states), instead of building all the failure links again.
+*
+* @param states     The states array (the states from n_old are new)
+* @param n_old      The number of old states
+* @param n          The number of states
+* @param order      The states by their depth (BFS order)
+* @param depth      The depth of every state
+* @param parents    The parent of every new state (indexed from n_old)
+* @param chars      The character from the parent of every new state (indexed from n_old)
+* @param arena      The arena for the temporary arrays
+*/
+static void repair_failure_links(State* states, size_t n_old, size_t n, const size_t* order, const size_t* depth,
+                                 const size_t* parents, const unsigned char* chars, Arena* arena) {
+	size_t *inv_start, *inv, *pos, *stack, *ends_start, *ends_n;
+	size_t i, k, x, w, u, v, fs, top;
+	StatesList ends = {NULL, 0, 0};
+	unsigned char c;
+
+	// the old failure tree (the children of x are inv[inv_start[x]], ..., inv[inv_start[x + 1] - 1])
+	inv_start = (size_t*)arena_calloc(arena, (n_old + 1) * sizeof(size_t));
+	inv = (size_t*)arena_alloc(arena, n_old * sizeof(size_t));
+	pos = (size_t*)arena_alloc(arena, n_old * sizeof(size_t));
+	stack = (size_t*)arena_alloc(arena, n_old * sizeof(size_t));
+	for (x = 1; x < n_old; ++x) {
+		++inv_start[states[x].failure_state + 1];
+	}
+	for (x = 0; x < n_old; ++x) {
+		inv_start[x + 1] += inv_start[x];
+		pos[x] = inv_start[x];
+	}
+	for (x = 1; x < n_old; ++x) {
+		inv[pos[states[x].failure_state]++] = x;
+	}
+
+	// the old states that end with every new state are ends.states[ends_start[v - n_old]], ... (ends_n of them)
+	ends_start = (size_t*)arena_alloc(arena, (n - n_old) * sizeof(size_t));
+	ends_n = (size_t*)arena_alloc(arena, (n - n_old) * sizeof(size_t));
+	for (i = 0; i < n; ++i) {
+		v = order[i];
+		if (v < n_old) continue;
+		u = parents[v - n_old];
+		c = chars[v - n_old];
+
+		// the failure link of the new state
+		if (u == 0) {
+			states[v].failure_state = 0;
+		} else {
+			fs = states[u].failure_state;
+			while (!states[fs].children[c] && fs) {
+				fs = states[fs].failure_state;
+			}
+			states[v].failure_state = states[fs].children[c];
+		}
+
+		// the old states that end with the new state
+		ends_start[v - n_old] = ends.n;
+		if (u < n_old) {
+			top = 0;
+			stack[top++] = u;
+			while (top) {
+				x = stack[--top];
+				w = states[x].children[c];
+				if (w && w < n_old) states_list_add(&ends, w);
+				for (k = inv_start[x]; k < inv_start[x + 1]; ++k) {
+					stack[top++] = inv[k];
+				}
+			}
+		} else {
+			for (k = 0; k < ends_n[u - n_old]; ++k) {
+				w = states[ends.states[ends_start[u - n_old] + k]].children[c];
+				if (w && w < n_old) states_list_add(&ends, w);
+			}
+		}
+		ends_n[v - n_old] = ends.n - ends_start[v - n_old];
+		for (k = 0; k < ends_n[v - n_old]; ++k) {
+			w = ends.states[ends_start[v - n_old] + k];
+			if (depth[v] > depth[states[w].failure_state]) states[w].failure_state = v;
+		}
+	}
+	free(ends.states);
+}
+
+#endif // AC_DFA
+
 
 /******************************************************************************
 *		API FUNCTIONS
@@ -235,9 +469,12 @@ static void free_tree(TreeNode *root) {
 */
 void* ac_create() {
 	AC* ac = (AC*)malloc(sizeof(AC));
+	if (ac == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
 	memset(ac, 0, sizeof(AC));
-	TreeNode* root = (TreeNode*)malloc(sizeof(TreeNode));
-	memset(root, 0, sizeof(TreeNode));
+	TreeNode* root = (TreeNode*)arena_calloc(&ac->build, sizeof(TreeNode));
 	root->id = null_pattern_id;
 	ac->root = root;
 	ac->n_states = 1;
@@ -262,8 +499,7 @@ void ac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
 		cur = cur->children[(unsigned char)pat[i++]];
 	}
 	for (; i < len; ++i) {
-		next = (TreeNode*)malloc(sizeof(TreeNode));
-		memset(next, 0, sizeof(TreeNode));
+		next = (TreeNode*)arena_calloc(&ac->build, sizeof(TreeNode));
 		next->id = null_pattern_id;
 		cur->children[(unsigned char)pat[i]] = next;
 		cur = next;
@@ -281,12 +517,11 @@ void ac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
 */
 void ac_compile(void* obj) {
 	AC *ac = (AC*)obj;
-	State *states = (State*)malloc(ac->n_states * sizeof(State));
-	memset(states, 0, ac->n_states * sizeof(State));
+	State *states = (State*)arena_calloc(&ac->mem, ac->n_states * sizeof(State));
 
 	convert_tree_to_states(ac->root, states, 0); // should return n_states
-	add_failure_links(states);
-	free_tree(ac->root);
+	add_failure_links(states, &ac->build);
+	arena_free(&ac->build);
 	ac->states = states;
 }
 
@@ -295,27 +530,228 @@ void ac_compile(void* obj) {
 *
 * It go through the failure links until it finds state which have
 * a child with the given character, and reutrn its id.
+* (on AC_DFA, all children are filled, so we just move to the child)
 *
 * @param obj    The ac object
+* @param ctx    The context of the stream
 * @param c      The next character in the stream
 *
 * @return       The id of the longest pattern that have a match
 */
-pattern_id_t ac_read_char(void* obj, char c) {
+pattern_id_t ac_ctx_read_char(void* obj, void* ctx, char c) {
 	AC *ac = (AC*)obj;
-	size_t current_state = ac->current_state;
+	ACContext *context = (ACContext*)ctx;
+	size_t current_state = context->current_state;
 	State* states = ac->states;
 	// the index in children array should be converted, since char is signed type
 	unsigned char uc = (unsigned char)c;
+#ifdef AC_DFA
+	context->current_state = states[current_state].children[uc];
+#else
 	while (!states[current_state].children[uc] && current_state) {
 		current_state = states[current_state].failure_state;
 	}
 	if (states[current_state].children[uc]) {
-		ac->current_state = states[current_state].children[uc];
+		context->current_state = states[current_state].children[uc];
 	} else {
-		ac->current_state = current_state;
+		context->current_state = current_state;
+	}
+#endif
+	return states[context->current_state].suffix_id;
+}
+
+/**
+* Aho-Corasick read block of characters from the stream function.
+*
+* Do the same as ac_ctx_read_char on every character in the block, while keeping
+* the current state in a local variable during the whole block.
+*
+* @param obj    The ac object
+* @param ctx    The context of the stream
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void ac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	AC *ac = (AC*)obj;
+	ACContext *context = (ACContext*)ctx;
+	size_t i, current_state = context->current_state;
+	State* states = ac->states;
+	unsigned char uc;
+	for (i = 0; i < len; ++i) {
+		uc = (unsigned char)buf[i];
+#ifdef AC_DFA
+		current_state = states[current_state].children[uc];
+#else
+		while (!states[current_state].children[uc] && current_state) {
+			current_state = states[current_state].failure_state;
+		}
+		if (states[current_state].children[uc]) {
+			current_state = states[current_state].children[uc];
+		}
+#endif
+		out[i] = states[current_state].suffix_id;
+	}
+	context->current_state = current_state;
+}
+
+/**
+* Aho-Corasick scan block of characters from the stream function.
+*
+* Read the block like ac_ctx_read_block, but only the characters with a match are reported (see "ctx_scan" in
+* MpsElem), so the loop doesn't write anything while nothing matches.
+*
+* @param obj          The ac object
+* @param ctx          The context of the stream
+* @param buf          The block of characters from the stream
+* @param len          The length of the block
+* @param mode         The scan mode (MPS_SCAN_FIRST, MPS_SCAN_COUNT or MPS_SCAN_LIST)
+* @param matches      Where to put the matches (not used on MPS_SCAN_COUNT)
+* @param max_matches  The number of matches that can be put in matches
+*
+* @return             The number of matches
+*/
+size_t ac_ctx_scan(void* obj, void* ctx, const char* buf, size_t len, int mode, MpsMatch* matches, size_t max_matches) {
+	AC *ac = (AC*)obj;
+	ACContext *context = (ACContext*)ctx;
+	size_t i, count = 0, current_state = context->current_state;
+	State* states = ac->states;
+	pattern_id_t id;
+	unsigned char uc;
+	for (i = 0; i < len; ++i) {
+		uc = (unsigned char)buf[i];
+#ifdef AC_DFA
+		current_state = states[current_state].children[uc];
+#else
+		while (!states[current_state].children[uc] && current_state) {
+			current_state = states[current_state].failure_state;
+		}
+		if (states[current_state].children[uc]) {
+			current_state = states[current_state].children[uc];
+		}
+#endif
+		id = states[current_state].suffix_id;
+		if (id == null_pattern_id) continue;
+		if (mode != MPS_SCAN_COUNT && count < max_matches) {
+			matches[count].pos = i;
+			matches[count].id = id;
+		}
+		++count;
+		if (mode == MPS_SCAN_FIRST) break;
 	}
-	return states[states[ac->current_state].suffix_link].id;
+	context->current_state = current_state;
+	return count;
+}
+
+/**
+* Aho-Corasick read blocks of many contexts function.
+*
+* Do the same as ac_ctx_read_block on every context with its block, but read all of the blocks in lockstep:
+* on every round we move every stream by one character, and prefetch the entries it would need on the next round
+* (the child of its new state with its next character and the id of the new state), so the cache misses of the
+* different streams are overlapped instead of waiting for them one after another.
+* When a block ends, its stream leaves the lockstep and the others continue.
+*
+* @param obj    The ac object
+* @param ctxs   The contexts of the streams
+* @param bufs   The blocks of characters of the streams (bufs[s] is the block of ctxs[s])
+* @param lens   The length of every block
+* @param outs   Where to put the id of the longest pattern that have a match on every character of every block
+* @param k      The number of contexts (at most MPS_MAX_BATCH)
+*/
+void ac_ctx_read_batch(void* obj, void** ctxs, const char** bufs, const size_t* lens, pattern_id_t** outs, size_t k) {
+	AC *ac = (AC*)obj;
+	State* states = ac->states;
+	size_t current[MPS_MAX_BATCH], left[MPS_MAX_BATCH], index[MPS_MAX_BATCH];
+	const char* buf[MPS_MAX_BATCH];
+	pattern_id_t* out[MPS_MAX_BATCH];
+	size_t i, s, n, m, current_state;
+	unsigned char uc;
+
+	// the streams that are still read (the first n)
+	for (s = 0, n = 0; s < k; ++s) {
+		if (lens[s] == 0) continue;
+		current[n] = ((ACContext*)ctxs[s])->current_state;
+		buf[n] = bufs[s];
+		out[n] = outs[s];
+		left[n] = lens[s];
+		index[n] = s;
+		__builtin_prefetch(&states[current[n]].children[(unsigned char)buf[n][0]]);
+		++n;
+	}
+
+	while (n > 0) {
+		// read the characters that all the streams have
+		for (m = left[0], s = 1; s < n; ++s) {
+			if (left[s] < m) m = left[s];
+		}
+		for (i = 0; i < m; ++i) {
+			for (s = 0; s < n; ++s) {
+				uc = (unsigned char)buf[s][i];
+				current_state = current[s];
+#ifdef AC_DFA
+				current_state = states[current_state].children[uc];
+#else
+				while (!states[current_state].children[uc] && current_state) {
+					current_state = states[current_state].failure_state;
+				}
+				if (states[current_state].children[uc]) {
+					current_state = states[current_state].children[uc];
+				}
+#endif
+				current[s] = current_state;
+				__builtin_prefetch(&states[current_state].suffix_id);
+				if (i + 1 < left[s]) {
+					__builtin_prefetch(&states[current_state].children[(unsigned char)buf[s][i + 1]]);
+				}
+			}
+			for (s = 0; s < n; ++s) {
+				out[s][i] = states[current[s]].suffix_id;
+			}
+		}
+
+		// advance the streams, and remove the finished ones
+		for (s = 0; s < n;) {
+			buf[s] += m;
+			out[s] += m;
+			left[s] -= m;
+			if (left[s] != 0) {
+				++s;
+				continue;
+			}
+			((ACContext*)ctxs[index[s]])->current_state = current[s];
+			--n;
+			current[s] = current[n];
+			buf[s] = buf[n];
+			out[s] = out[n];
+			left[s] = left[n];
+			index[s] = index[n];
+		}
+	}
+}
+
+/**
+* Aho-Corasick read next char in the stream function (with the context of the object)
+*
+* @param obj    The ac object
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t ac_read_char(void* obj, char c) {
+	return ac_ctx_read_char(obj, &((AC*)obj)->ctx, c);
+}
+
+/**
+* Aho-Corasick read block of characters from the stream function (with the context of the object)
+*
+* @param obj    The ac object
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void ac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	ac_ctx_read_block(obj, &((AC*)obj)->ctx, buf, len, out);
 }
 
 /**
@@ -328,7 +764,7 @@ pattern_id_t ac_read_char(void* obj, char c) {
 size_t ac_total_mem(void* obj) {
 	if (obj == NULL) return 0;
 	AC* ac = (AC*)obj;
-	return sizeof(AC) + ac->n_states * sizeof(State);
+	return sizeof(AC) + arena_total_mem(&ac->mem);
 }
 
 /**
@@ -337,8 +773,7 @@ size_t ac_total_mem(void* obj) {
 * @param obj    The ac object
 */
 void ac_reset(void* obj) {
-	AC* ac = (AC*)obj;
-	ac->current_state = 0;
+	ac_reset_context(obj, &((AC*)obj)->ctx);
 }
 
 /**
@@ -348,22 +783,258 @@ void ac_reset(void* obj) {
 */
 void ac_free(void *obj) {
 	AC *ac = (AC*)obj;
-	if (ac->states) free(ac->states);
+	arena_free(&ac->mem);
 	free(ac);
 }
 
+/**
+* Create new context for the compiled ac object (the state of a single stream)
+*
+* The object itself is not changed when reading with a context, so many contexts (on many threads)
+* can read with the same object.
+*
+* @param obj    The ac object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* ac_new_context(void* obj) {
+	ACContext* ctx = (ACContext*)malloc(sizeof(ACContext));
+	if (ctx == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	ac_reset_context(obj, ctx);
+	return (void*)ctx;
+}
+
+/**
+* Reset a context of the ac object back to the initial state
+*
+* @param obj    The ac object
+* @param ctx    The context to reset
+*/
+void ac_reset_context(void* obj, void* ctx) {
+	(void)obj;
+	((ACContext*)ctx)->current_state = 0;
+}
+
+/**
+* Get the memory used for a context of the ac object
+*
+* @param obj    The ac object
+* @param ctx    The context
+*
+* @return       The memory used for the context (in bytes)
+*/
+size_t ac_context_mem(void* obj, void* ctx) {
+	(void)obj;
+	(void)ctx;
+	return sizeof(ACContext);
+}
+
+/**
+* Free a context of the ac object
+*
+* @param obj    The ac object
+* @param ctx    The context to free
+*/
+void ac_free_context(void* obj, void* ctx) {
+	(void)obj;
+	free(ctx);
+}
+
+/**
+* Save the compiled ac object to the cache file
+*
+* The cache file of one layout is never loaded by the other (see CACHE_FLAG_AC_DFA in "cache.c"),
+* so the states are saved in the format of the layout: on AC_DFA every state is saved with all its children,
+* and otherwise with the number of its children and then the character and the state of every child.
+*
+* @param obj    The ac object
+* @param w      The cache writer
+*/
+void ac_save(void* obj, CacheWriter* w) {
+	AC *ac = (AC*)obj;
+	State *state;
+	uint64_t values[2] = {ac->n_states, 0};
+	size_t i;
+#ifndef AC_DFA
+	size_t c;
+#endif
+
+	cache_write(w, values, sizeof(uint64_t));
+	for (i = 0; i < ac->n_states; ++i) {
+		state = &ac->states[i];
+		values[0] = state->failure_state;
+#ifdef AC_DFA
+		cache_write(w, values, sizeof(uint64_t));
+		cache_write(w, state->children, sizeof(state->children));
+#else
+		for (c = 0, values[1] = 0; c < 256; ++c) {
+			if (state->children[c]) ++values[1];
+		}
+		cache_write(w, values, sizeof(values));
+		for (c = 0; c < 256; ++c) {
+			if (!state->children[c]) continue;
+			values[0] = c;
+			values[1] = state->children[c];
+			cache_write(w, values, sizeof(values));
+		}
+#endif
+	}
+	for (i = 0; i < ac->n_states; ++i) {
+		cache_write_ids(w, &ac->states[i].id, 1);
+		cache_write_ids(w, &ac->states[i].suffix_id, 1);
+	}
+}
+
+/**
+* Load the ac object (saved with ac_save) from the cache file
+*
+* @param obj    The newly created ac object
+* @param r      The cache reader
+*/
+void ac_load(void* obj, CacheReader* r) {
+	AC *ac = (AC*)obj;
+	State *state;
+	uint64_t values[2];
+	size_t i;
+#ifndef AC_DFA
+	size_t k;
+#endif
+
+	arena_free(&ac->build);
+	memcpy(values, cache_read(r, sizeof(uint64_t)), sizeof(uint64_t));
+	ac->n_states = values[0];
+	ac->states = (State*)arena_calloc(&ac->mem, ac->n_states * sizeof(State));
+	for (i = 0; i < ac->n_states; ++i) {
+		state = &ac->states[i];
+#ifdef AC_DFA
+		memcpy(values, cache_read(r, sizeof(uint64_t)), sizeof(uint64_t));
+		state->failure_state = values[0];
+		memcpy(state->children, cache_read(r, sizeof(state->children)), sizeof(state->children));
+#else
+		memcpy(values, cache_read(r, sizeof(values)), sizeof(values));
+		state->failure_state = values[0];
+		for (k = values[1]; k; --k) {
+			memcpy(values, cache_read(r, sizeof(values)), sizeof(values));
+			state->children[(unsigned char)values[0]] = values[1];
+		}
+#endif
+	}
+	for (i = 0; i < ac->n_states; ++i) {
+		cache_read_ids(r, &ac->states[i].id, 1);
+		cache_read_ids(r, &ac->states[i].suffix_id, 1);
+	}
+}
+
+#ifndef AC_DFA
+
+/**
+* Update the patterns of the compiled ac object in place
+*
+* The states array is copied to a bigger array, with the new states at the end (so the current states of the
+* contexts are kept), the ids of the states are replaced with their new ids (the removed patterns become states
+* without an id), the failure links are repaired (see repair_failure_links), and then the suffix links are set
+* again (all the ids are new) in BFS order.
+*
+* @param obj      The ac object
+* @param update   The update (see MpsUpdate)
+* @param ctxs     The contexts of the object (not changed)
+* @param n_ctxs   The number of contexts
+*/
+void ac_update(void* obj, const MpsUpdate* update, void** ctxs, size_t n_ctxs) {
+	AC* ac = (AC*)obj;
+	const PatternsList* patterns = update->patterns;
+	size_t i, x, head, tail, n_added = 0, n_old = ac->n_states, n_new;
+	size_t *parents, *order, *depth;
+	unsigned char* chars;
+	AddedPattern* added;
+	Arena mem = ARENA_INIT;
+	State* states;
+
+	(void)ctxs; // the contexts keep their states (the old states keep their indexes)
+	(void)n_ctxs;
+	// the added patterns, sorted for counting their new states
+	added = (AddedPattern*)arena_alloc(&ac->build, (patterns->n - update->first_added + 1) * sizeof(AddedPattern));
+	for (i = update->first_added; i < patterns->n; ++i) {
+		if (patterns->ids[i] == null_pattern_id) continue;
+		added[n_added].pat = patterns_list_get(patterns, i);
+		added[n_added].len = patterns->lens[i];
+		added[n_added++].id = patterns->ids[i];
+	}
+	qsort(added, n_added, sizeof(AddedPattern), cmp_added_patterns);
+	n_new = count_new_states(ac->states, added, n_added);
+
+	// move the states to a bigger array, and add the new patterns
+	states = (State*)arena_alloc(&mem, (n_old + n_new) * sizeof(State));
+	memcpy(states, ac->states, n_old * sizeof(State));
+	arena_free(&ac->mem);
+	ac->mem = mem;
+	ac->states = states;
+	for (i = 0; i < n_old; ++i) {
+		states[i].id = mps_update_id(update, states[i].id);
+	}
+	parents = (size_t*)arena_alloc(&ac->build, (n_new + 1) * sizeof(size_t));
+	chars = (unsigned char*)arena_alloc(&ac->build, n_new + 1);
+	for (i = 0; i < n_added; ++i) {
+		insert_pattern(ac, &added[i], n_old, parents, chars);
+	}
+
+	// BFS order of the states (by their depth)
+	order = (size_t*)arena_alloc(&ac->build, ac->n_states * sizeof(size_t));
+	depth = (size_t*)arena_alloc(&ac->build, ac->n_states * sizeof(size_t));
+	order[0] = 0;
+	depth[0] = 0;
+	for (head = 0, tail = 1; head < tail; ++head) {
+		x = order[head];
+		for (i = 0; i < 256; ++i) {
+			if (states[x].children[i]) {
+				depth[states[x].children[i]] = depth[x] + 1;
+				order[tail++] = states[x].children[i];
+			}
+		}
+	}
+
+	if (n_new) repair_failure_links(states, n_old, ac->n_states, order, depth, parents, chars, &ac->build);
+	states[0].suffix_id = null_pattern_id;
+	for (i = 1; i < ac->n_states; ++i) {
+		x = order[i];
+		states[x].suffix_id = states[x].id == null_pattern_id ? states[states[x].failure_state].suffix_id
+		                                                       : states[x].id;
+	}
+	arena_free(&ac->build);
+}
+
+#endif // AC_DFA
+
 /**
 * The mps registering function of the Aho-Corasick Algorithm.
 */
 void mps_ac_register() {
 	mps_table[MPS_AC].name = "Aho-Corasick";
+	mps_table[MPS_AC].short_name = "ac";
 	mps_table[MPS_AC].create = ac_create;
 	mps_table[MPS_AC].add_pattern = ac_add_pattern;
 	mps_table[MPS_AC].compile = ac_compile;
 	mps_table[MPS_AC].read_char = ac_read_char;
+	mps_table[MPS_AC].read_block = ac_read_block;
 	mps_table[MPS_AC].total_mem = ac_total_mem;
 	mps_table[MPS_AC].reset = ac_reset;
 	mps_table[MPS_AC].free = ac_free;
+	mps_table[MPS_AC].save = ac_save;
+	mps_table[MPS_AC].load = ac_load;
+	mps_table[MPS_AC].new_context = ac_new_context;
+	mps_table[MPS_AC].ctx_read_char = ac_ctx_read_char;
+	mps_table[MPS_AC].ctx_read_block = ac_ctx_read_block;
+	mps_table[MPS_AC].reset_context = ac_reset_context;
+	mps_table[MPS_AC].context_mem = ac_context_mem;
+	mps_table[MPS_AC].free_context = ac_free_context;
+	mps_table[MPS_AC].ctx_read_batch = ac_ctx_read_batch;
+	mps_table[MPS_AC].ctx_scan = ac_ctx_scan;
+#ifndef AC_DFA
+	mps_table[MPS_AC].update = ac_update; // on AC_DFA, the filled children would have to be filled again
+#endif
 }
 
 //=========================================================
@@ -12,6 +12,21 @@
 
 #include "mps.h"
 #include "PatternsTree.h"
+#include "cache.h"
+
+
+/******************************************************************************************************
+*		DEFINITIONS
+******************************************************************************************************/
+
+
+/**
+* Define AC_DFA (e.g. "make CFLAGS=-DAC_DFA") to compile the Aho-Corasick algorithms (this one and "mpcac.c") as DFA,
+* i.e. all the missing children are filled during compilation, so reading a character never
+* travels on the failure links (the time of reading a character is constant and doesn't depend on the stream).
+*
+* #define AC_DFA
+*/
 
 
 /******************************************************************************************************
@@ -23,9 +38,24 @@ void* ac_create();
 void ac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
 void ac_compile(void* obj);
 pattern_id_t ac_read_char(void* obj, char c);
+void ac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
 size_t ac_total_mem(void* obj);
 void ac_reset(void* obj);
 void ac_free(void *obj);
+void ac_save(void* obj, CacheWriter* w);
+void ac_load(void* obj, CacheReader* r);
+
+void* ac_new_context(void* obj);
+pattern_id_t ac_ctx_read_char(void* obj, void* ctx, char c);
+void ac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void ac_reset_context(void* obj, void* ctx);
+size_t ac_context_mem(void* obj, void* ctx);
+void ac_free_context(void* obj, void* ctx);
+void ac_ctx_read_batch(void* obj, void** ctxs, const char** bufs, const size_t* lens, pattern_id_t** outs, size_t k);
+size_t ac_ctx_scan(void* obj, void* ctx, const char* buf, size_t len, int mode, MpsMatch* matches, size_t max_matches);
+#ifndef AC_DFA
+void ac_update(void* obj, const MpsUpdate* update, void** ctxs, size_t n_ctxs);
+#endif
 
 void mps_ac_register();
 
@@ -7,6 +7,33 @@
 * and when given a character from the stream, we simply give that character to the
 * Breslauer-Galil objects of all the patterns, and return the id of the longest pattern
 * whose Breslauer-Galil object returned true.
+*
+* The short patterns (not longer than BG_SHORT_PATTERN_LENGTH, or a longer length set with "short=N") would each get
+* a real-time kmp from bg_new,
+* so instead all of them are put in one Low-Memory Aho-Corasick object (see "mplmac.c"), and only the long
+* patterns have Breslauer-Galil objects. Since every long match is longer than every short match,
+* the short match is used only when there is no long match.
+*
+* Since the patterns are independent, there is also a parallel version ("pmpbg"), which splits the patterns
+* array into consecutive shards (one per cpu). Every shard is an mpbg object by itself (with its own buffers)
+* that reads the whole block on its own thread, and the longest match of every character is then merged
+* from the results of all the shards.
+*
+* The bg objects are never changed while reading, the state of every stream (the states of the bg objects of all the
+* patterns, and the context of the short patterns) is in a context, so many streams can share the compiled object.
+* The states of all the patterns of a context are in one block of memory, where every pattern has its own offset.
+*
+* The kmp objects of the first stages of all the long patterns are also in a KMPBank (see "kmpbank.h"), so the block
+* is read in tiles: the bank reads the tile with the kmp objects of all the patterns together (vectorized), and then
+* the rest of every bg object reads the tile with the matches of its kmp objects (bg_read_char_after_kmp).
+*
+* The patterns of a compiled mpbg object can be changed in place with mpbg_update: the bg objects of the patterns
+* that stay are kept (with their states in every context), so only the added patterns are compiled. The short
+* patterns lmac object is built again (it is small, and lmac can't be changed after compilation).
+*
+* The compiled object is saved to the cache file with the bg object of every long pattern (its r, the fingerprints
+* of its stages and its kmp objects) and the short patterns lmac object, see mpbg_save. The parallel version saves
+* its mpbg, and is split into shards again when it is loaded.
 */
 
 
@@ -16,6 +43,13 @@
 
 
 #include "mpbg.h"
+#include "mplmac.h"
+#include "kmpbank.h"
+#include "arena.h"
+#include "util.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 
 /******************************************************************************************************
@@ -38,8 +72,21 @@ typedef struct mpbg_pattern_info_list {
 typedef struct {
 	BGStruct     *obj;
 	pattern_id_t  id;
+	size_t        state; // the offset of the state of the pattern in the states of a context
 } MPBGPatternInfo;
 
+/**
+* struct for a context of mpbg object (the state of a single stream)
+*/
+typedef struct {
+	void   *shorts;       // the context of the short patterns lmac object (NULL if there is no lmac object)
+	char   *states;       // the states of the bg objects of all the long patterns
+	size_t *longest;      // buffer for the length of the longest match on every character of a block
+	size_t  longest_size; // the number of elements allocated in longest
+	KMPState **kmp_states;  // the state of every lane of the bank (the kmp states of the first stages)
+	uint64_t  *kmp_matches; // the matches of the lanes of the bank on the current tile
+} MPBGContext;
+
 /**
 * struct for mpbg object
 */
@@ -48,9 +95,312 @@ typedef struct {
 		MPBGPatternInfoList  *patsList; // before compilation
 		MPBGPatternInfo      *pats;     // after compilation
 	} u;
-	size_t n_pats;
+	size_t n_pats;        // the number of long patterns
+	size_t short_length;  // the longest short pattern (at least BG_SHORT_PATTERN_LENGTH, set with "short=N")
+	unsigned simd_mask;   // the cpu features the kmp bank may use (CPU_FEATURES_ALL, or set with "simd=LEVEL")
+	void   *shorts;       // lmac object of the short patterns (NULL for a shard of the parallel mpbg)
+	size_t  states_size;  // the size of the states of all the long patterns in a context
+	KMPBank bank;         // the kmp objects of the first stages of the long patterns (one or two lanes per pattern)
+	MPBGContext ctx;      // the context used by mpbg_read_char & mpbg_read_block
+	Arena   build;        // arena for the pattern information list (freed at the end of compilation)
+	Arena   mem;          // arena for the pattern information array
 } MPBGStruct;
 
+// The minimal number of patterns in a shard of the parallel mpbg (less patterns don't worth a thread)
+#define PMPBG_MIN_SHARD_PATTERNS 64
+
+struct pmpbg_struct;
+
+/**
+* struct for a shard of the parallel mpbg object
+*
+* The mpbg of the shard holds a consecutive part of the patterns array of the parallel mpbg object
+* (it doesn't own the patterns, only its buffers). The context of the shard uses the states of the context
+* of the parallel mpbg object (the states of different shards don't overlap), with its own longest buffer.
+*/
+typedef struct {
+	MPBGStruct            mpbg;
+	pattern_id_t         *out;      // the results of the shard on the current block
+	size_t                out_size; // the number of elements allocated in out
+	pthread_t             thread;
+	pid_t                 tid;      // the kernel id of the thread (set when the thread starts)
+	struct pmpbg_struct  *parent;
+} PMPBGShard;
+
+/**
+* struct for parallel mpbg object
+*
+* shards[0] is read by the calling thread (and it also reads the short patterns of mpbg),
+* and each of the other shards by a thread of its own,
+* which waits on the barrier for the next block (or for done, when the object is freed)
+*/
+typedef struct pmpbg_struct {
+	MPBGStruct          mpbg; // own all the patterns
+	PMPBGShard         *shards;
+	size_t              n_shards;
+	size_t              requested_shards; // PMPBG_N_SHARDS, or the value set with "shards=N" (0 for one per cpu)
+	const char         *buf;  // the current block
+	size_t              len;  // the length of the current block
+	int                 done;
+	pthread_barrier_t   barrier;
+} PMPBGStruct;
+
+
+/******************************************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************************************/
+
+
+/**
+* Get the number of lanes of a pattern in the bank (kmp_period, and kmp_remaining if there is one)
+*/
+static inline size_t mpbg_n_lanes(BGStruct* bg) {
+	return bg->kmp_remaining ? 2 : 1;
+}
+
+/**
+* Put the kmp objects of the first stages of all the long patterns in the bank
+*
+* @param mpbg   The mpbg object (with its patterns array)
+*/
+static void mpbg_init_bank(MPBGStruct* mpbg) {
+	size_t i, n_lanes = 0;
+	MPBGPatternInfo* iter;
+	KMPRealTime** kmps;
+
+	for (i = mpbg->n_pats, iter = mpbg->u.pats; i; --i, ++iter) {
+		n_lanes += mpbg_n_lanes(iter->obj);
+	}
+	kmps = (KMPRealTime**) malloc(n_lanes * sizeof(KMPRealTime*));
+	if (kmps == NULL && n_lanes) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = mpbg->n_pats, iter = mpbg->u.pats, n_lanes = 0; i; --i, ++iter) {
+		kmps[n_lanes++] = iter->obj->kmp_period;
+		if (iter->obj->kmp_remaining) kmps[n_lanes++] = iter->obj->kmp_remaining;
+	}
+	kmp_bank_init(&mpbg->bank, kmps, n_lanes, cpu_features() & mpbg->simd_mask);
+	free(kmps);
+}
+
+/**
+* Set the kmp states of the lanes of the bank, from the states of the long patterns of a context
+* (and allocate the matches of the lanes)
+*
+* @param mpbg   The mpbg object
+* @param ctx    The context (with its states)
+*/
+static void mpbg_init_kmp_states(MPBGStruct* mpbg, MPBGContext* ctx) {
+	size_t i, lane = 0, n_lanes = mpbg->bank.n_lanes;
+	MPBGPatternInfo* iter;
+	BGState* state;
+
+	free(ctx->kmp_states);
+	free(ctx->kmp_matches);
+	ctx->kmp_states = (KMPState**) malloc(n_lanes * sizeof(KMPState*));
+	ctx->kmp_matches = (uint64_t*) malloc(n_lanes * KMP_BANK_WORDS * sizeof(uint64_t));
+	if ((ctx->kmp_states == NULL || ctx->kmp_matches == NULL) && n_lanes) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = mpbg->n_pats, iter = mpbg->u.pats; i; --i, ++iter) {
+		state = (BGState*)(ctx->states + iter->state);
+		ctx->kmp_states[lane++] = state->kmp_period;
+		if (iter->obj->kmp_remaining) ctx->kmp_states[lane++] = state->kmp_remaining;
+	}
+}
+
+/**
+* Initialize a context of the compiled mpbg object (in the initial state)
+*
+* @param mpbg   The mpbg object
+* @param ctx    The context to initialize
+*/
+static void mpbg_init_context(MPBGStruct* mpbg, MPBGContext* ctx) {
+	size_t i;
+	MPBGPatternInfo* iter;
+
+	ctx->shorts = mpbg->shorts ? lmac_new_context(mpbg->shorts) : NULL;
+	ctx->longest = NULL;
+	ctx->longest_size = 0;
+	ctx->states = (char*) malloc(mpbg->states_size);
+	if (ctx->states == NULL && mpbg->states_size) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = mpbg->n_pats, iter = mpbg->u.pats; i; --i, ++iter) {
+		bg_state_init(iter->obj, ctx->states + iter->state);
+	}
+	ctx->kmp_states = NULL;
+	ctx->kmp_matches = NULL;
+	mpbg_init_kmp_states(mpbg, ctx);
+}
+
+/**
+* Free the buffers of a context of mpbg object (without the context struct itself)
+*
+* @param mpbg   The mpbg object
+* @param ctx    The context
+*/
+static void mpbg_destroy_context(MPBGStruct* mpbg, MPBGContext* ctx) {
+	if (ctx->shorts) lmac_free_context(mpbg->shorts, ctx->shorts);
+	free(ctx->states);
+	free(ctx->longest);
+	free(ctx->kmp_states);
+	free(ctx->kmp_matches);
+}
+
+/**
+* Free the patterns and the buffers of mpbg object (without the struct itself)
+*
+* @param mpbg   The mpbg object
+*/
+static void mpbg_destroy(MPBGStruct* mpbg) {
+	size_t i, n_pats = mpbg->n_pats;
+
+	mpbg_destroy_context(mpbg, &mpbg->ctx);
+	for (i = 0; i < n_pats; ++i) {
+		bg_free(mpbg->u.pats[i].obj);
+	}
+	arena_free(&mpbg->build);
+	arena_free(&mpbg->mem);
+	kmp_bank_free(&mpbg->bank);
+	lmac_free(mpbg->shorts);
+}
+
+/**
+* Move the states of a context to a new states block, after the patterns of the object were changed
+*
+* @param mpbg     The mpbg object (with the new patterns array)
+* @param ctx      The context
+* @param from     The offset of the state of every pattern in the old states block (-1 for an added pattern)
+* @param shorts   The old lmac object of the short patterns (the context gets a new context of mpbg->shorts)
+*/
+static void mpbg_move_context(MPBGStruct* mpbg, MPBGContext* ctx, const size_t* from, void* shorts) {
+	char* states = (char*) malloc(mpbg->states_size);
+	size_t i;
+
+	if (states == NULL && mpbg->states_size) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < mpbg->n_pats; ++i) {
+		if (from[i] == (size_t)-1) {
+			bg_state_init(mpbg->u.pats[i].obj, states + mpbg->u.pats[i].state);
+		} else {
+			bg_state_copy(mpbg->u.pats[i].obj, states + mpbg->u.pats[i].state, (BGState*)(ctx->states + from[i]));
+		}
+	}
+	free(ctx->states);
+	ctx->states = states;
+	mpbg_init_kmp_states(mpbg, ctx);
+	if (ctx->shorts) lmac_free_context(shorts, ctx->shorts);
+	ctx->shorts = mpbg->shorts ? lmac_new_context(mpbg->shorts) : NULL;
+}
+
+/**
+* Read a block with a shard of the parallel mpbg, putting the results in the shard buffers
+*
+* @param shard   The shard
+* @param buf     The block of characters from the stream
+* @param len     The length of the block
+*/
+static void pmpbg_read_shard(PMPBGShard* shard, const char* buf, size_t len) {
+	if (shard->out_size < len) {
+		free(shard->out);
+		shard->out = (pattern_id_t*) malloc(len * sizeof(pattern_id_t));
+		if (shard->out == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		shard->out_size = len;
+	}
+	mpbg_ctx_read_block(&shard->mpbg, &shard->mpbg.ctx, buf, len, shard->out);
+}
+
+/**
+* The main function of the thread of a shard
+*
+* @param arg     The shard of the thread
+*
+* @return        NULL
+*/
+static void* pmpbg_shard_thread(void* arg) {
+	PMPBGShard* shard = (PMPBGShard*)arg;
+	PMPBGStruct* pmpbg = shard->parent;
+
+	shard->tid = (pid_t)syscall(SYS_gettid);
+	// let the compiling thread know the shard started
+	pthread_barrier_wait(&pmpbg->barrier);
+	while (1) {
+		// wait for the next block
+		pthread_barrier_wait(&pmpbg->barrier);
+		if (pmpbg->done) break;
+		pmpbg_read_shard(shard, pmpbg->buf, pmpbg->len);
+		// let the reading thread know the shard is done
+		pthread_barrier_wait(&pmpbg->barrier);
+	}
+	return NULL;
+}
+
+/**
+* Split the patterns of the compiled mpbg of the parallel mpbg object into shards (requested_shards, or one per cpu
+* if it is 0, but without shards with less than PMPBG_MIN_SHARD_PATTERNS patterns), and start the threads of the shards.
+*
+* @param pmpbg    The parallel mpbg object (its mpbg is compiled or loaded)
+*/
+static void pmpbg_init_shards(PMPBGStruct* pmpbg) {
+	PMPBGShard* shard;
+	size_t i, j, start, lane, n_lanes, n_shards, max_shards, n_pats = pmpbg->mpbg.n_pats;
+	int err;
+
+	n_shards = pmpbg->requested_shards ? pmpbg->requested_shards : get_n_cpus();
+	max_shards = (n_pats + PMPBG_MIN_SHARD_PATTERNS - 1) / PMPBG_MIN_SHARD_PATTERNS;
+	if (n_shards > max_shards) n_shards = max_shards;
+	if (n_shards == 0) n_shards = 1;
+
+	pmpbg->n_shards = n_shards;
+	pmpbg->shards = (PMPBGShard*) calloc(n_shards, sizeof(PMPBGShard));
+	if (pmpbg->shards == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0, start = 0, lane = 0; i < n_shards; ++i) {
+		shard = &pmpbg->shards[i];
+		shard->parent = pmpbg;
+		shard->mpbg.u.pats = pmpbg->mpbg.u.pats + start;
+		shard->mpbg.n_pats = n_pats / n_shards + (i < n_pats % n_shards);
+		shard->mpbg.ctx.states = pmpbg->mpbg.ctx.states;
+		// the lanes of the patterns of the shard are consecutive in the bank
+		for (j = 0, n_lanes = 0; j < shard->mpbg.n_pats; ++j) {
+			n_lanes += mpbg_n_lanes(shard->mpbg.u.pats[j].obj);
+		}
+		kmp_bank_view(&shard->mpbg.bank, &pmpbg->mpbg.bank, lane, n_lanes);
+		shard->mpbg.ctx.kmp_states = pmpbg->mpbg.ctx.kmp_states + lane;
+		shard->mpbg.ctx.kmp_matches = (uint64_t*) malloc(n_lanes * KMP_BANK_WORDS * sizeof(uint64_t));
+		if (shard->mpbg.ctx.kmp_matches == NULL && n_lanes) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		start += shard->mpbg.n_pats;
+		lane += n_lanes;
+	}
+	pmpbg->shards[0].mpbg.shorts = pmpbg->mpbg.shorts;
+	pmpbg->shards[0].mpbg.ctx.shorts = pmpbg->mpbg.ctx.shorts;
+
+	if (n_shards == 1) return;
+	pthread_barrier_init(&pmpbg->barrier, NULL, n_shards);
+	for (i = 1; i < n_shards; ++i) {
+		err = pthread_create(&pmpbg->shards[i].thread, NULL, pmpbg_shard_thread, &pmpbg->shards[i]);
+		if (err) {
+			fprintf(stderr, "failed to create mpbg shard thread: %s\n", strerror(err));
+			FatalExit();
+		}
+	}
+	pthread_barrier_wait(&pmpbg->barrier); // wait for the shards to start (and set their tid)
+}
+
 
 /******************************************************************************************************
 *		API FUNCTIONS
@@ -62,7 +412,14 @@ typedef struct {
 */
 void* mpbg_create(void) {
 	MPBGStruct* ret = (MPBGStruct*) malloc(sizeof(MPBGStruct));
+	if (ret == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
 	memset(ret, 0, sizeof(MPBGStruct));
+	ret->short_length = BG_SHORT_PATTERN_LENGTH;
+	ret->simd_mask = CPU_FEATURES_ALL;
+	ret->shorts = lmac_create();
 	return (void*)ret;
 }
 
@@ -70,7 +427,7 @@ void* mpbg_create(void) {
 * Add pattern to the mpbg struct
 *
 * This function already compile the pattern (since there is no dependency between patterns in this implementation),
-* and add it to the pattern information list
+* and add it to the pattern information list (or to the short patterns lmac object, if it is short)
 *
 * @param obj      The mpbg object to work on
 * @param pat      The pattern to add
@@ -79,8 +436,13 @@ void* mpbg_create(void) {
 */
 void mpbg_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
 	MPBGStruct* mpbg = (MPBGStruct*)obj;
-	MPBGPatternInfoList* patInf = (MPBGPatternInfoList*) malloc(sizeof(MPBGPatternInfoList));
-	patInf->obj = bg_new(pat, len, 2147483647);
+	MPBGPatternInfoList* patInf;
+	if (len <= mpbg->short_length) {
+		lmac_add_pattern(mpbg->shorts, pat, len, id);
+		return;
+	}
+	patInf = (MPBGPatternInfoList*) arena_alloc(&mpbg->build, sizeof(MPBGPatternInfoList));
+	patInf->obj = bg_new(pat, len);
 	patInf->id = id;
 	patInf->next = mpbg->u.patsList;
 	mpbg->u.patsList = patInf;
@@ -90,52 +452,57 @@ void mpbg_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
 /**
 * Compile the mpbg struct
 *
-* Convert the pattern info list to array, and free the list
+* Convert the pattern info list to array (with the offsets of the states of the patterns in a context),
+* free the list, compile the short patterns, and initialize the context of the object
 *
 * @param obj      The mpbg object
 */
 void mpbg_compile(void* obj) {
 	MPBGStruct* mpbg = (MPBGStruct*)obj;
 	size_t i;
-	MPBGPatternInfo* arr = (MPBGPatternInfo*) malloc(mpbg->n_pats * sizeof(MPBGPatternInfo));
-	MPBGPatternInfoList *cur, *next;
+	MPBGPatternInfo* arr = (MPBGPatternInfo*) arena_alloc(&mpbg->mem, mpbg->n_pats * sizeof(MPBGPatternInfo));
+	MPBGPatternInfoList *cur;
 
 	// transfering the list to array
 	cur = mpbg->u.patsList;
 	i = 0;
+	mpbg->states_size = 0;
 	while (cur) {
 		arr[i].obj = cur->obj;
 		arr[i].id = cur->id;
+		arr[i].state = mpbg->states_size;
+		mpbg->states_size += bg_state_size(cur->obj);
 		++i;
 		cur = cur->next;
 	}
 	// free the list
-	cur = mpbg->u.patsList;
-	while (cur) {
-		next = cur->next;
-		free(cur);
-		cur = next;
-	}
+	arena_free(&mpbg->build);
 	mpbg->u.pats = arr;
+	lmac_compile(mpbg->shorts);
+	mpbg_init_bank(mpbg);
+	mpbg_init_context(mpbg, &mpbg->ctx);
 }
 
 /**
 * The mpbg reading character fucntion
 *
-* This function just use bg on every pattern independently and return the id of the longest that match
+* This function just use bg on every long pattern independently and return the id of the longest that match
+* (or the short match, if no long pattern match)
 *
 * @param obj     The mpbg object
+* @param ctx     The context of the stream
 * @param c       The char arrived from the stream
 *
 * @return        The id of the longest pattern matched
 */
-pattern_id_t mpbg_read_char(void* obj, char c) {
+pattern_id_t mpbg_ctx_read_char(void* obj, void* ctx, char c) {
 	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	MPBGContext* context = (MPBGContext*)ctx;
 	MPBGPatternInfo* iter;
 	size_t i, length, longest = 0;
-	pattern_id_t longest_id = null_pattern_id;
+	pattern_id_t longest_id = context->shorts ? lmac_ctx_read_char(mpbg->shorts, context->shorts, c) : null_pattern_id;
 	for (i = mpbg->n_pats, iter = mpbg->u.pats; i; --i, ++iter) {
-		if (bg_read_char(iter->obj, c) &&
+		if (bg_read_char(iter->obj, (BGState*)(context->states + iter->state), c) &&
 		    (length = bg_get_length(iter->obj)) > longest) {
 			longest = length;
 			longest_id = iter->id;
@@ -144,6 +511,96 @@ pattern_id_t mpbg_read_char(void* obj, char c) {
 	return longest_id;
 }
 
+/**
+* The mpbg reading block of characters function
+*
+* Instead of going over all the patterns on every character, we go over a tile of the block with every pattern
+* (so the bg object and the state of the pattern stay in cache during the tile), while saving the length of the
+* longest match so far on every character of the block. The kmp objects of the first stages of all the patterns read
+* the tile first, together in the bank.
+* The results start as the short matches (with length 0, so every long match replaces them).
+*
+* @param obj     The mpbg object
+* @param ctx     The context of the stream
+* @param buf     The block of characters from the stream
+* @param len     The length of the block
+* @param out     Where to put the id of the longest pattern matched on every character
+*/
+void mpbg_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	MPBGContext* context = (MPBGContext*)ctx;
+	MPBGPatternInfo* iter;
+	size_t i, j, length, start, tile, lane;
+	size_t* longest;
+	uint64_t* matches = context->kmp_matches;
+	BGStruct* bg;
+	BGState* state;
+	int remaining;
+
+	if (context->longest_size < len) {
+		free(context->longest);
+		context->longest = (size_t*) malloc(len * sizeof(size_t));
+		if (context->longest == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		context->longest_size = len;
+	}
+	longest = context->longest;
+	for (j = 0; j < len; ++j) {
+		longest[j] = 0;
+	}
+	if (context->shorts) {
+		lmac_ctx_read_block(mpbg->shorts, context->shorts, buf, len, out);
+	} else {
+		for (j = 0; j < len; ++j) {
+			out[j] = null_pattern_id;
+		}
+	}
+	for (start = 0; start < len; start += tile) {
+		tile = len - start < KMP_BANK_TILE ? len - start : KMP_BANK_TILE;
+		kmp_bank_read(&mpbg->bank, context->kmp_states, buf + start, tile, matches);
+		for (i = mpbg->n_pats, iter = mpbg->u.pats, lane = 0; i; --i, ++iter) {
+			bg = iter->obj;
+			state = (BGState*)(context->states + iter->state);
+			length = bg_get_length(bg);
+			for (j = 0; j < tile; ++j) {
+				remaining = bg->kmp_remaining ? kmp_bank_match(matches, lane + 1, j) : 1;
+				if (bg_read_char_after_kmp(bg, state, buf[start + j], kmp_bank_match(matches, lane, j), remaining) &&
+				    length > longest[start + j]) {
+					longest[start + j] = length;
+					out[start + j] = iter->id;
+				}
+			}
+			lane += mpbg_n_lanes(bg);
+		}
+	}
+}
+
+/**
+* The mpbg reading character fucntion (with the context of the object)
+*
+* @param obj     The mpbg object
+* @param c       The char arrived from the stream
+*
+* @return        The id of the longest pattern matched
+*/
+pattern_id_t mpbg_read_char(void* obj, char c) {
+	return mpbg_ctx_read_char(obj, &((MPBGStruct*)obj)->ctx, c);
+}
+
+/**
+* The mpbg reading block of characters function (with the context of the object)
+*
+* @param obj     The mpbg object
+* @param buf     The block of characters from the stream
+* @param len     The length of the block
+* @param out     Where to put the id of the longest pattern matched on every character
+*/
+void mpbg_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	mpbg_ctx_read_block(obj, &((MPBGStruct*)obj)->ctx, buf, len, out);
+}
+
 /**
 * The mpbg total memory function
 *
@@ -154,8 +611,11 @@ pattern_id_t mpbg_read_char(void* obj, char c) {
 size_t mpbg_total_mem(void* obj) {
 	if (obj == NULL) return 0;
 	MPBGStruct* mpbg = (MPBGStruct*)obj;
-	size_t total_mem = sizeof(MPBGStruct), i, n_pats = mpbg->n_pats;
-	total_mem += n_pats * sizeof(MPBGPatternInfo);
+	size_t total_mem = sizeof(MPBGStruct) - sizeof(MPBGContext), i, n_pats = mpbg->n_pats;
+	total_mem += arena_total_mem(&mpbg->mem); // for the pattern information array
+	total_mem += kmp_bank_total_mem(&mpbg->bank);
+	total_mem += mpbg_context_mem(mpbg, &mpbg->ctx);
+	total_mem += lmac_total_mem(mpbg->shorts);
 	MPBGPatternInfo* cur = mpbg->u.pats;
 	for (i = n_pats; i; --i, ++cur) {
 		total_mem += bg_get_total_mem(cur->obj);
@@ -169,12 +629,70 @@ size_t mpbg_total_mem(void* obj) {
 * @param obj    The mpbg object
 */
 void mpbg_reset(void* obj) {
+	mpbg_reset_context(obj, &((MPBGStruct*)obj)->ctx);
+}
+
+/**
+* Create new context for the compiled mpbg object (the state of a single stream)
+*
+* @param obj    The mpbg object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* mpbg_new_context(void* obj) {
+	MPBGContext* ctx = (MPBGContext*) malloc(sizeof(MPBGContext));
+	if (ctx == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	mpbg_init_context((MPBGStruct*)obj, ctx);
+	return (void*)ctx;
+}
+
+/**
+* Reset a context of the mpbg object back to the initial state
+*
+* @param obj    The mpbg object
+* @param ctx    The context to reset
+*/
+void mpbg_reset_context(void* obj, void* ctx) {
 	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	MPBGContext* context = (MPBGContext*)ctx;
 	size_t i;
 	MPBGPatternInfo* cur;
 	for (i = mpbg->n_pats, cur = mpbg->u.pats; i; --i, ++cur) {
-		bg_reset(cur->obj);
+		bg_reset(cur->obj, (BGState*)(context->states + cur->state));
 	}
+	if (context->shorts) lmac_reset_context(mpbg->shorts, context->shorts);
+}
+
+/**
+* Get the memory used for a context of the mpbg object
+*
+* @param obj    The mpbg object
+* @param ctx    The context
+*
+* @return       The memory used for the context (in bytes)
+*/
+size_t mpbg_context_mem(void* obj, void* ctx) {
+	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	MPBGContext* context = (MPBGContext*)ctx;
+	return sizeof(MPBGContext) +
+	       mpbg->states_size +
+	       context->longest_size * sizeof(size_t) +
+	       mpbg->bank.n_lanes * (sizeof(KMPState*) + KMP_BANK_WORDS * sizeof(uint64_t)) +
+	       (context->shorts ? lmac_context_mem(mpbg->shorts, context->shorts) : 0);
+}
+
+/**
+* Free a context of the mpbg object
+*
+* @param obj    The mpbg object
+* @param ctx    The context to free
+*/
+void mpbg_free_context(void* obj, void* ctx) {
+	mpbg_destroy_context((MPBGStruct*)obj, (MPBGContext*)ctx);
+	free(ctx);
 }
 
 /**
@@ -184,13 +702,165 @@ void mpbg_reset(void* obj) {
 */
 void mpbg_free(void* obj) {
 	MPBGStruct* mpbg = (MPBGStruct*)obj;
-	size_t i, n_pats = mpbg->n_pats;
+	mpbg_destroy(mpbg);
+	free(mpbg);
+}
 
-	for (i = 0; i < n_pats; ++i) {
-		bg_free(mpbg->u.pats[i].obj);
+/**
+* Save the compiled mpbg object to the cache file (the short patterns lmac object, and the id and the bg object
+* of every long pattern)
+*
+* @param obj    The mpbg object
+* @param w      The cache writer
+*/
+void mpbg_save(void* obj, CacheWriter* w) {
+	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	uint64_t n_pats = mpbg->n_pats;
+	size_t i;
+
+	lmac_save(mpbg->shorts, w);
+	cache_write(w, &n_pats, sizeof(n_pats));
+	for (i = 0; i < mpbg->n_pats; ++i) {
+		cache_write_ids(w, &mpbg->u.pats[i].id, 1);
+		bg_save(mpbg->u.pats[i].obj, w);
 	}
-	free(mpbg->u.pats);
-	free(mpbg);
+}
+
+/**
+* Load the mpbg object (saved with mpbg_save) from the cache file, and initialize it as mpbg_compile does
+*
+* @param obj    The newly created mpbg object
+* @param r      The cache reader
+*/
+void mpbg_load(void* obj, CacheReader* r) {
+	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	MPBGPatternInfo* arr;
+	uint64_t n_pats;
+	size_t i;
+
+	arena_free(&mpbg->build);
+	lmac_load(mpbg->shorts, r);
+	memcpy(&n_pats, cache_read(r, sizeof(n_pats)), sizeof(n_pats));
+	mpbg->n_pats = n_pats;
+	arr = (MPBGPatternInfo*) arena_alloc(&mpbg->mem, mpbg->n_pats * sizeof(MPBGPatternInfo));
+	mpbg->states_size = 0;
+	for (i = 0; i < mpbg->n_pats; ++i) {
+		cache_read_ids(r, &arr[i].id, 1);
+		arr[i].obj = bg_load(r);
+		arr[i].state = mpbg->states_size;
+		mpbg->states_size += bg_state_size(arr[i].obj);
+	}
+	mpbg->u.pats = arr;
+	mpbg_init_bank(mpbg);
+	mpbg_init_context(mpbg, &mpbg->ctx);
+}
+
+/**
+* Update the patterns of the compiled mpbg object in place
+*
+* The patterns are independent, so the long patterns that stay keep their bg objects (with their new ids), the bg
+* objects of the removed patterns are freed, and the added long patterns get new bg objects. The states of every
+* context are moved to a new states block (see mpbg_move_context), so the patterns that stay continue their streams.
+* The short patterns lmac object is built again from all the short patterns.
+*
+* @param obj      The mpbg object
+* @param update   The update (see MpsUpdate)
+* @param ctxs     The contexts of the object
+* @param n_ctxs   The number of contexts
+*/
+void mpbg_update(void* obj, const MpsUpdate* update, void** ctxs, size_t n_ctxs) {
+	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	const PatternsList* patterns = update->patterns;
+	MPBGPatternInfo *pats, *old = mpbg->u.pats;
+	size_t i, n_pats = 0, n_old = mpbg->n_pats;
+	size_t* from;
+	void* shorts = mpbg->shorts;
+	Arena mem = ARENA_INIT;
+	pattern_id_t id;
+
+	for (i = 0; i < n_old; ++i) {
+		if (mps_update_id(update, old[i].id) != null_pattern_id) ++n_pats;
+	}
+	for (i = update->first_added; i < patterns->n; ++i) {
+		if (patterns->ids[i] != null_pattern_id && patterns->lens[i] > mpbg->short_length) ++n_pats;
+	}
+
+	// the new patterns array (the patterns that stay, and then the added patterns)
+	pats = (MPBGPatternInfo*) arena_alloc(&mem, n_pats * sizeof(MPBGPatternInfo));
+	from = (size_t*) arena_alloc(&mpbg->build, (n_pats + 1) * sizeof(size_t));
+	mpbg->states_size = 0;
+	n_pats = 0;
+	for (i = 0; i < n_old; ++i) {
+		id = mps_update_id(update, old[i].id);
+		if (id == null_pattern_id) continue;
+		pats[n_pats].obj = old[i].obj;
+		pats[n_pats].id = id;
+		pats[n_pats].state = mpbg->states_size;
+		from[n_pats++] = old[i].state;
+		mpbg->states_size += bg_state_size(old[i].obj);
+	}
+	for (i = update->first_added; i < patterns->n; ++i) {
+		if (patterns->ids[i] == null_pattern_id || patterns->lens[i] <= mpbg->short_length) continue;
+		pats[n_pats].obj = bg_new(patterns_list_get(patterns, i), patterns->lens[i]);
+		pats[n_pats].id = patterns->ids[i];
+		pats[n_pats].state = mpbg->states_size;
+		from[n_pats++] = (size_t)-1;
+		mpbg->states_size += bg_state_size(pats[n_pats - 1].obj);
+	}
+	mpbg->u.pats = pats;
+	mpbg->n_pats = n_pats;
+	kmp_bank_free(&mpbg->bank);
+	mpbg_init_bank(mpbg);
+
+	// build the short patterns again
+	if (shorts) {
+		mpbg->shorts = lmac_create();
+		for (i = 0; i < patterns->n; ++i) {
+			if (patterns->ids[i] != null_pattern_id && patterns->lens[i] <= mpbg->short_length) {
+				lmac_add_pattern(mpbg->shorts, patterns_list_get(patterns, i), patterns->lens[i], patterns->ids[i]);
+			}
+		}
+		lmac_compile(mpbg->shorts);
+	}
+
+	for (i = 0; i < n_ctxs; ++i) {
+		mpbg_move_context(mpbg, (MPBGContext*)ctxs[i], from, shorts);
+	}
+	mpbg_move_context(mpbg, &mpbg->ctx, from, shorts);
+
+	// free the removed patterns and the old tables
+	for (i = 0; i < n_old; ++i) {
+		if (mps_update_id(update, old[i].id) == null_pattern_id) bg_free(old[i].obj);
+	}
+	if (shorts) lmac_free(shorts);
+	arena_free(&mpbg->build);
+	arena_free(&mpbg->mem);
+	mpbg->mem = mem;
+}
+
+/**
+* Set a parameter of a new mpbg object (before any pattern was added)
+*
+* "short=N" puts the patterns up to length N (at least BG_SHORT_PATTERN_LENGTH) in the short patterns lmac object,
+* and "simd=LEVEL" limits the vectorized read of the kmp bank to the instructions of LEVEL (see cpu_parse_simd).
+*
+* @param obj      The mpbg object
+* @param key      The name of the parameter
+* @param val      The value of the parameter
+*
+* @return         0 on success, -1 if the parameter isn't valid
+*/
+int mpbg_set_param(void* obj, const char* key, const char* val) {
+	MPBGStruct* mpbg = (MPBGStruct*)obj;
+	size_t n;
+	if (strcmp(key, "short") == 0 && mps_parse_size(val, &n) == 0 && n >= BG_SHORT_PATTERN_LENGTH) {
+		mpbg->short_length = n;
+		return 0;
+	}
+	if (strcmp(key, "simd") == 0) {
+		return cpu_parse_simd(val, &mpbg->simd_mask);
+	}
+	return -1;
 }
 
 /**
@@ -198,11 +868,315 @@ void mpbg_free(void* obj) {
 */
 void mps_bg_register() {
 	mps_table[MPS_BG].name = "Multi-Pattern Breslauer-Galil";
+	mps_table[MPS_BG].short_name = "bg";
 	mps_table[MPS_BG].create = mpbg_create;
 	mps_table[MPS_BG].add_pattern = mpbg_add_pattern;
 	mps_table[MPS_BG].compile = mpbg_compile;
 	mps_table[MPS_BG].read_char = mpbg_read_char;
+	mps_table[MPS_BG].read_block = mpbg_read_block;
 	mps_table[MPS_BG].total_mem = mpbg_total_mem;
 	mps_table[MPS_BG].reset = mpbg_reset;
 	mps_table[MPS_BG].free = mpbg_free;
-}
\ No newline at end of file
+	mps_table[MPS_BG].save = mpbg_save;
+	mps_table[MPS_BG].load = mpbg_load;
+	mps_table[MPS_BG].new_context = mpbg_new_context;
+	mps_table[MPS_BG].ctx_read_char = mpbg_ctx_read_char;
+	mps_table[MPS_BG].ctx_read_block = mpbg_ctx_read_block;
+	mps_table[MPS_BG].reset_context = mpbg_reset_context;
+	mps_table[MPS_BG].context_mem = mpbg_context_mem;
+	mps_table[MPS_BG].free_context = mpbg_free_context;
+	mps_table[MPS_BG].update = mpbg_update;
+	mps_table[MPS_BG].set_param = mpbg_set_param;
+}
+
+/**
+* Create the parallel mpbg object
+*/
+void* pmpbg_create(void) {
+	PMPBGStruct* ret = (PMPBGStruct*) malloc(sizeof(PMPBGStruct));
+	if (ret == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memset(ret, 0, sizeof(PMPBGStruct));
+	ret->mpbg.short_length = BG_SHORT_PATTERN_LENGTH;
+	ret->mpbg.simd_mask = CPU_FEATURES_ALL;
+	ret->mpbg.shorts = lmac_create();
+	ret->requested_shards = PMPBG_N_SHARDS;
+	return (void*)ret;
+}
+
+/**
+* Add pattern to the parallel mpbg struct
+*
+* @param obj      The parallel mpbg object to work on
+* @param pat      The pattern to add
+* @param len      The length of the pattern
+* @param id       The id of the pattern
+*/
+void pmpbg_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
+	mpbg_add_pattern(&((PMPBGStruct*)obj)->mpbg, pat, len, id);
+}
+
+/**
+* Compile the parallel mpbg struct (compile the mpbg, and split its patterns into shards, see pmpbg_init_shards)
+*
+* @param obj      The parallel mpbg object
+*/
+void pmpbg_compile(void* obj) {
+	PMPBGStruct* pmpbg = (PMPBGStruct*)obj;
+	mpbg_compile(&pmpbg->mpbg);
+	pmpbg_init_shards(pmpbg);
+}
+
+/**
+* The parallel mpbg reading character function
+*
+* Waking the shards threads for every character costs much more than reading it, so this just reads
+* the character with all the patterns on the calling thread
+*
+* @param obj     The parallel mpbg object
+* @param c       The char arrived from the stream
+*
+* @return        The id of the longest pattern matched
+*/
+pattern_id_t pmpbg_read_char(void* obj, char c) {
+	return mpbg_read_char(&((PMPBGStruct*)obj)->mpbg, c);
+}
+
+/**
+* The parallel mpbg reading block of characters function
+*
+* All the shards read the whole block simultaneously (shards[0] on the calling thread, directly into out),
+* and then the longest match on every character is merged from the results of the shards.
+*
+* @param obj     The parallel mpbg object
+* @param buf     The block of characters from the stream
+* @param len     The length of the block
+* @param out     Where to put the id of the longest pattern matched on every character
+*/
+void pmpbg_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	PMPBGStruct* pmpbg = (PMPBGStruct*)obj;
+	PMPBGShard* shard;
+	size_t i, j, n_shards = pmpbg->n_shards;
+	size_t *longest, *shard_longest;
+
+	if (n_shards == 1) {
+		mpbg_ctx_read_block(&pmpbg->shards[0].mpbg, &pmpbg->shards[0].mpbg.ctx, buf, len, out);
+		return;
+	}
+
+	pmpbg->buf = buf;
+	pmpbg->len = len;
+	pthread_barrier_wait(&pmpbg->barrier); // start the shards
+	mpbg_ctx_read_block(&pmpbg->shards[0].mpbg, &pmpbg->shards[0].mpbg.ctx, buf, len, out);
+	pthread_barrier_wait(&pmpbg->barrier); // wait for the shards to finish
+
+	longest = pmpbg->shards[0].mpbg.ctx.longest;
+	for (i = 1; i < n_shards; ++i) {
+		shard = &pmpbg->shards[i];
+		shard_longest = shard->mpbg.ctx.longest;
+		for (j = 0; j < len; ++j) {
+			if (shard_longest[j] > longest[j]) {
+				longest[j] = shard_longest[j];
+				out[j] = shard->out[j];
+			}
+		}
+	}
+}
+
+/**
+* The parallel mpbg total memory function
+*
+* @param obj    The parallel mpbg object
+*
+* @return       The total memory allocated for this object
+*/
+size_t pmpbg_total_mem(void* obj) {
+	if (obj == NULL) return 0;
+	PMPBGStruct* pmpbg = (PMPBGStruct*)obj;
+	size_t total_mem, i;
+
+	total_mem = mpbg_total_mem(&pmpbg->mpbg) - sizeof(MPBGStruct) + sizeof(PMPBGStruct);
+	total_mem += pmpbg->n_shards * sizeof(PMPBGShard);
+	for (i = 0; i < pmpbg->n_shards; ++i) {
+		total_mem += pmpbg->shards[i].mpbg.ctx.longest_size * sizeof(size_t);
+		total_mem += pmpbg->shards[i].out_size * sizeof(pattern_id_t);
+		total_mem += pmpbg->shards[i].mpbg.bank.n_lanes * KMP_BANK_WORDS * sizeof(uint64_t);
+	}
+	return total_mem;
+}
+
+/**
+* The parallel mpbg reset function (returning to initial state)
+*
+* @param obj    The parallel mpbg object
+*/
+void pmpbg_reset(void* obj) {
+	mpbg_reset(&((PMPBGStruct*)obj)->mpbg);
+}
+
+/**
+* Create new context for the compiled parallel mpbg object
+*
+* The shards threads read only the stream of the object itself, so a context is an mpbg context of all the patterns,
+* which is read on the calling thread (streams of many contexts can be read in parallel by many threads)
+*
+* @param obj    The parallel mpbg object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* pmpbg_new_context(void* obj) {
+	return mpbg_new_context(&((PMPBGStruct*)obj)->mpbg);
+}
+
+/**
+* The parallel mpbg reading character function of a context (on the calling thread)
+*/
+pattern_id_t pmpbg_ctx_read_char(void* obj, void* ctx, char c) {
+	return mpbg_ctx_read_char(&((PMPBGStruct*)obj)->mpbg, ctx, c);
+}
+
+/**
+* The parallel mpbg reading block of characters function of a context (on the calling thread)
+*/
+void pmpbg_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	mpbg_ctx_read_block(&((PMPBGStruct*)obj)->mpbg, ctx, buf, len, out);
+}
+
+/**
+* Reset a context of the parallel mpbg object back to the initial state
+*/
+void pmpbg_reset_context(void* obj, void* ctx) {
+	mpbg_reset_context(&((PMPBGStruct*)obj)->mpbg, ctx);
+}
+
+/**
+* Get the memory used for a context of the parallel mpbg object
+*/
+size_t pmpbg_context_mem(void* obj, void* ctx) {
+	return mpbg_context_mem(&((PMPBGStruct*)obj)->mpbg, ctx);
+}
+
+/**
+* Free a context of the parallel mpbg object
+*/
+void pmpbg_free_context(void* obj, void* ctx) {
+	mpbg_free_context(&((PMPBGStruct*)obj)->mpbg, ctx);
+}
+
+/**
+* Free the parallel mpbg object (should be called AFTER compilation using pmpbg_compile)
+*
+* Stop the threads of the shards, and free the shards and the patterns
+*
+* @param obj    The parallel mpbg object to free
+*/
+void pmpbg_free(void* obj) {
+	PMPBGStruct* pmpbg = (PMPBGStruct*)obj;
+	size_t i, n_shards = pmpbg->n_shards;
+
+	if (n_shards > 1) {
+		pmpbg->done = 1;
+		pthread_barrier_wait(&pmpbg->barrier);
+		for (i = 1; i < n_shards; ++i) {
+			pthread_join(pmpbg->shards[i].thread, NULL);
+		}
+		pthread_barrier_destroy(&pmpbg->barrier);
+	}
+	for (i = 0; i < n_shards; ++i) {
+		free(pmpbg->shards[i].mpbg.ctx.longest);
+		free(pmpbg->shards[i].mpbg.ctx.kmp_matches);
+		free(pmpbg->shards[i].out);
+	}
+	free(pmpbg->shards);
+	mpbg_destroy(&pmpbg->mpbg);
+	free(pmpbg);
+}
+
+/**
+* Save the compiled parallel mpbg object to the cache file (its mpbg, the shards are split again when loading)
+*
+* @param obj    The parallel mpbg object
+* @param w      The cache writer
+*/
+void pmpbg_save(void* obj, CacheWriter* w) {
+	mpbg_save(&((PMPBGStruct*)obj)->mpbg, w);
+}
+
+/**
+* Load the parallel mpbg object (saved with pmpbg_save) from the cache file, and split it into shards
+*
+* @param obj    The newly created parallel mpbg object
+* @param r      The cache reader
+*/
+void pmpbg_load(void* obj, CacheReader* r) {
+	PMPBGStruct* pmpbg = (PMPBGStruct*)obj;
+	mpbg_load(&pmpbg->mpbg, r);
+	pmpbg_init_shards(pmpbg);
+}
+
+/**
+* Get the threads of the shards of the parallel mpbg object (which read the blocks besides the calling thread)
+*
+* @param obj           The parallel mpbg object (compiled)
+* @param threads       Where to put the threads
+* @param max_threads   The number of threads that can be put in threads
+*
+* @return              The number of threads of the shards
+*/
+size_t pmpbg_threads(void* obj, MpsThread* threads, size_t max_threads) {
+	PMPBGStruct* pmpbg = (PMPBGStruct*)obj;
+	size_t i;
+	for (i = 1; i < pmpbg->n_shards && i - 1 < max_threads; ++i) {
+		pthread_getcpuclockid(pmpbg->shards[i].thread, &threads[i - 1].clock);
+		threads[i - 1].tid = pmpbg->shards[i].tid;
+	}
+	return pmpbg->n_shards > 1 ? pmpbg->n_shards - 1 : 0;
+}
+
+/**
+* Set a parameter of a new parallel mpbg object (before any pattern was added)
+*
+* "shards=N" splits the patterns to N shards (0 for one per cpu) instead of PMPBG_N_SHARDS,
+* and "short=N" & "simd=LEVEL" are as in mpbg_set_param.
+*
+* @param obj      The parallel mpbg object
+* @param key      The name of the parameter
+* @param val      The value of the parameter
+*
+* @return         0 on success, -1 if the parameter isn't valid
+*/
+int pmpbg_set_param(void* obj, const char* key, const char* val) {
+	PMPBGStruct* pmpbg = (PMPBGStruct*)obj;
+	if (strcmp(key, "shards") == 0) {
+		return mps_parse_size(val, &pmpbg->requested_shards);
+	}
+	return mpbg_set_param(&pmpbg->mpbg, key, val);
+}
+
+/**
+* The mps registering function of Parallel Multi-Pattern Breslauer-Galil algorithm
+*/
+void mps_pbg_register() {
+	mps_table[MPS_PBG].name = "Parallel Multi-Pattern Breslauer-Galil";
+	mps_table[MPS_PBG].short_name = "pbg";
+	mps_table[MPS_PBG].create = pmpbg_create;
+	mps_table[MPS_PBG].add_pattern = pmpbg_add_pattern;
+	mps_table[MPS_PBG].compile = pmpbg_compile;
+	mps_table[MPS_PBG].read_char = pmpbg_read_char;
+	mps_table[MPS_PBG].read_block = pmpbg_read_block;
+	mps_table[MPS_PBG].total_mem = pmpbg_total_mem;
+	mps_table[MPS_PBG].reset = pmpbg_reset;
+	mps_table[MPS_PBG].free = pmpbg_free;
+	mps_table[MPS_PBG].save = pmpbg_save;
+	mps_table[MPS_PBG].load = pmpbg_load;
+	mps_table[MPS_PBG].new_context = pmpbg_new_context;
+	mps_table[MPS_PBG].ctx_read_char = pmpbg_ctx_read_char;
+	mps_table[MPS_PBG].ctx_read_block = pmpbg_ctx_read_block;
+	mps_table[MPS_PBG].reset_context = pmpbg_reset_context;
+	mps_table[MPS_PBG].context_mem = pmpbg_context_mem;
+	mps_table[MPS_PBG].free_context = pmpbg_free_context;
+	mps_table[MPS_PBG].set_param = pmpbg_set_param;
+	mps_table[MPS_PBG].threads = pmpbg_threads;
+}
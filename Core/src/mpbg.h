@@ -13,6 +13,21 @@
 #include "bgps.h"
 #include "mps.h"
 #include "PatternsTree.h"
+#include "cache.h"
+
+
+/******************************************************************************************************
+*		DEFINITIONS
+******************************************************************************************************/
+
+
+/**
+* The number of shards (threads) of the parallel mpbg, where 0 means one shard per cpu.
+* Can be given with CFLAGS (e.g. "make CFLAGS=-DPMPBG_N_SHARDS=4"), or for an instance with "-a pbg:shards=4"
+*/
+#ifndef PMPBG_N_SHARDS
+#define PMPBG_N_SHARDS 0
+#endif
 
 
 /******************************************************************************************************
@@ -24,10 +39,44 @@ void* mpbg_create(void);
 void mpbg_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
 void mpbg_compile(void* obj);
 pattern_id_t mpbg_read_char(void* obj, char c);
+void mpbg_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
 size_t mpbg_total_mem(void* obj);
 void mpbg_reset(void* obj);
 void mpbg_free(void* obj);
+void mpbg_save(void* obj, CacheWriter* w);
+void mpbg_load(void* obj, CacheReader* r);
+
+void* mpbg_new_context(void* obj);
+pattern_id_t mpbg_ctx_read_char(void* obj, void* ctx, char c);
+void mpbg_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void mpbg_reset_context(void* obj, void* ctx);
+size_t mpbg_context_mem(void* obj, void* ctx);
+void mpbg_free_context(void* obj, void* ctx);
+void mpbg_update(void* obj, const MpsUpdate* update, void** ctxs, size_t n_ctxs);
+int mpbg_set_param(void* obj, const char* key, const char* val);
 
 void mps_bg_register();
 
+void* pmpbg_create(void);
+void pmpbg_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
+void pmpbg_compile(void* obj);
+pattern_id_t pmpbg_read_char(void* obj, char c);
+void pmpbg_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
+size_t pmpbg_total_mem(void* obj);
+void pmpbg_reset(void* obj);
+void pmpbg_free(void* obj);
+void pmpbg_save(void* obj, CacheWriter* w);
+void pmpbg_load(void* obj, CacheReader* r);
+
+void* pmpbg_new_context(void* obj);
+pattern_id_t pmpbg_ctx_read_char(void* obj, void* ctx, char c);
+void pmpbg_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void pmpbg_reset_context(void* obj, void* ctx);
+size_t pmpbg_context_mem(void* obj, void* ctx);
+void pmpbg_free_context(void* obj, void* ctx);
+int pmpbg_set_param(void* obj, const char* key, const char* val);
+size_t pmpbg_threads(void* obj, MpsThread* threads, size_t max_threads);
+
+void mps_pbg_register();
+
 #endif /* MPBG_H */
\ No newline at end of file
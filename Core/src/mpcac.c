@@ -0,0 +1,568 @@
+/**
+* Multi-Pattern Compact Aho-Corasick Algorithm implementation
+*
+* This is the same algorithm as in "mpac.c", but with a smaller states table (about half of it on the snort & et
+* dictionaries, which use all the 256 byte values, and much smaller on dictionaries with a small alphabet):
+*
+* Alphabet compression - bytes that are not in any pattern can't have a child in any state, so they don't
+* need a column in the table. We map every byte that is in some pattern to its own column, and keep
+* class 0 for all the other bytes (reading such byte always moves to the root, without looking in the table).
+*
+* Small state indices - the states are saved as uint16_t when there are at most 2^16 states, and as uint32_t
+* otherwise (instead of size_t).
+*
+* The table is row-major (the row of a state is all its children), and the states are numbered in BFS order,
+* so the states near the root (which are used the most) are close to each other in memory.
+* The table itself is cache-line aligned, and the rows are padded so no row is split between
+* more cache lines than necessary.
+*
+* As in "mpac.c", for every state we keep the failure state and the id of its suffix link
+* (the longest pattern that is a suffix of the state).
+*
+* When compiled with AC_DFA defined (see "mpac.h"), all the missing children are filled (as in "mpac.c"),
+* which cost no memory here since the table have all the columns anyway.
+*
+* The tree is allocated from a build arena (freed at the end of compilation), and the compiled arrays from
+* the persistent arena of the object (see "arena.h").
+*
+* The table and the failure states contain no pointers, so when loading from the cache file they are used
+* directly from the mapping of the cache file (saved aligned to the cache line).
+*/
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mpcac.h"
+#include "arena.h"
+#include "cache.h"
+#include <stdint.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+#define CACHE_LINE_SIZE 64
+
+// A node in the Aho-Corasick tree (used before ac compilation)
+typedef struct tree_node {
+	struct tree_node *children[256];
+	pattern_id_t id;
+} TreeNode;
+
+// The stream state of the cac object (a context of a single stream)
+typedef struct {
+	size_t current_state;
+} CACContext;
+
+typedef struct {
+	union {
+		TreeNode *root;          // Aho-Corasick tree for before compilation
+		void     *table;         // the transitions table for after compilation (n_states rows of row_size entries)
+	};
+	void          *failure;      // the failure state of every state (entries in the same size as in table)
+	pattern_id_t  *outputs;      // the id of the suffix link of every state
+	uint16_t       classes[256]; // the column+1 of every byte in the table (0 for bytes that are in no pattern)
+	size_t         n_classes;    // the number of columns used in the table
+	size_t         row_size;     // the number of entries in a row (n_classes + padding)
+	size_t         entry_size;   // the size of an entry in the table (sizeof(uint16_t) or sizeof(uint32_t))
+	size_t         n_states;
+	CACContext     ctx;          // the context used by cac_read_char & cac_read_block
+	int            mapped;       // whether the table and failure are in the mapping of the cache file
+	Arena          build;        // arena for the tree (freed at the end of compilation)
+	Arena          mem;          // arena for the table, the failure states and the outputs
+} CAC;
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Get an entry from a table of states
+*
+* @param table        The table
+* @param entry_size   The size of an entry in the table
+* @param index        The index of the entry
+*
+* @return             The state in that entry
+*/
+static inline size_t get_entry(void* table, size_t entry_size, size_t index) {
+	return entry_size == sizeof(uint16_t) ? ((uint16_t*)table)[index] : ((uint32_t*)table)[index];
+}
+
+/**
+* Set an entry in a table of states
+*
+* @param table        The table
+* @param entry_size   The size of an entry in the table
+* @param index        The index of the entry
+* @param state        The state to put in the entry
+*/
+static inline void set_entry(void* table, size_t entry_size, size_t index, size_t state) {
+	if (entry_size == sizeof(uint16_t)) {
+		((uint16_t*)table)[index] = (uint16_t)state;
+	} else {
+		((uint32_t*)table)[index] = (uint32_t)state;
+	}
+}
+
+/**
+* Calculate the number of entries in a row of the table
+*
+* Rows that are smaller than a cache line are padded to a power of 2 (so a row is never split between two
+* cache lines), and bigger rows are padded to a multiple of the cache line size.
+*
+* @param n_classes     The number of columns needed in a row
+* @param entry_size    The size of an entry in the table
+*
+* @return              The number of entries in a row
+*/
+static size_t calc_row_size(size_t n_classes, size_t entry_size) {
+	size_t row_bytes = n_classes * entry_size, padded = entry_size;
+	if (row_bytes >= CACHE_LINE_SIZE) {
+		padded = (row_bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+	} else {
+		while (padded < row_bytes) padded <<= 1;
+	}
+	return padded / entry_size;
+}
+
+/**
+* Give a column to every byte that is in some pattern
+*
+* Before compilation, classes[c] is non-zero only for bytes that are in some pattern,
+* and after this function classes[c] is the column of c in the table plus 1.
+*
+* @param cac    The cac object
+*/
+static void assign_classes(CAC* cac) {
+	size_t i;
+	cac->n_classes = 0;
+	for (i = 0; i < 256; ++i) {
+		if (cac->classes[i]) {
+			cac->classes[i] = (uint16_t)++cac->n_classes;
+		}
+	}
+}
+
+/**
+* Convert the tree to the states table
+*
+* Number the states in BFS order, and fill the children of every state in the table.
+* Also put the id of every state in outputs (later changed to the id of the suffix link)
+*
+* @param cac     The cac object (with allocated table & outputs)
+* @param root    The root of the tree
+* @param nodes   Array of n_states elements, to put the tree nodes in BFS order
+*/
+static void convert_tree_to_table(CAC* cac, TreeNode* root, TreeNode** nodes) {
+	size_t i, head = 0, tail = 1, row_size = cac->row_size, entry_size = cac->entry_size;
+	TreeNode* node;
+	nodes[0] = root;
+	while (head < tail) {
+		node = nodes[head];
+		cac->outputs[head] = node->id;
+		for (i = 0; i < 256; ++i) {
+			if (node->children[i]) {
+				set_entry(cac->table, entry_size, head * row_size + cac->classes[i] - 1, tail);
+				nodes[tail++] = node->children[i];
+			}
+		}
+		++head;
+	}
+}
+
+/**
+* Add failure links to the table of states (and change outputs to be the id of the suffix link)
+*
+* Since the states are numbered in BFS order, going over the states by their number is a BFS,
+* and the failure state of a state (and so its suffix link) is always handled before the state itself.
+* (on AC_DFA, also the missing children of the failure state are already filled when we handle the state)
+*
+* @param cac    The cac object
+*/
+static void add_failure_links(CAC* cac) {
+	size_t state, col, child, fs;
+	size_t row_size = cac->row_size, entry_size = cac->entry_size;
+	void *table = cac->table, *failure = cac->failure;
+
+	set_entry(failure, entry_size, 0, 0);
+	for (state = 0; state < cac->n_states; ++state) {
+		for (col = 0; col < cac->n_classes; ++col) {
+			child = get_entry(table, entry_size, state * row_size + col);
+			fs = get_entry(failure, entry_size, state);
+			if (!child) {
+#ifdef AC_DFA
+				if (state) {
+					set_entry(table, entry_size, state * row_size + col, get_entry(table, entry_size, fs * row_size + col));
+				}
+#endif
+				continue;
+			}
+			if (state == 0) {
+				fs = 0;
+			} else {
+#ifndef AC_DFA
+				while (fs && !get_entry(table, entry_size, fs * row_size + col)) {
+					fs = get_entry(failure, entry_size, fs);
+				}
+#endif
+				fs = get_entry(table, entry_size, fs * row_size + col);
+			}
+			set_entry(failure, entry_size, child, fs);
+			if (cac->outputs[child] == null_pattern_id) {
+				cac->outputs[child] = cac->outputs[fs];
+			}
+		}
+	}
+}
+
+/**
+* The transition from the current state with the column col, for specific type of table entries.
+* (on AC_DFA, it is just the entry in the table)
+*/
+#ifdef AC_DFA
+#define CAC_NEXT_STATE(table, failure)                                                         \
+	do {                                                                                       \
+		current_state = table[current_state * row_size + col];                                 \
+		(void)failure;                                                                         \
+	} while (0)
+#else
+#define CAC_NEXT_STATE(table, failure)                                                         \
+	do {                                                                                       \
+		while (!table[current_state * row_size + col] && current_state) {                     \
+			current_state = failure[current_state];                                            \
+		}                                                                                      \
+		current_state = table[current_state * row_size + col];                                 \
+	} while (0)
+#endif
+
+/**
+* The loop of reading block, for specific type of table entries.
+*
+* Bytes of class 0 are not in any pattern, so they always move to the root.
+*/
+#define CAC_READ_LOOP(type)                                                                    \
+	do {                                                                                       \
+		type *table = (type*)cac->table, *failure = (type*)cac->failure;                       \
+		for (i = 0; i < len; ++i) {                                                            \
+			col = classes[(unsigned char)buf[i]];                                              \
+			if (!col) {                                                                        \
+				current_state = 0;                                                             \
+			} else {                                                                           \
+				--col;                                                                         \
+				CAC_NEXT_STATE(table, failure);                                                \
+			}                                                                                  \
+			out[i] = outputs[current_state];                                                   \
+		}                                                                                      \
+	} while (0)
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Create new CAC struct
+*
+* @return     A new dynamically allocated cac object
+*/
+void* cac_create() {
+	CAC* cac = (CAC*)malloc(sizeof(CAC));
+	if (cac == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memset(cac, 0, sizeof(CAC));
+	TreeNode* root = (TreeNode*)arena_calloc(&cac->build, sizeof(TreeNode));
+	root->id = null_pattern_id;
+	cac->root = root;
+	cac->n_states = 1;
+	return (void*)cac;
+}
+
+/**
+* Add pattern to the cac object
+*
+* Add the pattern to the Aho-Corasick tree, create all midway states, and mark the bytes of the pattern as used.
+*
+* @param obj      The cac object
+* @param pat      The pattern to add
+* @param len      The length of the pattern
+* @param id       The id of the pattern
+*/
+void cac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
+	CAC *cac = (CAC*)obj;
+	TreeNode *cur = cac->root, *next;
+	size_t i = 0;
+	while (i < len && cur->children[(unsigned char)pat[i]]) {
+		cur = cur->children[(unsigned char)pat[i++]];
+	}
+	for (; i < len; ++i) {
+		next = (TreeNode*)arena_calloc(&cac->build, sizeof(TreeNode));
+		next->id = null_pattern_id;
+		cur->children[(unsigned char)pat[i]] = next;
+		cac->classes[(unsigned char)pat[i]] = 1;
+		cur = next;
+		cac->n_states++;
+	}
+	cur->id = id;
+}
+
+/**
+* Compile the Compact Aho-Corasick object.
+*
+* Transfer the Aho-Corasick tree to the compact table, and add failure links.
+*
+* @param obj     The cac object
+*/
+void cac_compile(void* obj) {
+	CAC *cac = (CAC*)obj;
+	TreeNode* root = cac->root;
+	TreeNode** nodes = (TreeNode**)arena_alloc(&cac->build, cac->n_states * sizeof(TreeNode*));
+	size_t table_size;
+
+	assign_classes(cac);
+	cac->entry_size = cac->n_states <= (1 << 16) ? sizeof(uint16_t) : sizeof(uint32_t);
+	cac->row_size = calc_row_size(cac->n_classes, cac->entry_size);
+	table_size = cac->n_states * cac->row_size * cac->entry_size;
+	cac->table = arena_alloc_aligned(&cac->mem, table_size, CACHE_LINE_SIZE);
+	memset(cac->table, 0, table_size);
+	cac->failure = arena_alloc(&cac->mem, cac->n_states * cac->entry_size);
+	cac->outputs = (pattern_id_t*)arena_alloc(&cac->mem, cac->n_states * sizeof(pattern_id_t));
+
+	convert_tree_to_table(cac, root, nodes);
+	add_failure_links(cac);
+	arena_free(&cac->build);
+}
+
+/**
+* Compact Aho-Corasick read block of characters from the stream function.
+*
+* @param obj    The cac object
+* @param ctx    The context of the stream
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void cac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	CAC *cac = (CAC*)obj;
+	CACContext *context = (CACContext*)ctx;
+	size_t i, col, current_state = context->current_state, row_size = cac->row_size;
+	uint16_t* classes = cac->classes;
+	pattern_id_t* outputs = cac->outputs;
+	if (cac->entry_size == sizeof(uint16_t)) {
+		CAC_READ_LOOP(uint16_t);
+	} else {
+		CAC_READ_LOOP(uint32_t);
+	}
+	context->current_state = current_state;
+}
+
+/**
+* Compact Aho-Corasick read next char in the stream function.
+*
+* @param obj    The cac object
+* @param ctx    The context of the stream
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t cac_ctx_read_char(void* obj, void* ctx, char c) {
+	pattern_id_t ret;
+	cac_ctx_read_block(obj, ctx, &c, 1, &ret);
+	return ret;
+}
+
+/**
+* Compact Aho-Corasick read block of characters from the stream function (with the context of the object)
+*
+* @param obj    The cac object
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void cac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	cac_ctx_read_block(obj, &((CAC*)obj)->ctx, buf, len, out);
+}
+
+/**
+* Compact Aho-Corasick read next char in the stream function (with the context of the object)
+*
+* @param obj    The cac object
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t cac_read_char(void* obj, char c) {
+	pattern_id_t ret;
+	cac_ctx_read_block(obj, &((CAC*)obj)->ctx, &c, 1, &ret);
+	return ret;
+}
+
+/**
+* Compact Aho-Corasick get total memory function.
+*
+* @param obj     The cac object
+*
+* @return        The total memory used for this object
+*/
+size_t cac_total_mem(void* obj) {
+	if (obj == NULL) return 0;
+	CAC* cac = (CAC*)obj;
+	if (cac->mapped) {
+		return sizeof(CAC) +
+		       cac->n_states * cac->row_size * cac->entry_size +  // for the table (in the cache file mapping)
+		       cac->n_states * cac->entry_size +                  // for the failure states (in the mapping)
+		       arena_total_mem(&cac->mem);                        // for the outputs
+	}
+	return sizeof(CAC) + arena_total_mem(&cac->mem); // the table, the failure states and the outputs
+}
+
+/**
+* Compact Aho-Corasick reset function (reset the object back to initial state)
+*
+* @param obj    The cac object
+*/
+void cac_reset(void* obj) {
+	cac_reset_context(obj, &((CAC*)obj)->ctx);
+}
+
+/**
+* Create new context for the compiled cac object (the state of a single stream)
+*
+* @param obj    The cac object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* cac_new_context(void* obj) {
+	CACContext* ctx = (CACContext*)malloc(sizeof(CACContext));
+	if (ctx == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	cac_reset_context(obj, ctx);
+	return (void*)ctx;
+}
+
+/**
+* Reset a context of the cac object back to the initial state
+*
+* @param obj    The cac object
+* @param ctx    The context to reset
+*/
+void cac_reset_context(void* obj, void* ctx) {
+	(void)obj;
+	((CACContext*)ctx)->current_state = 0;
+}
+
+/**
+* Get the memory used for a context of the cac object
+*
+* @param obj    The cac object
+* @param ctx    The context
+*
+* @return       The memory used for the context (in bytes)
+*/
+size_t cac_context_mem(void* obj, void* ctx) {
+	(void)obj;
+	(void)ctx;
+	return sizeof(CACContext);
+}
+
+/**
+* Free a context of the cac object
+*
+* @param obj    The cac object
+* @param ctx    The context to free
+*/
+void cac_free_context(void* obj, void* ctx) {
+	(void)obj;
+	free(ctx);
+}
+
+/**
+* Free the memory of the cac object (must be done after compilation).
+*
+* @param obj    The cac object to free
+*/
+void cac_free(void *obj) {
+	CAC *cac = (CAC*)obj;
+	arena_free(&cac->build);
+	arena_free(&cac->mem);
+	free(cac);
+}
+
+/**
+* Save the compiled cac object to the cache file
+*
+* @param obj    The cac object
+* @param w      The cache writer
+*/
+void cac_save(void* obj, CacheWriter* w) {
+	CAC *cac = (CAC*)obj;
+	uint64_t sizes[4] = {cac->n_classes, cac->row_size, cac->entry_size, cac->n_states};
+	cache_write(w, sizes, sizeof(sizes));
+	cache_write(w, cac->classes, sizeof(cac->classes));
+	cache_write_align(w);
+	cache_write(w, cac->table, cac->n_states * cac->row_size * cac->entry_size);
+	cache_write_align(w);
+	cache_write(w, cac->failure, cac->n_states * cac->entry_size);
+	cache_write_ids(w, cac->outputs, cac->n_states);
+}
+
+/**
+* Load the cac object (saved with cac_save) from the cache file
+*
+* @param obj    The newly created cac object
+* @param r      The cache reader
+*/
+void cac_load(void* obj, CacheReader* r) {
+	CAC *cac = (CAC*)obj;
+	const uint64_t* sizes = (const uint64_t*)cache_read(r, 4 * sizeof(uint64_t));
+
+	arena_free(&cac->build);
+	cac->n_classes = sizes[0];
+	cac->row_size = sizes[1];
+	cac->entry_size = sizes[2];
+	cac->n_states = sizes[3];
+	memcpy(cac->classes, cache_read(r, sizeof(cac->classes)), sizeof(cac->classes));
+	cache_read_align(r);
+	cac->table = (void*)cache_read(r, cac->n_states * cac->row_size * cac->entry_size);
+	cache_read_align(r);
+	cac->failure = (void*)cache_read(r, cac->n_states * cac->entry_size);
+	cac->mapped = 1;
+	cac->outputs = (pattern_id_t*)arena_alloc(&cac->mem, cac->n_states * sizeof(pattern_id_t));
+	cache_read_ids(r, cac->outputs, cac->n_states);
+}
+
+/**
+* The mps registering function of the Compact Aho-Corasick Algorithm.
+*/
+void mps_cac_register() {
+	mps_table[MPS_CAC].name = "Compact Aho-Corasick";
+	mps_table[MPS_CAC].short_name = "cac";
+	mps_table[MPS_CAC].create = cac_create;
+	mps_table[MPS_CAC].add_pattern = cac_add_pattern;
+	mps_table[MPS_CAC].compile = cac_compile;
+	mps_table[MPS_CAC].read_char = cac_read_char;
+	mps_table[MPS_CAC].read_block = cac_read_block;
+	mps_table[MPS_CAC].total_mem = cac_total_mem;
+	mps_table[MPS_CAC].reset = cac_reset;
+	mps_table[MPS_CAC].free = cac_free;
+	mps_table[MPS_CAC].save = cac_save;
+	mps_table[MPS_CAC].load = cac_load;
+	mps_table[MPS_CAC].new_context = cac_new_context;
+	mps_table[MPS_CAC].ctx_read_char = cac_ctx_read_char;
+	mps_table[MPS_CAC].ctx_read_block = cac_ctx_read_block;
+	mps_table[MPS_CAC].reset_context = cac_reset_context;
+	mps_table[MPS_CAC].context_mem = cac_context_mem;
+	mps_table[MPS_CAC].free_context = cac_free_context;
+}
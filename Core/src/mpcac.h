@@ -0,0 +1,43 @@
+/**
+* Multi-Pattern Compact Aho-Corasick algorithm
+*/
+#ifndef MPCAC_H
+#define MPCAC_H
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mps.h"
+#include "PatternsTree.h"
+#include "cache.h"
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+void* cac_create();
+void cac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
+void cac_compile(void* obj);
+pattern_id_t cac_read_char(void* obj, char c);
+void cac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
+size_t cac_total_mem(void* obj);
+void cac_reset(void* obj);
+void cac_free(void *obj);
+void cac_save(void* obj, CacheWriter* w);
+void cac_load(void* obj, CacheReader* r);
+
+void* cac_new_context(void* obj);
+pattern_id_t cac_ctx_read_char(void* obj, void* ctx, char c);
+void cac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void cac_reset_context(void* obj, void* ctx);
+size_t cac_context_mem(void* obj, void* ctx);
+void cac_free_context(void* obj, void* ctx);
+
+void mps_cac_register();
+
+#endif // MPCAC_H
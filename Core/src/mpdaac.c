@@ -0,0 +1,574 @@
+/**
+* Multi-Pattern Double-Array Aho-Corasick Algorithm implementation
+*
+* This is the same algorithm as in "mpac.c", but the trie is a double-array trie: instead of a row for every state
+* (as in "mpac.c" & "mpcac.c") or a list of children (as in "mplmac.c"), the states are slots in one array, and
+* every slot has a base and a check. The child of the state s with the column c is the slot t = base[s] + c, if
+* check[t] == s (otherwise s has no such child). The bases are chosen while compiling so the children of different
+* states don't collide, which fill the array with little empty slots, so the memory is close to the memory of a list
+* of children, while a transition is still an array lookup.
+*
+* The columns are the same as in "mpcac.c" (alphabet compression): every byte that is in some pattern has its own
+* column (from 1), and bytes of column 0 always move to the root, without looking in the array.
+*
+* The base and the check of a slot are kept together (DAEntry), since a transition reads the check of the child,
+* and the next transition reads its base, so both are usually in the same cache line.
+* The failure state and the id of the suffix link of every slot are kept in parallel arrays (indexed by the slot).
+*
+* AC_DFA (see "mpac.h") is not used here, since filling the missing children would make the array dense.
+*
+* The tree is allocated from a build arena (freed at the end of compilation), and the compiled arrays from
+* the persistent arena of the object (see "arena.h"). The array and the failure states contain no pointers, so when
+* loading from the cache file they are used directly from the mapping of the cache file.
+*/
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mpdaac.h"
+#include "arena.h"
+#include "cache.h"
+#include <stdint.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+#define CACHE_LINE_SIZE 64
+
+// The check of a slot that is not a state
+#define DAAC_EMPTY UINT32_MAX
+
+// A node in the Aho-Corasick tree (used before daac compilation)
+typedef struct tree_node {
+	struct tree_node *children[256];
+	pattern_id_t id;
+	uint32_t slot;      // the slot of the node in the array (set while compiling)
+} TreeNode;
+
+// A slot in the double array
+typedef struct {
+	uint32_t base;      // the children of the state in this slot are in base + column
+	uint32_t check;     // the parent of the state in this slot (DAAC_EMPTY if the slot is not a state)
+} DAEntry;
+
+// The stream state of the daac object (a context of a single stream)
+typedef struct {
+	size_t current_state;
+} DAACContext;
+
+typedef struct {
+	TreeNode      *root;         // Aho-Corasick tree for before compilation
+	DAEntry       *array;        // the double array for after compilation (n_slots entries)
+	uint32_t      *failure;      // the failure state of every slot
+	pattern_id_t  *outputs;      // the id of the suffix link of every slot
+	uint16_t       classes[256]; // the column of every byte (0 for bytes that are in no pattern)
+	size_t         n_classes;    // the number of columns
+	size_t         n_states;
+	size_t         n_slots;      // the number of slots in the array (states and empty slots)
+	DAACContext    ctx;          // the context used by daac_read_char & daac_read_block
+	int            mapped;       // whether the array and failure are in the mapping of the cache file
+	Arena          build;        // arena for the tree (freed at the end of compilation)
+	Arena          mem;          // arena for the array, the failure states and the outputs
+} DAAC;
+
+// The double array while it is built (grows as the bases are chosen)
+typedef struct {
+	DAEntry  *array;
+	size_t    size;          // the number of allocated slots
+	size_t    used;          // all the slots from used are free
+	size_t    first_free;    // all the slots before first_free are states
+} DABuilder;
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Give a column to every byte that is in some pattern
+*
+* Before compilation, classes[c] is non-zero only for bytes that are in some pattern,
+* and after this function classes[c] is the column of c (from 1).
+*
+* @param daac   The daac object
+*/
+static void assign_classes(DAAC* daac) {
+	size_t i;
+	daac->n_classes = 0;
+	for (i = 0; i < 256; ++i) {
+		if (daac->classes[i]) {
+			daac->classes[i] = (uint16_t)++daac->n_classes;
+		}
+	}
+}
+
+/**
+* Make sure the builder has the slots up to (not including) size, new slots are free
+*
+* @param b      The builder
+* @param size   The number of slots needed
+*/
+static void builder_reserve(DABuilder* b, size_t size) {
+	size_t i, new_size = b->size ? b->size : 1024;
+	if (size <= b->size) return;
+	while (new_size < size) new_size <<= 1;
+	b->array = (DAEntry*)realloc(b->array, new_size * sizeof(DAEntry));
+	if (b->array == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = b->size; i < new_size; ++i) {
+		b->array[i].base = 0;
+		b->array[i].check = DAAC_EMPTY;
+	}
+	b->size = new_size;
+}
+
+/**
+* Find a base for the children of a node, so all the children are in free slots
+*
+* The first child goes to the first free slot that leaves room for all the others (first fit).
+*
+* @param b        The builder
+* @param cols     The columns of the children of the node (increasing)
+* @param n_cols   The number of children (at least 1)
+*
+* @return         The base
+*/
+static size_t builder_find_base(DABuilder* b, const size_t* cols, size_t n_cols) {
+	size_t pos, base, j;
+	for (pos = b->first_free > cols[0] ? b->first_free : cols[0]; ; ++pos) {
+		builder_reserve(b, pos + cols[n_cols - 1] + 1);
+		if (b->array[pos].check != DAAC_EMPTY) continue;
+		base = pos - cols[0];
+		for (j = 1; j < n_cols && b->array[base + cols[j]].check == DAAC_EMPTY; ++j);
+		if (j == n_cols) return base;
+	}
+}
+
+/**
+* Put the tree in the double array
+*
+* Go over the nodes in BFS order, and put the children of every node in the slots of a base chosen for it.
+* The nodes are put in nodes in BFS order (so the failure links can be added in the same order).
+*
+* @param daac    The daac object
+* @param b       The builder
+* @param nodes   Array of n_states elements, to put the tree nodes in BFS order
+*/
+static void convert_tree_to_array(DAAC* daac, DABuilder* b, TreeNode** nodes) {
+	size_t head = 0, tail = 1, i, n_cols, base;
+	size_t cols[256];
+	TreeNode* node;
+
+	builder_reserve(b, 1);
+	b->array[0].check = 0; // the root (no child can be in slot 0, since the columns start from 1)
+	b->first_free = 1;
+	b->used = 1;
+	daac->root->slot = 0;
+	nodes[0] = daac->root;
+	while (head < tail) {
+		node = nodes[head++];
+		n_cols = 0;
+		for (i = 0; i < 256; ++i) {
+			if (node->children[i]) cols[n_cols++] = daac->classes[i];
+		}
+		if (n_cols == 0) continue;
+		base = builder_find_base(b, cols, n_cols);
+		b->array[node->slot].base = (uint32_t)base;
+		for (i = 0; i < 256; ++i) {
+			if (node->children[i]) {
+				node->children[i]->slot = (uint32_t)(base + daac->classes[i]);
+				b->array[node->children[i]->slot].check = node->slot;
+				nodes[tail++] = node->children[i];
+			}
+		}
+		if (base + cols[n_cols - 1] + 1 > b->used) b->used = base + cols[n_cols - 1] + 1;
+		while (b->first_free < b->size && b->array[b->first_free].check != DAAC_EMPTY) ++b->first_free;
+	}
+}
+
+/**
+* Get the child of a state in the double array
+*
+* @param array   The double array
+* @param state   The state
+* @param col     The column of the child (from 1)
+*
+* @return        The slot of the child, or 0 if the state has no such child
+*/
+static inline size_t get_child(const DAEntry* array, size_t state, size_t col) {
+	size_t t = array[state].base + col;
+	return array[t].check == state ? t : 0;
+}
+
+/**
+* Add failure links to the double array (and set outputs to be the id of the suffix link)
+*
+* The nodes are in BFS order, so the failure state of a node (and so its suffix link) is always handled
+* before the node itself.
+*
+* @param daac    The daac object
+* @param nodes   The tree nodes in BFS order
+*/
+static void add_failure_links(DAAC* daac, TreeNode** nodes) {
+	size_t i, c, fs, child;
+	TreeNode *node, *next;
+
+	daac->failure[0] = 0;
+	daac->outputs[0] = daac->root->id;
+	for (i = 0; i < daac->n_states; ++i) {
+		node = nodes[i];
+		for (c = 0; c < 256; ++c) {
+			if (!(next = node->children[c])) continue;
+			if (i == 0) {
+				fs = 0;
+			} else {
+				fs = daac->failure[node->slot];
+				while (fs && !get_child(daac->array, fs, daac->classes[c])) {
+					fs = daac->failure[fs];
+				}
+				fs = get_child(daac->array, fs, daac->classes[c]);
+			}
+			child = next->slot;
+			daac->failure[child] = (uint32_t)fs;
+			daac->outputs[child] = next->id != null_pattern_id ? next->id : daac->outputs[fs];
+		}
+	}
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Create new DAAC struct
+*
+* @return     A new dynamically allocated daac object
+*/
+void* daac_create() {
+	DAAC* daac = (DAAC*)malloc(sizeof(DAAC));
+	if (daac == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memset(daac, 0, sizeof(DAAC));
+	TreeNode* root = (TreeNode*)arena_calloc(&daac->build, sizeof(TreeNode));
+	root->id = null_pattern_id;
+	daac->root = root;
+	daac->n_states = 1;
+	return (void*)daac;
+}
+
+/**
+* Add pattern to the daac object
+*
+* Add the pattern to the Aho-Corasick tree, create all midway states, and mark the bytes of the pattern as used.
+*
+* @param obj      The daac object
+* @param pat      The pattern to add
+* @param len      The length of the pattern
+* @param id       The id of the pattern
+*/
+void daac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
+	DAAC *daac = (DAAC*)obj;
+	TreeNode *cur = daac->root, *next;
+	size_t i = 0;
+	while (i < len && cur->children[(unsigned char)pat[i]]) {
+		cur = cur->children[(unsigned char)pat[i++]];
+	}
+	for (; i < len; ++i) {
+		next = (TreeNode*)arena_calloc(&daac->build, sizeof(TreeNode));
+		next->id = null_pattern_id;
+		cur->children[(unsigned char)pat[i]] = next;
+		daac->classes[(unsigned char)pat[i]] = 1;
+		cur = next;
+		daac->n_states++;
+	}
+	cur->id = id;
+}
+
+/**
+* Compile the Double-Array Aho-Corasick object.
+*
+* Put the Aho-Corasick tree in the double array, and add failure links.
+* The array is padded with empty slots so base + column is inside it for every state and column.
+*
+* @param obj     The daac object
+*/
+void daac_compile(void* obj) {
+	DAAC *daac = (DAAC*)obj;
+	TreeNode** nodes = (TreeNode**)arena_alloc(&daac->build, daac->n_states * sizeof(TreeNode*));
+	DABuilder b;
+	size_t i;
+
+	memset(&b, 0, sizeof(b));
+	assign_classes(daac);
+	convert_tree_to_array(daac, &b, nodes);
+
+	// every base is below used, so base + column is below used + n_classes
+	daac->n_slots = b.used + daac->n_classes + 1;
+	builder_reserve(&b, daac->n_slots);
+	daac->array = (DAEntry*)arena_alloc_aligned(&daac->mem, daac->n_slots * sizeof(DAEntry), CACHE_LINE_SIZE);
+	memcpy(daac->array, b.array, daac->n_slots * sizeof(DAEntry));
+	free(b.array);
+	daac->failure = (uint32_t*)arena_alloc(&daac->mem, daac->n_slots * sizeof(uint32_t));
+	daac->outputs = (pattern_id_t*)arena_alloc(&daac->mem, daac->n_slots * sizeof(pattern_id_t));
+	for (i = 0; i < daac->n_slots; ++i) {
+		daac->failure[i] = 0;
+		daac->outputs[i] = null_pattern_id;
+	}
+
+	add_failure_links(daac, nodes);
+	daac->root = NULL;
+	arena_free(&daac->build);
+}
+
+/**
+* Double-Array Aho-Corasick read block of characters from the stream function.
+*
+* Bytes of column 0 are not in any pattern, so they always move to the root.
+*
+* @param obj    The daac object
+* @param ctx    The context of the stream
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void daac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	DAAC *daac = (DAAC*)obj;
+	DAACContext *context = (DAACContext*)ctx;
+	size_t i, col, next, current_state = context->current_state;
+	const DAEntry* array = daac->array;
+	const uint32_t* failure = daac->failure;
+	const uint16_t* classes = daac->classes;
+	pattern_id_t* outputs = daac->outputs;
+	for (i = 0; i < len; ++i) {
+		col = classes[(unsigned char)buf[i]];
+		if (!col) {
+			current_state = 0;
+		} else {
+			while (1) {
+				next = array[current_state].base + col;
+				if (array[next].check == current_state) {
+					current_state = next;
+					break;
+				}
+				if (!current_state) break;
+				current_state = failure[current_state];
+			}
+		}
+		out[i] = outputs[current_state];
+	}
+	context->current_state = current_state;
+}
+
+/**
+* Double-Array Aho-Corasick read next char in the stream function.
+*
+* @param obj    The daac object
+* @param ctx    The context of the stream
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t daac_ctx_read_char(void* obj, void* ctx, char c) {
+	pattern_id_t ret;
+	daac_ctx_read_block(obj, ctx, &c, 1, &ret);
+	return ret;
+}
+
+/**
+* Double-Array Aho-Corasick read block of characters from the stream function (with the context of the object)
+*
+* @param obj    The daac object
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void daac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	daac_ctx_read_block(obj, &((DAAC*)obj)->ctx, buf, len, out);
+}
+
+/**
+* Double-Array Aho-Corasick read next char in the stream function (with the context of the object)
+*
+* @param obj    The daac object
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t daac_read_char(void* obj, char c) {
+	pattern_id_t ret;
+	daac_ctx_read_block(obj, &((DAAC*)obj)->ctx, &c, 1, &ret);
+	return ret;
+}
+
+/**
+* Double-Array Aho-Corasick get total memory function.
+*
+* @param obj     The daac object
+*
+* @return        The total memory used for this object
+*/
+size_t daac_total_mem(void* obj) {
+	if (obj == NULL) return 0;
+	DAAC* daac = (DAAC*)obj;
+	if (daac->mapped) {
+		return sizeof(DAAC) +
+		       daac->n_slots * sizeof(DAEntry) +    // for the array (in the cache file mapping)
+		       daac->n_slots * sizeof(uint32_t) +   // for the failure states (in the mapping)
+		       arena_total_mem(&daac->mem);         // for the outputs
+	}
+	return sizeof(DAAC) + arena_total_mem(&daac->mem); // the array, the failure states and the outputs
+}
+
+/**
+* Double-Array Aho-Corasick reset function (reset the object back to initial state)
+*
+* @param obj    The daac object
+*/
+void daac_reset(void* obj) {
+	daac_reset_context(obj, &((DAAC*)obj)->ctx);
+}
+
+/**
+* Create new context for the compiled daac object (the state of a single stream)
+*
+* @param obj    The daac object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* daac_new_context(void* obj) {
+	DAACContext* ctx = (DAACContext*)malloc(sizeof(DAACContext));
+	if (ctx == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	daac_reset_context(obj, ctx);
+	return (void*)ctx;
+}
+
+/**
+* Reset a context of the daac object back to the initial state
+*
+* @param obj    The daac object
+* @param ctx    The context to reset
+*/
+void daac_reset_context(void* obj, void* ctx) {
+	(void)obj;
+	((DAACContext*)ctx)->current_state = 0;
+}
+
+/**
+* Get the memory used for a context of the daac object
+*
+* @param obj    The daac object
+* @param ctx    The context
+*
+* @return       The memory used for the context (in bytes)
+*/
+size_t daac_context_mem(void* obj, void* ctx) {
+	(void)obj;
+	(void)ctx;
+	return sizeof(DAACContext);
+}
+
+/**
+* Free a context of the daac object
+*
+* @param obj    The daac object
+* @param ctx    The context to free
+*/
+void daac_free_context(void* obj, void* ctx) {
+	(void)obj;
+	free(ctx);
+}
+
+/**
+* Free the memory of the daac object (must be done after compilation).
+*
+* @param obj    The daac object to free
+*/
+void daac_free(void *obj) {
+	DAAC *daac = (DAAC*)obj;
+	arena_free(&daac->build);
+	arena_free(&daac->mem);
+	free(daac);
+}
+
+/**
+* Save the compiled daac object to the cache file
+*
+* @param obj    The daac object
+* @param w      The cache writer
+*/
+void daac_save(void* obj, CacheWriter* w) {
+	DAAC *daac = (DAAC*)obj;
+	uint64_t sizes[3] = {daac->n_classes, daac->n_states, daac->n_slots};
+	cache_write(w, sizes, sizeof(sizes));
+	cache_write(w, daac->classes, sizeof(daac->classes));
+	cache_write_align(w);
+	cache_write(w, daac->array, daac->n_slots * sizeof(DAEntry));
+	cache_write_align(w);
+	cache_write(w, daac->failure, daac->n_slots * sizeof(uint32_t));
+	cache_write_ids(w, daac->outputs, daac->n_slots);
+}
+
+/**
+* Load the daac object (saved with daac_save) from the cache file
+*
+* @param obj    The newly created daac object
+* @param r      The cache reader
+*/
+void daac_load(void* obj, CacheReader* r) {
+	DAAC *daac = (DAAC*)obj;
+	const uint64_t* sizes = (const uint64_t*)cache_read(r, 3 * sizeof(uint64_t));
+
+	arena_free(&daac->build);
+	daac->root = NULL;
+	daac->n_classes = sizes[0];
+	daac->n_states = sizes[1];
+	daac->n_slots = sizes[2];
+	memcpy(daac->classes, cache_read(r, sizeof(daac->classes)), sizeof(daac->classes));
+	cache_read_align(r);
+	daac->array = (DAEntry*)cache_read(r, daac->n_slots * sizeof(DAEntry));
+	cache_read_align(r);
+	daac->failure = (uint32_t*)cache_read(r, daac->n_slots * sizeof(uint32_t));
+	daac->mapped = 1;
+	daac->outputs = (pattern_id_t*)arena_alloc(&daac->mem, daac->n_slots * sizeof(pattern_id_t));
+	cache_read_ids(r, daac->outputs, daac->n_slots);
+}
+
+/**
+* The mps registering function of the Double-Array Aho-Corasick Algorithm.
+*/
+void mps_daac_register() {
+	mps_table[MPS_DAAC].name = "Double-Array Aho-Corasick";
+	mps_table[MPS_DAAC].short_name = "daac";
+	mps_table[MPS_DAAC].create = daac_create;
+	mps_table[MPS_DAAC].add_pattern = daac_add_pattern;
+	mps_table[MPS_DAAC].compile = daac_compile;
+	mps_table[MPS_DAAC].read_char = daac_read_char;
+	mps_table[MPS_DAAC].read_block = daac_read_block;
+	mps_table[MPS_DAAC].total_mem = daac_total_mem;
+	mps_table[MPS_DAAC].reset = daac_reset;
+	mps_table[MPS_DAAC].free = daac_free;
+	mps_table[MPS_DAAC].save = daac_save;
+	mps_table[MPS_DAAC].load = daac_load;
+	mps_table[MPS_DAAC].new_context = daac_new_context;
+	mps_table[MPS_DAAC].ctx_read_char = daac_ctx_read_char;
+	mps_table[MPS_DAAC].ctx_read_block = daac_ctx_read_block;
+	mps_table[MPS_DAAC].reset_context = daac_reset_context;
+	mps_table[MPS_DAAC].context_mem = daac_context_mem;
+	mps_table[MPS_DAAC].free_context = daac_free_context;
+}
@@ -0,0 +1,43 @@
+/**
+* Multi-Pattern Double-Array Aho-Corasick algorithm
+*/
+#ifndef MPDAAC_H
+#define MPDAAC_H
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mps.h"
+#include "PatternsTree.h"
+#include "cache.h"
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+void* daac_create();
+void daac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
+void daac_compile(void* obj);
+pattern_id_t daac_read_char(void* obj, char c);
+void daac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
+size_t daac_total_mem(void* obj);
+void daac_reset(void* obj);
+void daac_free(void *obj);
+void daac_save(void* obj, CacheWriter* w);
+void daac_load(void* obj, CacheReader* r);
+
+void* daac_new_context(void* obj);
+pattern_id_t daac_ctx_read_char(void* obj, void* ctx, char c);
+void daac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void daac_reset_context(void* obj, void* ctx);
+size_t daac_context_mem(void* obj, void* ctx);
+void daac_free_context(void* obj, void* ctx);
+
+void mps_daac_register();
+
+#endif // MPDAAC_H
@@ -0,0 +1,435 @@
+/**
+* Multi-Pattern Hybrid Algorithm implementation
+*
+* The Aho-Corasick algorithms are fast, but their memory grows with the total length of the patterns, while the
+* memory of Breslauer-Galil is O(log n) per pattern (but it reads every long pattern on every character).
+* So the patterns up to HYBRID_AC_MAX_LENGTH are put in a Compact Aho-Corasick (HYBRID_SHORT_ALGO), and the longer
+* patterns, where most of the memory of Aho-Corasick goes, in a Breslauer-Galil algorithm (HYBRID_LONG_ALGO, by default
+* the Shared-Fingerprint Breslauer-Galil, which reads a fingerprint per length instead of per pattern).
+*
+* Both algorithms read every character, and the longest match is the match of the pattern deeper in the
+* patterns tree: the two matches end at the same character, so one is a suffix of the other, which means it is its
+* ancestor in the patterns tree (and the long algorithm has the longer patterns, so its match wins whenever it has one).
+*
+* The two algorithms are used through mps_table, so a context is a context of each of them, and the object is saved
+* to the cache file with the "save" functions of both (every algorithm with contexts has one).
+*/
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mphybrid.h"
+#include <string.h>
+
+
+/******************************************************************************************************
+*		DEFINITIONS
+******************************************************************************************************/
+
+
+/**
+* struct for a context of hybrid object (the state of a single stream)
+*/
+typedef struct {
+	void          *shorts;        // the context of the short patterns object
+	void          *longs;         // the context of the long patterns object
+	pattern_id_t  *long_out;      // buffer for the results of the long patterns on a block
+	size_t         long_out_size; // the number of elements allocated in long_out
+} HybridContext;
+
+/**
+* struct for hybrid object
+*/
+typedef struct {
+	int            short_algo;    // the algorithm of the short patterns (HYBRID_SHORT_ALGO, or set with "short=NAME")
+	int            long_algo;     // the algorithm of the long patterns (HYBRID_LONG_ALGO, or set with "long=NAME")
+	size_t         max_short;     // the longest short pattern (HYBRID_AC_MAX_LENGTH, or set with "max_short=N")
+	void          *shorts;        // the object of the short patterns (created with the first pattern)
+	void          *longs;         // the object of the long patterns (created with the first pattern)
+	size_t         n_longs;       // the number of long patterns (the long object isn't read if there are none)
+	pattern_id_t  *long_out;      // the long_out buffer of the object itself (read with the contexts of the objects)
+	size_t         long_out_size;
+} Hybrid;
+
+
+/******************************************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************************************/
+
+
+/**
+* Create the objects of the two algorithms (if they weren't created yet)
+*
+* They are created only when the first pattern is added (or on compile), after the parameters are set,
+* so setting the algorithms doesn't need to free objects.
+*
+* @param hybrid   The hybrid object
+*/
+static void hybrid_create_objects(Hybrid* hybrid) {
+	if (hybrid->shorts) return;
+	hybrid->shorts = mps_table[hybrid->short_algo].create();
+	hybrid->longs = mps_table[hybrid->long_algo].create();
+}
+
+/**
+* Get the longest of two matches on the same character (one of them may be null_pattern_id)
+*
+* @param a      A match
+* @param b      Another match
+*
+* @return       The match of the pattern deeper in the patterns tree
+*/
+static inline pattern_id_t hybrid_longest(pattern_id_t a, pattern_id_t b) {
+	if (a == null_pattern_id) return b;
+	if (b == null_pattern_id) return a;
+	return b->depth > a->depth ? b : a;
+}
+
+/**
+* Make sure a results buffer has room for a block
+*
+* @param out    The buffer
+* @param size   The number of elements allocated in the buffer
+* @param len    The length of the block
+*/
+static void hybrid_reserve(pattern_id_t** out, size_t* size, size_t len) {
+	if (*size >= len) return;
+	free(*out);
+	*out = (pattern_id_t*) malloc(len * sizeof(pattern_id_t));
+	if (*out == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	*size = len;
+}
+
+/**
+* Read a block with an algorithm, with a context or with the context of its object
+*
+* @param mps    The algorithm
+* @param obj    The object
+* @param ctx    The context (NULL for the context of the object)
+* @param buf    The block
+* @param len    The length of the block
+* @param out    The results
+*/
+static void hybrid_read_part(MpsElem* mps, void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	size_t j;
+	if (ctx) {
+		mps->ctx_read_block(obj, ctx, buf, len, out);
+	} else if (mps->read_block) {
+		mps->read_block(obj, buf, len, out);
+	} else {
+		for (j = 0; j < len; ++j) out[j] = mps->read_char(obj, buf[j]);
+	}
+}
+
+/**
+* Read a block with both algorithms and merge the results
+*
+* @param hybrid   The hybrid object
+* @param shorts   The context of the short patterns (NULL for the context of the object)
+* @param longs    The context of the long patterns (NULL for the context of the object)
+* @param long_out The buffer for the results of the long patterns
+* @param size     The number of elements allocated in long_out
+* @param buf      The block
+* @param len      The length of the block
+* @param out      Where to put the id of the longest pattern matched on every character
+*/
+static void hybrid_read(Hybrid* hybrid, void* shorts, void* longs, pattern_id_t** long_out, size_t* size,
+                        const char* buf, size_t len, pattern_id_t* out) {
+	size_t j;
+	pattern_id_t* lo;
+
+	hybrid_read_part(&mps_table[hybrid->short_algo], hybrid->shorts, shorts, buf, len, out);
+	if (hybrid->n_longs == 0) return;
+	hybrid_reserve(long_out, size, len);
+	lo = *long_out;
+	hybrid_read_part(&mps_table[hybrid->long_algo], hybrid->longs, longs, buf, len, lo);
+	for (j = 0; j < len; ++j) {
+		out[j] = hybrid_longest(out[j], lo[j]);
+	}
+}
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+/**
+* Create the hybrid object
+*/
+void* hybrid_create() {
+	Hybrid* hybrid = (Hybrid*) malloc(sizeof(Hybrid));
+	if (hybrid == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memset(hybrid, 0, sizeof(Hybrid));
+	hybrid->short_algo = HYBRID_SHORT_ALGO;
+	hybrid->long_algo = HYBRID_LONG_ALGO;
+	hybrid->max_short = HYBRID_AC_MAX_LENGTH;
+	return (void*)hybrid;
+}
+
+/**
+* Set a parameter of a new hybrid object (before any pattern was added)
+*
+* "max_short=N" sets the longest short pattern (at least BG_SHORT_PATTERN_LENGTH), and "short=NAME" & "long=NAME"
+* set the algorithms of the short & long patterns (by their names in the command line, algorithms with contexts).
+*
+* @param obj      The hybrid object
+* @param key      The name of the parameter
+* @param val      The value of the parameter
+*
+* @return         0 on success, -1 if the parameter isn't valid
+*/
+int hybrid_set_param(void* obj, const char* key, const char* val) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	size_t n;
+	int algo;
+	if (strcmp(key, "max_short") == 0) {
+		if (mps_parse_size(val, &n) != 0 || n < BG_SHORT_PATTERN_LENGTH) return -1;
+		hybrid->max_short = n;
+		return 0;
+	}
+	if (strcmp(key, "short") != 0 && strcmp(key, "long") != 0) return -1;
+	algo = mps_find_algo(val);
+	if (algo == MPS_NONE || algo == MPS_HYBRID || mps_table[algo].new_context == NULL) return -1;
+	if (key[0] == 's') {
+		hybrid->short_algo = algo;
+	} else {
+		hybrid->long_algo = algo;
+	}
+	return 0;
+}
+
+/**
+* Add pattern to the hybrid object (to the short or to the long algorithm, by its length)
+*
+* @param obj      The hybrid object
+* @param pat      The pattern to add
+* @param len      The length of the pattern
+* @param id       The id of the pattern
+*/
+void hybrid_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	hybrid_create_objects(hybrid);
+	if (len <= hybrid->max_short) {
+		mps_table[hybrid->short_algo].add_pattern(hybrid->shorts, pat, len, id);
+	} else {
+		mps_table[hybrid->long_algo].add_pattern(hybrid->longs, pat, len, id);
+		hybrid->n_longs++;
+	}
+}
+
+/**
+* Compile the hybrid object (both algorithms)
+*
+* @param obj      The hybrid object
+*/
+void hybrid_compile(void* obj) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	hybrid_create_objects(hybrid);
+	mps_table[hybrid->short_algo].compile(hybrid->shorts);
+	mps_table[hybrid->long_algo].compile(hybrid->longs);
+}
+
+/**
+* The hybrid reading character function
+*
+* @param obj     The hybrid object
+* @param c       The char arrived from the stream
+*
+* @return        The id of the longest pattern matched
+*/
+pattern_id_t hybrid_read_char(void* obj, char c) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	pattern_id_t ret = mps_table[hybrid->short_algo].read_char(hybrid->shorts, c);
+	if (hybrid->n_longs == 0) return ret;
+	return hybrid_longest(ret, mps_table[hybrid->long_algo].read_char(hybrid->longs, c));
+}
+
+/**
+* The hybrid reading block of characters function
+*
+* @param obj     The hybrid object
+* @param buf     The block of characters from the stream
+* @param len     The length of the block
+* @param out     Where to put the id of the longest pattern matched on every character
+*/
+void hybrid_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	hybrid_read(hybrid, NULL, NULL, &hybrid->long_out, &hybrid->long_out_size, buf, len, out);
+}
+
+/**
+* The hybrid total memory function
+*
+* @param obj    The hybrid object
+*
+* @return       The total memory allocated for this object
+*/
+size_t hybrid_total_mem(void* obj) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	return sizeof(Hybrid) + hybrid->long_out_size * sizeof(pattern_id_t) +
+	       mps_table[hybrid->short_algo].total_mem(hybrid->shorts) +
+	       mps_table[hybrid->long_algo].total_mem(hybrid->longs);
+}
+
+/**
+* The hybrid reset function (returning to initial state)
+*
+* @param obj    The hybrid object
+*/
+void hybrid_reset(void* obj) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	mps_table[hybrid->short_algo].reset(hybrid->shorts);
+	mps_table[hybrid->long_algo].reset(hybrid->longs);
+}
+
+/**
+* Free the hybrid object (should be called AFTER compilation using hybrid_compile)
+*
+* @param obj    The hybrid object to free
+*/
+void hybrid_free(void* obj) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	mps_table[hybrid->short_algo].free(hybrid->shorts);
+	mps_table[hybrid->long_algo].free(hybrid->longs);
+	free(hybrid->long_out);
+	free(hybrid);
+}
+
+/**
+* Save the compiled hybrid object to the cache file (the objects of both algorithms)
+*
+* @param obj    The hybrid object
+* @param w      The cache writer
+*/
+void hybrid_save(void* obj, CacheWriter* w) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	uint64_t n_longs = hybrid->n_longs;
+	cache_write(w, &n_longs, sizeof(n_longs));
+	mps_table[hybrid->short_algo].save(hybrid->shorts, w);
+	mps_table[hybrid->long_algo].save(hybrid->longs, w);
+}
+
+/**
+* Load the hybrid object (saved with hybrid_save) from the cache file
+*
+* @param obj    The newly created hybrid object
+* @param r      The cache reader
+*/
+void hybrid_load(void* obj, CacheReader* r) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	uint64_t n_longs;
+	hybrid_create_objects(hybrid);
+	memcpy(&n_longs, cache_read(r, sizeof(n_longs)), sizeof(n_longs));
+	hybrid->n_longs = n_longs;
+	mps_table[hybrid->short_algo].load(hybrid->shorts, r);
+	mps_table[hybrid->long_algo].load(hybrid->longs, r);
+}
+
+/**
+* Create new context for the compiled hybrid object (a context of each algorithm)
+*
+* @param obj    The hybrid object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* hybrid_new_context(void* obj) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	HybridContext* ctx = (HybridContext*) malloc(sizeof(HybridContext));
+	if (ctx == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	ctx->shorts = mps_table[hybrid->short_algo].new_context(hybrid->shorts);
+	ctx->longs = mps_table[hybrid->long_algo].new_context(hybrid->longs);
+	ctx->long_out = NULL;
+	ctx->long_out_size = 0;
+	return (void*)ctx;
+}
+
+/**
+* The hybrid reading character function of a context
+*/
+pattern_id_t hybrid_ctx_read_char(void* obj, void* ctx, char c) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	HybridContext* context = (HybridContext*)ctx;
+	pattern_id_t ret = mps_table[hybrid->short_algo].ctx_read_char(hybrid->shorts, context->shorts, c);
+	if (hybrid->n_longs == 0) return ret;
+	return hybrid_longest(ret, mps_table[hybrid->long_algo].ctx_read_char(hybrid->longs, context->longs, c));
+}
+
+/**
+* The hybrid reading block of characters function of a context
+*/
+void hybrid_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	HybridContext* context = (HybridContext*)ctx;
+	hybrid_read((Hybrid*)obj, context->shorts, context->longs, &context->long_out, &context->long_out_size,
+	            buf, len, out);
+}
+
+/**
+* Reset a context of the hybrid object back to the initial state
+*/
+void hybrid_reset_context(void* obj, void* ctx) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	HybridContext* context = (HybridContext*)ctx;
+	mps_table[hybrid->short_algo].reset_context(hybrid->shorts, context->shorts);
+	mps_table[hybrid->long_algo].reset_context(hybrid->longs, context->longs);
+}
+
+/**
+* Get the memory used for a context of the hybrid object
+*/
+size_t hybrid_context_mem(void* obj, void* ctx) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	HybridContext* context = (HybridContext*)ctx;
+	return sizeof(HybridContext) + context->long_out_size * sizeof(pattern_id_t) +
+	       mps_table[hybrid->short_algo].context_mem(hybrid->shorts, context->shorts) +
+	       mps_table[hybrid->long_algo].context_mem(hybrid->longs, context->longs);
+}
+
+/**
+* Free a context of the hybrid object
+*/
+void hybrid_free_context(void* obj, void* ctx) {
+	Hybrid* hybrid = (Hybrid*)obj;
+	HybridContext* context = (HybridContext*)ctx;
+	mps_table[hybrid->short_algo].free_context(hybrid->shorts, context->shorts);
+	mps_table[hybrid->long_algo].free_context(hybrid->longs, context->longs);
+	free(context->long_out);
+	free(context);
+}
+
+/**
+* The mps registering function of the Hybrid algorithm
+*/
+void mps_hybrid_register() {
+	mps_table[MPS_HYBRID].name = "Hybrid Compact Aho-Corasick & Breslauer-Galil";
+	mps_table[MPS_HYBRID].short_name = "hybrid";
+	mps_table[MPS_HYBRID].create = hybrid_create;
+	mps_table[MPS_HYBRID].add_pattern = hybrid_add_pattern;
+	mps_table[MPS_HYBRID].compile = hybrid_compile;
+	mps_table[MPS_HYBRID].read_char = hybrid_read_char;
+	mps_table[MPS_HYBRID].read_block = hybrid_read_block;
+	mps_table[MPS_HYBRID].total_mem = hybrid_total_mem;
+	mps_table[MPS_HYBRID].reset = hybrid_reset;
+	mps_table[MPS_HYBRID].free = hybrid_free;
+	mps_table[MPS_HYBRID].save = hybrid_save;
+	mps_table[MPS_HYBRID].load = hybrid_load;
+	mps_table[MPS_HYBRID].new_context = hybrid_new_context;
+	mps_table[MPS_HYBRID].ctx_read_char = hybrid_ctx_read_char;
+	mps_table[MPS_HYBRID].ctx_read_block = hybrid_ctx_read_block;
+	mps_table[MPS_HYBRID].reset_context = hybrid_reset_context;
+	mps_table[MPS_HYBRID].context_mem = hybrid_context_mem;
+	mps_table[MPS_HYBRID].free_context = hybrid_free_context;
+	mps_table[MPS_HYBRID].set_param = hybrid_set_param;
+}
@@ -0,0 +1,71 @@
+/**
+* Multi-Pattern Hybrid algorithm (Compact Aho-Corasick for the short patterns, Breslauer-Galil for the long patterns)
+*/
+#ifndef MPHYBRID_H
+#define MPHYBRID_H
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mps.h"
+#include "PatternsTree.h"
+#include "bgps.h"
+#include "cache.h"
+
+
+/******************************************************************************************************
+*		DEFINITIONS
+******************************************************************************************************/
+
+
+// The longest pattern of the short algorithm (the longer patterns are put in the long algorithm),
+// e.g. "make CFLAGS=-DHYBRID_AC_MAX_LENGTH=32" (or for an instance, "-a hybrid:max_short=32")
+#ifndef HYBRID_AC_MAX_LENGTH
+#define HYBRID_AC_MAX_LENGTH 16
+#endif
+
+#if HYBRID_AC_MAX_LENGTH < BG_SHORT_PATTERN_LENGTH
+#error "HYBRID_AC_MAX_LENGTH must be at least BG_SHORT_PATTERN_LENGTH (shorter patterns aren't read by bg objects)"
+#endif
+
+// The algorithms of the short & the long patterns (or for an instance, "-a hybrid:short=daac,long=bg")
+#ifndef HYBRID_SHORT_ALGO
+#define HYBRID_SHORT_ALGO MPS_CAC
+#endif
+
+// e.g. "make CFLAGS=-DHYBRID_LONG_ALGO=MPS_BG"
+#ifndef HYBRID_LONG_ALGO
+#define HYBRID_LONG_ALGO MPS_SBG
+#endif
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+void* hybrid_create();
+void hybrid_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
+void hybrid_compile(void* obj);
+pattern_id_t hybrid_read_char(void* obj, char c);
+void hybrid_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
+size_t hybrid_total_mem(void* obj);
+void hybrid_reset(void* obj);
+void hybrid_free(void *obj);
+void hybrid_save(void* obj, CacheWriter* w);
+void hybrid_load(void* obj, CacheReader* r);
+
+void* hybrid_new_context(void* obj);
+pattern_id_t hybrid_ctx_read_char(void* obj, void* ctx, char c);
+void hybrid_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void hybrid_reset_context(void* obj, void* ctx);
+size_t hybrid_context_mem(void* obj, void* ctx);
+void hybrid_free_context(void* obj, void* ctx);
+int hybrid_set_param(void* obj, const char* key, const char* val);
+
+void mps_hybrid_register();
+
+#endif // MPHYBRID_H
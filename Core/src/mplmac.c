@@ -3,6 +3,21 @@
 *
 * This is basically the same file as "mpac.c" except, instead of saving the children
 * in a array of size 256, we keep a list, in which every element is a pair of (char, state)
+*
+* The lists are used only during compilation. At the end of compilation, we pack the children of all
+* the states into contiguous pools (so reading a character doesn't chase pointers between malloc'd nodes):
+*   - The root keeps all its 256 children as dense row (it is the state used the most).
+*   - State with at most LMAC_SPARSE_MAX_CHILDREN children keeps its children characters as sorted
+*     array of bytes, and its children states in the same order.
+*   - State with more children keeps a bitmap of 256 bits of its children characters, and its children states
+*     in the order of their characters, so the position of the child of c is the number of bits before c (popcount).
+*
+* AC_DFA (see "mpac.h") is not used here: even filling only the children that are not the same as the child of the
+* root takes most of the memory the lists save (on snort & et, 402MB instead of 35MB), and the longer lists are
+* slower to search than the failure links they replace.
+*
+* The tree, the children lists and the queue of the BFS are allocated from a build arena (freed at the end of
+* compilation), and the states array and the pools from the persistent arena of the object (see "arena.h").
 */
 
 
@@ -11,7 +26,10 @@
 ******************************************************************************/
 
 
-#include "mpac.h"
+#include "mplmac.h"
+#include "arena.h"
+#include "cache.h"
+#include <stdint.h>
 
 
 /******************************************************************************
@@ -48,21 +66,41 @@ typedef struct children_list {
         	  ch = node ? node->c : (char)0, \
         	  stt = node ? node->state : 0)
 
+#define LMAC_SPARSE_MAX_CHILDREN 8  // states with more children are saved with bitmap
+#define LMAC_BITMAP_SIZE         32 // the size in bytes of a bitmap of 256 bits
+
 // A state in the states array (used after ac compilation)
 typedef struct {
-	ChildrenList children;
+	union {
+		ChildrenList children; // the children list (before packing the children)
+		size_t       edges;    // the position of the first child in edge_states (after packing the children)
+	};
 	size_t failure_state;
-	size_t suffix_link;
+	pattern_id_t suffix_id; // the id of the suffix link
 	pattern_id_t id;
+	uint32_t chars;         // the position of the children chars (or bitmap) in edge_chars (after packing)
+	uint16_t n_children;    // the number of children (after packing)
 } State;
 
+// The stream state of the ac object (a context of a single stream)
+typedef struct {
+	size_t current_state;
+} ACContext;
+
 typedef struct {
 	union {
 		TreeNode *root;   // Aho-Corasick tree for before compilation
 		State    *states; // states array for after compilation
 	};
 	size_t n_states;
-	size_t current_state;
+	ACContext      ctx;                // the context used by lmac_read_char & lmac_read_block
+	size_t         root_children[256]; // the children of the root (dense row)
+	size_t        *edge_states;        // the pool of the children states of all the states
+	unsigned char *edge_chars;         // the pool of the children chars (or bitmaps) of all the states
+	size_t         n_edges;            // the number of elements in edge_states
+	size_t         chars_size;         // the size of edge_chars
+	Arena          build;              // arena for the tree and the children lists (freed at the end of compilation)
+	Arena          mem;                // arena for the states array and the pools
 } AC;
 
 typedef struct qnode {
@@ -72,6 +110,8 @@ typedef struct qnode {
 
 typedef struct queue {
 	QNode *head, *tail;
+	QNode *free_nodes; // the nodes that were popped (reused by queue_add)
+	Arena *arena;      // the arena to allocate the nodes from
 } Queue;
 
 
@@ -87,11 +127,13 @@ static void _print_states(AC* ac);
 /**
 * Create new queue
 *
-* @return    A new dynamically allocated queue
+* @param arena  The arena to allocate the queue and its nodes from
+*
+* @return    A new queue (allocated from the arena)
 */
-static inline Queue* queue_create() {
-	Queue *q = (Queue*)malloc(sizeof(Queue));
-	memset(q, 0, sizeof(Queue));
+static inline Queue* queue_create(Arena* arena) {
+	Queue *q = (Queue*)arena_calloc(arena, sizeof(Queue));
+	q->arena = arena;
 	return q;
 }
 
@@ -102,7 +144,12 @@ static inline Queue* queue_create() {
 * @param state  The state to add
 */
 static inline void queue_add(Queue* q, size_t state) {
-	QNode *node = (QNode*)malloc(sizeof(QNode));
+	QNode *node = q->free_nodes;
+	if (node) {
+		q->free_nodes = node->next;
+	} else {
+		node = (QNode*)arena_alloc(q->arena, sizeof(QNode));
+	}
 	node->next = NULL;
 	node->state = state;
 	if (q->tail) {
@@ -126,7 +173,8 @@ static inline size_t queue_pop(Queue* q) {
 	size_t state = temp->state;
 	q->head = temp->next;
 	if (!q->head) q->tail = NULL;
-	free(temp);
+	temp->next = q->free_nodes;
+	q->free_nodes = temp;
 	return state;
 }
 
@@ -141,44 +189,22 @@ static inline int queue_not_empty(Queue* q) {
 	return q->head ? 1 : 0;
 }
 
-/**
-* Free the queue
-*
-* @param q     The queue to free
-*/
-static inline void queue_free(Queue* q) {
-	free(q);
-}
-
 /**
 * Add a pair of (char, state) to the children list
 *
+* @param arena     The arena to allocate the list node from
 * @param list      Pointer to the children list
 * @param c         The character of that child from the parent
 * @param state     The child state (index in states array)
 */
-static inline void children_list_add(ChildrenList* list, char c, size_t state) {
-	ChildrenListNode* node = (ChildrenListNode*)malloc(sizeof(ChildrenListNode));
+static inline void children_list_add(Arena* arena, ChildrenList* list, char c, size_t state) {
+	ChildrenListNode* node = (ChildrenListNode*)arena_alloc(arena, sizeof(ChildrenListNode));
 	node->next = list->head;
 	node->c = c;
 	node->state = state;
 	list->head = node;
 }
 
-/**
-* Free a children list
-*
-* @param list     The children list to free
-*/
-static inline void free_children_list(ChildrenList* list) {
-	ChildrenListNode *cur = list->head, *next;
-	while (cur) {
-		next = cur->next;
-		free(cur);
-		cur = next;
-	}
-}
-
 /**
 * Find the child state with the given char
 * 
@@ -210,6 +236,27 @@ static inline size_t find_child_from_index(State* states, size_t index, char c)
 	return find_child(&states[index].children, c);
 }
 
+/**
+* Find the next state from a state and a character (the state to move to after reading the character),
+* using the children lists (before packing the children)
+*
+* Travel on the failure links until finding a state with a child of the character.
+*
+* @param states      The states array
+* @param state       The current state
+* @param c           The character read
+*
+* @return            The state after reading the character
+*/
+static inline size_t find_next_state_in_lists(State* states, size_t state, char c) {
+	size_t child = find_child_from_index(states, state, c);
+	while (state && !child) {
+		state = states[state].failure_state;
+		child = find_child_from_index(states, state, c);
+	}
+	return child;
+}
+
 /**
 * Convert tree to states
 *
@@ -219,18 +266,19 @@ static inline size_t find_child_from_index(State* states, size_t index, char c)
 * @param node      The root of the tree to convert
 * @param states    The array of states
 * @param from      The next position to add states from
+* @param arena     The arena for the children lists
 *
 * @return       The next available position in the states array
 */
-static size_t convert_tree_to_states(TreeNode* node, State* states, size_t from) {
+static size_t convert_tree_to_states(TreeNode* node, State* states, size_t from, Arena* arena) {
 	size_t i, pos = from++;
 	TreeNode* cur;
 	states[pos].id = node->id;
 	for (i = 0; i < 256; ++i) {
 		cur = node->children[i];
 		if (cur) {
-			children_list_add(&states[pos].children, (char)i, from);
-			from = convert_tree_to_states(cur, states, from);
+			children_list_add(arena, &states[pos].children, (char)i, from);
+			from = convert_tree_to_states(cur, states, from, arena);
 		} else {
 			// not adding anything to the list (no children)
 		}
@@ -249,33 +297,29 @@ static size_t convert_tree_to_states(TreeNode* node, State* states, size_t from)
 * @param child      The position of the child
 */
 static void add_failure_to_state(State* states, size_t parent, char c, size_t child) {
-	size_t fs = states[parent].failure_state;
-	size_t fs_child = find_child_from_index(states, fs, c);
-	while (fs && !fs_child) {
-		fs = states[fs].failure_state;
-		fs_child = find_child_from_index(states, fs, c);
-	}
-	states[child].failure_state = fs_child;
-	states[child].suffix_link = states[child].id == null_pattern_id ? states[states[child].failure_state].suffix_link : child;
+	states[child].failure_state = find_next_state_in_lists(states, states[parent].failure_state, c);
+	states[child].suffix_id = states[child].id == null_pattern_id ? states[states[child].failure_state].suffix_id
+	                                                               : states[child].id;
 }
 
 /**
 * Add failure links to the array of states (aldo add suffix links)
 *
 * @param states    The array of states
+* @param arena     The arena for the queue
 */
-static void add_failure_links(State* states) {
-	Queue* q = queue_create();
+static void add_failure_links(State* states, Arena* arena) {
+	Queue* q = queue_create(arena);
 	size_t i, cur_state, child_state;
 	char c;
 	ChildrenListNode* node;
 	// add the first level to the queue, and put their failure link to 0
 	states[0].failure_state = 0;
-	states[0].suffix_link = 0;
+	states[0].suffix_id = null_pattern_id;
 	foreach_child(node, c, cur_state, states[0].children) {
 		queue_add(q, cur_state);
 		states[cur_state].failure_state = 0;
-		states[cur_state].suffix_link = states[cur_state].id == null_pattern_id ? 0 : cur_state;
+		states[cur_state].suffix_id = states[cur_state].id;
 	}
 	while (queue_not_empty(q)) {
 		cur_state = queue_pop(q);
@@ -284,20 +328,177 @@ static void add_failure_links(State* states) {
 			queue_add(q, child_state);
 		}
 	}
-	queue_free(q);
 }
 
 /**
-* Free the memory of the aho-corasick tree
+* Sort the children of a state by their characters (insertion sort, since most states have very few children)
 *
-* @param root    The root of the tree
+* @param chars      The characters of the children
+* @param children   The states of the children (in the same order as chars)
+* @param n          The number of children
 */
-static void free_tree(TreeNode *root) {
-	size_t i;
-	for (i = 0; i < 256; ++i) {
-		if (root->children[i]) free_tree(root->children[i]);
+static void sort_children(unsigned char* chars, size_t* children, size_t n) {
+	size_t i, j, state;
+	unsigned char c;
+	for (i = 1; i < n; ++i) {
+		c = chars[i];
+		state = children[i];
+		for (j = i; j > 0 && chars[j - 1] > c; --j) {
+			chars[j] = chars[j - 1];
+			children[j] = children[j - 1];
+		}
+		chars[j] = c;
+		children[j] = state;
+	}
+}
+
+/**
+* Get the position of the chars of a state in edge_chars, and advance the position to the next state
+*
+* @param pos          The current position in edge_chars (changed to the position after the state)
+* @param n_children   The number of children of the state
+*
+* @return             The position of the chars (or bitmap) of the state in edge_chars
+*/
+static inline size_t advance_chars_pos(size_t* pos, size_t n_children) {
+	size_t ret;
+	if (n_children <= LMAC_SPARSE_MAX_CHILDREN) {
+		ret = *pos;
+		*pos += n_children;
+	} else {
+		// keep bitmaps aligned, so they can be read as uint64_t
+		ret = (*pos + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+		*pos = ret + LMAC_BITMAP_SIZE;
 	}
-	free(root);
+	return ret;
+}
+
+/**
+* Pack the children lists of all the states into the pools of the ac object
+*
+* @param ac     The ac object (after adding failure links)
+*/
+static void pack_children(AC* ac) {
+	State* states = ac->states;
+	size_t i, j, n, stt, edge_pos = 0, chars_pos = 0;
+	size_t children[256];
+	unsigned char chars[256];
+	ChildrenListNode* node;
+	uint64_t* bitmap;
+	char c;
+
+	// root children as dense row
+	memset(ac->root_children, 0, sizeof(ac->root_children));
+	foreach_child(node, c, stt, states[0].children) {
+		ac->root_children[(unsigned char)c] = stt;
+	}
+	states[0].edges = 0;
+	states[0].n_children = 0;
+
+	// count the memory needed for the pools
+	for (i = 1; i < ac->n_states; ++i) {
+		n = 0;
+		foreach_child(node, c, stt, states[i].children) ++n;
+		states[i].n_children = (uint16_t)n;
+		edge_pos += n;
+		advance_chars_pos(&chars_pos, n);
+	}
+	ac->n_edges = edge_pos;
+	ac->chars_size = chars_pos;
+	ac->edge_states = (size_t*)arena_alloc(&ac->mem, edge_pos * sizeof(size_t));
+	ac->edge_chars = (unsigned char*)arena_calloc(&ac->mem, chars_pos);
+
+	// fill the pools
+	edge_pos = chars_pos = 0;
+	for (i = 1; i < ac->n_states; ++i) {
+		n = 0;
+		foreach_child(node, c, stt, states[i].children) {
+			chars[n] = (unsigned char)c;
+			children[n++] = stt;
+		}
+		sort_children(chars, children, n);
+		states[i].edges = edge_pos;
+		states[i].chars = (uint32_t)advance_chars_pos(&chars_pos, n);
+		memcpy(ac->edge_states + edge_pos, children, n * sizeof(size_t));
+		edge_pos += n;
+		if (n <= LMAC_SPARSE_MAX_CHILDREN) {
+			memcpy(ac->edge_chars + states[i].chars, chars, n);
+		} else {
+			bitmap = (uint64_t*)(ac->edge_chars + states[i].chars);
+			for (j = 0; j < n; ++j) {
+				bitmap[chars[j] >> 6] |= 1ULL << (chars[j] & 63);
+			}
+		}
+	}
+}
+
+/**
+* Find the child state with the given char (after packing the children)
+*
+* @param ac       The ac object
+* @param state    The state to find its child
+* @param c        The character of the child from the state
+*
+* @return         The state of the child of that character, or 0 if no such child
+*/
+static inline size_t find_packed_child(AC* ac, size_t state, unsigned char c) {
+	State* st;
+	unsigned char* chars;
+	uint64_t* bitmap;
+	size_t i, n, w, index;
+	if (!state) {
+		return ac->root_children[c];
+	}
+	st = &ac->states[state];
+	chars = ac->edge_chars + st->chars;
+	n = st->n_children;
+	if (n <= LMAC_SPARSE_MAX_CHILDREN) {
+		for (i = 0; i < n; ++i) {
+			if (chars[i] >= c) {
+				return chars[i] == c ? ac->edge_states[st->edges + i] : 0;
+			}
+		}
+		return 0;
+	}
+	bitmap = (uint64_t*)chars;
+	w = c >> 6;
+	if (!((bitmap[w] >> (c & 63)) & 1)) {
+		return 0;
+	}
+	index = __builtin_popcountll(bitmap[w] & ((1ULL << (c & 63)) - 1));
+	for (i = 0; i < w; ++i) {
+		index += __builtin_popcountll(bitmap[i]);
+	}
+	return ac->edge_states[st->edges + index];
+}
+
+/**
+* Find the next state from a state and a character (the state to move to after reading the character),
+* after packing the children (see find_next_state_in_lists)
+*
+* @param ac          The ac object
+* @param state       The current state
+* @param c           The character read
+*
+* @return            The state after reading the character
+*/
+static inline size_t find_next_state(AC* ac, size_t state, char c) {
+	unsigned char uc = (unsigned char)c;
+	size_t child = find_packed_child(ac, state, uc);
+	while (state && !child) {
+		state = ac->states[state].failure_state;
+		child = find_packed_child(ac, state, uc);
+	}
+	return child;
+}
+
+/**
+* Copy data from the cache file to the persistent arena of the ac object
+*/
+static void* lmac_read_copy(AC* ac, CacheReader* r, size_t len) {
+	void* ret = arena_alloc(&ac->mem, len);
+	memcpy(ret, cache_read(r, len), len);
+	return ret;
 }
 
 
@@ -313,9 +514,12 @@ static void free_tree(TreeNode *root) {
 */
 void* lmac_create() {
 	AC* ac = (AC*)malloc(sizeof(AC));
+	if (ac == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
 	memset(ac, 0, sizeof(AC));
-	TreeNode* root = (TreeNode*)malloc(sizeof(TreeNode));
-	memset(root, 0, sizeof(TreeNode));
+	TreeNode* root = (TreeNode*)arena_calloc(&ac->build, sizeof(TreeNode));
 	root->id = null_pattern_id;
 	ac->root = root;
 	ac->n_states = 1;
@@ -340,8 +544,7 @@ void lmac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
 		cur = cur->children[(unsigned char)pat[i++]];
 	}
 	for (; i < len; ++i) {
-		next = (TreeNode*)malloc(sizeof(TreeNode));
-		memset(next, 0, sizeof(TreeNode));
+		next = (TreeNode*)arena_calloc(&ac->build, sizeof(TreeNode));
 		next->id = null_pattern_id;
 		cur->children[(unsigned char)pat[i]] = next;
 		cur = next;
@@ -359,13 +562,13 @@ void lmac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
 */
 void lmac_compile(void* obj) {
 	AC *ac = (AC*)obj;
-	State *states = (State*)malloc(ac->n_states * sizeof(State));
-	memset(states, 0, ac->n_states * sizeof(State));
+	State *states = (State*)arena_calloc(&ac->mem, ac->n_states * sizeof(State));
 
-	convert_tree_to_states(ac->root, states, 0); // should return n_states
-	add_failure_links(states);
-	free_tree(ac->root);
+	convert_tree_to_states(ac->root, states, 0, &ac->build); // should return n_states
+	add_failure_links(states, &ac->build);
 	ac->states = states;
+	pack_children(ac);
+	arena_free(&ac->build);
 }
 
 /**
@@ -375,25 +578,102 @@ void lmac_compile(void* obj) {
 * a child with the given character, and reutrn its id.
 *
 * @param obj    The ac object
+* @param ctx    The context of the stream
 * @param c      The next character in the stream
 *
 * @return       The id of the longest pattern that have a match
 */
-pattern_id_t lmac_read_char(void* obj, char c) {
+pattern_id_t lmac_ctx_read_char(void* obj, void* ctx, char c) {
+	AC *ac = (AC*)obj;
+	ACContext *context = (ACContext*)ctx;
+	context->current_state = find_next_state(ac, context->current_state, c);
+	return ac->states[context->current_state].suffix_id;
+}
+
+/**
+* Aho-Corasick read block of characters from the stream function.
+*
+* Do the same as lmac_ctx_read_char on every character in the block, while keeping
+* the current state in a local variable during the whole block.
+*
+* @param obj    The ac object
+* @param ctx    The context of the stream
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void lmac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
 	AC *ac = (AC*)obj;
+	ACContext *context = (ACContext*)ctx;
 	State* states = ac->states;
-	size_t current_state = ac->current_state;
-	size_t current_child = find_child_from_index(states, current_state, c);
-	while (current_state && !current_child) {
-		current_state = states[current_state].failure_state;
-		current_child = find_child_from_index(states, current_state, c);
+	size_t i, current_state = context->current_state;
+	for (i = 0; i < len; ++i) {
+		current_state = find_next_state(ac, current_state, buf[i]);
+		out[i] = states[current_state].suffix_id;
 	}
-	if (current_child) {
-		ac->current_state = current_child;
-	} else{
-		ac->current_state = current_state;
+	context->current_state = current_state;
+}
+
+/**
+* Aho-Corasick scan block of characters from the stream function.
+*
+* Read the block like lmac_ctx_read_block, but only the characters with a match are reported (see "ctx_scan" in
+* MpsElem), so the loop doesn't write anything while nothing matches.
+*
+* @param obj          The ac object
+* @param ctx          The context of the stream
+* @param buf          The block of characters from the stream
+* @param len          The length of the block
+* @param mode         The scan mode (MPS_SCAN_FIRST, MPS_SCAN_COUNT or MPS_SCAN_LIST)
+* @param matches      Where to put the matches (not used on MPS_SCAN_COUNT)
+* @param max_matches  The number of matches that can be put in matches
+*
+* @return             The number of matches
+*/
+size_t lmac_ctx_scan(void* obj, void* ctx, const char* buf, size_t len, int mode, MpsMatch* matches,
+                     size_t max_matches) {
+	AC *ac = (AC*)obj;
+	ACContext *context = (ACContext*)ctx;
+	State* states = ac->states;
+	size_t i, count = 0, current_state = context->current_state;
+	pattern_id_t id;
+	for (i = 0; i < len; ++i) {
+		current_state = find_next_state(ac, current_state, buf[i]);
+		id = states[current_state].suffix_id;
+		if (id == null_pattern_id) continue;
+		if (mode != MPS_SCAN_COUNT && count < max_matches) {
+			matches[count].pos = i;
+			matches[count].id = id;
+		}
+		++count;
+		if (mode == MPS_SCAN_FIRST) break;
 	}
-	return states[states[ac->current_state].suffix_link].id;
+	context->current_state = current_state;
+	return count;
+}
+
+/**
+* Aho-Corasick read next char in the stream function (with the context of the object)
+*
+* @param obj    The ac object
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t lmac_read_char(void* obj, char c) {
+	return lmac_ctx_read_char(obj, &((AC*)obj)->ctx, c);
+}
+
+/**
+* Aho-Corasick read block of characters from the stream function (with the context of the object)
+*
+* @param obj    The ac object
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void lmac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	lmac_ctx_read_block(obj, &((AC*)obj)->ctx, buf, len, out);
 }
 
 /**
@@ -406,17 +686,7 @@ pattern_id_t lmac_read_char(void* obj, char c) {
 size_t lmac_total_mem(void* obj) {
 	if (obj == NULL) return 0;
 	AC* ac = (AC*)obj;
-	size_t i, n = ac->n_states, total_mem;
-	total_mem = sizeof(AC) + ac->n_states * sizeof(State);
-	for (i = 0; i < n; ++i) {
-		ChildrenListNode* node;
-		size_t state;
-		char c;
-		foreach_child(node, c, state, ac->states[i].children) {
-			total_mem += sizeof(ChildrenListNode);
-		}
-	}
-	return total_mem;
+	return sizeof(AC) + arena_total_mem(&ac->mem); // the states and the pools
 }
 
 /**
@@ -425,8 +695,60 @@ size_t lmac_total_mem(void* obj) {
 * @param obj    The ac object
 */
 void lmac_reset(void* obj) {
-	AC* ac = (AC*)obj;
-	ac->current_state = 0;
+	lmac_reset_context(obj, &((AC*)obj)->ctx);
+}
+
+/**
+* Create new context for the compiled ac object (the state of a single stream)
+*
+* @param obj    The ac object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* lmac_new_context(void* obj) {
+	ACContext* ctx = (ACContext*)malloc(sizeof(ACContext));
+	if (ctx == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	lmac_reset_context(obj, ctx);
+	return (void*)ctx;
+}
+
+/**
+* Reset a context of the ac object back to the initial state
+*
+* @param obj    The ac object
+* @param ctx    The context to reset
+*/
+void lmac_reset_context(void* obj, void* ctx) {
+	(void)obj;
+	((ACContext*)ctx)->current_state = 0;
+}
+
+/**
+* Get the memory used for a context of the ac object
+*
+* @param obj    The ac object
+* @param ctx    The context
+*
+* @return       The memory used for the context (in bytes)
+*/
+size_t lmac_context_mem(void* obj, void* ctx) {
+	(void)obj;
+	(void)ctx;
+	return sizeof(ACContext);
+}
+
+/**
+* Free a context of the ac object
+*
+* @param obj    The ac object
+* @param ctx    The context to free
+*/
+void lmac_free_context(void* obj, void* ctx) {
+	(void)obj;
+	free(ctx);
 }
 
 /**
@@ -436,26 +758,88 @@ void lmac_reset(void* obj) {
 */
 void lmac_free(void *obj) {
 	AC *ac = (AC*)obj;
-	size_t i, n = ac->n_states;
-	for (i = 0; i < n; ++i) {
-		free_children_list(&ac->states[i].children);
-	}
-	if (ac->states) free(ac->states);
+	arena_free(&ac->build);
+	arena_free(&ac->mem);
 	free(ac);
 }
 
+/**
+* Save the compiled ac object to the cache file
+*
+* The states are saved as they are (without their pattern ids), and their pattern ids are saved
+* after them (as pattern indices)
+*
+* @param obj    The ac object
+* @param w      The cache writer
+*/
+void lmac_save(void* obj, CacheWriter* w) {
+	AC *ac = (AC*)obj;
+	uint64_t sizes[3] = {ac->n_states, ac->n_edges, ac->chars_size};
+	State state;
+	size_t i;
+	cache_write(w, sizes, sizeof(sizes));
+	cache_write(w, ac->root_children, sizeof(ac->root_children));
+	for (i = 0; i < ac->n_states; ++i) {
+		state = ac->states[i];
+		state.id = state.suffix_id = null_pattern_id;
+		cache_write(w, &state, sizeof(State));
+	}
+	for (i = 0; i < ac->n_states; ++i) {
+		cache_write_ids(w, &ac->states[i].id, 1);
+		cache_write_ids(w, &ac->states[i].suffix_id, 1);
+	}
+	cache_write(w, ac->edge_states, ac->n_edges * sizeof(size_t));
+	cache_write(w, ac->edge_chars, ac->chars_size);
+}
+
+/**
+* Load the ac object (saved with lmac_save) from the cache file
+*
+* @param obj    The newly created ac object
+* @param r      The cache reader
+*/
+void lmac_load(void* obj, CacheReader* r) {
+	AC *ac = (AC*)obj;
+	const uint64_t* sizes = (const uint64_t*)cache_read(r, 3 * sizeof(uint64_t));
+	size_t i;
+
+	arena_free(&ac->build);
+	ac->n_states = sizes[0];
+	ac->n_edges = sizes[1];
+	ac->chars_size = sizes[2];
+	memcpy(ac->root_children, cache_read(r, sizeof(ac->root_children)), sizeof(ac->root_children));
+	ac->states = (State*)lmac_read_copy(ac, r, ac->n_states * sizeof(State));
+	for (i = 0; i < ac->n_states; ++i) {
+		cache_read_ids(r, &ac->states[i].id, 1);
+		cache_read_ids(r, &ac->states[i].suffix_id, 1);
+	}
+	ac->edge_states = (size_t*)lmac_read_copy(ac, r, ac->n_edges * sizeof(size_t));
+	ac->edge_chars = (unsigned char*)lmac_read_copy(ac, r, ac->chars_size);
+}
+
 /**
 * The mps registering function of the Aho-Corasick Algorithm.
 */
 void mps_lmac_register() {
 	mps_table[MPS_LMAC].name = "Low-Memory Aho-Corasick";
+	mps_table[MPS_LMAC].short_name = "lmac";
 	mps_table[MPS_LMAC].create = lmac_create;
 	mps_table[MPS_LMAC].add_pattern = lmac_add_pattern;
 	mps_table[MPS_LMAC].compile = lmac_compile;
 	mps_table[MPS_LMAC].read_char = lmac_read_char;
+	mps_table[MPS_LMAC].read_block = lmac_read_block;
 	mps_table[MPS_LMAC].total_mem = lmac_total_mem;
 	mps_table[MPS_LMAC].reset = lmac_reset;
 	mps_table[MPS_LMAC].free = lmac_free;
+	mps_table[MPS_LMAC].save = lmac_save;
+	mps_table[MPS_LMAC].load = lmac_load;
+	mps_table[MPS_LMAC].new_context = lmac_new_context;
+	mps_table[MPS_LMAC].ctx_read_char = lmac_ctx_read_char;
+	mps_table[MPS_LMAC].ctx_read_block = lmac_ctx_read_block;
+	mps_table[MPS_LMAC].ctx_scan = lmac_ctx_scan;
+	mps_table[MPS_LMAC].reset_context = lmac_reset_context;
+	mps_table[MPS_LMAC].context_mem = lmac_context_mem;
+	mps_table[MPS_LMAC].free_context = lmac_free_context;
 }
 
 //=========================================================
@@ -466,15 +850,18 @@ static void _print_states(AC* ac) {
 	State* state;
 	char c;
 	size_t stt;
-	ChildrenListNode* node;
 	printf("printing ac states, number of states = %lu\n", ac->n_states);
 	for (size_t i = 0; i < ac->n_states; ++i) {
 		state = &ac->states[i];
 		printf("state %lu, id = %p, failure state = %lu\n", i, state->id, state->failure_state);
-		foreach_child(node, c, stt, state->children) {
-			printf("  ");
-			print_binary_str(&c, 1);
-			printf(", state = %lu\n", stt);
+		for (int j = 0; j < 256; ++j) {
+			c = (char)j;
+			stt = find_packed_child(ac, i, (unsigned char)j);
+			if (stt) {
+				printf("  ");
+				print_binary_str(&c, 1);
+				printf(", state = %lu\n", stt);
+			}
 		}
 	}
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 
 #include "mps.h"
 #include "PatternsTree.h"
+#include "cache.h"
 
 
 /******************************************************************************
@@ -23,9 +24,21 @@ void* lmac_create();
 void lmac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
 void lmac_compile(void* obj);
 pattern_id_t lmac_read_char(void* obj, char c);
+void lmac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
 size_t lmac_total_mem(void* obj);
 void lmac_reset(void* obj);
 void lmac_free(void *obj);
+void lmac_save(void* obj, CacheWriter* w);
+void lmac_load(void* obj, CacheReader* r);
+
+void* lmac_new_context(void* obj);
+pattern_id_t lmac_ctx_read_char(void* obj, void* ctx, char c);
+void lmac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+size_t lmac_ctx_scan(void* obj, void* ctx, const char* buf, size_t len, int mode, MpsMatch* matches,
+                     size_t max_matches);
+void lmac_reset_context(void* obj, void* ctx);
+size_t lmac_context_mem(void* obj, void* ctx);
+void lmac_free_context(void* obj, void* ctx);
 
 void mps_lmac_register();
 
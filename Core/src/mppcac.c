@@ -0,0 +1,1027 @@
+/**
+* Multi-Pattern Prefiltered Compact Aho-Corasick Algorithm implementation
+*
+* Most positions of a stream are not the start of any pattern, but the exact algorithms still do full work on
+* every character. Here a vectorized prefilter (in the style of Teddy) find the positions where a pattern may start,
+* and only the windows after these positions are given to the exact algorithm (Compact Aho-Corasick, see "mpcac.c").
+*
+* The fingerprint of a pattern is its first k characters (k = PCAC_MAX_K, or the length of the longest pattern if it
+* is shorter). The patterns are split to PCAC_N_BUCKETS buckets, and for every fingerprint character j we keep two
+* tables of 16 bucket masks, one for the low nibble and one for the high nibble of the character. A position may be
+* the start of a pattern of bucket b, only if bit b is set in the masks of the nibbles of all its k characters.
+* With pshufb we look up 16 (SSSE3) or 32 (AVX2) positions at once. The patterns shorter than k (short patterns)
+* have a bucket per length, in which the characters after the pattern match anything. The long patterns are grouped
+* to the other buckets by the nibbles they share (like FDR), so that few positions pass the masks of any bucket, also
+* when there are hundreds of patterns (see pcac_assign_bucket).
+*
+* The positions that pass are checked again with hash tables of the fingerprints (exact for fingerprints of up to 2
+* characters): for the long patterns, we keep in the entry of the fingerprint the length of the longest pattern
+* with that fingerprint hash, which is the window that the position opens (0 if there is no such pattern), and for the
+* short patterns of every length, a set of the patterns (their window is their length).
+*
+* The exact algorithm only reads the windows of the candidates (the windows that overlap are merged to one region).
+* It is reset at the start of every region, and all the positions that are not in any region have no match.
+* The longest match at a position is found, since every pattern that match there starts at a candidate whose window
+* contains the position, so the region of the position starts before all of them.
+*
+* The last k - 1 positions of a block can't be fully checked until the next block (only for the short patterns that
+* end in the block), so their characters are kept in the history. If a candidate starts in the history before the start
+* of the open region (or when no region is open), we reset the exact algorithm and replay the history from that
+* candidate into it.
+*
+* The vectorized prefilter is chosen at compilation by the cpu features (cpu_features), of those that "simd=LEVEL"
+* allows. The scalar prefilter (for other cpus) checks the hash tables of every position directly instead of the
+* bucket masks, and it is also used when most of the positions would pass the masks (with thousands of patterns).
+*
+* When the windows cover most of the stream (with many patterns, or many short patterns), the exact algorithm reads
+* most of the stream anyway, and the prefilter only adds the checks of the candidates and the resets of the regions.
+* So the windows that the prefilter opens are counted, and when they are too many the stream is read for a while by
+* the exact algorithm only, as one region (see pcac_probe).
+*/
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mppcac.h"
+#include "mpcac.h"
+#include "cache.h"
+#include "util.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PCAC_X86
+#include <immintrin.h>
+#endif
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+// The maximal number of characters in the fingerprint of a pattern
+#define PCAC_MAX_K 4
+
+// The number of entries in the hash tables of the fingerprints
+#define PCAC_HASH_SIZE 65536
+// The number of buckets of patterns in the prefilter tables (one bit of a bucket mask per bucket)
+#define PCAC_N_BUCKETS 8
+
+// The number of positions scanned by the prefilter at once (before giving the candidates to the exact algorithm)
+#define PCAC_CHUNK 4096
+
+// The part of the uniform distribution in the estimated distribution of the characters of the stream (the rest is the
+// distribution of the fingerprint characters of the patterns)
+#define PCAC_UNIFORM_WEIGHT 0.0625
+// Above this estimated rate of positions that pass the bucket masks, the scalar prefilter is faster than the masks
+#define PCAC_MAX_MASKS_PASS 0.2
+
+// Above this rate of positions that open a window, or number of windows that contain a position (about half of the
+// positions are in a window), reading with the exact algorithm only is faster than with the prefilter
+#define PCAC_MAX_WINDOWS_RATE 0.03
+#define PCAC_MAX_COVERAGE 0.7
+// The number of positions that the prefilter scans before checking these rates
+#define PCAC_PROBE PCAC_CHUNK
+// The number of positions read without the prefilter after the rates were too high (doubled every time they are too
+// high again, up to the maximum)
+#define PCAC_MIN_BYPASS (16 * PCAC_CHUNK)
+#define PCAC_MAX_BYPASS (256 * PCAC_CHUNK)
+
+// The prefilters
+enum {
+	PCAC_FILTER_MASKS = 0, // the bucket masks (vectorized, if the cpu supports it) and then the hash tables
+	PCAC_FILTER_HASH       // only the hash tables (the scalar prefilter)
+};
+
+// The size of the prefix kept for every pattern until compilation (the first PCAC_MAX_K characters and the length)
+#define PCAC_PREFIX_SIZE (PCAC_MAX_K + sizeof(uint32_t))
+
+#define set_contains(set, x) (((set)[(x) / 64] >> ((x) % 64)) & 1)
+#define set_add(set, x) ((set)[(x) / 64] |= (uint64_t)1 << ((x) % 64))
+
+struct pcac;
+
+// A prefilter function, put in cands the positions in [from, to) of buf that may be candidates (at least all the
+// candidates), and return how many (all the fingerprints of these positions are in buf)
+typedef size_t (*PcacScanFunc)(const struct pcac* pcac, const unsigned char* buf, size_t from, size_t to,
+                               size_t* cands);
+
+/**
+* A bucket of long patterns while the buckets are assigned (see pcac_assign_bucket)
+*/
+typedef struct {
+	uint16_t  lo[PCAC_MAX_K];   // the set of the low nibbles of every fingerprint character of the patterns
+	uint16_t  hi[PCAC_MAX_K];   // the set of the high nibbles of every fingerprint character of the patterns
+	double    pass[PCAC_MAX_K]; // the estimated probability that a character of the stream passes these nibbles
+} PcacBucket;
+
+/**
+* The stream state of the pcac object (a context of a single stream)
+*/
+typedef struct {
+	void           *cac;                      // the context of the exact algorithm
+	unsigned char   hist[PCAC_MAX_K - 1];     // the last characters of the stream, which were not fully checked yet
+	size_t          hist_len;
+	size_t          offset;                   // the number of characters read from the stream (before the block)
+	size_t          region_start;             // the offset in the stream of the start of the open region
+	size_t          remaining;                // the number of positions after the block left in the open region
+	size_t          bypass;                   // the number of positions left to read without the prefilter
+	size_t          bypass_len;               // the number of positions of the next bypass
+	size_t          probed;                   // the positions scanned by the prefilter since the rates were checked
+	size_t          probed_windows;           // the windows that these positions opened
+	size_t          probed_covered;           // the total size of these windows
+} PCACContext;
+
+typedef struct pcac {
+	void           *cac;                      // the exact algorithm (Compact Aho-Corasick object)
+	unsigned char   lo[PCAC_MAX_K][16];       // the bucket masks of the low nibble of every fingerprint character
+	unsigned char   hi[PCAC_MAX_K][16];       // the bucket masks of the high nibble of every fingerprint character
+	unsigned char   long_buckets;             // the mask of the buckets of the long patterns
+	uint16_t        windows[PCAC_HASH_SIZE];  // the longest long pattern of every fingerprint hash (saturated)
+	uint64_t        short_sets[PCAC_MAX_K - 1][PCAC_HASH_SIZE / 64]; // the hashes of the short patterns of every length
+	uint64_t        short_first[256 / 64];    // the first characters of the short patterns
+	size_t          k;                        // the number of characters in a fingerprint (0 if there are no patterns)
+	size_t          max_len;
+	int             filter;                   // the prefilter (PCAC_FILTER_...), chosen at compilation
+	size_t          first_bypass;             // the bypass of a new context (see pcac_probe)
+	PcacScanFunc    scan;
+	unsigned        simd_mask;                // the cpu features the prefilter may use (set with "simd=LEVEL")
+	PCACContext     ctx;                      // the context used by pcac_read_char & pcac_read_block
+	unsigned char  *prefixes;                 // PCAC_PREFIX_SIZE for every pattern (before compilation)
+	size_t          n_patterns;
+	size_t          capacity;
+} PCAC;
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* The hash of the first characters of a position (in [0, PCAC_HASH_SIZE), the characters themselves for up to 2)
+*
+* @param s        The position
+* @param len      The number of characters (up to PCAC_MAX_K)
+*
+* @return         The hash
+*/
+static inline size_t pcac_hash(const unsigned char* s, size_t len) {
+	uint32_t x;
+	if (len == 1) return s[0];
+	if (len == 2) return (size_t)s[0] | (size_t)s[1] << 8;
+	x = (uint32_t)s[0] | (uint32_t)s[1] << 8 | (uint32_t)s[2] << 16 | (len > 3 ? (uint32_t)s[3] << 24 : 0);
+	return (x * 2654435761u) >> 16;
+}
+
+/**
+* Find the window that a position opens
+*
+* @param pcac     The pcac object
+* @param s        The position
+* @param avail    The number of characters from the position which are known (at least 1), if it is less than k
+*                 only the short patterns that end in them are checked
+*
+* @return         The number of positions in the window of the position (0 if it is not a candidate)
+*/
+static inline size_t pcac_window(const PCAC* pcac, const unsigned char* s, size_t avail) {
+	unsigned char mask = 0xff;
+	size_t j, w, k = pcac->k;
+	if (avail >= k) {
+		for (j = 0; j < k; ++j) {
+			mask &= pcac->lo[j][s[j] & 0xf] & pcac->hi[j][s[j] >> 4];
+		}
+		if ((mask & pcac->long_buckets) && (w = pcac->windows[pcac_hash(s, k)])) {
+			return w == UINT16_MAX ? pcac->max_len : w;
+		}
+		avail = k - 1;
+	}
+	if (!set_contains(pcac->short_first, s[0])) return 0;
+	for (j = avail; j > 0; --j) {
+		if (set_contains(pcac->short_sets[j - 1], pcac_hash(s, j))) return j;
+	}
+	return 0;
+}
+
+/**
+* Scalar prefilter, check the fingerprint hashes of every position instead of the bucket masks (see PcacScanFunc)
+*/
+static size_t pcac_scan_scalar(const PCAC* pcac, const unsigned char* buf, size_t from, size_t to, size_t* cands) {
+	const uint16_t* windows = pcac->windows;
+	size_t s, k = pcac->k, n = 0;
+	for (s = from; s < to; ++s) {
+		if (windows[pcac_hash(buf + s, k)] || set_contains(pcac->short_first, buf[s])) cands[n++] = s;
+	}
+	return n;
+}
+
+#ifdef PCAC_X86
+
+/**
+* SSSE3 prefilter, 16 positions at once (see PcacScanFunc)
+*/
+__attribute__((target("ssse3")))
+static size_t pcac_scan_ssse3(const PCAC* pcac, const unsigned char* buf, size_t from, size_t to, size_t* cands) {
+	const __m128i nibble = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+	__m128i lo[PCAC_MAX_K], hi[PCAC_MAX_K], v, mask;
+	size_t j, s, k = pcac->k, n = 0;
+	unsigned bits;
+
+	for (j = 0; j < k; ++j) {
+		lo[j] = _mm_loadu_si128((const __m128i*)pcac->lo[j]);
+		hi[j] = _mm_loadu_si128((const __m128i*)pcac->hi[j]);
+	}
+	// the characters of positions before 'to' are in buf (so we can read 16 characters from s + j for every j < k)
+	for (s = from; s + 16 <= to; s += 16) {
+		mask = _mm_set1_epi8((char)0xff);
+		for (j = 0; j < k; ++j) {
+			v = _mm_loadu_si128((const __m128i*)(buf + s + j));
+			mask = _mm_and_si128(mask, _mm_shuffle_epi8(lo[j], _mm_and_si128(v, nibble)));
+			mask = _mm_and_si128(mask, _mm_shuffle_epi8(hi[j], _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+		}
+		bits = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(mask, zero)) & 0xffff;
+		while (bits) {
+			cands[n++] = s + __builtin_ctz(bits);
+			bits &= bits - 1;
+		}
+	}
+	return n + pcac_scan_scalar(pcac, buf, s, to, cands + n);
+}
+
+/**
+* AVX2 prefilter, 32 positions at once (see PcacScanFunc)
+*/
+__attribute__((target("avx2")))
+static size_t pcac_scan_avx2(const PCAC* pcac, const unsigned char* buf, size_t from, size_t to, size_t* cands) {
+	const __m256i nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+	__m256i lo[PCAC_MAX_K], hi[PCAC_MAX_K], v, mask;
+	size_t j, s, k = pcac->k, n = 0;
+	unsigned bits;
+
+	for (j = 0; j < k; ++j) {
+		// pshufb looks up in every 128 bits lane on its own, so both lanes have the table
+		lo[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)pcac->lo[j]));
+		hi[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)pcac->hi[j]));
+	}
+	for (s = from; s + 32 <= to; s += 32) {
+		mask = _mm256_set1_epi8((char)0xff);
+		for (j = 0; j < k; ++j) {
+			v = _mm256_loadu_si256((const __m256i*)(buf + s + j));
+			mask = _mm256_and_si256(mask, _mm256_shuffle_epi8(lo[j], _mm256_and_si256(v, nibble)));
+			mask = _mm256_and_si256(mask, _mm256_shuffle_epi8(hi[j], _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+		}
+		bits = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(mask, zero));
+		while (bits) {
+			cands[n++] = s + __builtin_ctz(bits);
+			bits &= bits - 1;
+		}
+	}
+	return n + pcac_scan_scalar(pcac, buf, s, to, cands + n);
+}
+
+#endif // PCAC_X86
+
+/**
+* Choose the function of the prefilter of the pcac object, the fastest that the cpu supports (and the object allows)
+*
+* @param pcac  The pcac object
+*
+* @return      The prefilter function
+*/
+static PcacScanFunc pcac_select_scan(const PCAC* pcac) {
+	if (pcac->filter == PCAC_FILTER_HASH) return pcac_scan_scalar;
+#ifdef PCAC_X86
+	if (cpu_features() & pcac->simd_mask & CPU_FEATURE_AVX2) return pcac_scan_avx2;
+	if (cpu_features() & pcac->simd_mask & CPU_FEATURE_SSSE3) return pcac_scan_ssse3;
+#endif
+	return pcac_scan_scalar;
+}
+
+/**
+* Give the exact algorithm the positions [*pos, to) which are in the current region, and put no match in the rest
+*
+* @param pcac          The pcac object
+* @param ctx           The context of the stream
+* @param buf           The block
+* @param pos           The first position without result (set to to)
+* @param region_end    The end of the current region (not including)
+* @param to            The end of the positions to fill
+* @param out           The results of the block
+*/
+static void pcac_run(const PCAC* pcac, PCACContext* ctx, const char* buf, size_t* pos, size_t region_end, size_t to,
+                     pattern_id_t* out) {
+	size_t i = *pos, end = region_end < to ? region_end : to;
+	if (end > i) {
+		cac_ctx_read_block(pcac->cac, ctx->cac, buf + i, end - i, out + i);
+		i = end;
+	}
+	for (; i < to; ++i) {
+		out[i] = null_pattern_id;
+	}
+	*pos = to;
+}
+
+/**
+* Keep the last k - 1 characters of the stream (after reading a block) in the history
+*
+* @param pcac     The pcac object
+* @param ctx      The context of the stream
+* @param buf      The block
+* @param len      The length of the block
+*/
+static void pcac_update_history(const PCAC* pcac, PCACContext* ctx, const unsigned char* buf, size_t len) {
+	size_t keep, n = pcac->k - 1;
+	if (len >= n) {
+		memcpy(ctx->hist, buf + len - n, n);
+		ctx->hist_len = n;
+		return;
+	}
+	keep = ctx->hist_len < n - len ? ctx->hist_len : n - len;
+	memmove(ctx->hist, ctx->hist + ctx->hist_len - keep, keep);
+	memcpy(ctx->hist + keep, buf, len);
+	ctx->hist_len = keep + len;
+}
+
+/**
+* Add a candidate position (which opens a window)
+*
+* @param pcac          The pcac object
+* @param ctx           The context of the stream
+* @param buf           The block
+* @param pos           The first position without result
+* @param region_end    The end of the open region (updated)
+* @param s             The position
+* @param w             The size of the window of the position
+* @param out           The results of the block
+*/
+static inline void pcac_add_candidate(const PCAC* pcac, PCACContext* ctx, const char* buf, size_t* pos,
+                                      size_t* region_end, size_t s, size_t w, pattern_id_t* out) {
+	if (s >= *region_end) {
+		// a new region
+		pcac_run(pcac, ctx, buf, pos, *region_end, s, out);
+		cac_reset_context(pcac->cac, ctx->cac);
+		ctx->region_start = ctx->offset + s;
+	}
+	if (*region_end < s + w) *region_end = s + w;
+}
+
+/**
+* Count the windows that the prefilter opened, and stop using it for a while if they are too many
+*
+* Every PCAC_PROBE scanned positions, if the windows opened on them (or the positions they cover) are too many, the
+* exact algorithm would read most of the stream anyway, and then checking the candidates and starting the regions only
+* cost more. So the next positions are read by the exact algorithm only (without the prefilter), for a bypass that is
+* doubled while the rates stay high (so the prefilter is checked again from time to time, when the stream changes).
+*
+* @param ctx          The context of the stream
+* @param n            The number of positions that the prefilter scanned
+* @param n_windows    The number of windows that these positions opened
+* @param covered      The total size of these windows
+*/
+static void pcac_probe(PCACContext* ctx, size_t n, size_t n_windows, size_t covered) {
+	ctx->probed += n;
+	ctx->probed_windows += n_windows;
+	ctx->probed_covered += covered;
+	if (ctx->probed < PCAC_PROBE) return;
+	if (ctx->probed_windows > PCAC_MAX_WINDOWS_RATE * ctx->probed ||
+	    ctx->probed_covered > PCAC_MAX_COVERAGE * ctx->probed) {
+		ctx->bypass = ctx->bypass_len;
+		if (ctx->bypass_len < PCAC_MAX_BYPASS) ctx->bypass_len *= 2;
+	} else {
+		ctx->bypass_len = PCAC_MIN_BYPASS;
+	}
+	ctx->probed = ctx->probed_windows = ctx->probed_covered = 0;
+}
+
+/**
+* Estimate the distribution of the characters of the stream, by the fingerprint characters of the patterns
+*
+* @param pcac     The pcac object (with the prefixes of the patterns)
+* @param freq     Where to put the probability of every character
+*/
+static void pcac_estimate_freqs(const PCAC* pcac, double* freq) {
+	size_t i, j, len, total = 0;
+	size_t counts[256] = {0};
+	unsigned char* prefix;
+	uint32_t len32;
+
+	for (i = 0; i < pcac->n_patterns; ++i) {
+		prefix = pcac->prefixes + i * PCAC_PREFIX_SIZE;
+		memcpy(&len32, prefix + PCAC_MAX_K, sizeof(uint32_t));
+		len = len32 < pcac->k ? len32 : pcac->k;
+		for (j = 0; j < len; ++j) {
+			++counts[prefix[j]];
+		}
+		total += len;
+	}
+	for (i = 0; i < 256; ++i) {
+		freq[i] = PCAC_UNIFORM_WEIGHT / 256 + (total ? (1 - PCAC_UNIFORM_WEIGHT) * counts[i] / total : 0);
+	}
+}
+
+/**
+* The estimated probability of the characters that pass the nibbles of a bucket only after a character is added to it
+*
+* @param freq     The estimated probability of every character
+* @param lo       The set of the low nibbles of the bucket
+* @param hi       The set of the high nibbles of the bucket
+* @param c        The added character
+*
+* @return         The probability of the characters that pass with c, but not without it
+*/
+static double pcac_added_pass(const double* freq, uint16_t lo, uint16_t hi, unsigned char c) {
+	unsigned l = c & 0xf, h = c >> 4, x;
+	double added = 0;
+	if (!((lo >> l) & 1)) {
+		for (x = 0; x < 16; ++x) {
+			if (((hi >> x) & 1) || x == h) added += freq[x << 4 | l];
+		}
+	}
+	if (!((hi >> h) & 1)) {
+		for (x = 0; x < 16; ++x) {
+			if ((lo >> x) & 1) added += freq[h << 4 | x];
+		}
+	}
+	return added;
+}
+
+/**
+* Choose the bucket of a long pattern, and add its fingerprint to the bucket
+*
+* The pattern is put in the bucket whose pass rate (the probability that a position passes its nibbles) grows the least
+* with it, so the empty buckets are filled first, and then patterns that share nibbles are grouped together (like the
+* buckets of FDR). The pass rates of the buckets add up to the pass rate of the bucket masks, which is kept low even
+* when there are many patterns, unlike buckets chosen by the first character (which all pass on most positions).
+*
+* @param buckets      The buckets of the long patterns
+* @param n_buckets    The number of buckets
+* @param freq         The estimated probability of every character
+* @param prefix       The fingerprint of the pattern
+* @param k            The number of characters in a fingerprint
+*
+* @return             The index of the bucket
+*/
+static size_t pcac_assign_bucket(PcacBucket* buckets, size_t n_buckets, const double* freq, const unsigned char* prefix,
+                                 size_t k) {
+	size_t b, j, best = 0;
+	double old_pass, new_pass, growth, best_growth = 2;
+	PcacBucket* bucket;
+
+	for (b = 0; b < n_buckets; ++b) {
+		bucket = &buckets[b];
+		old_pass = new_pass = 1;
+		for (j = 0; j < k; ++j) {
+			old_pass *= bucket->pass[j];
+			new_pass *= bucket->pass[j] + pcac_added_pass(freq, bucket->lo[j], bucket->hi[j], prefix[j]);
+		}
+		growth = new_pass - old_pass;
+		if (growth < best_growth) {
+			best_growth = growth;
+			best = b;
+		}
+	}
+	bucket = &buckets[best];
+	for (j = 0; j < k; ++j) {
+		bucket->pass[j] += pcac_added_pass(freq, bucket->lo[j], bucket->hi[j], prefix[j]);
+		bucket->lo[j] |= 1 << (prefix[j] & 0xf);
+		bucket->hi[j] |= 1 << (prefix[j] >> 4);
+	}
+	return best;
+}
+
+/**
+* Estimate the pass rate of the bucket masks (the probability that a position passes the masks of some bucket)
+*
+* @param pcac     The pcac object (with the tables built)
+* @param freq     The estimated probability of every character
+*
+* @return         The estimated pass rate
+*/
+static double pcac_estimate_masks_pass(const PCAC* pcac, const double* freq) {
+	size_t b, j, c;
+	double char_pass, pass, fail = 1;
+	for (b = 0; b < PCAC_N_BUCKETS; ++b) {
+		pass = 1;
+		for (j = 0; j < pcac->k; ++j) {
+			char_pass = 0;
+			for (c = 0; c < 256; ++c) {
+				if (pcac->lo[j][c & 0xf] & pcac->hi[j][c >> 4] & (1 << b)) char_pass += freq[c];
+			}
+			pass *= char_pass;
+		}
+		fail *= 1 - pass;
+	}
+	return 1 - fail;
+}
+
+/**
+* Estimate the rate of the positions that open a window, and the number of windows that contain a position
+*
+* @param pcac       The pcac object (with the tables built, and the prefixes of the patterns)
+* @param freq       The estimated probability of every character
+* @param rate       Where to put the estimated rate of the positions that open a window
+* @param coverage   Where to put the estimated number of windows that contain a position
+*/
+static void pcac_estimate_windows(const PCAC* pcac, const double* freq, double* rate, double* coverage) {
+	size_t i, j, e, w, len;
+	double p;
+	unsigned char* prefix;
+	uint32_t len32;
+	uint64_t* seen = (uint64_t*)calloc(PCAC_MAX_K * (PCAC_HASH_SIZE / 64), sizeof(uint64_t));
+
+	if (seen == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	*rate = *coverage = 0;
+	// every used entry of the windows is hit by the positions whose fingerprint hash is the entry
+	for (e = 0; e < PCAC_HASH_SIZE; ++e) {
+		if (pcac->windows[e] == 0) continue;
+		w = pcac->windows[e] == UINT16_MAX ? pcac->max_len : pcac->windows[e];
+		*rate += 1.0 / PCAC_HASH_SIZE;
+		*coverage += (double)w / PCAC_HASH_SIZE;
+	}
+	// and by the positions of the fingerprints themselves (the window of a short pattern is its length)
+	for (i = 0; i < pcac->n_patterns; ++i) {
+		prefix = pcac->prefixes + i * PCAC_PREFIX_SIZE;
+		memcpy(&len32, prefix + PCAC_MAX_K, sizeof(uint32_t));
+		len = len32 < pcac->k ? len32 : pcac->k;
+		e = pcac_hash(prefix, len);
+		if (set_contains(seen + (len - 1) * (PCAC_HASH_SIZE / 64), e)) continue;
+		set_add(seen + (len - 1) * (PCAC_HASH_SIZE / 64), e);
+		w = len < pcac->k ? len : pcac->windows[e] == UINT16_MAX ? pcac->max_len : pcac->windows[e];
+		p = 1;
+		for (j = 0; j < len; ++j) {
+			p *= freq[prefix[j]];
+		}
+		*rate += p;
+		*coverage += p * w;
+	}
+	free(seen);
+}
+
+/**
+* Build the prefilter tables from the prefixes of the patterns, and choose the prefilter
+*
+* The short patterns have a bucket per length (only the lengths that some pattern has), and the rest of the buckets
+* are for the long patterns (see pcac_assign_bucket). The prefilter is only the hash tables if the estimated pass rate
+* of the bucket masks is high (then checking the hash tables of every position is faster than the masks and the
+* checks of the positions that pass them), and the bucket masks otherwise. If the estimated rates of the windows are
+* much higher than those that make the prefilter slower (see pcac_probe), new contexts start with a bypass.
+*
+* @param pcac     The pcac object
+*/
+static void pcac_build_tables(PCAC* pcac) {
+	size_t i, j, c, len, n_long_buckets = 0;
+	unsigned char *prefix, bit, short_bits[PCAC_MAX_K] = {0};
+	uint16_t *entry, window;
+	uint32_t len32;
+	double rate, coverage, freq[256];
+	PcacBucket buckets[PCAC_N_BUCKETS];
+
+	pcac->k = pcac->max_len < PCAC_MAX_K ? pcac->max_len : PCAC_MAX_K;
+	memset(pcac->lo, 0, sizeof(pcac->lo));
+	memset(pcac->hi, 0, sizeof(pcac->hi));
+	memset(pcac->windows, 0, sizeof(pcac->windows));
+	memset(pcac->short_sets, 0, sizeof(pcac->short_sets));
+	memset(pcac->short_first, 0, sizeof(pcac->short_first));
+	memset(buckets, 0, sizeof(buckets));
+	pcac->long_buckets = 0;
+	pcac->filter = PCAC_FILTER_MASKS;
+	pcac->first_bypass = 0;
+	if (pcac->k == 0) return;
+
+	// the short buckets are the last bits, by the order of the lengths
+	for (i = 0; i < pcac->n_patterns; ++i) {
+		memcpy(&len32, pcac->prefixes + i * PCAC_PREFIX_SIZE + PCAC_MAX_K, sizeof(uint32_t));
+		if (len32 < pcac->k) short_bits[len32] = 1;
+	}
+	n_long_buckets = PCAC_N_BUCKETS;
+	for (len = pcac->k - 1; len > 0; --len) {
+		if (short_bits[len]) short_bits[len] = 1 << --n_long_buckets;
+	}
+	pcac->long_buckets = (1 << n_long_buckets) - 1;
+	pcac_estimate_freqs(pcac, freq);
+
+	for (i = 0; i < pcac->n_patterns; ++i) {
+		prefix = pcac->prefixes + i * PCAC_PREFIX_SIZE;
+		memcpy(&len32, prefix + PCAC_MAX_K, sizeof(uint32_t));
+		len = len32;
+		if (len >= pcac->k) {
+			bit = 1 << pcac_assign_bucket(buckets, n_long_buckets, freq, prefix, pcac->k);
+			entry = &pcac->windows[pcac_hash(prefix, pcac->k)];
+			window = len < UINT16_MAX ? len : UINT16_MAX;
+			if (*entry < window) *entry = window;
+		} else {
+			bit = short_bits[len];
+			set_add(pcac->short_sets[len - 1], pcac_hash(prefix, len));
+			set_add(pcac->short_first, prefix[0]);
+		}
+		for (j = 0; j < pcac->k; ++j) {
+			if (j < len) {
+				pcac->lo[j][prefix[j] & 0xf] |= bit;
+				pcac->hi[j][prefix[j] >> 4] |= bit;
+			} else {
+				// any character after a short pattern
+				for (c = 0; c < 16; ++c) {
+					pcac->lo[j][c] |= bit;
+					pcac->hi[j][c] |= bit;
+				}
+			}
+		}
+	}
+
+	if (pcac_estimate_masks_pass(pcac, freq) > PCAC_MAX_MASKS_PASS) {
+		pcac->filter = PCAC_FILTER_HASH;
+	}
+	pcac_estimate_windows(pcac, freq, &rate, &coverage);
+	if (rate > 2 * PCAC_MAX_WINDOWS_RATE || coverage > 2 * PCAC_MAX_COVERAGE) {
+		pcac->first_bypass = PCAC_MIN_BYPASS;
+	}
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Create new PCAC struct
+*
+* @return     A new dynamically allocated pcac object
+*/
+void* pcac_create() {
+	PCAC* pcac = (PCAC*)malloc(sizeof(PCAC));
+	if (pcac == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memset(pcac, 0, sizeof(PCAC));
+	pcac->simd_mask = CPU_FEATURES_ALL;
+	pcac->cac = cac_create();
+	pcac->ctx.cac = cac_new_context(pcac->cac);
+	pcac->ctx.bypass_len = PCAC_MIN_BYPASS;
+	return (void*)pcac;
+}
+
+/**
+* Add pattern to the pcac object
+*
+* Add the pattern to the exact algorithm, and keep its first characters and its length for the prefilter.
+*
+* @param obj      The pcac object
+* @param pat      The pattern to add
+* @param len      The length of the pattern
+* @param id       The id of the pattern
+*/
+void pcac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
+	PCAC* pcac = (PCAC*)obj;
+	unsigned char* prefix;
+	uint32_t len32;
+	if (len == 0) return;
+	cac_add_pattern(pcac->cac, pat, len, id);
+	if (pcac->n_patterns == pcac->capacity) {
+		pcac->capacity = pcac->capacity ? 2 * pcac->capacity : 1024;
+		pcac->prefixes = (unsigned char*)realloc(pcac->prefixes, pcac->capacity * PCAC_PREFIX_SIZE);
+		if (pcac->prefixes == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+	}
+	prefix = pcac->prefixes + pcac->n_patterns++ * PCAC_PREFIX_SIZE;
+	memset(prefix, 0, PCAC_PREFIX_SIZE);
+	memcpy(prefix, pat, len < PCAC_MAX_K ? len : PCAC_MAX_K);
+	len32 = len > UINT32_MAX ? UINT32_MAX : len;
+	memcpy(prefix + PCAC_MAX_K, &len32, sizeof(uint32_t));
+	if (len > pcac->max_len) pcac->max_len = len;
+}
+
+/**
+* Compile the Prefiltered Compact Aho-Corasick object.
+*
+* Build the prefilter tables, choose the prefilter function and compile the exact algorithm.
+*
+* @param obj     The pcac object
+*/
+void pcac_compile(void* obj) {
+	PCAC* pcac = (PCAC*)obj;
+	pcac_build_tables(pcac);
+	free(pcac->prefixes);
+	pcac->prefixes = NULL;
+	pcac->scan = pcac_select_scan(pcac);
+	pcac->ctx.bypass = pcac->first_bypass;
+	cac_compile(pcac->cac);
+}
+
+/**
+* Prefiltered Compact Aho-Corasick read block of characters from the stream function.
+*
+* The candidates of a chunk are on the stack, so the object isn't changed (only the context is).
+*
+* @param obj    The pcac object
+* @param ctx    The context of the stream
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void pcac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	const PCAC* pcac = (const PCAC*)obj;
+	PCACContext* context = (PCACContext*)ctx;
+	const unsigned char* ubuf = (const unsigned char*)buf;
+	unsigned char tmp[2 * (PCAC_MAX_K - 1)];
+	pattern_id_t replay[PCAC_MAX_K - 1];
+	size_t cands[PCAC_CHUNK]; // the candidates of the chunk being scanned
+	size_t k = pcac->k, h = context->hist_len;
+	size_t i, n, s, w, from, to, chunk_end, n_cands, n_windows, covered, pos = 0;
+	size_t region_end = context->remaining; // the open region is until region_end (not including)
+
+	if (k == 0) {
+		pcac_run(pcac, context, buf, &pos, 0, len, out);
+		return;
+	}
+
+	// the candidates that start in the history (at i - h) and have a window that ends in the block
+	n = len < k - 1 ? len : k - 1;
+	memcpy(tmp, context->hist, h);
+	memcpy(tmp + h, ubuf, n);
+	for (i = 0; i < h; ++i) {
+		w = pcac_window(pcac, tmp + i, h + n - i);
+		if (i + w <= h) continue;
+		if (region_end == 0 || context->region_start > context->offset - (h - i)) {
+			// the exact algorithm didn't read the history from this candidate
+			cac_reset_context(pcac->cac, context->cac);
+			cac_ctx_read_block(pcac->cac, context->cac, (const char*)tmp + i, h - i, replay);
+			context->region_start = context->offset - (h - i);
+		}
+		if (region_end < i + w - h) region_end = i + w - h;
+	}
+
+	// the candidates that start in the block (all the fingerprint in the block)
+	to = len + 1 > k ? len + 1 - k : 0;
+	for (from = 0; from < to; from = chunk_end) {
+		if (context->bypass) {
+			// every position is a candidate, with the window of the longest pattern
+			chunk_end = to - from > context->bypass ? from + context->bypass : to;
+			context->bypass -= chunk_end - from;
+			pcac_add_candidate(pcac, context, buf, &pos, &region_end, from, chunk_end - from - 1 + pcac->max_len, out);
+			pcac_run(pcac, context, buf, &pos, region_end, chunk_end, out);
+			continue;
+		}
+		chunk_end = to - from > PCAC_CHUNK ? from + PCAC_CHUNK : to;
+		n_cands = pcac->scan(pcac, ubuf, from, chunk_end, cands);
+		n_windows = covered = 0;
+		for (i = 0; i < n_cands; ++i) {
+			s = cands[i];
+			w = pcac_window(pcac, ubuf + s, k);
+			if (w) {
+				pcac_add_candidate(pcac, context, buf, &pos, &region_end, s, w, out);
+				++n_windows;
+				covered += w;
+			}
+		}
+		pcac_run(pcac, context, buf, &pos, region_end, chunk_end, out);
+		pcac_probe(context, chunk_end - from, n_windows, covered);
+	}
+
+	// the last k - 1 positions only for the short patterns that end in the block (checked again with the next block)
+	for (s = to; s < len; ++s) {
+		w = pcac_window(pcac, ubuf + s, len - s);
+		if (w) pcac_add_candidate(pcac, context, buf, &pos, &region_end, s, w, out);
+	}
+	pcac_run(pcac, context, buf, &pos, region_end, len, out);
+
+	context->remaining = region_end > len ? region_end - len : 0;
+	context->offset += len;
+	pcac_update_history(pcac, context, ubuf, len);
+}
+
+/**
+* Prefiltered Compact Aho-Corasick read next char in the stream function.
+*
+* @param obj    The pcac object
+* @param ctx    The context of the stream
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t pcac_ctx_read_char(void* obj, void* ctx, char c) {
+	pattern_id_t ret;
+	pcac_ctx_read_block(obj, ctx, &c, 1, &ret);
+	return ret;
+}
+
+/**
+* Prefiltered Compact Aho-Corasick read block of characters from the stream function (with the context of the object)
+*
+* @param obj    The pcac object
+* @param buf    The block of characters from the stream
+* @param len    The length of the block
+* @param out    Where to put the id of the longest pattern that have a match on every character
+*/
+void pcac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	pcac_ctx_read_block(obj, &((PCAC*)obj)->ctx, buf, len, out);
+}
+
+/**
+* Prefiltered Compact Aho-Corasick read next char in the stream function (with the context of the object)
+*
+* @param obj    The pcac object
+* @param c      The next character in the stream
+*
+* @return       The id of the longest pattern that have a match
+*/
+pattern_id_t pcac_read_char(void* obj, char c) {
+	pattern_id_t ret;
+	pcac_ctx_read_block(obj, &((PCAC*)obj)->ctx, &c, 1, &ret);
+	return ret;
+}
+
+/**
+* Prefiltered Compact Aho-Corasick get total memory function.
+*
+* @param obj     The pcac object
+*
+* @return        The total memory used for this object
+*/
+size_t pcac_total_mem(void* obj) {
+	if (obj == NULL) return 0;
+	PCAC* pcac = (PCAC*)obj;
+	return sizeof(PCAC) + cac_total_mem(pcac->cac) + cac_context_mem(pcac->cac, pcac->ctx.cac);
+}
+
+/**
+* Prefiltered Compact Aho-Corasick reset function (reset the object back to initial state)
+*
+* @param obj    The pcac object
+*/
+void pcac_reset(void* obj) {
+	pcac_reset_context(obj, &((PCAC*)obj)->ctx);
+}
+
+/**
+* Create new context for the compiled pcac object (the state of a single stream)
+*
+* @param obj    The pcac object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* pcac_new_context(void* obj) {
+	PCAC* pcac = (PCAC*)obj;
+	PCACContext* ctx = (PCACContext*)malloc(sizeof(PCACContext));
+	if (ctx == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	ctx->cac = cac_new_context(pcac->cac);
+	pcac_reset_context(obj, ctx);
+	return (void*)ctx;
+}
+
+/**
+* Reset a context of the pcac object back to the initial state
+*
+* @param obj    The pcac object
+* @param ctx    The context to reset
+*/
+void pcac_reset_context(void* obj, void* ctx) {
+	PCAC* pcac = (PCAC*)obj;
+	PCACContext* context = (PCACContext*)ctx;
+	cac_reset_context(pcac->cac, context->cac);
+	context->hist_len = 0;
+	context->offset = 0;
+	context->region_start = 0;
+	context->remaining = 0;
+	context->bypass = pcac->first_bypass;
+	context->bypass_len = PCAC_MIN_BYPASS;
+	context->probed = context->probed_windows = context->probed_covered = 0;
+}
+
+/**
+* Get the memory used for a context of the pcac object
+*
+* @param obj    The pcac object
+* @param ctx    The context
+*
+* @return       The memory used for the context (in bytes)
+*/
+size_t pcac_context_mem(void* obj, void* ctx) {
+	PCAC* pcac = (PCAC*)obj;
+	return sizeof(PCACContext) + cac_context_mem(pcac->cac, ((PCACContext*)ctx)->cac);
+}
+
+/**
+* Free a context of the pcac object
+*
+* @param obj    The pcac object
+* @param ctx    The context to free
+*/
+void pcac_free_context(void* obj, void* ctx) {
+	PCAC* pcac = (PCAC*)obj;
+	cac_free_context(pcac->cac, ((PCACContext*)ctx)->cac);
+	free(ctx);
+}
+
+/**
+* Free the memory of the pcac object (must be done after compilation).
+*
+* @param obj    The pcac object to free
+*/
+void pcac_free(void *obj) {
+	PCAC* pcac = (PCAC*)obj;
+	cac_free_context(pcac->cac, pcac->ctx.cac);
+	cac_free(pcac->cac);
+	free(pcac->prefixes);
+	free(pcac);
+}
+
+/**
+* Save the compiled pcac object to the cache file
+*
+* @param obj    The pcac object
+* @param w      The cache writer
+*/
+void pcac_save(void* obj, CacheWriter* w) {
+	PCAC* pcac = (PCAC*)obj;
+	uint64_t sizes[5] = {pcac->k, pcac->max_len, pcac->long_buckets, (uint64_t)pcac->filter, pcac->first_bypass};
+	cache_write(w, sizes, sizeof(sizes));
+	cache_write(w, pcac->lo, sizeof(pcac->lo));
+	cache_write(w, pcac->hi, sizeof(pcac->hi));
+	cache_write(w, pcac->windows, sizeof(pcac->windows));
+	cache_write(w, pcac->short_sets, sizeof(pcac->short_sets));
+	cache_write(w, pcac->short_first, sizeof(pcac->short_first));
+	cac_save(pcac->cac, w);
+}
+
+/**
+* Load the pcac object (saved with pcac_save) from the cache file
+*
+* @param obj    The newly created pcac object
+* @param r      The cache reader
+*/
+void pcac_load(void* obj, CacheReader* r) {
+	PCAC* pcac = (PCAC*)obj;
+	const uint64_t* sizes = (const uint64_t*)cache_read(r, 5 * sizeof(uint64_t));
+	pcac->k = sizes[0];
+	pcac->max_len = sizes[1];
+	pcac->long_buckets = sizes[2];
+	pcac->filter = (int)sizes[3];
+	pcac->first_bypass = sizes[4];
+	pcac->ctx.bypass = pcac->first_bypass;
+	memcpy(pcac->lo, cache_read(r, sizeof(pcac->lo)), sizeof(pcac->lo));
+	memcpy(pcac->hi, cache_read(r, sizeof(pcac->hi)), sizeof(pcac->hi));
+	memcpy(pcac->windows, cache_read(r, sizeof(pcac->windows)), sizeof(pcac->windows));
+	memcpy(pcac->short_sets, cache_read(r, sizeof(pcac->short_sets)), sizeof(pcac->short_sets));
+	memcpy(pcac->short_first, cache_read(r, sizeof(pcac->short_first)), sizeof(pcac->short_first));
+	pcac->scan = pcac_select_scan(pcac);
+	cac_load(pcac->cac, r);
+}
+
+/**
+* Set a parameter of a new pcac object (before any pattern was added)
+*
+* "simd=LEVEL" limits the prefilter to the instructions of LEVEL (see cpu_parse_simd), e.g. to compare it with the
+* scalar prefilter.
+*
+* @param obj      The pcac object
+* @param key      The name of the parameter
+* @param val      The value of the parameter
+*
+* @return         0 on success, -1 if the parameter isn't valid
+*/
+int pcac_set_param(void* obj, const char* key, const char* val) {
+	PCAC* pcac = (PCAC*)obj;
+	if (strcmp(key, "simd") == 0) {
+		return cpu_parse_simd(val, &pcac->simd_mask);
+	}
+	return -1;
+}
+
+/**
+* The mps registering function of the Prefiltered Compact Aho-Corasick Algorithm.
+*/
+void mps_pcac_register() {
+	mps_table[MPS_PCAC].name = "Prefiltered Compact Aho-Corasick";
+	mps_table[MPS_PCAC].short_name = "pcac";
+	mps_table[MPS_PCAC].create = pcac_create;
+	mps_table[MPS_PCAC].add_pattern = pcac_add_pattern;
+	mps_table[MPS_PCAC].compile = pcac_compile;
+	mps_table[MPS_PCAC].read_char = pcac_read_char;
+	mps_table[MPS_PCAC].read_block = pcac_read_block;
+	mps_table[MPS_PCAC].total_mem = pcac_total_mem;
+	mps_table[MPS_PCAC].reset = pcac_reset;
+	mps_table[MPS_PCAC].free = pcac_free;
+	mps_table[MPS_PCAC].save = pcac_save;
+	mps_table[MPS_PCAC].load = pcac_load;
+	mps_table[MPS_PCAC].new_context = pcac_new_context;
+	mps_table[MPS_PCAC].ctx_read_char = pcac_ctx_read_char;
+	mps_table[MPS_PCAC].ctx_read_block = pcac_ctx_read_block;
+	mps_table[MPS_PCAC].reset_context = pcac_reset_context;
+	mps_table[MPS_PCAC].context_mem = pcac_context_mem;
+	mps_table[MPS_PCAC].free_context = pcac_free_context;
+	mps_table[MPS_PCAC].set_param = pcac_set_param;
+}
@@ -0,0 +1,44 @@
+/**
+* Multi-Pattern Prefiltered Compact Aho-Corasick algorithm
+*/
+#ifndef MPPCAC_H
+#define MPPCAC_H
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mps.h"
+#include "PatternsTree.h"
+#include "cache.h"
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+void* pcac_create();
+void pcac_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
+void pcac_compile(void* obj);
+pattern_id_t pcac_read_char(void* obj, char c);
+void pcac_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
+size_t pcac_total_mem(void* obj);
+void pcac_reset(void* obj);
+void pcac_free(void *obj);
+void pcac_save(void* obj, CacheWriter* w);
+void pcac_load(void* obj, CacheReader* r);
+
+void* pcac_new_context(void* obj);
+pattern_id_t pcac_ctx_read_char(void* obj, void* ctx, char c);
+void pcac_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void pcac_reset_context(void* obj, void* ctx);
+size_t pcac_context_mem(void* obj, void* ctx);
+void pcac_free_context(void* obj, void* ctx);
+int pcac_set_param(void* obj, const char* key, const char* val);
+
+void mps_pcac_register();
+
+#endif // MPPCAC_H
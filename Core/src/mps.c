@@ -14,11 +14,23 @@
 #include "PatternsTree.h"
 #include "conf.h"
 #include "util.h"
+#include "cache.h"
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
 
 // include the algorithms
 #include "mpbg.h"
 #include "mpac.h"
 #include "mplmac.h"
+#include "mpcac.h"
+#include "mpsbg.h"
+#include "mppcac.h"
+#include "mphybrid.h"
+#include "mpdaac.h"
+
+// The number of characters that mps_ctx_scan reads with every ctx_read_block (its results are on the stack)
+#define MPS_SCAN_CHUNK 256
 
 
 /******************************************************************************
@@ -28,71 +40,99 @@
 
 MpsElem mps_table[MPS_SIZE];
 
-
 /******************************************************************************
 *		INNER FUNCTIONS
 ******************************************************************************/
 
 
+/**
+* Copy a string to a newly allocated string
+*
+* @param str      The string
+* @param len      The length of the string to copy
+*
+* @return         The new string (null terminated)
+*/
+static char* copy_string(const char* str, size_t len) {
+	char* ret = (char*) malloc(len + 1);
+	if (ret == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	return ret;
+}
+
 /**
 * Initialize the mps instances in the configuration.
 *
-* Currently create one instance per algorithm
+* The instances given with "-a" are already in the configuration (without objects), and if none was given,
+* there is one instance per algorithm (without parameters). The objects are created here, with their parameters.
+* The reliable instance is created too, unless it is skipped (MPS_NONE).
 *
 * @param conf     The configuration
 */
-void init_mps_instances(Conf* conf) {
+static void init_mps_instances(Conf* conf) {
 	size_t i;
-	conf->mps_instances = (MpsInstance*) malloc(MPS_SIZE * sizeof(MpsInstance));
-	conf->n_mps_instances = MPS_SIZE;
-	for (i = 0; i < MPS_SIZE; ++i) {
-		conf->mps_instances[i].algo = i;
-		conf->mps_instances[i].obj = mps_table[i].create();
+	if (conf->n_mps_instances == 0) {
+		conf->mps_instances = (MpsInstance*) malloc(MPS_SIZE * sizeof(MpsInstance));
+		if (conf->mps_instances == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		conf->n_mps_instances = MPS_SIZE;
+		for (i = 0; i < MPS_SIZE; ++i) {
+			mps_parse_instance(mps_table[i].short_name, &conf->mps_instances[i]);
+		}
+	}
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		conf->mps_instances[i].obj = mps_create_object(&conf->mps_instances[i]);
+	}
+	if (conf->reliable_mps_instance.algo != MPS_NONE) {
+		conf->reliable_mps_instance.obj = mps_create_object(&conf->reliable_mps_instance);
 	}
-	conf->reliable_mps_instance.algo = MPS_AC;
-	conf->reliable_mps_instance.obj = mps_table[MPS_AC].create();
 }
 
 /**
-* Add the pattern received to all mps instances (callback function for adding new pattern)
+* Record the pattern received, so it can be added to the instances later (callback function for adding new pattern)
 *
 * @param pconf      The configuration (in void pointer, since this is callback function)
 * @param pat        The pattern to add
 * @param len        The length of the pattern
 * @param id         The id of the pattern
 */
-void add_pattern_to_all_instances(void* pconf, char* pat, size_t len, pattern_id_t id) {
+static void record_pattern(void* pconf, char* pat, size_t len, pattern_id_t id) {
 	Conf* conf = (Conf*)pconf;
-	size_t i, n = conf->n_mps_instances;
-	int algo;
-	void* obj;
-	for (i = 0; i < n; ++i) {
-		algo = conf->mps_instances[i].algo;
-		obj = conf->mps_instances[i].obj;
-		mps_table[algo].add_pattern(obj, pat, len, id);
-	}
-	algo = conf->reliable_mps_instance.algo;
-	obj = conf->reliable_mps_instance.obj;
-	mps_table[algo].add_pattern(obj, pat, len, id);
+	patterns_list_add(&conf->patterns, pat, len, id->pattern_id, id);
+	if (conf->cache_file_name) cache_record_pattern(conf, pat, len, id);
 }
 
 /**
-* Compile all the mps instances in the configuration file.
+* Build an mps instance from the recorded patterns (add all of them, and compile)
 *
-* @param conf     The configuration
+* The two phases are measured separately (see measure_phase_start)
+*
+* @param conf     The configuration (the patterns are in conf->patterns)
+* @param inst     The instance
+* @param stats    The statistics of the instance (NULL if not measured)
 */
-void compile_all_instances(Conf* conf) {
-	size_t i, n = conf->n_mps_instances;
-	int algo;
-	void* obj;
-	for (i = 0; i < n; ++i) {
-		algo = conf->mps_instances[i].algo;
-		obj = conf->mps_instances[i].obj;
-		mps_table[algo].compile(obj);
+static void build_instance(Conf* conf, MpsInstance* inst, InstanceStats* stats) {
+	MpsElem* mps;
+	PatternsList* patterns = &conf->patterns;
+	size_t i;
+
+	if (inst->algo == MPS_NONE) return;
+	mps = &mps_table[inst->algo];
+	measure_phase_start(conf, stats ? &stats->build.add : NULL);
+	for (i = 0; i < patterns->n; ++i) {
+		mps->add_pattern(inst->obj, patterns_list_get(patterns, i), patterns->lens[i], patterns->ids[i]);
 	}
-	algo = conf->reliable_mps_instance.algo;
-	obj = conf->reliable_mps_instance.obj;
-	mps_table[algo].compile(obj);
+	measure_phase_stop(conf, stats ? &stats->build.add : NULL);
+
+	measure_phase_start(conf, stats ? &stats->build.compile : NULL);
+	mps->compile(inst->obj);
+	measure_phase_stop(conf, stats ? &stats->build.compile : NULL);
 }
 
 
@@ -101,15 +141,185 @@ void compile_all_instances(Conf* conf) {
 ******************************************************************************/
 
 
+/**
+* Find an algorithm by its name in the command line
+*
+* @param short_name   The name of the algorithm in the command line (e.g. "cac")
+*
+* @return             The algorithm (MPS_NONE if there is no such algorithm)
+*/
+int mps_find_algo(const char* short_name) {
+	int i;
+	for (i = 0; i < MPS_SIZE; ++i) {
+		if (strcmp(mps_table[i].short_name, short_name) == 0) return i;
+	}
+	return MPS_NONE;
+}
+
+/**
+* Parse a numeric value of an algorithm parameter (for the set_param functions)
+*
+* @param val      The value string
+* @param out      Where to put the value
+*
+* @return         0 on success, -1 if the value isn't a non-negative number
+*/
+int mps_parse_size(const char* val, size_t* out) {
+	char* end;
+	if (!isdigit((unsigned char)*val)) return -1;
+	errno = 0;
+	*out = strtoul(val, &end, 10);
+	return errno || *end != '\0' ? -1 : 0;
+}
+
+/**
+* Parse an instance from the command line, "name" or "name:key=val,key=val,..." (see "-a" in the usage)
+*
+* The object of the instance isn't created (see mps_create_object), so the parameters are checked only then.
+* The name "none" is the instance that doesn't exist (MPS_NONE, used to skip the reliable instance).
+*
+* @param spec     The instance string
+* @param inst     The instance to fill
+*
+* @return         0 on success, -1 if there is no algorithm with that name
+*/
+int mps_parse_instance(const char* spec, MpsInstance* inst) {
+	const char* colon = strchr(spec, ':');
+	size_t name_len = colon ? (size_t)(colon - spec) : strlen(spec);
+	char* short_name = copy_string(spec, name_len);
+	const char* name;
+
+	inst->obj = NULL;
+	inst->params = colon && colon[1] ? copy_string(colon + 1, strlen(colon + 1)) : NULL;
+	if (strcmp(short_name, "none") == 0 && inst->params == NULL) {
+		inst->algo = MPS_NONE;
+		inst->name = short_name;
+		return 0;
+	}
+	inst->algo = mps_find_algo(short_name);
+	free(short_name);
+	if (inst->algo == MPS_NONE) return -1;
+
+	// the name in the output, e.g. "Hybrid Compact Aho-Corasick & Breslauer-Galil (max_short=32)"
+	name = mps_table[inst->algo].name;
+	if (inst->params == NULL) {
+		inst->name = copy_string(name, strlen(name));
+	} else {
+		inst->name = (char*) malloc(strlen(name) + strlen(inst->params) + 4);
+		if (inst->name == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		sprintf(inst->name, "%s (%s)", name, inst->params);
+	}
+	return 0;
+}
+
+/**
+* Create the object of an instance, and set its parameters
+*
+* Exits with an error if a parameter isn't valid for the algorithm of the instance.
+*
+* @param inst     The instance
+*
+* @return         The new object (without patterns)
+*/
+void* mps_create_object(const MpsInstance* inst) {
+	MpsElem* mps = &mps_table[inst->algo];
+	void* obj = mps->create();
+	char *params, *param, *val, *save;
+
+	if (inst->params == NULL) return obj;
+	params = copy_string(inst->params, strlen(inst->params));
+	for (param = strtok_r(params, ",", &save); param; param = strtok_r(NULL, ",", &save)) {
+		val = strchr(param, '=');
+		if (val) *val++ = '\0';
+		if (val == NULL || mps->set_param == NULL || mps->set_param(obj, param, val) != 0) {
+			fprintf(stderr, "Error: invalid parameter %s%s%s for algorithm %s\n\n", param, val ? "=" : "",
+			        val ? val : "", mps->short_name);
+			print_usage_and_exit();
+		}
+	}
+	free(params);
+	return obj;
+}
+
+/**
+* Scan a block with a context of an object (see "ctx_scan" in MpsElem)
+*
+* Algorithms that don't implement ctx_scan are scanned with ctx_read_block, MPS_SCAN_CHUNK characters at a time
+* (and with ctx_read_char on MPS_SCAN_FIRST, so the context doesn't read after the first match).
+*
+* @param mps          The functions of the algorithm (which must implement contexts)
+* @param obj          The mps object
+* @param ctx          The context of the stream
+* @param buf          The block of characters from the stream
+* @param len          The length of the block
+* @param mode         The scan mode (MPS_SCAN_FIRST, MPS_SCAN_COUNT or MPS_SCAN_LIST)
+* @param matches      Where to put the matches (not used on MPS_SCAN_COUNT)
+* @param max_matches  The number of matches that can be put in matches
+*
+* @return             The number of matches
+*/
+size_t mps_ctx_scan(MpsElem* mps, void* obj, void* ctx, const char* buf, size_t len, int mode,
+                    MpsMatch* matches, size_t max_matches) {
+	pattern_id_t out[MPS_SCAN_CHUNK], id;
+	size_t i, j, n, count = 0;
+
+	if (mps->ctx_scan) return mps->ctx_scan(obj, ctx, buf, len, mode, matches, max_matches);
+	if (mode == MPS_SCAN_FIRST) {
+		for (i = 0; i < len; ++i) {
+			id = mps->ctx_read_char(obj, ctx, buf[i]);
+			if (id == null_pattern_id) continue;
+			if (max_matches) {
+				matches[0].pos = i;
+				matches[0].id = id;
+			}
+			return 1;
+		}
+		return 0;
+	}
+	for (i = 0; i < len; i += n) {
+		n = len - i < MPS_SCAN_CHUNK ? len - i : MPS_SCAN_CHUNK;
+		mps->ctx_read_block(obj, ctx, buf + i, n, out);
+		for (j = 0; j < n; ++j) {
+			if (out[j] == null_pattern_id) continue;
+			if (mode == MPS_SCAN_LIST && count < max_matches) {
+				matches[count].pos = i + j;
+				matches[count].id = out[j];
+			}
+			++count;
+		}
+	}
+	return count;
+}
+
 /**
 * Initialize the Multi-Pattern Search (mps) in the configuration
 *
+* If there is a cache file (which is up to date), the patterns tree and the instances are loaded from it,
+* otherwise they are built from the dictionary files (and saved to the cache file, if there is one)
+*
+* The patterns are recorded in conf->patterns while building the patterns tree (they are kept for reloading the
+* dictionaries, see "reload.h"), and then every instance is built in its turn (so the time, the perf counters and
+* the memory of adding the patterns & compiling are of that instance alone)
+*
 * @param conf     The configuration
 */
 void init_mps(Conf* conf) {
+	size_t i;
+
 	init_mps_instances(conf);
-	conf->patterns_tree = patterns_tree_build(conf, (void*)conf, add_pattern_to_all_instances);
-	compile_all_instances(conf);
+	init_measure(conf);
+	if (conf->cache_file_name && cache_load(conf)) return;
+
+	conf->patterns_tree = patterns_tree_build(conf, (void*)conf, record_pattern);
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		build_instance(conf, &conf->mps_instances[i], &conf->mps_instances_stats[i]);
+	}
+	build_instance(conf, &conf->reliable_mps_instance, NULL);
+
+	if (conf->cache_file_name) cache_save(conf);
 }
 
 /**
@@ -121,4 +331,10 @@ void mps_table_setup() {
 	mps_ac_register();
 	mps_bg_register();
 	mps_lmac_register();
+	mps_cac_register();
+	mps_pbg_register();
+	mps_sbg_register();
+	mps_pcac_register();
+	mps_hybrid_register();
+	mps_daac_register();
 }
\ No newline at end of file
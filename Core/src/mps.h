@@ -7,6 +7,8 @@
 
 
 #include "PatternsTree.h"
+#include <sys/types.h>
+#include <time.h>
 
 
 /******************************************************************************
@@ -15,15 +17,69 @@
 
 
 struct _Conf;
+struct cache_writer;
+struct cache_reader;
 
 // Multi-Pattern Search Algorithms
 enum {
 	MPS_AC = 0,   // Multi-Pattern Aho-Corasick
 	MPS_LMAC,     // Multi-Pattern Low-Memory Aho-Corasick
 	MPS_BG,       // Multi-Pattern Brausler-Galil
+	MPS_CAC,      // Multi-Pattern Compact Aho-Corasick
+	MPS_PBG,      // Parallel Multi-Pattern Brausler-Galil
+	MPS_SBG,      // Multi-Pattern Shared-Fingerprint Brausler-Galil
+	MPS_PCAC,     // Multi-Pattern Prefiltered Compact Aho-Corasick
+	MPS_HYBRID,   // Multi-Pattern Hybrid Compact Aho-Corasick & Brausler-Galil
+	MPS_DAAC,     // Multi-Pattern Double-Array Aho-Corasick
 	MPS_SIZE
 };
 
+// The algorithm of an instance that doesn't exist (e.g. the reliable instance, when it is skipped with "-r none")
+#define MPS_NONE (-1)
+
+// The maximal number of contexts read together by ctx_read_batch
+#define MPS_MAX_BATCH 16
+
+// The scan modes of ctx_scan (see "ctx_scan" in MpsElem)
+enum {
+	MPS_SCAN_FIRST = 0, // stop on the first match
+	MPS_SCAN_COUNT,     // only count the matches
+	MPS_SCAN_LIST       // list the matches
+};
+
+// The scan mode of the measured streams when they are read with read_block (see "--scan")
+#define MPS_SCAN_NONE (-1)
+
+/**
+* A match found by ctx_scan: the longest pattern that matched at buf[pos]
+*/
+typedef struct mps_match {
+	size_t        pos;
+	pattern_id_t  id;
+} MpsMatch;
+
+/**
+* A thread that an object reads with, besides the calling thread (see "threads" in MpsElem)
+*/
+typedef struct mps_thread {
+	clockid_t  clock; // the cpu-time clock of the thread (from pthread_getcpuclockid)
+	pid_t      tid;   // the kernel id of the thread (for perf_event_open)
+} MpsThread;
+
+/**
+* A change of the patterns of a compiled object (see "update" in MpsElem)
+*
+* The patterns after the change are in patterns, with their new ids (nodes in the new patterns tree).
+* The patterns that were added are patterns->ids[first_added], ..., patterns->ids[patterns->n - 1] (those which are
+* null_pattern_id are already in the list, and should be skipped), and the new id of every old pattern is
+* id_map[old_id->index] (null_pattern_id if the pattern was removed).
+*/
+typedef struct mps_update {
+	PatternsList  *patterns;
+	size_t         first_added;
+	pattern_id_t  *id_map;
+} MpsUpdate;
+
 /**
 * struct for holding an algorithm for multi-pattern search (hold its functions)
 *
@@ -41,6 +97,11 @@ enum {
 * 4. read the next character from the stream and return the id of the LONGEST pattern that
 *    had a match using "read char" (from longest patterns matches, we can get the other patterns)
 *
+*    Optionally, an algorithm can also implement "read_block", which read a whole block of characters
+*    from the stream and put in out[i] the id of the longest pattern that had a match at buf[i].
+*    calling "read_block" on a block is the same as calling "read_char" on every character of the block,
+*    but without the function call per character (algorithms that don't implement it, leave it NULL)
+*
 * 5. get the total memory that the object uses (not include memory that was freed before compilation)
 *    using "total_mem" (this function should be used on the object only after compilation).
 *
@@ -50,6 +111,49 @@ enum {
 * 
 * 7. free the data object using "free" (only used after compilation)
 *
+* Optionally, an algorithm can also implement "save" and "load", for the cache file (see "cache.h").
+* "save" write the compiled object to the cache file, and "load" fill a newly created object (without patterns)
+* with what "save" wrote, so it would be like the compiled object that was saved (instead of adding the patterns
+* and compiling). algorithms that don't implement them leave them NULL.
+*
+* Optionally, an algorithm can also separate the stream state from the compiled object, with contexts.
+* "new_context" create a context (the state of a single stream, e.g. a flow) for the compiled object,
+* and "ctx_read_char" & "ctx_read_block" read the stream of the context, like "read_char" & "read_block" read
+* the stream of the object. reading with a context doesn't change the object, so one compiled object can be
+* shared by many contexts, also on many threads (but every context is used by one thread at a time).
+* "reset_context" put the context in the initial state, "context_mem" return the memory used for the context,
+* and "free_context" free it (before the object is freed). algorithms that implement "new_context" must
+* implement all of them, and algorithms that don't, leave them NULL.
+*
+* An algorithm with contexts can also implement "ctx_read_batch", which read a block of every one of k independent
+* contexts (up to MPS_MAX_BATCH of them) together, like calling "ctx_read_block" on every context with its block.
+* reading the streams in lockstep lets the algorithm overlap their cache misses (the next states of the different
+* streams don't depend on each other), e.g. by prefetching the next state of every stream while reading the others.
+*
+* Optionally, an algorithm can also implement "set_param", which set a parameter of a newly created object (before
+* any pattern is added), given as the key and the value strings of "-a name:key=val,..." (see "init_mps"). it returns
+* 0 on success, and -1 if the key isn't a parameter of the algorithm or the value isn't valid for it.
+* algorithms without parameters leave it NULL.
+*
+* Optionally, an algorithm can also implement "update", which change the patterns of a compiled object in place
+* (add and remove patterns, and replace the ids of the others, see MpsUpdate), so the object acts like an object
+* built from the new patterns, without building it again. the given contexts of the object (and the context of the
+* object itself) keep their streams, so reading continues with the new patterns. algorithms that don't implement
+* it leave it NULL, and are built again with the new patterns instead (see "reload.h").
+*
+* Optionally, an algorithm with contexts can also implement "ctx_scan", which read a block with a context like
+* "ctx_read_block", but instead of the id on every character, it only report the characters with a match (those
+* that read_block would have put anything but null_pattern_id in), so nothing is written while nothing matches.
+* with MPS_SCAN_FIRST, it stops right after the first match (the context has read the block up to and including
+* it) and put it in matches[0], with MPS_SCAN_COUNT it only counts the matches, and with MPS_SCAN_LIST it put the
+* first max_matches matches in matches (by their order in the block). it returns the number of matches (0 or 1 with
+* MPS_SCAN_FIRST). algorithms that don't implement it leave it NULL, and "mps_ctx_scan" scans with ctx_read_block.
+*
+* Optionally, an algorithm whose "read_block" also reads on threads of its own (e.g. the shards of the parallel
+* mpbg) implements "threads", which put the first max_threads of these threads in threads, and returns their number.
+* the measurement adds their cpu time and perf counters to those of the calling thread, so the time of the algorithm
+* is the cpu time of all its threads. algorithms that read only on the calling thread leave it NULL.
+*
 * example:
 *
 *   MpsElem mps; // initialized to some algorithm
@@ -65,41 +169,100 @@ enum {
 *   match = mps->read_char(obj, 'e');
 *   match = mps->read_char(obj, 'a');
 *   match = mps->read_char(obj, 'm');
+*   pattern_id_t matches[6];
+*   if (mps->read_block) mps->read_block(obj, "stream", 6, matches);
 *   printf("total memory used: %lu\n", mps->total_mem(obj));
+*   if (mps->new_context) {
+*     void* flow = mps->new_context(obj);
+*     match = mps->ctx_read_char(obj, flow, 'S');
+*     mps->ctx_read_block(obj, flow, "tream", 5, matches);
+*     if (mps->ctx_read_batch) {
+*       void* flows[2] = {flow, other_flow};
+*       const char* bufs[2] = {"first", "second"};
+*       size_t lens[2] = {5, 6};
+*       pattern_id_t* outs[2] = {matches, other_matches};
+*       mps->ctx_read_batch(obj, flows, bufs, lens, outs, 2);
+*     }
+*     MpsMatch first;
+*     if (mps_ctx_scan(mps, obj, flow, "stream", 6, MPS_SCAN_FIRST, &first, 1)) printf("match at %lu\n", first.pos);
+*     mps->free_context(obj, flow);
+*   }
 *   mps->free(obj);
 */
 typedef struct {
 	char* name;
+	char* short_name; // the name of the algorithm in the command line (e.g. "-a cac")
 	void* (*create)(void);
 	void (*add_pattern)(void*, char*, size_t, pattern_id_t);
 	void (*compile)(void*);
 	pattern_id_t (*read_char)(void*, char);
+	void (*read_block)(void*, const char*, size_t, pattern_id_t*); // optional (can be NULL)
 	size_t (*total_mem)(void*);
 	void (*reset)(void*);
 	void (*free)(void*);
+	void (*save)(void*, struct cache_writer*); // optional (can be NULL)
+	void (*load)(void*, struct cache_reader*); // optional (can be NULL)
+	void* (*new_context)(void*); // optional (can be NULL), and so are the other context functions
+	pattern_id_t (*ctx_read_char)(void*, void*, char);
+	void (*ctx_read_block)(void*, void*, const char*, size_t, pattern_id_t*);
+	void (*reset_context)(void*, void*);
+	size_t (*context_mem)(void*, void*);
+	void (*free_context)(void*, void*);
+	void (*ctx_read_batch)(void*, void**, const char**, const size_t*, pattern_id_t**, size_t); // optional (can be NULL)
+	void (*update)(void*, const MpsUpdate*, void**, size_t); // optional (can be NULL)
+	int (*set_param)(void*, const char*, const char*); // optional (can be NULL)
+	size_t (*ctx_scan)(void*, void*, const char*, size_t, int, MpsMatch*, size_t); // optional (can be NULL)
+	size_t (*threads)(void*, MpsThread*, size_t); // optional (can be NULL)
 } MpsElem;
 
 /**
 * mps instance.
 *
 * In the configuration struct there is a list of mps instances, and on them we do the tests.
-* note that there can be more than one instance per algorithm, or algorithms without instances.
-* (the init_mps function is currently responsible for creating the instances according to the algorithms)
+* note that there can be more than one instance per algorithm (with different parameters), or algorithms without
+* instances. the instances are chosen with "-a" (see mps_parse_instance), and without it there is one instance
+* per algorithm.
 */
 typedef struct {
 	void *obj;
 	int   algo;
+	char *name;   // the name of the instance in the output (the algorithm name, and its parameters if it has)
+	char *params; // the parameters of the instance, "key=val,..." (NULL if it has none)
 } MpsInstance;
 
 extern MpsElem mps_table[MPS_SIZE]; // definition in .c file
 
 
+/******************************************************************************
+*		INLINE FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Get the id of a pattern after an update
+*
+* @param update   The update
+* @param id       The id of the pattern before the update (can be null_pattern_id)
+*
+* @return         The id of the pattern after the update (null_pattern_id if it was removed)
+*/
+static inline pattern_id_t mps_update_id(const MpsUpdate* update, pattern_id_t id) {
+	return id == null_pattern_id ? null_pattern_id : update->id_map[id->index];
+}
+
+
 /******************************************************************************
 *		API FUNCTIONS
 ******************************************************************************/
 
 
 void mps_table_setup();
+int mps_find_algo(const char* short_name);
+int mps_parse_size(const char* val, size_t* out);
+int mps_parse_instance(const char* spec, MpsInstance* inst);
+void* mps_create_object(const MpsInstance* inst);
+size_t mps_ctx_scan(MpsElem* mps, void* obj, void* ctx, const char* buf, size_t len, int mode,
+                    MpsMatch* matches, size_t max_matches);
 void init_mps(struct _Conf* conf);
 
 
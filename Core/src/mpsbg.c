@@ -0,0 +1,809 @@
+/**
+* Multi-Pattern Shared-Fingerprint Breslauer-Galil Algorithm Implementation.
+*
+* In "mpbg.c" every pattern has its own Breslauer-Galil object, so the same fingerprint of the stream is
+* computed again for every pattern on every character. Here all the patterns share one random r,
+* so there is only one cumulative fingerprint of the stream, and the stages of all the patterns are checked
+* together.
+*
+* Definitions:
+*
+* The stages of a pattern of length n are its prefixes of lengths base, 2*base, 4*base, ... (while shorter than n)
+* and n itself (base is SBG_BASE_LENGTH, so every pattern longer than BG_SHORT_PATTERN_LENGTH has at least 2 stages).
+* The stages of all the patterns form a tree (a stage node is a child of the node of the previous stage),
+* where patterns with the same prefix share the nodes of that prefix. All the nodes are saved in one hash table,
+* where the key of a node is (parent node, length, fingerprint of the prefix), so checking whether a block of
+* the stream is a child of some node is a single lookup.
+*
+* A Viable Occurance (VO) is a position in the stream with a node whose prefix match the stream from that position.
+* On every character we look up the last base characters as a child of the root (a new VO in the first stage),
+* and every VO is checked against every length of the children of its node exactly when the stream reaches the end
+* of that length. Those checks are scheduled in a timing wheel (a slot for every position in the next max_len
+* positions), so on every character we only handle the VOs whose check ends on that character.
+* A VO that match a child becomes a VO of the child, and when the child is a whole pattern, we have a match.
+*
+* Since at most one node of every length can match the stream from a position, the number of checks per
+* character is bounded by the number of stages (and not by the number of patterns).
+*
+* To compute the fingerprint of any block in the last max_len characters, we keep a ring of the cumulative
+* fingerprints (fp(stream[0..pos-1])) and of r^-pos for the last max_len positions.
+*
+* The short patterns (not longer than BG_SHORT_PATTERN_LENGTH) are not in the tree, all of them are put in one
+* Low-Memory Aho-Corasick object (as in "mpbg.c"), which is used only when there is no long match
+* (a short match is always shorter than any long match).
+*
+* The stages tree and the hash table are never changed while reading, the state of every stream (the VOs, the wheel,
+* the rings and the cumulative fingerprint) is in a context, so many streams can share the compiled object.
+* They contain no pointers (only the ids of the nodes), so they are saved to the cache file as they are, with the
+* shared r (see sbg_save).
+*/
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "mpsbg.h"
+#include "mplmac.h"
+#include "arena.h"
+#include <stdint.h>
+#include <time.h>
+
+
+/******************************************************************************************************
+*		DEFINITIONS
+******************************************************************************************************/
+
+
+// The length of the first stage (must not be longer than BG_SHORT_PATTERN_LENGTH)
+#define SBG_BASE_LENGTH BG_SHORT_PATTERN_LENGTH
+
+// Index for no node / no event
+#define SBG_NONE UINT32_MAX
+
+// The root node (the parent of all the first stage nodes)
+#define SBG_ROOT 0
+
+/**
+* struct used to save the patterns (used BEFORE sbg compilation)
+*/
+typedef struct sbg_pattern_list {
+	struct sbg_pattern_list *next;
+	char                    *pat;
+	size_t                   len;
+	pattern_id_t             id;
+} SBGPatternList;
+
+/**
+* struct for a node in the stages tree
+*/
+typedef struct {
+	pattern_id_t id;           // the id of the pattern which this node is all of (null_pattern_id if none)
+	uint32_t     child_lens;   // the index in lens of the first length of the children of this node
+	uint32_t     n_child_lens; // the number of different lengths of the children of this node
+} SBGNode;
+
+/**
+* struct for an entry in the nodes hash table (node is SBG_NONE for empty entry)
+*/
+typedef struct {
+	fingerprint_t fp;
+	uint32_t      parent;
+	uint32_t      len;
+	uint32_t      node;
+} SBGHashEntry;
+
+/**
+* struct for a scheduled check of a VO
+*
+* The VO is the position start with the node, and it should be checked against the child-th length of the
+* children of the node (when the stream reach start + length - 1)
+*/
+typedef struct {
+	pos_t    start;
+	uint32_t node;
+	uint32_t child;
+	uint32_t next;  // the next event in the same wheel slot (or in the free events list)
+} SBGEvent;
+
+/**
+* struct for a context of sbg object (the state of a single stream)
+*/
+typedef struct {
+	void             *shorts;        // the context of the short patterns lmac object
+
+	SBGEvent         *events;        // pool of events
+	size_t            n_events;      // the number of events used from the pool
+	size_t            events_size;   // the number of events allocated in the pool
+	uint32_t          free_events;   // list of freed events
+	uint32_t         *wheel;         // the first event of every slot (the slot of position pos is pos & window_mask)
+
+	fingerprint_t    *ring_fp;       // the cumulative fingerprint before every position (fp(stream[0..pos-1]))
+	field_t          *ring_inv;      // r^-pos for every position
+
+	FieldVal          current_r;     // r^current_pos
+	fingerprint_t     current_fp;    // fp(stream[0..current_pos-1])
+	pos_t             current_pos;
+} SBGContext;
+
+/**
+* struct for sbg object
+*/
+typedef struct {
+	SBGPatternList   *patterns;      // the long patterns (before compilation)
+	void             *shorts;        // lmac object of the short patterns
+
+	SBGNode          *nodes;         // the stages tree (nodes[SBG_ROOT] is the root)
+	size_t            n_nodes;
+	uint32_t         *lens;          // the lengths of the children of all the nodes (sorted for every node)
+	size_t            n_lens;
+	SBGHashEntry     *table;         // the nodes hash table
+	size_t            table_mask;    // the size of the table - 1 (the size is power of 2)
+
+	size_t            window_mask;   // the size of the wheel and the rings - 1 (the size is power of 2 > max_len)
+
+	FieldVal          r;
+	size_t            max_len;       // the length of the longest pattern
+
+	SBGContext        ctx;           // the context used by sbg_read_char & sbg_read_block
+
+	Arena             build;         // arena for the patterns list (freed at the end of compilation)
+	Arena             mem;           // arena for the stages tree and the hash table
+} SBGStruct;
+
+
+/******************************************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************************************/
+
+
+/**
+* Allocate memory, and exit on failure
+*
+* @param size    The size to allocate
+*
+* @return        The allocated memory
+*/
+static void* sbg_malloc(size_t size) {
+	void* ret = malloc(size);
+	if (ret == NULL && size != 0) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	return ret;
+}
+
+/**
+* Get the smallest power of 2 which is larger than x
+*/
+static size_t sbg_pow2_above(size_t x) {
+	size_t ret = 1;
+	while (ret <= x) ret <<= 1;
+	return ret;
+}
+
+/**
+* Hash a key of the nodes hash table
+*/
+static inline size_t sbg_hash(uint32_t parent, uint32_t len, fingerprint_t fp) {
+	uint64_t h = (fp ^ ((uint64_t)parent << 32) ^ len) * 0x9E3779B97F4A7C15ull;
+	return (size_t)(h >> 29);
+}
+
+/**
+* Find the node with the given key in the nodes hash table
+*
+* @param sbg      The sbg object
+* @param parent   The parent of the node
+* @param len      The length of the node
+* @param fp       The fingerprint of the node prefix
+*
+* @return         The node, or SBG_NONE if not exist
+*/
+static inline uint32_t sbg_lookup(const SBGStruct* sbg, uint32_t parent, uint32_t len, fingerprint_t fp) {
+	size_t mask = sbg->table_mask, i = sbg_hash(parent, len, fp) & mask;
+	SBGHashEntry* e;
+	while ((e = &sbg->table[i])->node != SBG_NONE) {
+		if (e->fp == fp && e->parent == parent && e->len == len) {
+			return e->node;
+		}
+		i = (i + 1) & mask;
+	}
+	return SBG_NONE;
+}
+
+/**
+* Find the node with the given key in the nodes hash table, and create it if not exist
+*
+* The table must have enough room for the new node, and so must the nodes array.
+*
+* @param sbg      The sbg object
+* @param parent   The parent of the node
+* @param len      The length of the node
+* @param fp       The fingerprint of the node prefix
+* @param created  Set to 1 if the node was created, 0 otherwise
+*
+* @return         The node
+*/
+static uint32_t sbg_insert(SBGStruct* sbg, uint32_t parent, uint32_t len, fingerprint_t fp, int* created) {
+	size_t mask = sbg->table_mask, i = sbg_hash(parent, len, fp) & mask;
+	SBGHashEntry* e;
+	while ((e = &sbg->table[i])->node != SBG_NONE) {
+		if (e->fp == fp && e->parent == parent && e->len == len) {
+			*created = 0;
+			return e->node;
+		}
+		i = (i + 1) & mask;
+	}
+	e->fp = fp;
+	e->parent = parent;
+	e->len = len;
+	e->node = sbg->n_nodes++;
+	sbg->nodes[e->node].id = null_pattern_id;
+	*created = 1;
+	return e->node;
+}
+
+/**
+* Compare two (parent, length) pairs (for sorting the children lengths)
+*/
+static int sbg_cmp_edges(const void* a, const void* b) {
+	const uint32_t *x = (const uint32_t*)a, *y = (const uint32_t*)b;
+	if (x[0] != y[0]) return x[0] < y[0] ? -1 : 1;
+	if (x[1] != y[1]) return x[1] < y[1] ? -1 : 1;
+	return 0;
+}
+
+/**
+* Get the number of stages of a (long) pattern
+*/
+static size_t sbg_n_stages(size_t n) {
+	size_t len, ret = 1;
+	for (len = SBG_BASE_LENGTH; len < n; len <<= 1) ++ret;
+	return ret;
+}
+
+/**
+* Build the stages tree of the long patterns (and the children lengths of every node)
+*
+* @param sbg        The sbg object
+* @param n_stages   The total number of stages of all the long patterns
+*/
+static void sbg_build_tree(SBGStruct* sbg, size_t n_stages) {
+	SBGPatternList* cur;
+	uint32_t *edges, parent, node;
+	size_t i, j, len, done, n_edges = 0;
+	fingerprint_t fp;
+	field_t rn;
+	int created;
+
+	sbg->nodes = (SBGNode*)arena_alloc(&sbg->mem, (n_stages + 1) * sizeof(SBGNode));
+	sbg->table_mask = sbg_pow2_above(2 * n_stages) - 1;
+	sbg->table = (SBGHashEntry*)arena_alloc(&sbg->mem, (sbg->table_mask + 1) * sizeof(SBGHashEntry));
+	for (i = 0; i <= sbg->table_mask; ++i) {
+		sbg->table[i].node = SBG_NONE;
+	}
+	edges = (uint32_t*)arena_alloc(&sbg->build, 2 * n_stages * sizeof(uint32_t));
+	sbg->nodes[SBG_ROOT].id = null_pattern_id;
+	sbg->n_nodes = 1;
+
+	for (cur = sbg->patterns; cur; cur = cur->next) {
+		parent = SBG_ROOT;
+		len = SBG_BASE_LENGTH;
+		fp = 0;
+		rn = 1;
+		done = 0;
+		while (1) {
+			for (; done < len; ++done) {
+				fp = field_mod_add(fp, field_mod_mul(field_from_char(cur->pat[done]), rn));
+				rn = field_mod_mul(rn, sbg->r.val);
+			}
+			node = sbg_insert(sbg, parent, len, fp, &created);
+			if (created) {
+				edges[2 * n_edges] = parent;
+				edges[2 * n_edges + 1] = len;
+				++n_edges;
+			}
+			if (len == cur->len) {
+				sbg->nodes[node].id = cur->id;
+				break;
+			}
+			parent = node;
+			len = 2 * len < cur->len ? 2 * len : cur->len;
+		}
+	}
+
+	// the children lengths of every node are the distinct lengths of the edges from it (sorted)
+	qsort(edges, n_edges, 2 * sizeof(uint32_t), sbg_cmp_edges);
+	sbg->lens = (uint32_t*)arena_alloc(&sbg->mem, n_edges * sizeof(uint32_t));
+	sbg->n_lens = 0;
+	for (i = 0; i < sbg->n_nodes; ++i) {
+		sbg->nodes[i].child_lens = 0;
+		sbg->nodes[i].n_child_lens = 0;
+	}
+	for (i = 0; i < n_edges; i = j) {
+		parent = edges[2 * i];
+		sbg->nodes[parent].child_lens = sbg->n_lens;
+		for (j = i; j < n_edges && edges[2 * j] == parent; ++j) {
+			if (j == i || edges[2 * j + 1] != edges[2 * j - 1]) {
+				sbg->lens[sbg->n_lens++] = edges[2 * j + 1];
+				sbg->nodes[parent].n_child_lens++;
+			}
+		}
+	}
+}
+
+/**
+* Get the fingerprint of the stream from position start until the current position (including)
+*/
+static inline fingerprint_t sbg_window_fp(const SBGStruct* sbg, const SBGContext* ctx, pos_t start) {
+	size_t i = start & sbg->window_mask;
+	fingerprint_t prefix_fp = ctx->ring_fp[i];
+	fingerprint_t all_fp = ctx->current_fp;
+	return field_mod_mul(field_mod_sub(all_fp, prefix_fp), ctx->ring_inv[i]);
+}
+
+/**
+* Schedule the check of a VO against the child-th length of the children of its node
+*
+* @param sbg      The sbg object
+* @param ctx      The context of the stream
+* @param ev       The event to use for the check
+* @param start    The position of the VO
+* @param node     The node of the VO
+* @param child    The index of the length (in the children lengths of the node) to check
+*/
+static inline void sbg_schedule(const SBGStruct* sbg, SBGContext* ctx, uint32_t ev, pos_t start, uint32_t node, uint32_t child) {
+	SBGEvent* e = &ctx->events[ev];
+	size_t slot = (start + sbg->lens[sbg->nodes[node].child_lens + child] - 1) & sbg->window_mask;
+	e->start = start;
+	e->node = node;
+	e->child = child;
+	e->next = ctx->wheel[slot];
+	ctx->wheel[slot] = ev;
+}
+
+/**
+* Add new VO (if its node has children)
+*
+* @param sbg      The sbg object
+* @param ctx      The context of the stream
+* @param start    The position of the VO
+* @param node     The node of the VO
+*/
+static inline void sbg_add_vo(const SBGStruct* sbg, SBGContext* ctx, pos_t start, uint32_t node) {
+	uint32_t ev;
+	if (sbg->nodes[node].n_child_lens == 0) return;
+	if (ctx->free_events != SBG_NONE) {
+		ev = ctx->free_events;
+		ctx->free_events = ctx->events[ev].next;
+	} else {
+		if (ctx->n_events == ctx->events_size) {
+			ctx->events_size = ctx->events_size ? 2 * ctx->events_size : 64;
+			ctx->events = (SBGEvent*)realloc(ctx->events, ctx->events_size * sizeof(SBGEvent));
+			if (ctx->events == NULL) {
+				perror("failed to allocate memory");
+				FatalExit();
+			}
+		}
+		ev = ctx->n_events++;
+	}
+	sbg_schedule(sbg, ctx, ev, start, node, 0);
+}
+
+/**
+* Read a character with the long patterns
+*
+* @param sbg      The sbg object
+* @param ctx      The context of the stream
+* @param c        The char arrived from the stream
+* @param longest  Set to the length of the longest match (0 if none)
+*
+* @return         The id of the longest long pattern matched
+*/
+static inline pattern_id_t sbg_read_long(SBGStruct* sbg, SBGContext* ctx, unsigned char c, size_t* longest) {
+	pos_t pos = ctx->current_pos;
+	size_t slot = pos & sbg->window_mask, len;
+	uint32_t ev, next, child;
+	SBGEvent* e;
+	pattern_id_t ret = null_pattern_id;
+
+	*longest = 0;
+	ctx->ring_fp[slot] = ctx->current_fp;
+	ctx->ring_inv[slot] = ctx->current_r.inv;
+	ctx->current_fp = field_mod_add(ctx->current_fp, field_mod_mul(c, ctx->current_r.val));
+	field_mul(&ctx->current_r, &ctx->current_r, &sbg->r);
+
+	// the checks that end on this character (the new VOs are always scheduled to later positions)
+	ev = ctx->wheel[slot];
+	ctx->wheel[slot] = SBG_NONE;
+	while (ev != SBG_NONE) {
+		e = &ctx->events[ev];
+		next = e->next;
+		len = sbg->lens[sbg->nodes[e->node].child_lens + e->child];
+		child = sbg_lookup(sbg, e->node, len, sbg_window_fp(sbg, ctx, e->start));
+		if (child != SBG_NONE) {
+			if (sbg->nodes[child].id != null_pattern_id && len > *longest) {
+				*longest = len;
+				ret = sbg->nodes[child].id;
+			}
+			sbg_add_vo(sbg, ctx, e->start, child);
+			e = &ctx->events[ev]; // the events may be reallocated
+		}
+		// the VO remains in its node until checked against all the lengths of its children
+		if (e->child + 1 < sbg->nodes[e->node].n_child_lens) {
+			sbg_schedule(sbg, ctx, ev, e->start, e->node, e->child + 1);
+		} else {
+			e->next = ctx->free_events;
+			ctx->free_events = ev;
+		}
+		ev = next;
+	}
+
+	// new VO in the first stage
+	if (pos + 1 >= SBG_BASE_LENGTH) {
+		child = sbg_lookup(sbg, SBG_ROOT, SBG_BASE_LENGTH, sbg_window_fp(sbg, ctx, pos + 1 - SBG_BASE_LENGTH));
+		if (child != SBG_NONE) {
+			sbg_add_vo(sbg, ctx, pos + 1 - SBG_BASE_LENGTH, child);
+		}
+	}
+	ctx->current_pos++;
+	return ret;
+}
+
+/**
+* Initialize a context of the compiled sbg object (in the initial state)
+*
+* @param sbg      The sbg object
+* @param ctx      The context to initialize
+*/
+static void sbg_init_context(SBGStruct* sbg, SBGContext* ctx) {
+	size_t window = sbg->window_mask + 1;
+	ctx->shorts = lmac_new_context(sbg->shorts);
+	ctx->events = NULL;
+	ctx->events_size = 0;
+	ctx->wheel = (uint32_t*)sbg_malloc(window * sizeof(uint32_t));
+	ctx->ring_fp = (fingerprint_t*)sbg_malloc(window * sizeof(fingerprint_t));
+	ctx->ring_inv = (field_t*)sbg_malloc(window * sizeof(field_t));
+	sbg_reset_context(sbg, ctx);
+}
+
+/**
+* Free the buffers of a context of sbg object (without the context struct itself)
+*
+* @param sbg      The sbg object
+* @param ctx      The context
+*/
+static void sbg_destroy_context(SBGStruct* sbg, SBGContext* ctx) {
+	if (ctx->shorts) lmac_free_context(sbg->shorts, ctx->shorts);
+	free(ctx->events);
+	free(ctx->wheel);
+	free(ctx->ring_fp);
+	free(ctx->ring_inv);
+}
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+/**
+* Create the sbg object
+*/
+void* sbg_create(void) {
+	SBGStruct* ret = (SBGStruct*)sbg_malloc(sizeof(SBGStruct));
+	memset(ret, 0, sizeof(SBGStruct));
+	ret->shorts = lmac_create();
+	return (void*)ret;
+}
+
+/**
+* Add pattern to the sbg struct (the long patterns are saved until compilation)
+*
+* @param obj      The sbg object to work on
+* @param pat      The pattern to add
+* @param len      The length of the pattern
+* @param id       The id of the pattern
+*/
+void sbg_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	SBGPatternList* patInf;
+	if (len <= BG_SHORT_PATTERN_LENGTH) {
+		lmac_add_pattern(sbg->shorts, pat, len, id);
+		return;
+	}
+	patInf = (SBGPatternList*)arena_alloc(&sbg->build, sizeof(SBGPatternList));
+	patInf->pat = (char*)arena_alloc(&sbg->build, len);
+	memcpy(patInf->pat, pat, len);
+	patInf->len = len;
+	patInf->id = id;
+	patInf->next = sbg->patterns;
+	sbg->patterns = patInf;
+}
+
+/**
+* Compile the sbg struct
+*
+* Choose the shared r, build the stages tree of the long patterns, compile the short patterns,
+* and initialize the context of the object
+*
+* @param obj      The sbg object
+*/
+void sbg_compile(void* obj) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	SBGPatternList *cur;
+	size_t n_stages = 0;
+
+	srand(time(NULL));
+	sbg->r.val = field_random();
+	sbg->r.inv = calculate_inverse(sbg->r.val, FIELD_P);
+
+	for (cur = sbg->patterns; cur; cur = cur->next) {
+		n_stages += sbg_n_stages(cur->len);
+		if (cur->len > sbg->max_len) sbg->max_len = cur->len;
+	}
+	lmac_compile(sbg->shorts);
+	sbg_build_tree(sbg, n_stages);
+
+	sbg->window_mask = sbg_pow2_above(sbg->max_len) - 1;
+
+	// free the patterns list (and the edges used to build the tree)
+	arena_free(&sbg->build);
+	sbg->patterns = NULL;
+	sbg_init_context(sbg, &sbg->ctx);
+}
+
+/**
+* The sbg reading character function
+*
+* @param obj     The sbg object
+* @param ctx     The context of the stream
+* @param c       The char arrived from the stream
+*
+* @return        The id of the longest pattern matched
+*/
+pattern_id_t sbg_ctx_read_char(void* obj, void* ctx, char c) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	SBGContext* context = (SBGContext*)ctx;
+	size_t longest;
+	pattern_id_t long_id = sbg_read_long(sbg, context, (unsigned char)c, &longest);
+	pattern_id_t short_id = lmac_ctx_read_char(sbg->shorts, context->shorts, c);
+	return long_id != null_pattern_id ? long_id : short_id;
+}
+
+/**
+* The sbg reading block of characters function
+*
+* @param obj     The sbg object
+* @param ctx     The context of the stream
+* @param buf     The block of characters from the stream
+* @param len     The length of the block
+* @param out     Where to put the id of the longest pattern matched on every character
+*/
+void sbg_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	SBGContext* context = (SBGContext*)ctx;
+	size_t j, longest;
+	pattern_id_t id;
+	lmac_ctx_read_block(sbg->shorts, context->shorts, buf, len, out);
+	for (j = 0; j < len; ++j) {
+		id = sbg_read_long(sbg, context, (unsigned char)buf[j], &longest);
+		if (id != null_pattern_id) out[j] = id;
+	}
+}
+
+/**
+* The sbg reading character function (with the context of the object)
+*
+* @param obj     The sbg object
+* @param c       The char arrived from the stream
+*
+* @return        The id of the longest pattern matched
+*/
+pattern_id_t sbg_read_char(void* obj, char c) {
+	return sbg_ctx_read_char(obj, &((SBGStruct*)obj)->ctx, c);
+}
+
+/**
+* The sbg reading block of characters function (with the context of the object)
+*
+* @param obj     The sbg object
+* @param buf     The block of characters from the stream
+* @param len     The length of the block
+* @param out     Where to put the id of the longest pattern matched on every character
+*/
+void sbg_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out) {
+	sbg_ctx_read_block(obj, &((SBGStruct*)obj)->ctx, buf, len, out);
+}
+
+/**
+* The sbg total memory function
+*
+* @param obj    The sbg object
+*
+* @return       The total memory allocated for this object
+*/
+size_t sbg_total_mem(void* obj) {
+	if (obj == NULL) return 0;
+	SBGStruct* sbg = (SBGStruct*)obj;
+	size_t total_mem = sizeof(SBGStruct) - sizeof(SBGContext);
+	total_mem += lmac_total_mem(sbg->shorts);
+	total_mem += arena_total_mem(&sbg->mem); // the stages tree and the hash table
+	total_mem += sbg_context_mem(sbg, &sbg->ctx);
+	return total_mem;
+}
+
+/**
+* The sbg reset function (returning to initial state)
+*
+* @param obj    The sbg object
+*/
+void sbg_reset(void* obj) {
+	sbg_reset_context(obj, &((SBGStruct*)obj)->ctx);
+}
+
+/**
+* Create new context for the compiled sbg object (the state of a single stream)
+*
+* @param obj    The sbg object
+*
+* @return       A new dynamically allocated context, in the initial state
+*/
+void* sbg_new_context(void* obj) {
+	SBGContext* ctx = (SBGContext*)sbg_malloc(sizeof(SBGContext));
+	sbg_init_context((SBGStruct*)obj, ctx);
+	return (void*)ctx;
+}
+
+/**
+* Reset a context of the sbg object back to the initial state
+*
+* @param obj    The sbg object
+* @param ctx    The context to reset
+*/
+void sbg_reset_context(void* obj, void* ctx) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	SBGContext* context = (SBGContext*)ctx;
+	size_t i;
+	lmac_reset_context(sbg->shorts, context->shorts);
+	for (i = 0; i <= sbg->window_mask; ++i) {
+		context->wheel[i] = SBG_NONE;
+	}
+	context->n_events = 0;
+	context->free_events = SBG_NONE;
+	context->current_fp = 0;
+	context->current_r.val = 1;
+	context->current_r.inv = 1;
+	context->current_pos = 0;
+}
+
+/**
+* Get the memory used for a context of the sbg object
+*
+* @param obj    The sbg object
+* @param ctx    The context
+*
+* @return       The memory used for the context (in bytes)
+*/
+size_t sbg_context_mem(void* obj, void* ctx) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	SBGContext* context = (SBGContext*)ctx;
+	return sizeof(SBGContext) +
+	       (sbg->window_mask + 1) * (sizeof(uint32_t) + sizeof(fingerprint_t) + sizeof(field_t)) + // wheel & rings
+	       context->events_size * sizeof(SBGEvent) +
+	       lmac_context_mem(sbg->shorts, context->shorts);
+}
+
+/**
+* Free a context of the sbg object
+*
+* @param obj    The sbg object
+* @param ctx    The context to free
+*/
+void sbg_free_context(void* obj, void* ctx) {
+	sbg_destroy_context((SBGStruct*)obj, (SBGContext*)ctx);
+	free(ctx);
+}
+
+/**
+* Free the sbg object (should be called AFTER compilation using sbg_compile)
+*
+* @param obj    The sbg object to free
+*/
+void sbg_free(void* obj) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	sbg_destroy_context(sbg, &sbg->ctx);
+	lmac_free(sbg->shorts);
+	arena_free(&sbg->build);
+	arena_free(&sbg->mem);
+	free(sbg);
+}
+
+/**
+* Save the compiled sbg object to the cache file (the short patterns lmac object, the shared r,
+* the stages tree and the hash table)
+*
+* @param obj    The sbg object
+* @param w      The cache writer
+*/
+void sbg_save(void* obj, CacheWriter* w) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	uint64_t sizes[5] = {sbg->n_nodes, sbg->n_lens, sbg->table_mask, sbg->window_mask, sbg->max_len};
+	SBGNode node;
+	size_t i;
+
+	lmac_save(sbg->shorts, w);
+	cache_write(w, sizes, sizeof(sizes));
+	cache_write(w, &sbg->r, sizeof(FieldVal));
+	for (i = 0; i < sbg->n_nodes; ++i) {
+		node = sbg->nodes[i];
+		node.id = null_pattern_id;
+		cache_write(w, &node, sizeof(SBGNode));
+	}
+	for (i = 0; i < sbg->n_nodes; ++i) {
+		cache_write_ids(w, &sbg->nodes[i].id, 1);
+	}
+	cache_write(w, sbg->lens, sbg->n_lens * sizeof(uint32_t));
+	cache_write(w, sbg->table, (sbg->table_mask + 1) * sizeof(SBGHashEntry));
+}
+
+/**
+* Load the sbg object (saved with sbg_save) from the cache file, and initialize its context
+*
+* @param obj    The newly created sbg object
+* @param r      The cache reader
+*/
+void sbg_load(void* obj, CacheReader* r) {
+	SBGStruct* sbg = (SBGStruct*)obj;
+	uint64_t sizes[5];
+	size_t i, size;
+
+	arena_free(&sbg->build);
+	sbg->patterns = NULL;
+	lmac_load(sbg->shorts, r);
+	memcpy(sizes, cache_read(r, sizeof(sizes)), sizeof(sizes));
+	sbg->n_nodes = sizes[0];
+	sbg->n_lens = sizes[1];
+	sbg->table_mask = sizes[2];
+	sbg->window_mask = sizes[3];
+	sbg->max_len = sizes[4];
+	memcpy(&sbg->r, cache_read(r, sizeof(FieldVal)), sizeof(FieldVal));
+	size = sbg->n_nodes * sizeof(SBGNode);
+	sbg->nodes = (SBGNode*)arena_alloc(&sbg->mem, size);
+	memcpy(sbg->nodes, cache_read(r, size), size);
+	for (i = 0; i < sbg->n_nodes; ++i) {
+		cache_read_ids(r, &sbg->nodes[i].id, 1);
+	}
+	size = sbg->n_lens * sizeof(uint32_t);
+	sbg->lens = (uint32_t*)arena_alloc(&sbg->mem, size);
+	memcpy(sbg->lens, cache_read(r, size), size);
+	size = (sbg->table_mask + 1) * sizeof(SBGHashEntry);
+	sbg->table = (SBGHashEntry*)arena_alloc(&sbg->mem, size);
+	memcpy(sbg->table, cache_read(r, size), size);
+	sbg_init_context(sbg, &sbg->ctx);
+}
+
+/**
+* The mps registering function of Shared-Fingerprint Breslauer-Galil algorithm
+*/
+void mps_sbg_register() {
+	mps_table[MPS_SBG].name = "Shared-Fingerprint Breslauer-Galil";
+	mps_table[MPS_SBG].short_name = "sbg";
+	mps_table[MPS_SBG].create = sbg_create;
+	mps_table[MPS_SBG].add_pattern = sbg_add_pattern;
+	mps_table[MPS_SBG].compile = sbg_compile;
+	mps_table[MPS_SBG].read_char = sbg_read_char;
+	mps_table[MPS_SBG].read_block = sbg_read_block;
+	mps_table[MPS_SBG].total_mem = sbg_total_mem;
+	mps_table[MPS_SBG].reset = sbg_reset;
+	mps_table[MPS_SBG].free = sbg_free;
+	mps_table[MPS_SBG].save = sbg_save;
+	mps_table[MPS_SBG].load = sbg_load;
+	mps_table[MPS_SBG].new_context = sbg_new_context;
+	mps_table[MPS_SBG].ctx_read_char = sbg_ctx_read_char;
+	mps_table[MPS_SBG].ctx_read_block = sbg_ctx_read_block;
+	mps_table[MPS_SBG].reset_context = sbg_reset_context;
+	mps_table[MPS_SBG].context_mem = sbg_context_mem;
+	mps_table[MPS_SBG].free_context = sbg_free_context;
+}
@@ -0,0 +1,44 @@
+/**
+* Multi-Pattern Shared-Fingerprint Breslauer-Galil algorithm
+*/
+#ifndef MPSBG_H
+#define MPSBG_H
+
+
+/******************************************************************************************************
+*		INCLUDES
+******************************************************************************************************/
+
+
+#include "bgps.h"
+#include "mps.h"
+#include "PatternsTree.h"
+#include "cache.h"
+
+
+/******************************************************************************************************
+*		API FUNCTIONS
+******************************************************************************************************/
+
+
+void* sbg_create(void);
+void sbg_add_pattern(void* obj, char* pat, size_t len, pattern_id_t id);
+void sbg_compile(void* obj);
+pattern_id_t sbg_read_char(void* obj, char c);
+void sbg_read_block(void* obj, const char* buf, size_t len, pattern_id_t* out);
+size_t sbg_total_mem(void* obj);
+void sbg_reset(void* obj);
+void sbg_free(void* obj);
+void sbg_save(void* obj, CacheWriter* w);
+void sbg_load(void* obj, CacheReader* r);
+
+void* sbg_new_context(void* obj);
+pattern_id_t sbg_ctx_read_char(void* obj, void* ctx, char c);
+void sbg_ctx_read_block(void* obj, void* ctx, const char* buf, size_t len, pattern_id_t* out);
+void sbg_reset_context(void* obj, void* ctx);
+size_t sbg_context_mem(void* obj, void* ctx);
+void sbg_free_context(void* obj, void* ctx);
+
+void mps_sbg_register();
+
+#endif /* MPSBG_H */
@@ -9,11 +9,14 @@
 
 
 #include <unistd.h>
+#include <getopt.h>
 #include <ctype.h>
+#include <errno.h>
 #include "parser.h"
 #include "conf.h"
 #include "util.h"
 #include "mps.h"
+#include "report.h"
 
 
 /******************************************************************************************************
@@ -98,19 +101,42 @@ size_t parse_pattern_from_line(char* line, size_t n, char** ret) {
 	return len;
 }
 
+// The options that have only a long name
+enum {
+	OPT_FORMAT = 256,
+	OPT_BASELINE,
+	OPT_THRESHOLD,
+	OPT_SCAN,
+	OPT_CALIBRATE
+};
+
+static const char short_options[] = "d:s:p:o:j:k:e:c:u:a:r:v";
+
+static const struct option long_options[] = {
+	{"format",    required_argument, NULL, OPT_FORMAT},
+	{"baseline",  required_argument, NULL, OPT_BASELINE},
+	{"threshold", required_argument, NULL, OPT_THRESHOLD},
+	{"scan",      required_argument, NULL, OPT_SCAN},
+	{"calibrate", no_argument,       NULL, OPT_CALIBRATE},
+	{NULL, 0, NULL, 0}
+};
+
 /**
 * Parse the main arguments for the program and updates configuration data accordingly
 */
 void parse_arguments(int argc, char* argv[], Conf* conf) {
 	int opt, algo;
-	size_t n_dict = 0, n_stream = 0, n_output = 0, dict_ind = 0, stream_ind = 0;
+	char* end;
+	size_t n_dict = 0, n_stream = 0, n_output = 0, n_algo = 0, dict_ind = 0, stream_ind = 0;
 	
 	opterr = 0;
-	while ((opt = getopt(argc, argv, "d:s:o:")) != -1) {
+	while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
 		switch (opt) {
 			case 'd': ++n_dict; break;
 			case 's': ++n_stream; break;
+			case 'p': ++n_stream; break;
 			case 'o': ++n_output; break;
+			case 'a': ++n_algo; break;
 			default: break;
 		}
 	}
@@ -119,12 +145,30 @@ void parse_arguments(int argc, char* argv[], Conf* conf) {
 		fprintf(stderr, "Error: have more than one output file\n\n");
 		print_usage_and_exit();
 	}
+	if (n_output == 0) {
+		// the results are written only after the whole measurement, so fail before it
+		fprintf(stderr, "Error: missing output file (-o)\n\n");
+		print_usage_and_exit();
+	}
 	conf->n_dictionary_files = n_dict;
 	conf->n_stream_files = n_stream;
-	conf->dictionary_files = (char**) malloc(n_dict);
-	conf->stream_files = (char**) malloc(n_stream);
+	conf->dictionary_files = (char**) malloc(n_dict * sizeof(char*));
+	conf->stream_files = (char**) malloc(n_stream * sizeof(char*));
+	conf->stream_is_capture = (int*) calloc(n_stream + 1, sizeof(int));
+	if (n_algo) conf->mps_instances = (MpsInstance*) malloc(n_algo * sizeof(MpsInstance));
+	if ((conf->dictionary_files == NULL && n_dict != 0) || (conf->stream_files == NULL && n_stream != 0) ||
+	    conf->stream_is_capture == NULL || (conf->mps_instances == NULL && n_algo != 0)) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	conf->n_threads = 1;
+	conf->n_interleaved = 1;
+	conf->output_format = REPORT_CSV;
+	conf->regression_threshold = REPORT_DEFAULT_THRESHOLD;
+	conf->scan_mode = MPS_SCAN_NONE;
+	mps_parse_instance(mps_table[MPS_AC].short_name, &conf->reliable_mps_instance);
 	optind = 1;
-	while ((opt = getopt(argc, argv, "d:s:o:v")) != -1) {
+	while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'd':
 			conf->dictionary_files[dict_ind] = (char*) malloc(strlen(optarg) + 1);
@@ -136,15 +180,111 @@ void parse_arguments(int argc, char* argv[], Conf* conf) {
 			strcpy(conf->stream_files[stream_ind], optarg);
 			++stream_ind;
 			break;
+		case 'p':
+			conf->stream_files[stream_ind] = (char*) malloc(strlen(optarg) + 1);
+			strcpy(conf->stream_files[stream_ind], optarg);
+			conf->stream_is_capture[stream_ind] = 1;
+			++conf->n_capture_files;
+			++stream_ind;
+			break;
 		case 'o':
 			conf->output_file_name = (char*) malloc(strlen(optarg) + 1);
 			strcpy(conf->output_file_name, optarg);
 			break;
+		case 'j':
+			errno = 0;
+			conf->n_threads = strtoul(optarg, &end, 10);
+			if (errno || *optarg == '\0' || *end != '\0' || conf->n_threads == 0) {
+				fprintf(stderr, "Error: invalid number of threads %s\n\n", optarg);
+				print_usage_and_exit();
+			}
+			break;
+		case 'k':
+			errno = 0;
+			conf->n_interleaved = strtoul(optarg, &end, 10);
+			if (errno || *optarg == '\0' || *end != '\0' || conf->n_interleaved == 0 ||
+			    conf->n_interleaved > MPS_MAX_BATCH) {
+				fprintf(stderr, "Error: invalid number of interleaved streams %s (must be 1 to %d)\n\n",
+				        optarg, MPS_MAX_BATCH);
+				print_usage_and_exit();
+			}
+			break;
+		case 'e':
+			if (add_perf_events_group(conf, optarg)) {
+				print_usage_and_exit();
+			}
+			break;
+		case 'c':
+			conf->cache_file_name = (char*) malloc(strlen(optarg) + 1);
+			strcpy(conf->cache_file_name, optarg);
+			break;
+		case 'u':
+			conf->reload_file_name = (char*) malloc(strlen(optarg) + 1);
+			strcpy(conf->reload_file_name, optarg);
+			break;
+		case 'a':
+			if (mps_parse_instance(optarg, &conf->mps_instances[conf->n_mps_instances]) != 0 ||
+			    conf->mps_instances[conf->n_mps_instances].algo == MPS_NONE) {
+				fprintf(stderr, "Error: unknown algorithm %s\n\n", optarg);
+				print_usage_and_exit();
+			}
+			++conf->n_mps_instances;
+			break;
+		case 'r':
+			free(conf->reliable_mps_instance.name);
+			free(conf->reliable_mps_instance.params);
+			if (mps_parse_instance(optarg, &conf->reliable_mps_instance) != 0) {
+				fprintf(stderr, "Error: unknown algorithm %s\n\n", optarg);
+				print_usage_and_exit();
+			}
+			break;
 		case 'v':
 			verbose = 1;
 			break;
+		case OPT_FORMAT:
+			if (strcmp(optarg, "csv") == 0) {
+				conf->output_format = REPORT_CSV;
+			} else if (strcmp(optarg, "json") == 0) {
+				conf->output_format = REPORT_JSON;
+			} else {
+				fprintf(stderr, "Error: unknown output format %s (must be csv or json)\n\n", optarg);
+				print_usage_and_exit();
+			}
+			break;
+		case OPT_BASELINE:
+			conf->baseline_file_name = (char*) malloc(strlen(optarg) + 1);
+			strcpy(conf->baseline_file_name, optarg);
+			break;
+		case OPT_THRESHOLD:
+			errno = 0;
+			conf->regression_threshold = strtod(optarg, &end);
+			if (errno || *optarg == '\0' || *end != '\0' || conf->regression_threshold < 0) {
+				fprintf(stderr, "Error: invalid regression threshold %s\n\n", optarg);
+				print_usage_and_exit();
+			}
+			break;
+		case OPT_SCAN:
+			if (strcmp(optarg, "block") == 0) {
+				conf->scan_mode = MPS_SCAN_NONE;
+			} else if (strcmp(optarg, "first") == 0) {
+				conf->scan_mode = MPS_SCAN_FIRST;
+			} else if (strcmp(optarg, "count") == 0) {
+				conf->scan_mode = MPS_SCAN_COUNT;
+			} else if (strcmp(optarg, "list") == 0) {
+				conf->scan_mode = MPS_SCAN_LIST;
+			} else {
+				fprintf(stderr, "Error: unknown scan mode %s (must be block, first, count or list)\n\n", optarg);
+				print_usage_and_exit();
+			}
+			break;
+		case OPT_CALIBRATE:
+			conf->calibrate = 1;
+			break;
 		case '?':
-			if (optopt == 'd' || optopt == 's' || optopt == 'o') {
+			if (optopt >= OPT_FORMAT || (optopt == 0 && optind > 0)) {
+				fprintf(stderr, "Unknown option or missing argument %s.\n\n", argv[optind - 1]);
+			} else if (optopt == 'd' || optopt == 's' || optopt == 'p' || optopt == 'o' || optopt == 'j' || optopt == 'k' || optopt == 'e' || optopt == 'c' || optopt == 'u' ||
+			           optopt == 'a' || optopt == 'r') {
 				fprintf(stderr, "Option -%c must have argument.\n\n", optopt);
 			} else if (isprint(optopt)) {
 				fprintf(stderr, "Unknown option -%c.\n\n", optopt);
@@ -159,4 +299,19 @@ void parse_arguments(int argc, char* argv[], Conf* conf) {
 		}
 	}
 
+	if (conf->n_capture_files && conf->reload_file_name) {
+		// the flows of an instance are read by all the workers, so it can't be updated by one of them
+		fprintf(stderr, "Error: can't reload the dictionaries (-u) while reading capture files (-p)\n\n");
+		print_usage_and_exit();
+	}
+	if (conf->calibrate && conf->n_stream_files == conf->n_capture_files) {
+		// the sample of the calibration is the start of a stream file
+		fprintf(stderr, "Error: can't calibrate (--calibrate) without a stream file (-s)\n\n");
+		print_usage_and_exit();
+	}
+	if (conf->n_capture_files && conf->scan_mode != MPS_SCAN_NONE) {
+		// the flows of capture files are always read with ctx_read_block
+		fprintf(stderr, "Error: can't scan (--scan) capture files (-p)\n\n");
+		print_usage_and_exit();
+	}
 }
\ No newline at end of file
@@ -0,0 +1,472 @@
+/**
+* Reloading the dictionaries of the mps instances while the streams are measured (the "-u" option)
+*
+* The reload is given as a patterns diff file: every line that starts with '+' is an added pattern, and every line
+* that starts with '-' is a removed pattern (the rest of the line is the pattern, in the syntax of the dictionary
+* files), and all the other lines are ignored. The removed patterns are removed first, so a pattern that is both
+* removed and added is replaced (it gets the internal id of its line in the diff, with the file number after the
+* dictionary files). Adding a pattern that is already there, or removing a pattern that isn't, does nothing.
+*
+* The reload never pauses the reading of the streams. A reloading thread reads the diff and builds the next
+* generation of the dictionaries (the new patterns list, their patterns tree, the id of every old pattern in the
+* new tree, and a new reliable instance), and publishes it. Then:
+*   - Instances whose algorithm implements "update" (see "mps.h") are updated in place by the thread that reads
+*     them, before its next chunk (with the contexts it reads, which keep their streams).
+*   - The other instances are built again on the reloading thread, and the new object is published by a single
+*     atomic store of the object pointer of the instance (read-copy-update): the readers keep reading the old
+*     object until they see the new one, and the old object is freed only after all of them are done with it.
+*
+* The readers take the object pointers once per chunk: the main thread reads them between the chunks (in
+* reload_begin_chunk, the readers are waiting on the barrier then), and every reader switches to the new object
+* (with new contexts) at the start of the chunk. The barrier at the end of the chunk is a quiescent state of all the
+* readers (a grace period), so after it nobody uses the replaced objects, and they are freed before the next chunk.
+*
+* While some instances are still in generation 0, the main thread computes the real results of both generations
+* (with the reliable instance of each), and every instance is compared with the results of its generation.
+* Generation 0 is freed once no instance uses it.
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "reload.h"
+#include "conf.h"
+#include "parser.h"
+#include <string.h>
+#include <errno.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+// Not an index of a pattern (in a patterns list)
+#define NO_PATTERN ((size_t)-1)
+
+/**
+* Hash table of the patterns of a patterns list (open addressing, every slot has the index of a pattern + 1)
+*/
+typedef struct {
+	size_t  *slots;
+	size_t   mask;  // the number of slots - 1 (a power of 2)
+} PatternsTable;
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Hash a pattern (FNV-1a)
+*/
+static inline uint64_t hash_pattern(const char* pat, size_t len) {
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		hash ^= (unsigned char)pat[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+* Build the hash table of the patterns of a list
+*
+* @param table    The table to build
+* @param list     The patterns
+*/
+static void patterns_table_build(PatternsTable* table, PatternsList* list) {
+	size_t i, slot, n_slots = 16;
+	while (n_slots < 2 * list->n) {
+		n_slots *= 2;
+	}
+	table->mask = n_slots - 1;
+	table->slots = (size_t*)calloc(n_slots, sizeof(size_t));
+	if (table->slots == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < list->n; ++i) {
+		slot = hash_pattern(patterns_list_get(list, i), list->lens[i]) & table->mask;
+		while (table->slots[slot]) {
+			slot = (slot + 1) & table->mask;
+		}
+		table->slots[slot] = i + 1;
+	}
+}
+
+/**
+* Find a pattern in the hash table of a list
+*
+* @param table    The table
+* @param list     The patterns of the table
+* @param pat      The pattern to find
+* @param len      The length of the pattern
+*
+* @return         The index of the pattern in the list, or NO_PATTERN if it isn't there
+*/
+static size_t patterns_table_find(PatternsTable* table, PatternsList* list, const char* pat, size_t len) {
+	size_t i, slot = hash_pattern(pat, len) & table->mask;
+	while (table->slots[slot]) {
+		i = table->slots[slot] - 1;
+		if (list->lens[i] == len && !memcmp(patterns_list_get(list, i), pat, len)) return i;
+		slot = (slot + 1) & table->mask;
+	}
+	return NO_PATTERN;
+}
+
+/**
+* Build an mps object of an instance with the patterns of a list (add all of them, and compile)
+*
+* @param inst      The instance (the object is created with its algorithm and parameters)
+* @param patterns  The patterns
+*
+* @return          The compiled object (NULL if the instance doesn't exist, see MPS_NONE)
+*/
+static void* build_object(const MpsInstance* inst, PatternsList* patterns) {
+	MpsElem* mps;
+	void* obj;
+	if (inst->algo == MPS_NONE) return NULL;
+	mps = &mps_table[inst->algo];
+	obj = mps_create_object(inst);
+	size_t i;
+	for (i = 0; i < patterns->n; ++i) {
+		if (patterns->ids[i] != null_pattern_id) {
+			mps->add_pattern(obj, patterns_list_get(patterns, i), patterns->lens[i], patterns->ids[i]);
+		}
+	}
+	mps->compile(obj);
+	return obj;
+}
+
+/**
+* Read the patterns diff file, and build the patterns of the next generation (with their patterns tree and the
+* update from the previous generation)
+*
+* @param reload   The reload (with the previous generation in gens[0])
+*/
+static void build_next_generation(MpsReload* reload) {
+	Conf* conf = reload->conf;
+	MpsGeneration *old = &reload->gens[0], *gen = &reload->gens[1];
+	PatternsList added;
+	PatternsTable table;
+	PatternInternalID internal_id;
+	size_t i, j, len, cap = 0, line_number = 0, n_old = old->patterns.n;
+	size_t* new_index;
+	char *line = NULL, *pat, *removed;
+	ssize_t read;
+	FILE* fp;
+
+	fp = fopen(conf->reload_file_name, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "failed to open patterns diff file %s: %s\n", conf->reload_file_name, strerror(errno));
+		FatalExit();
+	}
+	memset(&added, 0, sizeof(PatternsList));
+	patterns_table_build(&table, &old->patterns);
+	removed = (char*)calloc(n_old + 1, 1);
+	new_index = (size_t*)malloc((n_old + 1) * sizeof(size_t));
+	if (removed == NULL || new_index == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	while ((read = getline(&line, &cap, fp)) != -1) {
+		++line_number;
+		if (read > 0 && line[read - 1] == '\n') --read;
+		if (read < 2 || (line[0] != '+' && line[0] != '-')) continue;
+		pat = NULL;
+		len = parse_pattern_from_line(line + 1, read - 1, &pat);
+		if (len == 0) continue;
+		if (line[0] == '-') {
+			j = patterns_table_find(&table, &old->patterns, pat, len);
+			if (j != NO_PATTERN) removed[j] = 1;
+		} else {
+			internal_id.file_number = conf->n_dictionary_files;
+			internal_id.line_number = line_number;
+			patterns_list_add(&added, pat, len, internal_id, null_pattern_id);
+		}
+		free(pat);
+	}
+	if (ferror(fp)) {
+		fprintf(stderr, "failed to read patterns diff file %s: %s\n", conf->reload_file_name, strerror(errno));
+		FatalExit();
+	}
+	fclose(fp);
+	free(line);
+
+	// the old patterns that stay (by their order), and then the added patterns that are not there already
+	for (j = 0; j < n_old; ++j) {
+		if (removed[j]) {
+			new_index[j] = NO_PATTERN;
+			continue;
+		}
+		new_index[j] = gen->patterns.n;
+		patterns_list_add(&gen->patterns, patterns_list_get(&old->patterns, j), old->patterns.lens[j],
+		                  old->patterns.internal_ids[j], null_pattern_id);
+	}
+	gen->update.first_added = gen->patterns.n;
+	for (i = 0; i < added.n; ++i) {
+		j = patterns_table_find(&table, &old->patterns, patterns_list_get(&added, i), added.lens[i]);
+		if (j != NO_PATTERN && !removed[j]) continue;
+		patterns_list_add(&gen->patterns, patterns_list_get(&added, i), added.lens[i], added.internal_ids[i],
+		                  null_pattern_id);
+	}
+	gen->max_pat_len = 0;
+	for (i = 0; i < gen->patterns.n; ++i) {
+		if (gen->patterns.lens[i] > gen->max_pat_len) gen->max_pat_len = gen->patterns.lens[i];
+	}
+
+	// the new tree, and the new id of every old pattern
+	gen->patterns_tree = patterns_tree_build_from_list(&gen->patterns);
+	gen->update.patterns = &gen->patterns;
+	gen->update.id_map = (pattern_id_t*)malloc(old->patterns_tree->n_nodes * sizeof(pattern_id_t));
+	if (gen->update.id_map == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < old->patterns_tree->n_nodes; ++i) {
+		gen->update.id_map[i] = null_pattern_id;
+	}
+	for (j = 0; j < n_old; ++j) {
+		if (new_index[j] != NO_PATTERN) {
+			gen->update.id_map[old->patterns.ids[j]->index] = gen->patterns.ids[new_index[j]];
+		}
+	}
+
+	patterns_list_free(&added);
+	free(table.slots);
+	free(removed);
+	free(new_index);
+}
+
+/**
+* The main function of the reloading thread
+*
+* Build the next generation and publish it, and then build again every instance that can't be updated in place,
+* and publish its new object (the old object is freed by the main thread, after the readers are done with it)
+*
+* @param arg      The reload
+*
+* @return         NULL
+*/
+static void* reload_thread(void* arg) {
+	MpsReload* reload = (MpsReload*)arg;
+	Conf* conf = reload->conf;
+	MpsGeneration* gen = &reload->gens[1];
+	MpsInstance* inst;
+	uint64_t begin;
+	size_t i;
+	void* obj;
+
+	build_next_generation(reload);
+	gen->reliable = reload->gens[0].reliable;
+	gen->reliable.obj = build_object(&gen->reliable, &gen->patterns);
+	__atomic_store_n(&reload->published, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		inst = &conf->mps_instances[i];
+		if (mps_table[inst->algo].update) continue;
+		begin = monotonic_ns();
+		obj = build_object(inst, &gen->patterns);
+		conf->mps_instances_stats[i].reload.ns = monotonic_ns() - begin;
+		__atomic_store_n(&inst->obj, obj, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/**
+* Free the objects that were replaced in the previous chunk (all the readers passed a quiescent state since)
+*
+* @param reload   The reload
+*/
+static void free_retired(MpsReload* reload) {
+	size_t i;
+	for (i = 0; i < reload->n_retired; ++i) {
+		mps_table[reload->retired[i].algo].free(reload->retired[i].obj);
+	}
+	reload->n_retired = 0;
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Start reloading the dictionaries of the instances with the patterns diff file (in the background)
+*
+* Should be called by the main thread before the readers start. The patterns of the configuration become
+* generation 0 (they are moved from conf->patterns).
+*
+* @param conf     The configuration (with the patterns diff file name)
+*
+* @return         The reload
+*/
+MpsReload* reload_start(Conf* conf) {
+	MpsReload* reload = (MpsReload*)calloc(1, sizeof(MpsReload));
+	size_t i, n = conf->n_mps_instances;
+	int err;
+
+	if (reload == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	reload->conf = conf;
+	reload->gens[0].patterns = conf->patterns;
+	memset(&conf->patterns, 0, sizeof(PatternsList));
+	reload->gens[0].patterns_tree = conf->patterns_tree;
+	reload->gens[0].reliable = conf->reliable_mps_instance;
+	reload->gens[0].max_pat_len = conf->max_pat_len;
+	reload->old_was_used = 1;
+	reload->objs = (void**)malloc((n + 1) * sizeof(void*));
+	reload->generations = (int*)calloc(n + 1, sizeof(int));
+	reload->retired = (MpsInstance*)malloc((n + 1) * sizeof(MpsInstance));
+	if (reload->objs == NULL || reload->generations == NULL || reload->retired == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (i = 0; i < n; ++i) {
+		reload->objs[i] = conf->mps_instances[i].obj;
+	}
+
+	err = pthread_create(&reload->thread, NULL, reload_thread, reload);
+	if (err) {
+		fprintf(stderr, "failed to create reloading thread: %s\n", strerror(err));
+		FatalExit();
+	}
+	return reload;
+}
+
+/**
+* Take the objects and the generations of the instances for the next chunk (on the main thread, between chunks)
+*
+* Also free the objects that were replaced in the previous chunk.
+*
+* @param reload   The reload
+*
+* @return         The generations used in the chunk (bit g is set if generation g is used). Generation 0 is also
+*                 used in the first chunk after the last instance left it (its updates in place still use it).
+*/
+int reload_begin_chunk(MpsReload* reload) {
+	Conf* conf = reload->conf;
+	int published, used = 0, old_used;
+	size_t i;
+	void* obj;
+
+	free_retired(reload);
+	published = __atomic_load_n(&reload->published, __ATOMIC_ACQUIRE);
+	for (i = 0; i < conf->n_mps_instances; ++i) {
+		obj = __atomic_load_n(&conf->mps_instances[i].obj, __ATOMIC_ACQUIRE);
+		if (obj != reload->objs[i]) {
+			// built again (so gens[1] was published before)
+			reload->retired[reload->n_retired].obj = reload->objs[i];
+			reload->retired[reload->n_retired++].algo = conf->mps_instances[i].algo;
+			reload->objs[i] = obj;
+			reload->generations[i] = 1;
+		} else if (published && mps_table[conf->mps_instances[i].algo].update) {
+			reload->generations[i] = 1;
+		}
+		used |= 1 << reload->generations[i];
+	}
+	old_used = used & 1;
+	if (reload->old_was_used && !reload->old_freed) used |= 1;
+	reload->old_was_used = old_used;
+	return used;
+}
+
+/**
+* Switch a reader of an instance to the generation of the instance in the current chunk (on the reading thread,
+* at the start of the chunk)
+*
+* An instance that can be updated in place is updated (with the contexts of the reader), and the update time is
+* put in its statistics. For an instance that was built again, the contexts of the old object are freed, and
+* new contexts are created for the new object.
+*
+* @param reload   The reload
+* @param i        The index of the instance
+* @param reader   The state of the instance on the reading thread
+* @param stats    The statistics of the instance
+*
+* @return         1 if the reader switched in this chunk, 0 if it didn't
+*/
+int reload_sync_reader(MpsReload* reload, size_t i, MpsReader* reader, InstanceStats* stats) {
+	MpsElem* mps = &mps_table[reload->conf->mps_instances[i].algo];
+	void* obj = reload->objs[i];
+	uint64_t begin;
+	size_t j;
+
+	if (reader->generation == reload->generations[i]) return 0;
+	if (obj == reader->obj) {
+		begin = monotonic_ns();
+		mps->update(obj, &reload->gens[1].update, reader->ctxs, reader->n_ctxs);
+		stats->reload.ns = monotonic_ns() - begin;
+		stats->reload.in_place = 1;
+	} else {
+		for (j = 0; j < reader->n_ctxs; ++j) {
+			mps->free_context(reader->obj, reader->ctxs[j]);
+			reader->ctxs[j] = mps->new_context(obj);
+		}
+		reader->obj = obj;
+	}
+	reader->generation = reload->generations[i];
+	return 1;
+}
+
+/**
+* Free generation 0 (when it isn't used anymore, see reload_begin_chunk), after the contexts of its reliable
+* instance were freed
+*
+* @param reload   The reload
+*/
+void reload_free_old(MpsReload* reload) {
+	MpsGeneration* old = &reload->gens[0];
+	if (reload->old_freed) return;
+	if (old->reliable.algo != MPS_NONE) mps_table[old->reliable.algo].free(old->reliable.obj);
+	patterns_tree_free(old->patterns_tree);
+	patterns_list_free(&old->patterns);
+	reload->old_freed = 1;
+}
+
+/**
+* Wait for the reloading thread to finish (after the streams were read), and take the final objects and
+* generations of the instances (every reader should sync once more after that)
+*
+* @param reload   The reload
+*/
+void reload_finish(MpsReload* reload) {
+	pthread_join(reload->thread, NULL);
+	reload_begin_chunk(reload);
+}
+
+/**
+* End the reload, after the readers are done: free the replaced objects and generation 0, and put the new
+* generation in the configuration
+*
+* @param reload   The reload
+*/
+void reload_end(MpsReload* reload) {
+	Conf* conf = reload->conf;
+	MpsGeneration* gen = &reload->gens[1];
+
+	free_retired(reload);
+	reload_free_old(reload);
+	conf->patterns = gen->patterns;
+	conf->patterns_tree = gen->patterns_tree;
+	conf->reliable_mps_instance = gen->reliable;
+	conf->max_pat_len = gen->max_pat_len;
+	if (verbose) {
+		printf("Reloaded the dictionaries with %s (%zu patterns)\n", conf->reload_file_name,
+		       gen->patterns_tree->n_nodes - 1);
+	}
+	free(gen->update.id_map);
+	free(reload->objs);
+	free(reload->generations);
+	free(reload->retired);
+	free(reload);
+}
@@ -0,0 +1,82 @@
+/**
+* Reloading the dictionaries of the mps instances while the streams are measured (the "-u" option)
+*/
+#ifndef RELOAD_H
+#define RELOAD_H
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "PatternsTree.h"
+#include "mps.h"
+#include <pthread.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+struct _Conf;
+struct instance_stats;
+
+/**
+* A generation of the dictionaries: the patterns, their patterns tree, and the reliable instance built from them
+*
+* Generation 0 is the dictionaries of the configuration, and generation 1 is the dictionaries after the reload.
+*/
+typedef struct {
+	PatternsList   patterns;
+	PatternsTree  *patterns_tree;
+	MpsInstance    reliable;
+	MpsUpdate      update;      // the change from generation 0 (only in generation 1)
+	size_t         max_pat_len;
+} MpsGeneration;
+
+/**
+* The state of an mps instance on the thread that reads it
+*/
+typedef struct {
+	void   *obj;        // the object that is read
+	void  **ctxs;       // the contexts of the interleaved streams (NULL when reading a single stream)
+	size_t  n_ctxs;
+	int     generation; // the generation of the patterns of obj
+} MpsReader;
+
+/**
+* Reloading the dictionaries of the instances (see "reload.c")
+*
+* objs and generations are the object of every instance and its generation in the current chunk, they are set by
+* the main thread between the chunks (reload_begin_chunk), and read by the readers during the chunk.
+*/
+typedef struct {
+	struct _Conf   *conf;
+	MpsGeneration   gens[2];
+	int             published;    // whether gens[1] is ready (set by the reloading thread)
+	int             old_freed;    // whether gens[0] was freed
+	int             old_was_used; // whether some instance was in gens[0] in the previous chunk
+	void          **objs;
+	int            *generations;
+	MpsInstance    *retired;      // the objects replaced in the current chunk (freed after it)
+	size_t          n_retired;
+	pthread_t       thread;
+} MpsReload;
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+MpsReload* reload_start(struct _Conf* conf);
+int reload_begin_chunk(MpsReload* reload);
+int reload_sync_reader(MpsReload* reload, size_t i, MpsReader* reader, struct instance_stats* stats);
+void reload_free_old(MpsReload* reload);
+void reload_finish(MpsReload* reload);
+void reload_end(MpsReload* reload);
+
+
+#endif // RELOAD_H
@@ -0,0 +1,862 @@
+/**
+* Reporting the measured statistics of the mps instances
+*
+* The statistics are written to the output file as CSV (the default) or as JSON ("--format json"). For every instance
+* there is a row (an object in JSON) with its statistics on all the streams, and a row for every stream file.
+* Besides the raw measurements, we write metrics derived from them: the throughput, the cycles and instructions
+* per byte (when these perf events were measured) and the memory per pattern. The statistics of building the instance
+* (the time, the perf_event counters and the peak heap memory of adding the patterns and of compiling) are written
+* next to them, also in the rows of the streams. When the dictionaries were reloaded ("-u FILE"), so are the
+* statistics of the reload (the time of updating or building the instance again, and the bytes read before it).
+*
+* With "--baseline FILE", the statistics are compared to FILE, the JSON output of an earlier run. An instance regresses
+* if its throughput is lower, or its p99 latency or memory are higher, by more than the threshold ("--threshold PCT").
+* To read the baseline we have a small JSON parser (which keeps the whole document in memory, as it is small).
+*/
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "report.h"
+#include "conf.h"
+#include "util.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+/**
+* The metrics reported for the statistics of an instance (on all the streams or on a single stream)
+*/
+typedef struct {
+	double   time;                  // the CPU time of reading (in seconds)
+	double   false_pos_rate;        // NAN if no result was compared to the real results (e.g. with "-r none")
+	double   false_neg_rate;
+	double   partial_suc_rate;
+	double   throughput;            // MB (10^6 bytes) per second
+	double   cycles_per_byte;       // NAN if the cycles weren't measured
+	double   instructions_per_byte; // NAN if the instructions weren't measured
+	double   mem_per_pattern;       // bytes of the object per pattern
+	double   add_time;              // the time of adding the patterns to the instance (in seconds)
+	double   compile_time;          // the time of compiling the instance, or loading it from the cache (in seconds)
+	double   build_time;            // add_time + compile_time
+	double   p50, p99, p999;        // latency percentiles (ns per byte)
+} Metrics;
+
+// The types of JSON values
+enum {
+	JSON_NULL = 0,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+};
+
+/**
+* A parsed JSON value
+*
+* An array has n items, and an object has n keys with their n values (in items)
+*/
+typedef struct json_value {
+	int                 type;
+	double              number; // for numbers (and 0/1 for bools)
+	char               *string; // for strings
+	char              **keys;   // for objects
+	struct json_value  *items;  // for arrays and objects
+	size_t              n;
+} JsonValue;
+
+/**
+* The state of the JSON parser
+*/
+typedef struct {
+	const char  *pos;
+	const char  *end;
+} JsonParser;
+
+// The maximal depth of nested arrays and objects in the baseline
+#define JSON_MAX_DEPTH 64
+
+
+/******************************************************************************
+*		INNER FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Get the total count of a perf event in the statistics
+*
+* @param conf     The configuration with the perf_event groups
+* @param stats    The statistics
+* @param type     The type of the event
+* @param config   The config of the event
+* @param value    Where to put the count
+*
+* @return         1 if the event was measured, 0 otherwise
+*/
+static int find_perf_event_total(Conf* conf, InstanceStats* stats, uint32_t type, uint64_t config, uint64_t* value) {
+	size_t i, j;
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			if (conf->perf_groups[i].events[j].type == type && conf->perf_groups[i].events[j].config == config) {
+				*value = stats->perf_groups_stats[i].perf_stats[j];
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+* Compute the reported metrics of statistics of an instance
+*
+* @param conf     The configuration
+* @param stats    The statistics (of all the streams or of a single stream)
+* @param build    The statistics of building the instance
+* @param m        Where to put the metrics
+*/
+static void compute_metrics(Conf* conf, InstanceStats* stats, BuildStats* build, Metrics* m) {
+	SuccessRate* sr = &stats->suc_rate;
+	size_t sum = sr->success + sr->false_pos + sr->false_neg + sr->partial_suc;
+	size_t n_patterns = conf->patterns_tree ? conf->patterns_tree->n_nodes - 1 : 0;
+	uint64_t value;
+
+	m->time = (double)stats->total_cycles / CLOCKS_PER_SEC;
+	m->false_pos_rate = sum ? (double)sr->false_pos / sum : NAN;
+	m->false_neg_rate = sum ? (double)sr->false_neg / sum : NAN;
+	m->partial_suc_rate = sum ? (double)sr->partial_suc / sum : NAN;
+	m->throughput = m->time > 0 ? stats->n_bytes / m->time / 1e6 : NAN;
+	m->cycles_per_byte = NAN;
+	if (stats->n_bytes && find_perf_event_total(conf, stats, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, &value)) {
+		m->cycles_per_byte = (double)value / stats->n_bytes;
+	}
+	m->instructions_per_byte = NAN;
+	if (stats->n_bytes && find_perf_event_total(conf, stats, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, &value)) {
+		m->instructions_per_byte = (double)value / stats->n_bytes;
+	}
+	m->mem_per_pattern = n_patterns ? (double)stats->total_mem / n_patterns : NAN;
+	m->add_time = (double)build->add.ns / 1e9;
+	m->compile_time = (double)build->compile.ns / 1e9;
+	m->build_time = m->add_time + m->compile_time;
+	m->p50 = latency_histogram_percentile(&stats->latency, 0.5);
+	m->p99 = latency_histogram_percentile(&stats->latency, 0.99);
+	m->p999 = latency_histogram_percentile(&stats->latency, 0.999);
+}
+
+/**
+* Write a field of a CSV row (quoted if needed)
+*
+* @param out      The output file
+* @param field    The field
+*/
+static void csv_write_field(FILE* out, const char* field) {
+	if (strpbrk(field, ",\"\n") == NULL) {
+		fputs(field, out);
+		return;
+	}
+	fputc('"', out);
+	for (; *field; ++field) {
+		if (*field == '"') fputc('"', out);
+		fputc(*field, out);
+	}
+	fputc('"', out);
+}
+
+/**
+* Write a number to a CSV row (an empty field if it is not a number)
+*
+* @param out      The output file
+* @param x        The number
+* @param format   The printf format of the number
+*/
+static void csv_write_number(FILE* out, double x, const char* format) {
+	fputc(',', out);
+	if (isfinite(x)) fprintf(out, format, x);
+}
+
+/**
+* Write the CSV header
+*
+* @param out      The output file
+* @param conf     The configuration with the perf_event groups
+*/
+static void csv_write_header(FILE* out, Conf* conf) {
+	size_t i, j;
+	fputs("Algorithm,Stream,Time (in secs),Total Memory Used,False Positive Rate,False Negative Rate,"
+	      "Partial Success Rate,Throughput (MB per sec),Cycles per Byte,Instructions per Byte,"
+	      "Memory per Pattern (bytes),Add Time (in secs),Compile Time (in secs),Build Peak Memory,"
+	      "p50 Latency (ns per byte),p99 Latency (ns per byte),p99.9 Latency (ns per byte),"
+	      "Reload Time (in secs),Reloaded In Place,Bytes Read With Old Dictionaries", out);
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fputc(',', out);
+			csv_write_field(out, conf->perf_groups[i].events[j].desc);
+		}
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fprintf(out, ",max %s per window", conf->perf_groups[i].events[j].desc);
+		}
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fprintf(out, ",%s in add", conf->perf_groups[i].events[j].desc);
+		}
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fprintf(out, ",%s in compile", conf->perf_groups[i].events[j].desc);
+		}
+	}
+	fputc('\n', out);
+}
+
+/**
+* Write a CSV row of statistics of an instance
+*
+* @param out      The output file
+* @param conf     The configuration
+* @param inst     The instance
+* @param stats    The statistics (of all the streams or of a single stream)
+* @param build    The statistics of building the instance
+* @param reload   The statistics of reloading the dictionaries of the instance
+* @param stream   The name of the stream (or "all" for all the streams)
+*/
+static void csv_write_row(FILE* out, Conf* conf, MpsInstance* inst, InstanceStats* stats, BuildStats* build,
+                          ReloadStats* reload, const char* stream) {
+	Metrics m;
+	size_t i, j;
+
+	compute_metrics(conf, stats, build, &m);
+	csv_write_field(out, inst->name);
+	fputc(',', out);
+	csv_write_field(out, stream);
+	fprintf(out, ",%.6f,%zu", m.time, stats->total_mem);
+	csv_write_number(out, m.false_pos_rate, "%.6f");
+	csv_write_number(out, m.false_neg_rate, "%.6f");
+	csv_write_number(out, m.partial_suc_rate, "%.6f");
+	csv_write_number(out, m.throughput, "%.3f");
+	csv_write_number(out, m.cycles_per_byte, "%.3f");
+	csv_write_number(out, m.instructions_per_byte, "%.3f");
+	csv_write_number(out, m.mem_per_pattern, "%.1f");
+	fprintf(out, ",%.6f,%.6f,%zu", m.add_time, m.compile_time, build_peak_mem(build));
+	fprintf(out, ",%.3f,%.3f,%.3f", m.p50, m.p99, m.p999);
+	if (conf->reload_file_name) {
+		fprintf(out, ",%.6f,%d,%zu", (double)reload->ns / 1e9, reload->in_place, reload->old_bytes);
+	} else {
+		fputs(",,,", out);
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fprintf(out, ",%" PRIu64, stats->perf_groups_stats[i].perf_stats[j]);
+		}
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fprintf(out, ",%" PRIu64, stats->perf_groups_stats[i].max_window_stats[j]);
+		}
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fprintf(out, ",%" PRIu64, build->add.perf_groups_stats[i].perf_stats[j]);
+		}
+	}
+	for (i = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j) {
+			fprintf(out, ",%" PRIu64, build->compile.perf_groups_stats[i].perf_stats[j]);
+		}
+	}
+	fputc('\n', out);
+}
+
+/**
+* Write a JSON string (with escaping)
+*
+* @param out      The output file
+* @param str      The string
+*/
+static void json_write_string(FILE* out, const char* str) {
+	fputc('"', out);
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(out, "\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			fprintf(out, "\\u%04x", (unsigned char)*str);
+		} else {
+			fputc(*str, out);
+		}
+	}
+	fputc('"', out);
+}
+
+/**
+* Write a JSON number (null if it is not a number, since JSON doesn't have NaN)
+*
+* @param out      The output file
+* @param x        The number
+*/
+static void json_write_number(FILE* out, double x) {
+	if (isfinite(x)) {
+		fprintf(out, "%.9g", x);
+	} else {
+		fputs("null", out);
+	}
+}
+
+/**
+* Write a JSON array of strings
+*
+* @param out      The output file
+* @param strs     The strings
+* @param n        The number of strings
+*/
+static void json_write_strings(FILE* out, char** strs, size_t n) {
+	size_t i;
+	fputc('[', out);
+	for (i = 0; i < n; ++i) {
+		if (i) fputs(", ", out);
+		json_write_string(out, strs[i]);
+	}
+	fputc(']', out);
+}
+
+/**
+* Write a JSON object of the perf_event counters
+*
+* @param out      The output file
+* @param conf     The configuration with the perf_event groups
+* @param stats    The counters (of every perf_event group)
+* @param max      Whether to write the maximal counters in a window (max_window_stats) instead of the totals
+*/
+static void json_write_perf(FILE* out, Conf* conf, PerfEventGroupStats* stats, int max) {
+	size_t i, j, n;
+	fputc('{', out);
+	for (i = 0, n = 0; i < conf->n_perf_groups; ++i) {
+		for (j = 0; j < conf->perf_groups[i].n; ++j, ++n) {
+			if (n) fputs(", ", out);
+			json_write_string(out, conf->perf_groups[i].events[j].desc);
+			fprintf(out, ": %" PRIu64, max ? stats[i].max_window_stats[j] : stats[i].perf_stats[j]);
+		}
+	}
+	fputc('}', out);
+}
+
+/**
+* Write a JSON object of the statistics of a phase of building an instance
+*
+* @param out      The output file
+* @param conf     The configuration with the perf_event groups
+* @param phase    The statistics of the phase
+*/
+static void json_write_phase(FILE* out, Conf* conf, PhaseStats* phase) {
+	fputs("{\"time\": ", out);
+	json_write_number(out, (double)phase->ns / 1e9);
+	fprintf(out, ", \"mem\": %" PRId64 ", \"peak_mem\": %zu, \"perf\": ", phase->mem, phase->peak_mem);
+	json_write_perf(out, conf, phase->perf_groups_stats, 0);
+	fputc('}', out);
+}
+
+/**
+* Write the members of the JSON object of statistics of an instance
+*
+* @param out      The output file
+* @param conf     The configuration
+* @param inst     The instance
+* @param stats    The statistics (of all the streams or of a single stream)
+* @param build    The statistics of building the instance (for build_time)
+* @param indent   The indentation of the members
+*/
+static void json_write_stats(FILE* out, Conf* conf, InstanceStats* stats, BuildStats* build, const char* indent) {
+	Metrics m;
+
+	compute_metrics(conf, stats, build, &m);
+	fprintf(out, "%s\"time\": ", indent);
+	json_write_number(out, m.time);
+	fprintf(out, ",\n%s\"bytes\": %zu,\n%s\"total_mem\": %zu", indent, stats->n_bytes, indent, stats->total_mem);
+	fprintf(out, ",\n%s\"false_pos_rate\": ", indent);
+	json_write_number(out, m.false_pos_rate);
+	fprintf(out, ",\n%s\"false_neg_rate\": ", indent);
+	json_write_number(out, m.false_neg_rate);
+	fprintf(out, ",\n%s\"partial_suc_rate\": ", indent);
+	json_write_number(out, m.partial_suc_rate);
+	fprintf(out, ",\n%s\"throughput_mb_per_sec\": ", indent);
+	json_write_number(out, m.throughput);
+	fprintf(out, ",\n%s\"cycles_per_byte\": ", indent);
+	json_write_number(out, m.cycles_per_byte);
+	fprintf(out, ",\n%s\"instructions_per_byte\": ", indent);
+	json_write_number(out, m.instructions_per_byte);
+	fprintf(out, ",\n%s\"mem_per_pattern\": ", indent);
+	json_write_number(out, m.mem_per_pattern);
+	fprintf(out, ",\n%s\"build_time\": ", indent);
+	json_write_number(out, m.build_time);
+	fprintf(out, ",\n%s\"latency_ns_per_byte\": {\"p50\": ", indent);
+	json_write_number(out, m.p50);
+	fputs(", \"p99\": ", out);
+	json_write_number(out, m.p99);
+	fputs(", \"p99.9\": ", out);
+	json_write_number(out, m.p999);
+	fprintf(out, "},\n%s\"perf\": ", indent);
+	json_write_perf(out, conf, stats->perf_groups_stats, 0);
+	fprintf(out, ",\n%s\"max_perf_per_window\": ", indent);
+	json_write_perf(out, conf, stats->perf_groups_stats, 1);
+}
+
+/**
+* Write the member of the JSON object of an instance with the statistics of building it
+*
+* @param out      The output file
+* @param conf     The configuration with the perf_event groups
+* @param build    The statistics of building the instance
+* @param indent   The indentation of the member
+*/
+static void json_write_build(FILE* out, Conf* conf, BuildStats* build, const char* indent) {
+	fprintf(out, "%s\"build\": {\n%s  \"add\": ", indent, indent);
+	json_write_phase(out, conf, &build->add);
+	fprintf(out, ",\n%s  \"compile\": ", indent);
+	json_write_phase(out, conf, &build->compile);
+	fprintf(out, ",\n%s  \"peak_mem\": %zu\n%s}", indent, build_peak_mem(build), indent);
+}
+
+/**
+* Write the member of the JSON object of an instance with the statistics of reloading its dictionaries
+*
+* @param out      The output file
+* @param reload   The statistics of reloading the dictionaries of the instance
+* @param indent   The indentation of the member
+*/
+static void json_write_reload(FILE* out, ReloadStats* reload, const char* indent) {
+	fprintf(out, "%s\"reload\": {\n%s  \"time\": ", indent, indent);
+	json_write_number(out, (double)reload->ns / 1e9);
+	fprintf(out, ",\n%s  \"in_place\": %s", indent, reload->in_place ? "true" : "false");
+	fprintf(out, ",\n%s  \"old_bytes\": %zu\n%s}", indent, reload->old_bytes, indent);
+}
+
+/**
+* Write the statistics as JSON
+*
+* @param out      The output file
+* @param conf     The configuration with the statistics
+*/
+static void json_write_report(FILE* out, Conf* conf) {
+	InstanceStats* is;
+	MpsInstance* mi;
+	size_t i, k;
+
+	fputs("{\n  \"dictionaries\": ", out);
+	json_write_strings(out, conf->dictionary_files, conf->n_dictionary_files);
+	fputs(",\n  \"streams\": ", out);
+	json_write_strings(out, conf->stream_files, conf->n_stream_files);
+	fprintf(out, ",\n  \"n_patterns\": %zu", conf->patterns_tree ? conf->patterns_tree->n_nodes - 1 : 0);
+	fprintf(out, ",\n  \"n_interleaved\": %zu", conf->n_interleaved);
+	fputs(",\n  \"instances\": [", out);
+	for (k = 0; k < conf->n_mps_instances; ++k) {
+		is = &conf->mps_instances_stats[k];
+		mi = &conf->mps_instances[k];
+		fputs(k ? ",\n    {\n" : "\n    {\n", out);
+		fputs("      \"name\": ", out);
+		json_write_string(out, mi->name);
+		fputs(",\n", out);
+		json_write_stats(out, conf, is, &is->build, "      ");
+		fputs(",\n", out);
+		json_write_build(out, conf, &is->build, "      ");
+		if (conf->reload_file_name) {
+			fputs(",\n", out);
+			json_write_reload(out, &is->reload, "      ");
+		}
+		fputs(",\n      \"streams\": [", out);
+		for (i = 0; i < conf->n_stream_files; ++i) {
+			fputs(i ? ",\n        {\n" : "\n        {\n", out);
+			fputs("          \"stream\": ", out);
+			json_write_string(out, conf->stream_files[i]);
+			fputs(",\n", out);
+			json_write_stats(out, conf, &is->stream_stats[i], &is->build, "          ");
+			fputs("\n        }", out);
+		}
+		fputs(conf->n_stream_files ? "\n      ]\n    }" : "]\n    }", out);
+	}
+	fputs(conf->n_mps_instances ? "\n  ]\n}\n" : "]\n}\n", out);
+}
+
+/**
+* Skip the white spaces in the JSON text
+*
+* @param p        The parser
+*/
+static void json_skip_spaces(JsonParser* p) {
+	while (p->pos < p->end && (*p->pos == ' ' || *p->pos == '\t' || *p->pos == '\n' || *p->pos == '\r')) {
+		++p->pos;
+	}
+}
+
+/**
+* Parse a JSON string (the parser is at the opening quote)
+*
+* Escaped characters are kept as they are, except for \" and \\ (we only compare the strings to our own names).
+*
+* @param p        The parser
+*
+* @return         The string (dynamically allocated), or NULL if it is invalid
+*/
+static char* json_parse_string(JsonParser* p) {
+	const char* start = ++p->pos;
+	char* str;
+	size_t n = 0;
+
+	while (p->pos < p->end && *p->pos != '"') {
+		if (*p->pos == '\\') ++p->pos;
+		++p->pos;
+	}
+	if (p->pos >= p->end) return NULL;
+	str = (char*)malloc(p->pos - start + 1);
+	if (str == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	for (; start < p->pos; ++start) {
+		if (*start == '\\' && (start[1] == '"' || start[1] == '\\')) ++start;
+		str[n++] = *start;
+	}
+	str[n] = '\0';
+	++p->pos;
+	return str;
+}
+
+/**
+* Add an item to a JSON array or object
+*
+* @param v        The array or object
+* @param key      The key of the item (NULL in an array)
+*
+* @return         The new item
+*/
+static JsonValue* json_add_item(JsonValue* v, char* key) {
+	v->items = (JsonValue*)realloc(v->items, (v->n + 1) * sizeof(JsonValue));
+	if (v->items == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	if (v->type == JSON_OBJECT) {
+		v->keys = (char**)realloc(v->keys, (v->n + 1) * sizeof(char*));
+		if (v->keys == NULL) {
+			perror("failed to allocate memory");
+			FatalExit();
+		}
+		v->keys[v->n] = key;
+	}
+	memset(&v->items[v->n], 0, sizeof(JsonValue));
+	return &v->items[v->n++];
+}
+
+/**
+* Parse a JSON value
+*
+* @param p        The parser
+* @param v        Where to put the value
+* @param depth    The depth of the value (in nested arrays and objects)
+*
+* @return         1 on success, 0 if the text is not valid JSON
+*/
+static int json_parse_value(JsonParser* p, JsonValue* v, size_t depth) {
+	char* key;
+	char* end;
+	char close;
+
+	memset(v, 0, sizeof(JsonValue));
+	json_skip_spaces(p);
+	if (p->pos >= p->end || depth > JSON_MAX_DEPTH) return 0;
+	switch (*p->pos) {
+	case '"':
+		v->type = JSON_STRING;
+		v->string = json_parse_string(p);
+		return v->string != NULL;
+	case '[':
+	case '{':
+		v->type = *p->pos == '[' ? JSON_ARRAY : JSON_OBJECT;
+		close = *p->pos == '[' ? ']' : '}';
+		++p->pos;
+		json_skip_spaces(p);
+		if (p->pos < p->end && *p->pos == close) {
+			++p->pos;
+			return 1;
+		}
+		while (1) {
+			key = NULL;
+			if (v->type == JSON_OBJECT) {
+				json_skip_spaces(p);
+				if (p->pos >= p->end || *p->pos != '"' || (key = json_parse_string(p)) == NULL) return 0;
+				json_skip_spaces(p);
+				if (p->pos >= p->end || *p->pos != ':') {
+					free(key);
+					return 0;
+				}
+				++p->pos;
+			}
+			if (!json_parse_value(p, json_add_item(v, key), depth + 1)) return 0;
+			json_skip_spaces(p);
+			if (p->pos < p->end && *p->pos == ',') {
+				++p->pos;
+				continue;
+			}
+			if (p->pos < p->end && *p->pos == close) {
+				++p->pos;
+				return 1;
+			}
+			return 0;
+		}
+	default:
+		if ((size_t)(p->end - p->pos) >= 4 && strncmp(p->pos, "null", 4) == 0) {
+			p->pos += 4;
+			return 1;
+		}
+		if ((size_t)(p->end - p->pos) >= 4 && strncmp(p->pos, "true", 4) == 0) {
+			v->type = JSON_BOOL;
+			v->number = 1;
+			p->pos += 4;
+			return 1;
+		}
+		if ((size_t)(p->end - p->pos) >= 5 && strncmp(p->pos, "false", 5) == 0) {
+			v->type = JSON_BOOL;
+			p->pos += 5;
+			return 1;
+		}
+		// the text is NUL terminated, so strtod stops before the end
+		v->type = JSON_NUMBER;
+		v->number = strtod(p->pos, &end);
+		if (end == p->pos) return 0;
+		p->pos = end;
+		return 1;
+	}
+}
+
+/**
+* Free a parsed JSON value
+*
+* @param v        The value (the struct itself is not freed)
+*/
+static void json_free(JsonValue* v) {
+	size_t i;
+	for (i = 0; i < v->n; ++i) {
+		json_free(&v->items[i]);
+		if (v->keys) free(v->keys[i]);
+	}
+	free(v->items);
+	free(v->keys);
+	free(v->string);
+}
+
+/**
+* Get a member of a JSON object
+*
+* @param v        The object
+* @param key      The key of the member
+*
+* @return         The value of the member, or NULL if v is not an object or doesn't have it
+*/
+static JsonValue* json_get(JsonValue* v, const char* key) {
+	size_t i;
+	if (v == NULL || v->type != JSON_OBJECT) return NULL;
+	for (i = 0; i < v->n; ++i) {
+		if (strcmp(v->keys[i], key) == 0) return &v->items[i];
+	}
+	return NULL;
+}
+
+/**
+* Get a number member of a JSON object
+*
+* @param v        The object
+* @param key      The key of the member
+*
+* @return         The number, or NAN if there is no such number
+*/
+static double json_get_number(JsonValue* v, const char* key) {
+	JsonValue* member = json_get(v, key);
+	return member && member->type == JSON_NUMBER ? member->number : NAN;
+}
+
+/**
+* Read and parse a JSON file
+*
+* @param file_name  The name of the file
+* @param root       Where to put the parsed value
+*
+* @return           1 on success, 0 if the file can't be read or is not valid JSON (after printing the error)
+*/
+static int json_parse_file(const char* file_name, JsonValue* root) {
+	JsonParser p;
+	FILE* fp;
+	char* text;
+	long size;
+	int ok;
+
+	fp = fopen(file_name, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "failed to open baseline file %s: %s\n", file_name, strerror(errno));
+		return 0;
+	}
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		fprintf(stderr, "failed to read baseline file %s: %s\n", file_name, strerror(errno));
+		fclose(fp);
+		return 0;
+	}
+	text = (char*)malloc(size + 1);
+	if (text == NULL) {
+		perror("failed to allocate memory");
+		FatalExit();
+	}
+	if (fread(text, 1, size, fp) != (size_t)size) {
+		fprintf(stderr, "failed to read baseline file %s\n", file_name);
+		free(text);
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	text[size] = '\0';
+
+	p.pos = text;
+	p.end = text + size;
+	ok = json_parse_value(&p, root, 0);
+	json_skip_spaces(&p);
+	if (!ok || p.pos != p.end) {
+		fprintf(stderr, "baseline file %s is not valid JSON (at offset %zu)\n", file_name, (size_t)(p.pos - text));
+		json_free(root);
+		ok = 0;
+	}
+	free(text);
+	return ok;
+}
+
+/**
+* Compare a metric to its baseline, and print the comparison
+*
+* @param name       The name of the metric
+* @param unit       The unit of the metric
+* @param value      The value of the metric
+* @param baseline   The value in the baseline (NAN if it is not in the baseline)
+* @param higher     Whether higher values are better
+* @param threshold  The regression threshold (in percents)
+*
+* @return           1 if the metric regressed more than the threshold, 0 otherwise
+*/
+static int compare_metric(const char* name, const char* unit, double value, double baseline, int higher,
+                          double threshold) {
+	double change;
+	int regression;
+	if (!isfinite(value) || !isfinite(baseline) || baseline == 0) return 0;
+	change = (value - baseline) / baseline * 100;
+	regression = higher ? change < -threshold : change > threshold;
+	printf("    %-12s %14.3f %s (baseline %.3f, %+.1f%%)%s\n", name, value, unit, baseline, change,
+	       regression ? "  REGRESSION" : "");
+	return regression;
+}
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+/**
+* Write the statistics to the output file specified in the configuration struct
+*
+* The format is conf->output_format (CSV or JSON), and the file is truncated if it exists.
+*
+* @param conf    The configuration struct with the statistic and the output file name
+*/
+void write_stats_to_file(Conf* conf) {
+	InstanceStats* is;
+	MpsInstance* mi;
+	FILE* out;
+	size_t i, k;
+	int output_fd;
+
+	if (verbose) printf("opening file %s to write results\n", conf->output_file_name);
+	output_fd = open(conf->output_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (output_fd == -1 || (out = fdopen(output_fd, "w")) == NULL) {
+		fprintf(stderr, "failed to open results file %s: %s\n", conf->output_file_name, strerror(errno));
+		if (output_fd != -1) close(output_fd);
+		return;
+	}
+
+	if (conf->output_format == REPORT_JSON) {
+		json_write_report(out, conf);
+	} else {
+		csv_write_header(out, conf);
+		for (k = 0; k < conf->n_mps_instances; ++k) {
+			is = &conf->mps_instances_stats[k];
+			mi = &conf->mps_instances[k];
+			csv_write_row(out, conf, mi, is, &is->build, &is->reload, "all");
+			for (i = 0; i < conf->n_stream_files; ++i) {
+				csv_write_row(out, conf, mi, &is->stream_stats[i], &is->build, &is->reload,
+				              conf->stream_files[i]);
+			}
+		}
+	}
+	if (fclose(out) != 0) {
+		fprintf(stderr, "failed to write results file %s: %s\n", conf->output_file_name, strerror(errno));
+	}
+}
+
+/**
+* Compare the statistics to the baseline file of the configuration (the JSON output of an earlier run)
+*
+* Every instance is compared to the instance with the same name in the baseline (on all the streams),
+* and it regresses if its throughput is lower, or its p99 latency or memory are higher, by more than
+* conf->regression_threshold percents. The comparison is printed to stdout.
+*
+* @param conf    The configuration with the statistics and the baseline file name
+*
+* @return        The number of regressed instances (an unreadable baseline counts as one regression)
+*/
+size_t compare_stats_to_baseline(Conf* conf) {
+	JsonValue root, *instances, *old, *name;
+	size_t i, k, n_regressions = 0;
+	const char* algo_name;
+	Metrics m;
+	int regression;
+
+	if (!json_parse_file(conf->baseline_file_name, &root)) return 1;
+	instances = json_get(&root, "instances");
+	if (instances == NULL || instances->type != JSON_ARRAY) {
+		fprintf(stderr, "baseline file %s doesn't have instances\n", conf->baseline_file_name);
+		json_free(&root);
+		return 1;
+	}
+
+	printf("\nComparing to baseline %s (threshold %.1f%%)\n", conf->baseline_file_name, conf->regression_threshold);
+	for (k = 0; k < conf->n_mps_instances; ++k) {
+		algo_name = conf->mps_instances[k].name;
+		for (i = 0, old = NULL; i < instances->n && old == NULL; ++i) {
+			name = json_get(&instances->items[i], "name");
+			if (name && name->type == JSON_STRING && strcmp(name->string, algo_name) == 0) old = &instances->items[i];
+		}
+		printf("  %s:%s\n", algo_name, old ? "" : " not in the baseline");
+		if (old == NULL) continue;
+		compute_metrics(conf, &conf->mps_instances_stats[k], &conf->mps_instances_stats[k].build, &m);
+		regression = compare_metric("throughput", "MB/s", m.throughput,
+		                            json_get_number(old, "throughput_mb_per_sec"), 1, conf->regression_threshold);
+		regression |= compare_metric("p99 latency", "ns/byte", m.p99,
+		                             json_get_number(json_get(old, "latency_ns_per_byte"), "p99"), 0,
+		                             conf->regression_threshold);
+		regression |= compare_metric("memory", "bytes", (double)conf->mps_instances_stats[k].total_mem,
+		                             json_get_number(old, "total_mem"), 0, conf->regression_threshold);
+		n_regressions += regression;
+	}
+	printf("%zu of %zu algorithms regressed\n", n_regressions, conf->n_mps_instances);
+	json_free(&root);
+	return n_regressions;
+}
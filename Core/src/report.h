@@ -0,0 +1,45 @@
+/**
+* Reporting the measured statistics of the mps instances (CSV or JSON), and comparing them to a baseline
+*/
+#ifndef REPORT_H
+#define REPORT_H
+
+
+/******************************************************************************
+*		INCLUDES
+******************************************************************************/
+
+
+#include "measure.h"
+
+
+/******************************************************************************
+*		DEFINITIONS
+******************************************************************************/
+
+
+struct _Conf;
+
+// The formats of the output file
+enum {
+	REPORT_CSV = 0,
+	REPORT_JSON
+};
+
+// The default threshold for a regression from the baseline (in percents)
+#define REPORT_DEFAULT_THRESHOLD 5.0
+
+// The exit status of the program when there is a regression from the baseline
+#define REPORT_REGRESSION_EXIT_STATUS 2
+
+
+/******************************************************************************
+*		API FUNCTIONS
+******************************************************************************/
+
+
+void write_stats_to_file(struct _Conf* conf);
+size_t compare_stats_to_baseline(struct _Conf* conf);
+
+
+#endif /* REPORT_H */
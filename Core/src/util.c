@@ -1,13 +1,136 @@
+#define _GNU_SOURCE
 #include "util.h"
+#include "mps.h"
+#include <sched.h>
+#include <unistd.h>
+#include <string.h>
 
 char* program_name;
 int verbose = 0;
 
+// The names of the cpu features (for printing them)
+static const struct {
+	unsigned     feature;
+	const char  *name;
+} cpu_feature_names[] = {
+	{CPU_FEATURE_SSSE3, "ssse3"},
+	{CPU_FEATURE_SSE42, "sse4.2"},
+	{CPU_FEATURE_AVX2, "avx2"},
+	{CPU_FEATURE_BMI2, "bmi2"},
+	{CPU_FEATURE_AVX512F, "avx512f"}
+};
+
+// The levels of "simd=LEVEL", and the cpu features that every level may use
+static const struct {
+	const char  *name;
+	unsigned     mask;
+} simd_levels[] = {
+	{"none", 0},
+	{"ssse3", CPU_FEATURE_SSSE3},
+	{"sse4.2", CPU_FEATURE_SSSE3 | CPU_FEATURE_SSE42},
+	{"avx2", CPU_FEATURE_SSSE3 | CPU_FEATURE_SSE42 | CPU_FEATURE_AVX2 | CPU_FEATURE_BMI2},
+	{"avx512", CPU_FEATURES_ALL}
+};
+
 void usage() {
+	int i;
 	fprintf(stderr, "Usage: %s [OPTION]...\n", program_name);
 	fprintf(stderr, "options:\n");
 	fprintf(stderr, "  -d FILE               use FILE as one of the dictionary files (can be used many times).\n");
 	fprintf(stderr, "  -s FILE               use FILE as one of the stream files (can be used many times).\n");
+	fprintf(stderr, "  -p FILE               use the pcap or pcapng FILE as a stream of flows (can be used many times).\n");
 	fprintf(stderr, "  -o FILE               set FILE to be the output file.\n");
+	fprintf(stderr, "  -j N                  measure the algorithms on N worker threads (default 1).\n");
+	fprintf(stderr, "  -k K                  split every chunk of the streams to K streams read together (default 1).\n");
+	fprintf(stderr, "  -e EVENTS             measure the comma separated perf EVENTS as a group (can be used many times).\n");
+	fprintf(stderr, "  -c FILE               use FILE as cache of the loaded dictionaries (rebuilt if out of date).\n");
+	fprintf(stderr, "  -u FILE               reload the dictionaries with the patterns diff FILE while measuring.\n");
+	fprintf(stderr, "  -a NAME[:KEY=VAL,...] measure the algorithm NAME with the parameters (can be used many times,\n");
+	fprintf(stderr, "                        default one instance of every algorithm).\n");
+	fprintf(stderr, "  -r NAME[:KEY=VAL,...] compute the real results with the algorithm NAME (default ac),\n");
+	fprintf(stderr, "                        or none to skip them (no accuracy rates).\n");
+	fprintf(stderr, "  --format FORMAT       write the output file as FORMAT, csv (default) or json.\n");
+	fprintf(stderr, "  --baseline FILE       compare the results to FILE (the json output of an earlier run).\n");
+	fprintf(stderr, "  --threshold PCT       the change from the baseline which is a regression (default 5).\n");
+	fprintf(stderr, "  --scan MODE           read the streams with the scan MODE: block (default, the result of every\n");
+	fprintf(stderr, "                        byte), first (stop on the first match of every part of a chunk), count\n");
+	fprintf(stderr, "                        (count the matches) or list (list the matches).\n");
+	fprintf(stderr, "  --calibrate           measure only the fastest algorithm on a sample of the first stream file.\n");
 	fprintf(stderr, "  -v                    set verbose to true (print more information)\n");
-}
\ No newline at end of file
+	fprintf(stderr, "algorithms:\n");
+	for (i = 0; i < MPS_SIZE; ++i) {
+		fprintf(stderr, "  %-22s%s\n", mps_table[i].short_name, mps_table[i].name);
+	}
+	fprintf(stderr, "parameters: bg & pbg short=N, pbg shards=N, hybrid max_short=N, short=NAME & long=NAME,\n");
+	fprintf(stderr, "            bg, pbg & pcac simd=LEVEL (none, ssse3, sse4.2, avx2 or avx512).\n");
+}
+
+/**
+* Get the number of cpus the program can run on
+*
+* @return     The number of cpus in the affinity mask of the program (at least 1)
+*/
+size_t get_n_cpus() {
+	cpu_set_t set;
+	long n;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+		return CPU_COUNT(&set);
+	}
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+/**
+* Detect the cpu features of the host (on cpus other than x86, there are none)
+*
+* @return     The CPU_FEATURE_* flags of the features that the cpu supports
+*/
+unsigned cpu_features() {
+	unsigned features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) features |= CPU_FEATURE_SSSE3;
+	if (__builtin_cpu_supports("sse4.2")) features |= CPU_FEATURE_SSE42;
+	if (__builtin_cpu_supports("avx2")) features |= CPU_FEATURE_AVX2;
+	if (__builtin_cpu_supports("bmi2")) features |= CPU_FEATURE_BMI2;
+	if (__builtin_cpu_supports("avx512f")) features |= CPU_FEATURE_AVX512F;
+#endif
+	return features;
+}
+
+/**
+* Write the names of cpu features, comma separated ("none" if there are none)
+*
+* @param features  The CPU_FEATURE_* flags
+* @param buf       Where to write the names
+* @param size      The size of buf
+*/
+void cpu_features_string(unsigned features, char* buf, size_t size) {
+	size_t i, pos = 0;
+	if (size == 0) return;
+	buf[0] = '\0';
+	for (i = 0; i < sizeof(cpu_feature_names) / sizeof(cpu_feature_names[0]); ++i) {
+		if (!(features & cpu_feature_names[i].feature) || pos >= size) continue;
+		pos += snprintf(buf + pos, size - pos, "%s%s", pos ? "," : "", cpu_feature_names[i].name);
+	}
+	if (pos == 0) snprintf(buf, size, "none");
+}
+
+/**
+* Parse the value of the "simd=LEVEL" parameter of an algorithm (the most advanced instructions it may use)
+*
+* @param val      The level (none, ssse3, sse4.2, avx2 or avx512)
+* @param mask     Where to put the cpu features that the level may use
+*
+* @return         0 on success, -1 if there is no such level
+*/
+int cpu_parse_simd(const char* val, unsigned* mask) {
+	size_t i;
+	for (i = 0; i < sizeof(simd_levels) / sizeof(simd_levels[0]); ++i) {
+		if (strcmp(val, simd_levels[i].name) == 0) {
+			*mask = simd_levels[i].mask;
+			return 0;
+		}
+	}
+	return -1;
+}
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <time.h>
 
 
 /******************************************************************************************************
@@ -19,6 +21,18 @@
 extern char* program_name;
 extern int verbose;
 
+// The cpu features that the vectorized code of the algorithms is chosen by (see cpu_features)
+enum {
+	CPU_FEATURE_SSSE3   = 1 << 0,
+	CPU_FEATURE_SSE42   = 1 << 1,
+	CPU_FEATURE_AVX2    = 1 << 2,
+	CPU_FEATURE_BMI2    = 1 << 3,
+	CPU_FEATURE_AVX512F = 1 << 4
+};
+
+// All the cpu features (the mask of an algorithm that may use any vectorized code the cpu supports)
+#define CPU_FEATURES_ALL (~0u)
+
 
 
 /******************************************************************************************************
@@ -27,6 +41,10 @@ extern int verbose;
 
 
 void usage();
+size_t get_n_cpus();
+unsigned cpu_features();
+void cpu_features_string(unsigned features, char* buf, size_t size);
+int cpu_parse_simd(const char* val, unsigned* mask);
 
 
 /******************************************************************************************************
@@ -43,6 +61,17 @@ static inline void print_usage_and_exit() {
 	exit(EXIT_FAILURE);
 };
 
+/**
+* Get the time of the monotonic clock (for measuring elapsed time)
+*
+* @return       The time in nanoseconds
+*/
+static inline uint64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static inline void print_binary_str(char* str, size_t len) {
 	size_t i;
 	for (i = 0; i < len; ++i) {